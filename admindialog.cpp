@@ -9,6 +9,20 @@
 #include <QSqlQuery>
 #include <QSqlError>
 #include <QCryptographicHash>
+#include <QThread>
+#include <QFileInfo>
+
+#include "auditlog.h"
+#include "cardfilter.h"
+#include "cardkey.h"
+#include "databasebackup.h"
+#include "eventlog.h"
+#include "ledgerreconciler.h"
+#include "readsnapshot.h"
+#include "shardedstore.h"
+#include "shardmap.h"
+#include "sqlitestore.h"
+#include "transactionarchive.h"
 
 namespace {
 const QString ADMIN_CARD = "0000000000000000";
@@ -103,6 +117,56 @@ AdminDialog::AdminDialog(QWidget *parent)
 
     layout->addLayout(transferLayout);
 
+    auto *archiveLayout = new QHBoxLayout();
+
+    m_archiveButton = new QPushButton("Архивировать закрытые месяцы", this);
+    m_archiveStatusLabel = new QLabel("", this);
+
+    archiveLayout->addWidget(m_archiveButton);
+    archiveLayout->addWidget(m_archiveStatusLabel, 1);
+
+    layout->addLayout(archiveLayout);
+
+    auto *reconcileLayout = new QHBoxLayout();
+
+    m_reconcileButton = new QPushButton("Сверить журнал", this);
+    m_reconcileStatusLabel = new QLabel("", this);
+
+    reconcileLayout->addWidget(m_reconcileButton);
+    reconcileLayout->addWidget(m_reconcileStatusLabel, 1);
+
+    layout->addLayout(reconcileLayout);
+
+    auto *auditLayout = new QHBoxLayout();
+
+    m_auditButton = new QPushButton("Проверить аудит", this);
+    m_auditStatusLabel = new QLabel("", this);
+
+    auditLayout->addWidget(m_auditButton);
+    auditLayout->addWidget(m_auditStatusLabel, 1);
+
+    layout->addLayout(auditLayout);
+
+    auto *backupLayout = new QHBoxLayout();
+
+    m_backupButton = new QPushButton("Резервная копия", this);
+    m_backupStatusLabel = new QLabel("", this);
+
+    backupLayout->addWidget(m_backupButton);
+    backupLayout->addWidget(m_backupStatusLabel, 1);
+
+    layout->addLayout(backupLayout);
+
+    auto *forecastLayout = new QHBoxLayout();
+
+    m_forecastButton = new QPushButton("Выгрузить прогноз", this);
+    m_forecastLabel = new QLabel("", this);
+
+    forecastLayout->addWidget(m_forecastButton);
+    forecastLayout->addWidget(m_forecastLabel, 1);
+
+    layout->addLayout(forecastLayout);
+
     m_table = new QTableWidget(this);
     m_table->setColumnCount(3);
     m_table->setHorizontalHeaderLabels({"Карта", "PIN (скрыт)", "Баланс"});
@@ -110,24 +174,69 @@ AdminDialog::AdminDialog(QWidget *parent)
 
     layout->addWidget(m_table);
 
+    m_totalsLabel = new QLabel("", this);
+    layout->addWidget(m_totalsLabel);
+
+    m_cardFilterLabel = new QLabel("", this);
+    layout->addWidget(m_cardFilterLabel);
+
     connect(m_addButton, &QPushButton::clicked, this, &AdminDialog::onAddAccount);
     connect(m_deleteButton, &QPushButton::clicked, this, &AdminDialog::onDeleteAccount);
     connect(m_updateBalanceButton, &QPushButton::clicked, this, &AdminDialog::onUpdateBalance);
     connect(m_resetPinButton, &QPushButton::clicked, this, &AdminDialog::onResetPin);
     connect(m_transferButton, &QPushButton::clicked, this, &AdminDialog::onTransfer);
+    connect(m_archiveButton, &QPushButton::clicked, this, &AdminDialog::onArchive);
+    connect(m_reconcileButton, &QPushButton::clicked, this, &AdminDialog::onReconcile);
+    connect(m_auditButton, &QPushButton::clicked, this, &AdminDialog::onVerifyAudit);
+    connect(m_backupButton, &QPushButton::clicked, this, &AdminDialog::onBackup);
+    connect(m_forecastButton, &QPushButton::clicked, this, &AdminDialog::onExportForecast);
 
     refreshTable();
 }
 
+bool AdminDialog::beginAudited(QSqlDatabase &db)
+{
+    QSqlQuery q(db);
+    if (!db.isOpen() || !q.exec("BEGIN IMMEDIATE")) {
+        EventLog::error("tx.begin_failed", "BEGIN IMMEDIATE", q.lastError().text());
+        QMessageBox::warning(this, "Ошибка", "Не удалось начать транзакцию.");
+        return false;
+    }
+    return true;
+}
+
+bool AdminDialog::commitAudited(QSqlDatabase &db,
+                                const QString &action,
+                                const QString &card,
+                                const QString &details)
+{
+    if (!AuditLog::append(db, action, card, details)) {
+        db.rollback();
+        QMessageBox::warning(this, "Ошибка", "Не удалось записать журнал аудита.");
+        return false;
+    }
+
+    if (!db.commit()) {
+        EventLog::error("tx.commit_failed", "COMMIT", db.lastError().text());
+        db.rollback();
+        QMessageBox::warning(this, "Ошибка", "Не удалось сохранить изменения.");
+        return false;
+    }
+    return true;
+}
+
 double AdminDialog::getBalance(const QString &card)
 {
-    QSqlDatabase db = QSqlDatabase::database();
+    // Снимок читателя есть только у основной БД (шард 0).
+    ReadSnapshot snapshot;
+    QSqlDatabase db = ShardMap::connectionFor(card).isEmpty() ? snapshot.database()
+                                                              : ShardMap::databaseFor(card);
     if (!db.isOpen())
         return 0.0;
 
-    QSqlQuery q;
-    q.prepare("SELECT balance FROM accounts WHERE card_number = :card");
-    q.bindValue(":card", card);
+    QSqlQuery q(db);
+    q.prepare("SELECT balance FROM account_balances WHERE card_number = :card");
+    q.bindValue(":card", cardKey(card));
     if (!q.exec())
         return 0.0;
     if (!q.next())
@@ -138,54 +247,131 @@ double AdminDialog::getBalance(const QString &card)
 
 bool AdminDialog::updateBalance(const QString &card, double newBal)
 {
-    QSqlDatabase db = QSqlDatabase::database();
+    QSqlDatabase db = ShardMap::databaseFor(card);
     if (!db.isOpen())
         return false;
 
-    QSqlQuery q;
-    q.prepare("UPDATE accounts SET balance = :bal WHERE card_number = :card");
-    q.bindValue(":bal", newBal);
-    q.bindValue(":card", card);
-    return q.exec();
-}
+    // Баланс считается из журнала, поэтому изменение — строка корректировки
+    // на разницу. BEGIN IMMEDIATE: между чтением баланса и записью не
+    // вклинится операция терминала.
+    QSqlQuery q(db);
+    if (!q.exec("BEGIN IMMEDIATE")) {
+        EventLog::error("tx.begin_failed", "BEGIN IMMEDIATE", q.lastError().text());
+        return false;
+    }
 
-bool AdminDialog::recordTransaction(const QString &card,
-                                    const QString &type,
-                                    double amount,
-                                    double balanceAfter)
-{
-    QSqlDatabase db = QSqlDatabase::database();
-    if (!db.isOpen())
+    q.prepare("SELECT balance FROM account_balances WHERE card_number = :card");
+    q.bindValue(":card", cardKey(card));
+    if (!q.exec() || !q.next()) {
+        db.rollback();
         return false;
+    }
+    double oldBal = q.value(0).toDouble();
+    q.finish();
+
+    SqliteStore ledger(ShardMap::connectionFor(card));
+    TransactionRecord entry;
+    if (!ledger.append(card, TransactionType::AdminAdjustment, newBal - oldBal, newBal, entry)
+        || !AuditLog::append(db, "balance_set", card,
+                             QString("old=%1 new=%2 operation_id=%3")
+                                 .arg(oldBal, 0, 'f', 2)
+                                 .arg(newBal, 0, 'f', 2)
+                                 .arg(entry.operationId)))
+    {
+        db.rollback();
+        return false;
+    }
 
-    QSqlQuery q;
-    q.prepare("INSERT INTO transactions "
-              "(card_number, type, amount, balance_after) "
-              "VALUES (:card, :type, :amount, :bal)");
-    q.bindValue(":card", card);
-    q.bindValue(":type", type);
-    q.bindValue(":amount", amount);
-    q.bindValue(":bal", balanceAfter);
-    return q.exec();
+    if (!db.commit()) {
+        EventLog::error("tx.commit_failed", "COMMIT", db.lastError().text());
+        db.rollback();
+        return false;
+    }
+    return true;
 }
 
 void AdminDialog::refreshTable()
 {
     m_table->setRowCount(0);
 
-    QSqlQuery q("SELECT card_number, pin, balance FROM accounts");
-    while (q.next())
-    {
-        int row = m_table->rowCount();
-        m_table->insertRow(row);
+    // Таблица и итоги читаются из одного снимка: они сходятся, даже если
+    // терминал проводит операции во время обновления.
+    ReadSnapshot snapshot;
+
+    double total = 0.0;
+
+    // Остальные шарды читаются без снимка: их счета не пересекаются с
+    // основной БД.
+    QList<QSqlDatabase> shards = ShardMap::databases();
+    shards.first() = snapshot.database();
+
+    for (const QSqlDatabase &shard : shards) {
+        QSqlQuery q(shard);
+        q.exec("SELECT card_number, balance FROM account_balances");
+        while (q.next())
+        {
+            int row = m_table->rowCount();
+            m_table->insertRow(row);
+
+            QString card = cardNumberFromKey(q.value(0).toLongLong());
+            QString bal  = q.value(1).toString();
+            total += q.value(1).toDouble();
+
+            m_table->setItem(row, 0, new QTableWidgetItem(card));
+            m_table->setItem(row, 1, new QTableWidgetItem("****"));
+            m_table->setItem(row, 2, new QTableWidgetItem(bal));
+        }
+    }
 
-        QString card = q.value(0).toString();
-        QString bal  = q.value(2).toString();
+    double cash = 0.0;
+    QSqlQuery cashQuery(snapshot.database());
+    if (cashQuery.exec("SELECT cash_total FROM atm_state WHERE id = 1") && cashQuery.next())
+        cash = cashQuery.value(0).toDouble();
+
+    m_totalsLabel->setText(QString("Счетов: %1, сумма балансов: %2, наличность банкомата: %3")
+                               .arg(m_table->rowCount())
+                               .arg(total, 0, 'f', 2)
+                               .arg(cash, 0, 'f', 2));
+
+    // Прогноз читает только часовые агрегаты — дёшево и на каждом
+    // обновлении таблицы.
+    QStringList forecastLines;
+    if (CashForecast::compute(shards, QDateTime::currentDateTimeUtc(),
+                              CashForecast::Options(), m_forecast)) {
+        for (const CashForecast::Result &r : m_forecast)
+            forecastLines.append(CashForecast::describe(r));
+    } else {
+        forecastLines.append("Прогноз недоступен, см. журнал событий");
+    }
+    m_forecastLabel->setText(forecastLines.join("\n"));
+    updateCardFilterLabel();
+}
 
-        m_table->setItem(row, 0, new QTableWidgetItem(card));
-        m_table->setItem(row, 1, new QTableWidgetItem("****"));
-        m_table->setItem(row, 2, new QTableWidgetItem(bal));
+void AdminDialog::setCardFilter(std::shared_ptr<CardFilter> filter)
+{
+    m_cardFilter = std::move(filter);
+    updateCardFilterLabel();
+}
+
+void AdminDialog::updateCardFilterLabel()
+{
+    if (!m_cardFilter) {
+        m_cardFilterLabel->clear();
+        return;
     }
+
+    CardFilter::Stats s = m_cardFilter->stats();
+    m_cardFilterLabel->setText(
+        QString("Фильтр карт: %1 карт, %2 бит, проверок %3, отсеяно Луном %4, "
+                "фильтром %5, ложных срабатываний %6 (%7%, расчётно %8%)")
+            .arg(s.cards)
+            .arg(s.bits)
+            .arg(s.lookups)
+            .arg(s.rejectedLuhn)
+            .arg(s.rejectedFilter)
+            .arg(s.falsePositives)
+            .arg(s.observedFpRate * 100.0, 0, 'f', 2)
+            .arg(s.expectedFpRate * 100.0, 0, 'f', 2));
 }
 
 void AdminDialog::onAddAccount()
@@ -205,6 +391,10 @@ void AdminDialog::onAddAccount()
         QMessageBox::warning(this, "Ошибка", "Этот номер карты зарезервирован для администратора.");
         return;
     }
+    if (!CardFilter::luhnValid(card)) {
+        QMessageBox::warning(this, "Ошибка", "Номер карты не проходит проверку по алгоритму Луна.");
+        return;
+    }
     if (pin.length() != 4) {
         QMessageBox::warning(this, "Ошибка", "PIN должен содержать 4 цифры.");
         return;
@@ -216,17 +406,33 @@ void AdminDialog::onAddAccount()
 
     QString pinHash = hashPin(pin);
 
-    QSqlQuery q;
+    QSqlDatabase db = ShardMap::databaseFor(card);
+    if (!beginAudited(db))
+        return;
+
+    QSqlQuery q(db);
     q.prepare("INSERT INTO accounts (card_number, pin, balance) VALUES (?, ?, ?)");
-    q.addBindValue(card);
+    q.addBindValue(cardKey(card));
     q.addBindValue(pinHash);
     q.addBindValue(bal.toDouble());
 
     if (!q.exec()) {
-        QMessageBox::warning(this, "Ошибка", q.lastError().text());
+        QString error = q.lastError().text();
+        db.rollback();
+        QMessageBox::warning(this, "Ошибка", error);
         return;
     }
 
+    if (!commitAudited(db, "account_add", card,
+                       QString("balance=%1").arg(bal.toDouble(), 0, 'f', 2)))
+        return;
+
+    if (m_cardFilter) {
+        m_cardFilter->add(card);
+        if (m_cardFilter->needsRebuild())
+            m_cardFilter->load(ShardMap::databases());
+    }
+
     refreshTable();
 }
 
@@ -247,21 +453,54 @@ void AdminDialog::onDeleteAccount()
     auto reply = QMessageBox::question(
         this,
         "Подтверждение",
-        "Удалить аккаунт с картой: " + card + " ?",
+        "Закрыть аккаунт с картой: " + card + " ?",
         QMessageBox::Yes | QMessageBox::No
         );
     if (reply != QMessageBox::Yes)
         return;
 
-    QSqlQuery q;
-    q.prepare("DELETE FROM accounts WHERE card_number = ?");
-    q.addBindValue(card);
-    q.exec();
+    QSqlDatabase db = ShardMap::databaseFor(card);
+    if (!beginAudited(db))
+        return;
 
-    QSqlQuery q2;
-    q2.prepare("DELETE FROM transactions WHERE card_number = ?");
-    q2.addBindValue(card);
-    q2.exec();
+    // Журнал append-only: строки счёта остаются, счёт только помечается
+    // закрытым и пропадает из account_balances.
+    QSqlQuery q(db);
+    q.prepare("SELECT balance FROM account_balances WHERE card_number = :card");
+    q.bindValue(":card", cardKey(card));
+    if (!q.exec()) {
+        QString error = q.lastError().text();
+        db.rollback();
+        QMessageBox::warning(this, "Ошибка", "Не удалось закрыть аккаунт: " + error);
+        return;
+    }
+    if (!q.next()) {
+        db.rollback();
+        QMessageBox::warning(this, "Ошибка", "Аккаунт не найден.");
+        return;
+    }
+    double balance = q.value(0).toDouble();
+    q.finish();
+
+    q.prepare("UPDATE accounts SET closed_at = CURRENT_TIMESTAMP "
+              "WHERE card_number = :card AND closed_at IS NULL");
+    q.bindValue(":card", cardKey(card));
+    if (!q.exec() || q.numRowsAffected() != 1) {
+        QString error = q.lastError().text();
+        db.rollback();
+        QMessageBox::warning(this, "Ошибка", "Не удалось закрыть аккаунт: " + error);
+        return;
+    }
+
+    if (!commitAudited(db, "account_close", card,
+                       QString("balance=%1").arg(balance, 0, 'f', 2)))
+        return;
+
+    if (m_cardFilter) {
+        m_cardFilter->remove(card);
+        if (m_cardFilter->needsRebuild())
+            m_cardFilter->load(ShardMap::databases());
+    }
 
     refreshTable();
 }
@@ -334,16 +573,25 @@ void AdminDialog::onResetPin()
 
     QString newPinHash = hashPin("0000");
 
-    QSqlQuery q;
+    QSqlDatabase db = ShardMap::databaseFor(card);
+    if (!beginAudited(db))
+        return;
+
+    QSqlQuery q(db);
     q.prepare("UPDATE accounts SET pin = :pin, failed_attempts = 0, locked_until = NULL "
-              "WHERE card_number = :card");
+              "WHERE card_number = :card AND closed_at IS NULL");
     q.bindValue(":pin", newPinHash);
-    q.bindValue(":card", card);
+    q.bindValue(":card", cardKey(card));
     if (!q.exec()) {
-        QMessageBox::warning(this, "Ошибка", "Не удалось обновить PIN: " + q.lastError().text());
+        QString error = q.lastError().text();
+        db.rollback();
+        QMessageBox::warning(this, "Ошибка", "Не удалось обновить PIN: " + error);
         return;
     }
 
+    if (!commitAudited(db, "pin_reset", card, QString()))
+        return;
+
     refreshTable();
 }
 
@@ -398,39 +646,212 @@ void AdminDialog::onTransfer()
     if (reply != QMessageBox::Yes)
         return;
 
-    if (!db.transaction()) {
-        QMessageBox::warning(this, "Ошибка", "Не удалось начать транзакцию.");
+    if (getBalance(fromCard) < amount) {
+        QMessageBox::warning(this, "Ошибка", "Недостаточно средств на карте отправителя.");
         return;
     }
 
-    double fromBal = getBalance(fromCard);
-    double toBal   = getBalance(toCard);
+    // Перевод и его запись аудита фиксируются вместе: одной транзакцией
+    // SqliteStore или, между шардами, одной двухфазной фиксацией.
+    EventLog::Scope scope("admin_transfer", fromCard);
+
+    auto audit = [&](QSqlDatabase &txDb, const TransactionRecord &out) {
+        return AuditLog::append(txDb, "admin_transfer", fromCard,
+                                QString("to=%1 amount=%2 operation_id=%3")
+                                    .arg(toCard)
+                                    .arg(amount, 0, 'f', 2)
+                                    .arg(out.operationId));
+    };
+
+    OperationResult result;
+    bool ok = ShardMap::active()
+                  ? ShardedStore(ShardMap::active()).transfer(
+                        fromCard, toCard, amount, TransactionType::AdminTransferOut,
+                        TransactionType::AdminTransferIn, result, audit)
+                  : SqliteStore().transfer(
+                        fromCard, toCard, amount, TransactionType::AdminTransferOut,
+                        TransactionType::AdminTransferIn, result, audit);
+    if (!ok) {
+        QMessageBox::warning(this, "Ошибка",
+                             QString::fromUtf8(operationErrorInfo(result.error).message));
+        return;
+    }
+    scope.succeed();
 
-    if (fromBal < amount) {
-        db.rollback();
-        QMessageBox::warning(this, "Ошибка", "Недостаточно средств на карте отправителя.");
+    QMessageBox::information(this, "Готово", "Перевод выполнен.");
+    refreshTable();
+}
+
+
+void AdminDialog::onArchive()
+{
+    QSqlDatabase db = QSqlDatabase::database();
+    if (!db.isOpen()) {
+        QMessageBox::warning(this, "Ошибка", "База данных не открыта.");
         return;
     }
 
-    double newFromBal = fromBal - amount;
-    double newToBal   = toBal + amount;
+    m_archiveButton->setEnabled(false);
+    m_archiveStatusLabel->setText("Архивация...");
+
+    // Поток без родителя: диалог можно закрыть, не дожидаясь архиватора.
+    auto *thread = new QThread();
+    auto *archiver = new TransactionArchiver(db.databaseName());
+    archiver->moveToThread(thread);
+
+    connect(thread, &QThread::started, archiver, &TransactionArchiver::run);
+    connect(archiver, &TransactionArchiver::finished, thread, &QThread::quit);
+    connect(archiver, &TransactionArchiver::finished, archiver, &QObject::deleteLater);
+    connect(thread, &QThread::finished, thread, &QObject::deleteLater);
+
+    connect(archiver, &TransactionArchiver::progress, this,
+            [this](const QString &month, qint64 movedTotal) {
+                m_archiveStatusLabel->setText(
+                    QString("Архивация %1: перенесено %2").arg(month).arg(movedTotal));
+            });
+    connect(archiver, &TransactionArchiver::finished, this,
+            [this](bool ok, qint64 movedTotal) {
+                m_archiveButton->setEnabled(true);
+                m_archiveStatusLabel->setText(
+                    ok ? QString("Архивация завершена: перенесено %1").arg(movedTotal)
+                       : QString("Архивация прервана: перенесено %1").arg(movedTotal));
+            });
+
+    thread->start();
+}
 
-    if (!updateBalance(fromCard, newFromBal) ||
-        !updateBalance(toCard,   newToBal)   ||
-        !recordTransaction(fromCard, "admin_transfer_out", amount, newFromBal) ||
-        !recordTransaction(toCard,   "admin_transfer_in",  amount, newToBal))
-    {
-        db.rollback();
-        QMessageBox::warning(this, "Ошибка", "Не удалось выполнить перевод.");
+void AdminDialog::onReconcile()
+{
+    QSqlDatabase db = QSqlDatabase::database();
+    if (!db.isOpen()) {
+        QMessageBox::warning(this, "Ошибка", "База данных не открыта.");
         return;
     }
 
-    if (!db.commit()) {
-        QMessageBox::warning(this, "Ошибка", "Не удалось зафиксировать перевод.");
+    m_reconcileButton->setEnabled(false);
+    m_reconcileStatusLabel->setText("Сверка...");
+
+    // Как и архиватор: поток без родителя, сверка читает из своих
+    // соединений и терминалы не блокирует.
+    auto *thread = new QThread();
+    auto *reconciler = new LedgerReconciler(db.databaseName());
+    reconciler->moveToThread(thread);
+
+    connect(thread, &QThread::started, reconciler, &LedgerReconciler::run);
+    connect(reconciler, &LedgerReconciler::finished, thread, &QThread::quit);
+    connect(reconciler, &LedgerReconciler::finished, reconciler, &QObject::deleteLater);
+    connect(thread, &QThread::finished, thread, &QObject::deleteLater);
+
+    connect(reconciler, &LedgerReconciler::progress, this,
+            [this](int shardsDone, int shardsTotal) {
+                m_reconcileStatusLabel->setText(
+                    QString("Сверка: диапазонов %1 из %2").arg(shardsDone).arg(shardsTotal));
+            });
+    connect(reconciler, &LedgerReconciler::finished, this,
+            [this](bool ok, qint64 mismatches, qint64 gaps, const QString &reportPath) {
+                m_reconcileButton->setEnabled(true);
+                m_reconcileStatusLabel->setText(
+                    ok ? QString("Расхождений: %1, разрывов: %2. Отчёт: %3")
+                             .arg(mismatches).arg(gaps).arg(reportPath)
+                       : QString("Сверка прервана, см. журнал событий"));
+            });
+
+    thread->start();
+}
+
+void AdminDialog::onVerifyAudit()
+{
+    QSqlDatabase db = QSqlDatabase::database();
+    if (!db.isOpen()) {
+        QMessageBox::warning(this, "Ошибка", "База данных не открыта.");
         return;
     }
 
-    QMessageBox::information(this, "Готово", "Перевод выполнен.");
-    refreshTable();
+    m_auditButton->setEnabled(false);
+    m_auditStatusLabel->setText("Проверка цепочки...");
+
+    // У каждого шарда своя цепочка audit_log.
+    QStringList paths;
+    for (const QSqlDatabase &shard : ShardMap::databases())
+        paths.append(shard.databaseName());
+
+    auto *thread = new QThread();
+    auto *verifier = new AuditVerifier(paths);
+    verifier->moveToThread(thread);
+
+    connect(thread, &QThread::started, verifier, &AuditVerifier::run);
+    connect(verifier, &AuditVerifier::finished, thread, &QThread::quit);
+    connect(verifier, &AuditVerifier::finished, verifier, &QObject::deleteLater);
+    connect(thread, &QThread::finished, thread, &QObject::deleteLater);
+
+    connect(verifier, &AuditVerifier::finished, this,
+            [this](bool ok, qint64 entries, qint64 broken, qint64 firstBrokenId,
+                   const QString &firstBrokenFile) {
+                m_auditButton->setEnabled(true);
+                if (!ok)
+                    m_auditStatusLabel->setText("Проверка прервана, см. журнал событий");
+                else if (broken == 0)
+                    m_auditStatusLabel->setText(QString("Цепочка цела: записей %1").arg(entries));
+                else
+                    m_auditStatusLabel->setText(
+                        QString("Цепочка нарушена: записей %1, не сходится %2, первая — id %3 (%4)")
+                            .arg(entries).arg(broken).arg(firstBrokenId)
+                            .arg(QFileInfo(firstBrokenFile).fileName()));
+            });
+
+    thread->start();
 }
 
+void AdminDialog::onBackup()
+{
+    QSqlDatabase db = QSqlDatabase::database();
+    if (!db.isOpen()) {
+        QMessageBox::warning(this, "Ошибка", "База данных не открыта.");
+        return;
+    }
+
+    m_backupButton->setEnabled(false);
+    m_backupStatusLabel->setText("Резервное копирование...");
+
+    // Копия читает снимок на своём соединении и пишет порциями с паузами:
+    // терминалы продолжают работать.
+    auto *thread = new QThread();
+    auto *backup = new DatabaseBackup(db.databaseName(),
+                                      DatabaseBackup::defaultPath(db.databaseName()));
+    backup->moveToThread(thread);
+
+    connect(thread, &QThread::started, backup, &DatabaseBackup::run);
+    connect(backup, &DatabaseBackup::finished, thread, &QThread::quit);
+    connect(backup, &DatabaseBackup::finished, backup, &QObject::deleteLater);
+    connect(thread, &QThread::finished, thread, &QObject::deleteLater);
+
+    connect(backup, &DatabaseBackup::progress, this,
+            [this](int percent, qint64 rows, qint64 bytesPerSecond) {
+                m_backupStatusLabel->setText(
+                    QString("Копирование: %1%, строк %2, %3 МБ/с")
+                        .arg(percent)
+                        .arg(rows)
+                        .arg(bytesPerSecond / (1024.0 * 1024.0), 0, 'f', 1));
+            });
+    connect(backup, &DatabaseBackup::finished, this,
+            [this](bool ok, qint64 rows, const QString &path) {
+                m_backupButton->setEnabled(true);
+                m_backupStatusLabel->setText(
+                    ok ? QString("Копия готова: строк %1, %2").arg(rows).arg(path)
+                       : QString("Копирование прервано, см. журнал событий"));
+            });
+
+    thread->start();
+}
+
+void AdminDialog::onExportForecast()
+{
+    QString path = CashForecast::defaultExportPath(QSqlDatabase::database().databaseName());
+    QString error;
+    if (!CashForecast::exportCsv(path, m_forecast, error)) {
+        EventLog::error("forecast.export_failed", nullptr, path + ": " + error);
+        QMessageBox::warning(this, "Ошибка", "Не удалось выгрузить прогноз: " + error);
+        return;
+    }
+    QMessageBox::information(this, "Прогноз", "Прогноз выгружен: " + path);
+}
@@ -5,7 +5,15 @@
 #include <QLineEdit>
 #include <QPushButton>
 #include <QTableWidget>
+#include <QLabel>
 #include <QRegularExpressionValidator>
+#include <QSqlDatabase>
+
+#include <memory>
+
+#include "cashforecast.h"
+
+class CardFilter;
 
 class AdminDialog : public QDialog
 {
@@ -14,23 +22,36 @@ class AdminDialog : public QDialog
 public:
     explicit AdminDialog(QWidget *parent = nullptr);
 
+    // Фильтр карт терминала: добавленные и удалённые счета сразу видны в нём.
+    void setCardFilter(std::shared_ptr<CardFilter> filter);
+
 private slots:
     void onAddAccount();
     void onDeleteAccount();
     void onUpdateBalance();
     void onResetPin();
-    void onTransfer();       
+    void onTransfer();
+    void onArchive();
+    void onReconcile();
+    void onVerifyAudit();
+    void onBackup();
+    void onExportForecast();
     void refreshTable();
 
 private:
+    void updateCardFilterLabel();
+
     QString hashPin(const QString &pin);
 
+    // Изменение и его запись audit_log — одна транзакция BEGIN IMMEDIATE.
+    bool beginAudited(QSqlDatabase &db);
+    bool commitAudited(QSqlDatabase &db,
+                       const QString &action,
+                       const QString &card,
+                       const QString &details);
+
     double getBalance(const QString &card);
     bool updateBalance(const QString &card, double newBal);
-    bool recordTransaction(const QString &card,
-                           const QString &type,
-                           double amount,
-                           double balanceAfter);
 
 private:
     QLineEdit *m_cardEdit = nullptr;
@@ -46,8 +67,24 @@ private:
     QPushButton *m_updateBalanceButton = nullptr;
     QPushButton *m_resetPinButton = nullptr;
     QPushButton *m_transferButton = nullptr;
+    QPushButton *m_archiveButton = nullptr;
+    QPushButton *m_reconcileButton = nullptr;
+    QPushButton *m_auditButton = nullptr;
+    QPushButton *m_backupButton = nullptr;
+    QPushButton *m_forecastButton = nullptr;
+
+    QLabel *m_archiveStatusLabel = nullptr;
+    QLabel *m_reconcileStatusLabel = nullptr;
+    QLabel *m_auditStatusLabel = nullptr;
+    QLabel *m_backupStatusLabel = nullptr;
+    QLabel *m_forecastLabel = nullptr;
+    QLabel *m_totalsLabel = nullptr;
+    QLabel *m_cardFilterLabel = nullptr;
 
     QTableWidget *m_table = nullptr;
+
+    std::shared_ptr<CardFilter> m_cardFilter;
+    QList<CashForecast::Result> m_forecast;
 };
 
 #endif // ADMINDIALOG_H
@@ -1,21 +1,76 @@
 #include "atmcontroller.h"
 
-#include <QSqlDatabase>
-#include <QSqlQuery>
-#include <QSqlError>
-#include <QVariant>
-#include <QDebug>
 #include <QCryptographicHash>
 #include <QDateTime>
+#include <QElapsedTimer>
+
+#include "atmevents.h"
+#include "cardfilter.h"
+#include "eventlog.h"
+#include "readsnapshot.h"
+#include "shardedstore.h"
+#include "sqlitestore.h"
+#include "velocitylimiter.h"
 
 namespace {
 const QString ADMIN_CARD = "0000000000000000";
 }
 
-AtmController::AtmController()
+AtmController::AtmController(const QString &connectionName)
+{
+    openStorage(connectionName);
+}
+
+void AtmController::openStorage(const QString &connectionName)
+{
+    // Терминал на соединении по умолчанию показывает баланс и историю
+    // через соединение-читатель.
+    QString readConnection = connectionName.isEmpty() ? ReadSnapshot::connectionName()
+                                                      : QString();
+    if (connectionName.isEmpty() && ShardMap::active()) {
+        auto store = std::make_shared<ShardedStore>(ShardMap::active(), readConnection);
+        m_accounts = store;
+        m_ledger = store;
+        return;
+    }
+
+    auto store = std::make_shared<SqliteStore>(connectionName, readConnection);
+    m_accounts = store;
+    m_ledger = store;
+}
+
+AtmController::AtmController(std::shared_ptr<AccountStore> accounts,
+                             std::shared_ptr<LedgerStore> ledger)
+    : m_accounts(std::move(accounts))
+    , m_ledger(std::move(ledger))
 {
 }
 
+void AtmController::setVelocityLimiter(std::shared_ptr<VelocityLimiter> limiter)
+{
+    m_limiter = std::move(limiter);
+}
+
+void AtmController::setCardFilter(std::shared_ptr<CardFilter> filter)
+{
+    m_cardFilter = std::move(filter);
+}
+
+void AtmController::setEvents(AtmEvents *events)
+{
+    m_events = events;
+}
+
+void AtmController::publish(const QString &cardNumber, const TransactionRecord &entry)
+{
+    if (!m_events)
+        return;
+
+    emit m_events->transactionCommitted(cardNumber, entry);
+    if (entry.type != TransactionType::PinChange)
+        emit m_events->balanceChanged(cardNumber, entry.balanceAfter);
+}
+
 QString AtmController::hashPin(const QString &pin)
 {
     QByteArray data = pin.toUtf8();
@@ -32,75 +87,8 @@ QString AtmController::currentCardNumber() const
 
 bool AtmController::login(const QString &cardNumber, const QString &pin)
 {
-    QSqlDatabase db = QSqlDatabase::database();
-    if (!db.isOpen()) {
-        qDebug() << "БД не открыта в login()";
+    if (!authenticate(cardNumber, pin))
         return false;
-    }
-
-    QSqlQuery query;
-    query.prepare("SELECT pin, failed_attempts, locked_until "
-                  "FROM accounts WHERE card_number = :card");
-    query.bindValue(":card", cardNumber);
-
-    if (!query.exec()) {
-        qDebug() << "Ошибка login() SELECT:" << query.lastError().text();
-        return false;
-    }
-
-    if (!query.next()) {
-        return false;
-    }
-
-    QString storedHash = query.value(0).toString();
-    int failedAttempts = query.value(1).toInt();
-    QVariant lockedVar = query.value(2);
-
-    QDateTime now = QDateTime::currentDateTime();
-
-    if (!lockedVar.isNull()) {
-        QDateTime lockedUntil = lockedVar.toDateTime();
-        if (lockedUntil.isValid() && lockedUntil > now) {
-            return false;
-        }
-    }
-
-    QString inputHash = hashPin(pin);
-
-    if (inputHash != storedHash) {
-        failedAttempts++;
-
-        QSqlQuery upd;
-        upd.prepare("UPDATE accounts "
-                    "SET failed_attempts = :fa, locked_until = :lu "
-                    "WHERE card_number = :card");
-        upd.bindValue(":fa", failedAttempts);
-
-        if (failedAttempts >= 3) {
-            QDateTime lockedUntil = now.addSecs(5 * 60);
-            upd.bindValue(":lu", lockedUntil);
-        } else {
-            upd.bindValue(":lu", QVariant(QVariant::DateTime));
-        }
-
-        upd.bindValue(":card", cardNumber);
-
-        if (!upd.exec()) {
-            qDebug() << "Ошибка login() UPDATE failed_attempts:"
-                     << upd.lastError().text();
-        }
-
-        return false;
-    }
-
-    QSqlQuery reset;
-    reset.prepare("UPDATE accounts "
-                  "SET failed_attempts = 0, locked_until = NULL "
-                  "WHERE card_number = :card");
-    reset.bindValue(":card", cardNumber);
-    if (!reset.exec()) {
-        qDebug() << "Ошибка login() RESET:" << reset.lastError().text();
-    }
 
     m_currentCardNumber = cardNumber;
     return true;
@@ -111,406 +99,320 @@ void AtmController::logout()
     m_currentCardNumber.reset();
 }
 
-double AtmController::getBalanceFromDb(const QString &cardNumber) const
+double AtmController::currentBalance() const
 {
-    QSqlDatabase db = QSqlDatabase::database();
-    if (!db.isOpen()) {
-        qDebug() << "БД не открыта в getBalanceFromDb()";
+    if (!m_currentCardNumber.has_value())
         return 0.0;
-    }
-
-    QSqlQuery query;
-    query.prepare("SELECT balance FROM accounts WHERE card_number = :card");
-    query.bindValue(":card", cardNumber);
+    return m_accounts->balance(m_currentCardNumber.value()).value_or(0.0);
+}
 
-    if (!query.exec()) {
-        qDebug() << "Ошибка getBalanceFromDb():" << query.lastError().text();
-        return 0.0;
-    }
+OperationResult AtmController::withdraw(double amount)
+{
+    if (!m_currentCardNumber.has_value())
+        return OperationResult::failure(OperationError::NotLoggedIn);
+    return withdrawFor(m_currentCardNumber.value(), amount);
+}
 
-    if (query.next()) {
-        return query.value(0).toDouble();
-    }
+OperationResult AtmController::deposit(double amount)
+{
+    if (!m_currentCardNumber.has_value())
+        return OperationResult::failure(OperationError::NotLoggedIn);
+    return depositFor(m_currentCardNumber.value(), amount);
+}
 
-    return 0.0;
+OperationResult AtmController::transferTo(const QString &targetCardNumber, double amount)
+{
+    if (!m_currentCardNumber.has_value())
+        return OperationResult::failure(OperationError::NotLoggedIn);
+    return transferFor(m_currentCardNumber.value(), targetCardNumber, amount);
 }
 
-bool AtmController::updateBalanceInDb(const QString &cardNumber, double newBalance)
+OperationResult AtmController::changePin(const QString &oldPin, const QString &newPin)
 {
-    QSqlDatabase db = QSqlDatabase::database();
-    if (!db.isOpen()) {
-        qDebug() << "БД не открыта в updateBalanceInDb()";
-        return false;
-    }
+    if (!m_currentCardNumber.has_value())
+        return OperationResult::failure(OperationError::NotLoggedIn);
+    return changePinFor(m_currentCardNumber.value(), oldPin, newPin);
+}
 
-    QSqlQuery query;
-    query.prepare("UPDATE accounts SET balance = :bal WHERE card_number = :card");
-    query.bindValue(":bal", newBalance);
-    query.bindValue(":card", cardNumber);
+QList<AtmController::TransactionRecord>
+AtmController::lastTransactions(int limit, qint64 beforeId) const
+{
+    if (!m_currentCardNumber.has_value())
+        return {};
+    return historyFor(m_currentCardNumber.value(), limit, beforeId);
+}
 
-    if (!query.exec()) {
-        qDebug() << "Ошибка updateBalanceInDb():" << query.lastError().text();
+bool AtmController::lastTransactions(int limit, qint64 beforeId, HistoryBuffer &page) const
+{
+    if (!m_currentCardNumber.has_value())
         return false;
-    }
 
+    EventLog::Scope scope("history", m_currentCardNumber.value());
+    if (!m_ledger->historyInto(m_currentCardNumber.value(), limit, beforeId, page))
+        return false;
+    scope.succeed();
     return true;
 }
 
-double AtmController::getAtmCash() const
+std::optional<QString> AtmController::sessionCard(SessionHandle session)
 {
-    QSqlDatabase db = QSqlDatabase::database();
-    if (!db.isOpen()) {
-        qDebug() << "БД не открыта в getAtmCash()";
-        return 0.0;
-    }
-
-    QSqlQuery query("SELECT cash_total FROM atm_state WHERE id = 1");
-    if (!query.exec()) {
-        qDebug() << "Ошибка getAtmCash():" << query.lastError().text();
-        return 0.0;
-    }
-
-    if (query.next()) {
-        return query.value(0).toDouble();
-    }
-
-    return 0.0;
+    return m_sessions.touch(session, QDateTime::currentMSecsSinceEpoch());
 }
 
-bool AtmController::updateAtmCash(double newCash)
+AtmController::SessionHandle AtmController::openSession(const QString &cardNumber,
+                                                        const QString &pin)
 {
-    QSqlDatabase db = QSqlDatabase::database();
-    if (!db.isOpen()) {
-        qDebug() << "БД не открыта в updateAtmCash()";
-        return false;
-    }
-
-    QSqlQuery query;
-    query.prepare("UPDATE atm_state SET cash_total = :cash WHERE id = 1");
-    query.bindValue(":cash", newCash);
-
-    if (!query.exec()) {
-        qDebug() << "Ошибка updateAtmCash():" << query.lastError().text();
-        return false;
-    }
+    if (!authenticate(cardNumber, pin))
+        return 0;
+    return m_sessions.open(cardNumber, QDateTime::currentMSecsSinceEpoch());
+}
 
-    return true;
+void AtmController::closeSession(SessionHandle session)
+{
+    m_sessions.close(session);
 }
 
-bool AtmController::recordTransactionFor(const QString &cardNumber,
-                                         const QString &type,
-                                         double amount,
-                                         double balanceAfter)
+double AtmController::balance(SessionHandle session)
 {
-    QSqlDatabase db = QSqlDatabase::database();
-    if (!db.isOpen()) {
-        qDebug() << "БД не открыта в recordTransactionFor()";
-        return false;
-    }
+    std::optional<QString> card = sessionCard(session);
+    if (!card.has_value())
+        return 0.0;
+    return m_accounts->balance(card.value()).value_or(0.0);
+}
 
-    QSqlQuery query;
-    query.prepare("INSERT INTO transactions "
-                  "(card_number, type, amount, balance_after) "
-                  "VALUES (:card, :type, :amount, :bal)");
-    query.bindValue(":card", cardNumber);
-    query.bindValue(":type", type);
-    query.bindValue(":amount", amount);
-    query.bindValue(":bal", balanceAfter);
-
-    if (!query.exec()) {
-        qDebug() << "Ошибка recordTransactionFor():" << query.lastError().text();
-        return false;
-    }
+OperationResult AtmController::withdraw(SessionHandle session, double amount)
+{
+    std::optional<QString> card = sessionCard(session);
+    if (!card.has_value())
+        return OperationResult::failure(OperationError::NotLoggedIn);
+    return withdrawFor(card.value(), amount);
+}
 
-    return true;
+OperationResult AtmController::deposit(SessionHandle session, double amount)
+{
+    std::optional<QString> card = sessionCard(session);
+    if (!card.has_value())
+        return OperationResult::failure(OperationError::NotLoggedIn);
+    return depositFor(card.value(), amount);
 }
 
-bool AtmController::recordTransaction(const QString &type,
-                                      double amount,
-                                      double balanceAfter)
+OperationResult AtmController::transferTo(SessionHandle session,
+                                          const QString &targetCardNumber,
+                                          double amount)
 {
-    if (!m_currentCardNumber.has_value())
-        return false;
-    return recordTransactionFor(m_currentCardNumber.value(),
-                                type, amount, balanceAfter);
+    std::optional<QString> card = sessionCard(session);
+    if (!card.has_value())
+        return OperationResult::failure(OperationError::NotLoggedIn);
+    return transferFor(card.value(), targetCardNumber, amount);
 }
 
-double AtmController::currentBalance() const
+OperationResult AtmController::changePin(SessionHandle session, const QString &oldPin,
+                                         const QString &newPin)
 {
-    if (!m_currentCardNumber.has_value())
-        return 0.0;
-    return getBalanceFromDb(m_currentCardNumber.value());
+    std::optional<QString> card = sessionCard(session);
+    if (!card.has_value())
+        return OperationResult::failure(OperationError::NotLoggedIn);
+    return changePinFor(card.value(), oldPin, newPin);
 }
 
-bool AtmController::withdraw(double amount)
+QList<AtmController::TransactionRecord>
+AtmController::history(SessionHandle session, int limit, qint64 beforeId)
 {
-    if (!m_currentCardNumber.has_value())
-        return false;
-    if (amount <= 0)
-        return false;
+    std::optional<QString> card = sessionCard(session);
+    if (!card.has_value())
+        return {};
+    return historyFor(card.value(), limit, beforeId);
+}
 
-    QString card = m_currentCardNumber.value();
-    QSqlDatabase db = QSqlDatabase::database();
-    if (!db.isOpen()) {
-        qDebug() << "БД не открыта в withdraw()";
+bool AtmController::authenticate(const QString &cardNumber, const QString &pin)
+{
+    if (m_cardFilter && !m_cardFilter->mayContain(cardNumber))
         return false;
-    }
 
-    double balance = getBalanceFromDb(card);
-    double atmCash = getAtmCash();
+    EventLog::Scope scope("login", cardNumber);
 
-    if (amount > balance || amount > atmCash) {
+    std::optional<AccountRecord> account = m_accounts->account(cardNumber);
+    if (!account.has_value()) {
+        if (m_cardFilter)
+            m_cardFilter->reportFalsePositive();
         return false;
     }
 
-    double newBalance = balance - amount;
-    double newAtmCash = atmCash - amount;
+    QDateTime now = QDateTime::currentDateTime();
 
-    if (!db.transaction()) {
-        qDebug() << "Не удалось начать транзакцию в withdraw()";
+    if (account->lockedUntil.isValid() && account->lockedUntil > now)
         return false;
-    }
 
-    if (!updateBalanceInDb(card, newBalance)) {
-        db.rollback();
-        return false;
-    }
+    QString inputHash = hashPin(pin);
 
-    if (!updateAtmCash(newAtmCash)) {
-        db.rollback();
-        return false;
-    }
+    if (inputHash != account->pinHash) {
+        int failedAttempts = account->failedAttempts + 1;
 
-    if (!recordTransaction("withdraw", amount, newBalance)) {
-        db.rollback();
-        return false;
-    }
+        QDateTime lockedUntil;
+        if (failedAttempts >= 3)
+            lockedUntil = now.addSecs(5 * 60);
 
-    if (!db.commit()) {
-        qDebug() << "Не удалось зафиксировать транзакцию в withdraw()";
+        m_accounts->setLoginState(cardNumber, failedAttempts, lockedUntil);
         return false;
     }
 
+    m_accounts->setLoginState(cardNumber, 0, QDateTime());
+
+    scope.succeed();
     return true;
 }
 
-bool AtmController::deposit(double amount)
+OperationResult AtmController::withdrawFor(const QString &card, double amount)
 {
-    if (!m_currentCardNumber.has_value())
-        return false;
-    if (amount <= 0)
-        return false;
-
-    QString card = m_currentCardNumber.value();
-    QSqlDatabase db = QSqlDatabase::database();
-    if (!db.isOpen()) {
-        qDebug() << "БД не открыта в deposit()";
-        return false;
-    }
-
-    double balance = getBalanceFromDb(card);
-    double newBalance = balance + amount;
+    EventLog::Scope scope("withdraw", card);
+    QElapsedTimer total;
+    total.start();
 
-    if (!db.transaction()) {
-        qDebug() << "Не удалось начать транзакцию в deposit()";
-        return false;
-    }
+    OperationResult result;
+    if (amount <= 0)
+        return finish(result, OperationError::InvalidAmount, total);
 
-    if (!updateBalanceInDb(card, newBalance)) {
-        db.rollback();
-        return false;
-    }
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
 
-    if (!recordTransaction("deposit", amount, newBalance)) {
-        db.rollback();
-        return false;
+    if (m_limiter && !m_limiter->reserve(card, VelocityLimiter::Kind::Withdraw, amount, now)) {
+        EventLog::warning("limit.exceeded", nullptr, "withdraw");
+        return finish(result, OperationError::LimitExceeded, total);
     }
 
-    if (!db.commit()) {
-        qDebug() << "Не удалось зафиксировать транзакцию в deposit()";
-        return false;
+    if (!m_accounts->withdraw(card, amount, result)) {
+        if (m_limiter)
+            m_limiter->release(card, VelocityLimiter::Kind::Withdraw, amount, now);
+        return finish(result, result.error, total);
     }
 
-    return true;
+    publish(card, result.entry);
+    scope.succeed();
+    return finish(result, OperationError::None, total);
 }
 
-bool AtmController::transferTo(const QString &targetCardNumber, double amount)
+OperationResult AtmController::depositFor(const QString &card, double amount)
 {
-    if (!m_currentCardNumber.has_value())
-        return false;
-    if (amount <= 0)
-        return false;
-
-    QString sourceCard = m_currentCardNumber.value();
-    QString targetCard = targetCardNumber.trimmed();
+    EventLog::Scope scope("deposit", card);
+    QElapsedTimer total;
+    total.start();
 
-    if (targetCard.isEmpty() || targetCard == sourceCard)
-        return false;
+    OperationResult result;
+    if (amount <= 0)
+        return finish(result, OperationError::InvalidAmount, total);
 
-    if (targetCard == ADMIN_CARD)
-        return false;
+    if (!m_accounts->deposit(card, amount, result))
+        return finish(result, result.error, total);
 
-    QSqlDatabase db = QSqlDatabase::database();
-    if (!db.isOpen()) {
-        qDebug() << "БД не открыта в transferTo()";
-        return false;
-    }
-
-    if (!db.transaction()) {
-        qDebug() << "Не удалось начать транзакцию в transferTo()";
-        return false;
-    }
-
-    double sourceBalance = getBalanceFromDb(sourceCard);
-    if (amount > sourceBalance) {
-        db.rollback();
-        return false;
-    }
+    publish(card, result.entry);
+    scope.succeed();
+    return finish(result, OperationError::None, total);
+}
 
-    QSqlQuery query;
-    query.prepare("SELECT balance FROM accounts WHERE card_number = :card");
-    query.bindValue(":card", targetCard);
+OperationResult AtmController::transferFor(const QString &sourceCard,
+                                           const QString &targetCardNumber,
+                                           double amount)
+{
+    EventLog::Scope scope("transfer", sourceCard);
+    QElapsedTimer total;
+    total.start();
 
-    if (!query.exec()) {
-        qDebug() << "Ошибка transferTo() SELECT target:"
-                 << query.lastError().text();
-        db.rollback();
-        return false;
-    }
+    OperationResult result;
+    if (amount <= 0)
+        return finish(result, OperationError::InvalidAmount, total);
 
-    if (!query.next()) {
-        db.rollback();
-        return false;
-    }
+    QString targetCard = targetCardNumber.trimmed();
 
-    double targetBalance = query.value(0).toDouble();
+    if (targetCard.isEmpty() || targetCard == ADMIN_CARD)
+        return finish(result, OperationError::InvalidCard, total);
+    if (targetCard == sourceCard)
+        return finish(result, OperationError::SameCard, total);
 
-    double newSourceBalance = sourceBalance - amount;
-    double newTargetBalance = targetBalance + amount;
+    if (m_cardFilter && !m_cardFilter->mayContain(targetCard))
+        return finish(result, OperationError::AccountNotFound, total);
 
-    if (!updateBalanceInDb(sourceCard, newSourceBalance)) {
-        db.rollback();
-        return false;
-    }
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
 
-    if (!updateBalanceInDb(targetCard, newTargetBalance)) {
-        db.rollback();
-        return false;
+    if (m_limiter && !m_limiter->reserve(sourceCard, VelocityLimiter::Kind::Transfer, amount, now)) {
+        EventLog::warning("limit.exceeded", nullptr, "transfer");
+        return finish(result, OperationError::LimitExceeded, total);
     }
 
-    if (!recordTransactionFor(sourceCard, "transfer_out",
-                              amount, newSourceBalance)) {
-        db.rollback();
-        return false;
+    if (!m_accounts->transfer(sourceCard, targetCard, amount,
+                              TransactionType::TransferOut, TransactionType::TransferIn,
+                              result)) {
+        if (m_limiter)
+            m_limiter->release(sourceCard, VelocityLimiter::Kind::Transfer, amount, now);
+        return finish(result, result.error, total);
     }
 
-    if (!recordTransactionFor(targetCard, "transfer_in",
-                              amount, newTargetBalance)) {
-        db.rollback();
-        return false;
-    }
+    publish(sourceCard, result.entry);
+    scope.succeed();
+    return finish(result, OperationError::None, total);
+}
 
-    if (!db.commit()) {
-        qDebug() << "Не удалось зафиксировать транзакцию в transferTo()";
-        return false;
-    }
+OperationResult AtmController::adminTransfer(const QString &fromCard,
+                                             const QString &toCard,
+                                             double amount)
+{
+    EventLog::Scope scope("admin_transfer", fromCard);
+    QElapsedTimer total;
+    total.start();
 
-    return true;
+    OperationResult result;
+    if (amount <= 0)
+        return finish(result, OperationError::InvalidAmount, total);
+    if (fromCard == toCard)
+        return finish(result, OperationError::SameCard, total);
+    if (fromCard == ADMIN_CARD || toCard == ADMIN_CARD)
+        return finish(result, OperationError::InvalidCard, total);
+
+    if (!m_accounts->transfer(fromCard, toCard, amount,
+                              TransactionType::AdminTransferOut, TransactionType::AdminTransferIn,
+                              result))
+        return finish(result, result.error, total);
+
+    publish(fromCard, result.entry);
+    scope.succeed();
+    return finish(result, OperationError::None, total);
 }
 
-bool AtmController::changePin(const QString &oldPin, const QString &newPin)
+OperationResult AtmController::changePinFor(const QString &card, const QString &oldPin,
+                                            const QString &newPin)
 {
-    if (!m_currentCardNumber.has_value())
-        return false;
+    EventLog::Scope scope("change_pin", card);
+    QElapsedTimer total;
+    total.start();
 
+    OperationResult result;
     if (newPin.isEmpty())
-        return false;
-
-    QString card = m_currentCardNumber.value();
-    QSqlDatabase db = QSqlDatabase::database();
-    if (!db.isOpen()) {
-        qDebug() << "БД не открыта в changePin()";
-        return false;
-    }
-
-    QSqlQuery check;
-    check.prepare("SELECT pin FROM accounts WHERE card_number = :card");
-    check.bindValue(":card", card);
-
-    if (!check.exec()) {
-        qDebug() << "Ошибка changePin() SELECT:" << check.lastError().text();
-        return false;
-    }
-
-    if (!check.next())
-        return false;
-
-    QString storedHash = check.value(0).toString();
-    QString oldHash = hashPin(oldPin);
-
-    if (storedHash != oldHash)
-        return false;
+        return finish(result, OperationError::InvalidPin, total);
 
-    QString newHash = hashPin(newPin);
+    // Проверка старого PIN, смена и строка журнала с текущим балансом —
+    // одна операция хранилища.
+    if (!m_accounts->changePin(card, hashPin(oldPin), hashPin(newPin), result))
+        return finish(result, result.error, total);
 
-    QSqlQuery upd;
-    upd.prepare("UPDATE accounts "
-                "SET pin = :pin, failed_attempts = 0, locked_until = NULL "
-                "WHERE card_number = :card");
-    upd.bindValue(":pin", newHash);
-    upd.bindValue(":card", card);
-
-    if (!upd.exec()) {
-        qDebug() << "Ошибка changePin() UPDATE:" << upd.lastError().text();
-        return false;
-    }
-
-    double balance = getBalanceFromDb(card);
-    recordTransaction("pin_change", 0.0, balance);
+    publish(card, result.entry);
+    scope.succeed();
+    return finish(result, OperationError::None, total);
+}
 
-    return true;
+OperationResult &AtmController::finish(OperationResult &result,
+                                       OperationError error,
+                                       const QElapsedTimer &total)
+{
+    result.error = error;
+    result.timings.totalNs = total.nsecsElapsed();
+    if (error != OperationError::None)
+        EventLog::info("op.refused", nullptr, operationErrorInfo(error).code);
+    return result;
 }
 
 QList<AtmController::TransactionRecord>
-AtmController::lastTransactions(int limit) const
+AtmController::historyFor(const QString &card, int limit, qint64 beforeId) const
 {
-    QList<TransactionRecord> list;
-
-    if (!m_currentCardNumber.has_value())
-        return list;
-
-    QString card = m_currentCardNumber.value();
-
-    QSqlDatabase db = QSqlDatabase::database();
-    if (!db.isOpen()) {
-        qDebug() << "БД не открыта в lastTransactions()";
-        return list;
-    }
-
-    QString sql =
-        "SELECT type, amount, balance_after, ts "
-        "FROM transactions "
-        "WHERE card_number = :card "
-        "ORDER BY ts DESC "
-        "LIMIT " + QString::number(limit);
-
-    QSqlQuery query;
-    query.prepare(sql);
-    query.bindValue(":card", card);
-
-    if (!query.exec()) {
-        qDebug() << "Ошибка lastTransactions():" << query.lastError().text();
-        return list;
-    }
-
-    while (query.next()) {
-        TransactionRecord rec;
-        rec.type = query.value(0).toString();
-        rec.amount = query.value(1).toDouble();
-        rec.balanceAfter = query.value(2).toDouble();
-        rec.timestamp = query.value(3).toDateTime();
-        list.append(rec);
-    }
-
+    EventLog::Scope scope("history", card);
+    QList<TransactionRecord> list = m_ledger->history(card, limit, beforeId);
+    scope.succeed();
     return list;
 }
@@ -4,19 +4,45 @@
 #include <QString>
 #include <QList>
 #include <QDateTime>
+#include <memory>
 #include <optional>
 
+#include "sessionmanager.h"
+#include "storage.h"
+
+class AtmEvents;
+class QElapsedTimer;
+class CardFilter;
+class HistoryBuffer;
+class VelocityLimiter;
+
 class AtmController
 {
 public:
-    struct TransactionRecord {
-        QString type;          
-        double amount;
-        double balanceAfter;
-        QDateTime timestamp;
-    };
+    using TransactionRecord = ::TransactionRecord;
+
+    // Пустое имя — соединение по умолчанию (или все шарды, если настроен
+    // ShardMap). Каждому потоку нужно своё соединение QSqlDatabase, поэтому
+    // нагрузочный тест передаёт имя явно.
+    explicit AtmController(const QString &connectionName = QString());
+
+    // Заново выбирает хранилище по имени соединения — после того как при
+    // запуске открыты БД и карта шардов.
+    void openStorage(const QString &connectionName = QString());
+
+    // Произвольный движок хранения (например, MemoryStore).
+    AtmController(std::shared_ptr<AccountStore> accounts,
+                  std::shared_ptr<LedgerStore> ledger);
+
+    // Лимиты снятий и переводов; без лимитера операции не ограничены.
+    void setVelocityLimiter(std::shared_ptr<VelocityLimiter> limiter);
+
+    // Фильтр существующих карт: login и transferTo на заведомо
+    // несуществующий номер отклоняются без запроса к хранилищу.
+    void setCardFilter(std::shared_ptr<CardFilter> filter);
 
-    AtmController();
+    // Получатель сигналов о зафиксированных операциях (не владеет).
+    void setEvents(AtmEvents *events);
 
     static QString hashPin(const QString &pin);
 
@@ -28,31 +54,70 @@ public:
 
     double currentBalance() const;
 
-    bool withdraw(double amount);
-    bool deposit(double amount);
-    bool transferTo(const QString &targetCardNumber, double amount);
-
-    bool changePin(const QString &oldPin, const QString &newPin);
-
-    QList<TransactionRecord> lastTransactions(int limit = 10) const;
+    // Деньги и PIN: результат несёт причину отказа, а при успехе — строку
+    // журнала с остатком после операции (для чека без повторного чтения).
+    OperationResult withdraw(double amount);
+    OperationResult deposit(double amount);
+    OperationResult transferTo(const QString &targetCardNumber, double amount);
+
+    OperationResult changePin(const QString &oldPin, const QString &newPin);
+
+    // beforeId > 0 — следующая (более старая) страница истории.
+    QList<TransactionRecord> lastTransactions(int limit = 10, qint64 beforeId = 0) const;
+    // То же по столбцам, для TransactionHistoryModel.
+    bool lastTransactions(int limit, qint64 beforeId, HistoryBuffer &page) const;
+
+    OperationResult adminTransfer(const QString &fromCard,
+                                  const QString &toCard,
+                                  double amount);
+
+    // Сессии: один контроллер обслуживает много держателей карт сразу, в
+    // том числе из разных потоков (SqliteStore открывает каждому потоку
+    // своё соединение). Методы выше — одна сессия терминала без дескриптора.
+    using SessionHandle = SessionManager::Handle;
+
+    // 0 — неверный PIN, карта заблокирована или не найдена.
+    SessionHandle openSession(const QString &cardNumber, const QString &pin);
+    void closeSession(SessionHandle session);
+
+    double balance(SessionHandle session);
+    OperationResult withdraw(SessionHandle session, double amount);
+    OperationResult deposit(SessionHandle session, double amount);
+    OperationResult transferTo(SessionHandle session, const QString &targetCardNumber,
+                               double amount);
+    OperationResult changePin(SessionHandle session, const QString &oldPin,
+                              const QString &newPin);
+    QList<TransactionRecord> history(SessionHandle session,
+                                     int limit = 10,
+                                     qint64 beforeId = 0);
+
+    SessionManager &sessions() { return m_sessions; }
 
 private:
+    void publish(const QString &cardNumber, const TransactionRecord &entry);
+
+    std::optional<QString> sessionCard(SessionHandle session);
+
+    bool authenticate(const QString &cardNumber, const QString &pin);
+    OperationResult withdrawFor(const QString &cardNumber, double amount);
+    OperationResult depositFor(const QString &cardNumber, double amount);
+    OperationResult transferFor(const QString &sourceCard, const QString &targetCardNumber,
+                                double amount);
+    OperationResult changePinFor(const QString &cardNumber, const QString &oldPin,
+                                 const QString &newPin);
+    // Проставляет ошибку и общее время, отказ пишет в журнал событий.
+    static OperationResult &finish(OperationResult &result,
+                                   OperationError error,
+                                   const QElapsedTimer &total);
+    QList<TransactionRecord> historyFor(const QString &cardNumber, int limit, qint64 beforeId) const;
+
+    std::shared_ptr<AccountStore> m_accounts;
+    std::shared_ptr<LedgerStore> m_ledger;
+    std::shared_ptr<VelocityLimiter> m_limiter;
+    std::shared_ptr<CardFilter> m_cardFilter;
+    AtmEvents *m_events = nullptr;
     std::optional<QString> m_currentCardNumber;
-
-    double getBalanceFromDb(const QString &cardNumber) const;
-    bool updateBalanceInDb(const QString &cardNumber, double newBalance);
-
-    double getAtmCash() const;
-    bool updateAtmCash(double newCash);
-
-    bool recordTransactionFor(const QString &cardNumber,
-                              const QString &type,
-                              double amount,
-                              double balanceAfter);
-    bool recordTransaction(const QString &type,
-                           double amount,
-                           double balanceAfter);
+    SessionManager m_sessions;
 };
 
 #endif // ATMCONTROLLER_H
-
@@ -0,0 +1,7 @@
+#include "atmevents.h"
+
+AtmEvents::AtmEvents(QObject *parent)
+    : QObject(parent)
+{
+    qRegisterMetaType<TransactionRecord>();
+}
@@ -0,0 +1,24 @@
+#ifndef ATMEVENTS_H
+#define ATMEVENTS_H
+
+#include <QObject>
+#include <QString>
+
+#include "storage.h"
+
+// Уведомления о зафиксированных операциях AtmController. Сигналы
+// отправляются после COMMIT и несут записанную строку журнала и новый
+// баланс, так что экрану не нужно перечитывать БД.
+class AtmEvents : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit AtmEvents(QObject *parent = nullptr);
+
+signals:
+    void transactionCommitted(const QString &cardNumber, const TransactionRecord &record);
+    void balanceChanged(const QString &cardNumber, double balance);
+};
+
+#endif // ATMEVENTS_H
@@ -0,0 +1,322 @@
+#include "auditlog.h"
+
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QVariant>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QCryptographicHash>
+#include <QThread>
+
+#include <algorithm>
+#include <thread>
+
+#include "eventlog.h"
+
+namespace {
+const QString TIMESTAMP_FORMAT = "yyyy-MM-dd HH:mm:ss";
+const QString PLAN_CONNECTION = "audit_plan";
+const QString WORKER_CONNECTION = "audit_verify_%1";
+const int SEGMENTS_PER_THREAD = 4;
+const int MAX_LOGGED_BREAKS = 100;
+const char FIELD_SEPARATOR = '\x1f';
+
+bool openReadOnly(const QString &connectionName, const QString &path)
+{
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+    db.setDatabaseName(path);
+    db.setConnectOptions("QSQLITE_OPEN_READONLY;QSQLITE_BUSY_TIMEOUT=5000");
+
+    if (!db.open()) {
+        EventLog::error("db.open_failed", "audit connection", db.lastError().text());
+        return false;
+    }
+    return true;
+}
+
+// Поля записи подряд через разделитель, которого нет в тексте полей.
+void hashEntry(QCryptographicHash &hash,
+               const QByteArray &prevHash,
+               qint64 id,
+               const QString &ts,
+               const QString &action,
+               const QString &cardNumber,
+               const QString &details)
+{
+    hash.reset();
+    hash.addData(prevHash);
+    hash.addData(QByteArray(1, FIELD_SEPARATOR) + QByteArray::number(id));
+    for (const QString *field : { &ts, &action, &cardNumber, &details }) {
+        hash.addData(QByteArray(1, FIELD_SEPARATOR));
+        hash.addData(field->toUtf8());
+    }
+}
+}
+
+QByteArray AuditLog::genesisHash()
+{
+    return QByteArray(64, '0');
+}
+
+QByteArray AuditLog::entryHash(const QByteArray &prevHash,
+                               qint64 id,
+                               const QString &ts,
+                               const QString &action,
+                               const QString &cardNumber,
+                               const QString &details)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    hashEntry(hash, prevHash, id, ts, action, cardNumber, details);
+    return hash.result().toHex();
+}
+
+bool AuditLog::append(QSqlDatabase &db,
+                      const QString &action,
+                      const QString &cardNumber,
+                      const QString &details)
+{
+    QSqlQuery last(db);
+    if (!last.exec("SELECT id, hash FROM audit_log ORDER BY id DESC LIMIT 1")) {
+        EventLog::error("sql.failed", "SELECT audit_log", last.lastError().text());
+        return false;
+    }
+
+    qint64 id = 1;
+    QByteArray prevHash = genesisHash();
+    if (last.next()) {
+        id = last.value(0).toLongLong() + 1;
+        prevHash = last.value(1).toString().toLatin1();
+    }
+    last.finish();
+
+    QString ts = QDateTime::currentDateTimeUtc().toString(TIMESTAMP_FORMAT);
+
+    QSqlQuery ins(db);
+    ins.prepare("INSERT INTO audit_log (id, ts, action, card_number, details, prev_hash, hash) "
+                "VALUES (:id, :ts, :action, :card, :details, :prev, :hash)");
+    ins.bindValue(":id", id);
+    ins.bindValue(":ts", ts);
+    ins.bindValue(":action", action);
+    ins.bindValue(":card", cardNumber);
+    ins.bindValue(":details", details);
+    ins.bindValue(":prev", QString::fromLatin1(prevHash));
+    ins.bindValue(":hash", QString::fromLatin1(entryHash(prevHash, id, ts, action,
+                                                         cardNumber, details)));
+    if (!ins.exec()) {
+        EventLog::error("sql.failed", "INSERT audit_log", ins.lastError().text());
+        return false;
+    }
+    return true;
+}
+
+AuditVerifier::AuditVerifier(const QStringList &databasePaths, int threads, QObject *parent)
+    : QObject(parent),
+    m_databasePaths(databasePaths),
+    m_threads(threads > 0 ? threads : std::max(1, QThread::idealThreadCount()))
+{
+}
+
+void AuditVerifier::run()
+{
+    EventLog::Scope scope("audit_verify", QString());
+
+    QElapsedTimer timer;
+    timer.start();
+
+    m_summary = Summary();
+    m_summary.threads = m_threads;
+
+    bool ok = true;
+    for (const QString &path : m_databasePaths) {
+        if (!verifyFile(path))
+            ok = false;
+        ++m_summary.files;
+    }
+    m_summary.seconds = timer.nsecsElapsed() / 1e9;
+
+    EventLog::info("audit.verified", nullptr,
+                   QString("files=%1 entries=%2 broken=%3 first_broken=%4 seconds=%5")
+                       .arg(m_summary.files)
+                       .arg(m_summary.entries)
+                       .arg(m_summary.broken)
+                       .arg(m_summary.firstBrokenId)
+                       .arg(m_summary.seconds, 0, 'f', 1));
+
+    if (ok)
+        scope.succeed();
+    emit finished(ok, m_summary.entries, m_summary.broken, m_summary.firstBrokenId,
+                  m_summary.firstBrokenFile);
+}
+
+bool AuditVerifier::verifyFile(const QString &path)
+{
+    m_databasePath = path;
+
+    std::vector<Segment> segments;
+    if (!planSegments(segments))
+        return false;
+    m_summary.segments += int(segments.size());
+
+    std::vector<SegmentResult> results(segments.size());
+    std::atomic<int> next(0);
+    std::atomic<int> done(0);
+
+    int threads = std::min<int>(m_threads, int(segments.size()));
+    {
+        std::vector<std::thread> workers;
+        workers.reserve(threads);
+        for (int t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t]() {
+                worker(t, segments, results, next, done);
+            });
+        }
+        for (std::thread &w : workers)
+            w.join();
+    }
+
+    // Диапазоны идут по возрастанию id: первая поломка — в первом
+    // диапазоне, где она есть.
+    bool ok = true;
+    for (const SegmentResult &r : results) {
+        ok = ok && r.ok;
+        m_summary.entries += r.entries;
+        m_summary.broken += r.broken;
+        if (m_summary.firstBrokenId == 0 && r.firstBrokenId != 0) {
+            m_summary.firstBrokenId = r.firstBrokenId;
+            m_summary.firstBrokenFile = path;
+        }
+    }
+    return ok;
+}
+
+bool AuditVerifier::planSegments(std::vector<Segment> &segments)
+{
+    // id идут подряд с 1 (запись берёт MAX(id) + 1 под блокировкой
+    // записи), поэтому диапазоны режутся по id без прохода по таблице.
+    bool ok = openReadOnly(PLAN_CONNECTION, m_databasePath);
+
+    if (ok) {
+        QSqlDatabase db = QSqlDatabase::database(PLAN_CONNECTION);
+        QSqlQuery q(db);
+        if (!q.exec("SELECT IFNULL(MAX(id), 0) FROM audit_log") || !q.next()) {
+            EventLog::error("sql.failed", "SELECT MAX audit_log", q.lastError().text());
+            ok = false;
+        } else {
+            qint64 last = q.value(0).toLongLong();
+            q.finish();
+
+            int target = m_threads * SEGMENTS_PER_THREAD;
+            qint64 step = std::max<qint64>(1, (last + target - 1) / target);
+            for (qint64 from = 1; from <= last; from += step)
+                segments.push_back({ from, std::min(from + step, last + 1) });
+        }
+    }
+
+    QSqlDatabase::removeDatabase(PLAN_CONNECTION);
+    return ok;
+}
+
+void AuditVerifier::worker(int index,
+                           const std::vector<Segment> &segments,
+                           std::vector<SegmentResult> &results,
+                           std::atomic<int> &next,
+                           std::atomic<int> &done)
+{
+    const QString connectionName = WORKER_CONNECTION.arg(index);
+
+    if (!openReadOnly(connectionName, m_databasePath)) {
+        QSqlDatabase::removeDatabase(connectionName);
+        for (int i = next++; i < int(segments.size()); i = next++) {
+            results[i].ok = false;
+            emit progress(++done, int(segments.size()));
+        }
+        return;
+    }
+
+    for (int i = next++; i < int(segments.size()); i = next++) {
+        results[i].ok = verifySegment(connectionName, segments[i], results[i]);
+        emit progress(++done, int(segments.size()));
+    }
+
+    QSqlDatabase::database(connectionName, false).close();
+    QSqlDatabase::removeDatabase(connectionName);
+}
+
+bool AuditVerifier::verifySegment(const QString &connectionName,
+                                  const Segment &segment,
+                                  SegmentResult &result)
+{
+    QSqlDatabase db = QSqlDatabase::database(connectionName);
+
+    // Запись перед диапазоном читается тем же запросом: её хеш —
+    // ожидаемый prev_hash первой записи диапазона.
+    QSqlQuery q(db);
+    q.setForwardOnly(true);
+    q.prepare("SELECT id, ts, action, card_number, details, prev_hash, hash FROM audit_log "
+              "WHERE id >= :from AND id < :to ORDER BY id");
+    q.bindValue(":from", segment.from - 1);
+    q.bindValue(":to", segment.to);
+    if (!q.exec()) {
+        EventLog::error("sql.failed", "SELECT audit_log range", q.lastError().text());
+        return false;
+    }
+
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    QByteArray expectedPrev = AuditLog::genesisHash();
+    qint64 expectedId = segment.from;
+
+    auto markBroken = [&result, &db](qint64 id) {
+        if (result.broken < MAX_LOGGED_BREAKS)
+            EventLog::warning("audit.broken", nullptr,
+                              QString("file=%1 id=%2").arg(db.databaseName()).arg(id));
+        if (result.firstBrokenId == 0)
+            result.firstBrokenId = id;
+        ++result.broken;
+    };
+
+    while (q.next()) {
+        qint64 id = q.value(0).toLongLong();
+        QByteArray storedHash = q.value(6).toString().toLatin1();
+
+        if (id < segment.from) {
+            expectedPrev = storedHash;
+            continue;
+        }
+
+        QByteArray prevHash = q.value(5).toString().toLatin1();
+        hashEntry(hash, prevHash, id,
+                  q.value(1).toString(), q.value(2).toString(),
+                  q.value(3).toString(), q.value(4).toString());
+
+        // Пропуск id — удалённая запись; prev_hash не тот — подменена
+        // предыдущая; хеш не сходится — подменена сама запись.
+        if (id != expectedId || prevHash != expectedPrev
+            || hash.result().toHex() != storedHash)
+            markBroken(id);
+
+        expectedPrev = storedHash;
+        expectedId = id + 1;
+        ++result.entries;
+    }
+
+    // Записи в конце диапазона пропали.
+    if (expectedId != segment.to)
+        markBroken(expectedId);
+
+    bool ok = q.lastError().type() == QSqlError::NoError;
+    if (!ok)
+        EventLog::error("sql.failed", "SELECT audit_log rows", q.lastError().text());
+    return ok;
+}
+
+void AuditVerifier::printSummary(QTextStream &out, const Summary &s)
+{
+    out << QString("threads       %1\n").arg(s.threads)
+        << QString("files         %1\n").arg(s.files)
+        << QString("segments      %1\n").arg(s.segments)
+        << QString("entries       %1\n").arg(s.entries)
+        << QString("seconds       %1\n").arg(s.seconds, 0, 'f', 2)
+        << QString("entries/s     %1\n").arg(s.seconds > 0 ? s.entries / s.seconds : 0.0, 0, 'f', 0)
+        << QString("broken        %1\n").arg(s.broken)
+        << QString("first_broken  %1 %2\n").arg(s.firstBrokenId).arg(s.firstBrokenFile);
+}
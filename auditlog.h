@@ -0,0 +1,109 @@
+#ifndef AUDITLOG_H
+#define AUDITLOG_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QSqlDatabase>
+#include <QTextStream>
+
+#include <atomic>
+#include <vector>
+
+// Журнал действий администратора (audit_log). Только дописывается: UPDATE
+// и DELETE запрещены триггерами. Каждая запись несёт SHA-256 от хеша
+// предыдущей записи и своих полей, поэтому правку или удаление записи в
+// обход приложения выдаёт первая же несошедшаяся запись цепочки.
+class AuditLog
+{
+public:
+    // Пишет запись в уже открытой транзакции записи (BEGIN IMMEDIATE):
+    // запись фиксируется или откатывается вместе с самим изменением, и
+    // два писателя не возьмут один и тот же предыдущий хеш.
+    static bool append(QSqlDatabase &db,
+                       const QString &action,
+                       const QString &cardNumber,
+                       const QString &details);
+
+    // Хеш записи в hex: от хеша предыдущей записи, id и полей.
+    static QByteArray entryHash(const QByteArray &prevHash,
+                                qint64 id,
+                                const QString &ts,
+                                const QString &action,
+                                const QString &cardNumber,
+                                const QString &details);
+
+    static QByteArray genesisHash();
+};
+
+// Проверка цепочки audit_log. Диапазоны id раздаются потокам; каждый поток
+// читает свой диапазон через соединение только для чтения, начиная с
+// последней записи предыдущего диапазона — её хеш и есть ожидаемый
+// prev_hash первой записи. Так диапазоны проверяются независимо.
+//
+// С шардами у каждого файла БД своя цепочка: записи о счёте пишутся в шард
+// карты, о переводах — в шард 0. Проверяются цепочки всех файлов.
+class AuditVerifier : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Summary {
+        int threads = 0;
+        int files = 0;
+        int segments = 0;
+        qint64 entries = 0;
+        qint64 broken = 0;          // запись не сходится с цепочкой
+        qint64 firstBrokenId = 0;   // 0 — цепочка цела
+        QString firstBrokenFile;    // файл БД с firstBrokenId
+        double seconds = 0.0;
+    };
+
+    // databasePaths — основная БД и шарды; threads = 0 — по числу ядер.
+    explicit AuditVerifier(const QStringList &databasePaths,
+                           int threads = 0,
+                           QObject *parent = nullptr);
+
+    const Summary &summary() const { return m_summary; }
+
+    static void printSummary(QTextStream &out, const Summary &s);
+
+public slots:
+    void run();
+
+signals:
+    void progress(int segmentsDone, int segmentsTotal);
+    void finished(bool ok, qint64 entries, qint64 broken, qint64 firstBrokenId,
+                  const QString &firstBrokenFile);
+
+private:
+    struct Segment {
+        qint64 from;   // включительно
+        qint64 to;     // не включительно
+    };
+
+    struct SegmentResult {
+        bool ok = true;
+        qint64 entries = 0;
+        qint64 broken = 0;
+        qint64 firstBrokenId = 0;
+    };
+
+    bool verifyFile(const QString &path);
+    bool planSegments(std::vector<Segment> &segments);
+    void worker(int index,
+                const std::vector<Segment> &segments,
+                std::vector<SegmentResult> &results,
+                std::atomic<int> &next,
+                std::atomic<int> &done);
+    bool verifySegment(const QString &connectionName, const Segment &segment,
+                       SegmentResult &result);
+
+    QStringList m_databasePaths;
+    QString m_databasePath;   // проверяемый сейчас файл
+    int m_threads;
+    Summary m_summary;
+};
+
+#endif // AUDITLOG_H
@@ -0,0 +1,279 @@
+#include "cardfilter.h"
+
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QVariant>
+#include <QElapsedTimer>
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <random>
+
+#include "cardkey.h"
+#include "eventlog.h"
+
+namespace {
+const qint64 MIN_CAPACITY = 1024;
+
+quint64 mix(quint64 x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// 15 старших цифр номера + контрольная цифра Луна.
+quint64 withCheckDigit(quint64 body)
+{
+    int sum = 0;
+    bool doubled = true;
+    for (quint64 rest = body; rest > 0; rest /= 10, doubled = !doubled) {
+        int d = int(rest % 10);
+        if (doubled) {
+            d *= 2;
+            if (d > 9)
+                d -= 9;
+        }
+        sum += d;
+    }
+    return body * 10 + quint64((10 - sum % 10) % 10);
+}
+}
+
+void CardFilter::Bits::reset(qint64 expectedCards, double targetFpRate)
+{
+    capacity = std::max(expectedCards, MIN_CAPACITY);
+
+    const double ln2 = std::log(2.0);
+    double wanted = -double(capacity) * std::log(targetFpRate) / (ln2 * ln2);
+
+    quint64 bits = 64;
+    while (double(bits) < wanted)
+        bits <<= 1;
+
+    mask = bits - 1;
+    hashes = std::clamp(int(std::lround(double(bits) / capacity * ln2)), 1, 16);
+    words.assign(bits / 64, 0);
+}
+
+bool CardFilter::Bits::test(quint64 key) const
+{
+    quint64 h1 = mix(key);
+    quint64 h2 = mix(h1) | 1;
+    for (int i = 0; i < hashes; ++i) {
+        quint64 bit = (h1 + quint64(i) * h2) & mask;
+        if (!(words[bit >> 6] & (1ULL << (bit & 63))))
+            return false;
+    }
+    return true;
+}
+
+void CardFilter::Bits::set(quint64 key)
+{
+    quint64 h1 = mix(key);
+    quint64 h2 = mix(h1) | 1;
+    for (int i = 0; i < hashes; ++i) {
+        quint64 bit = (h1 + quint64(i) * h2) & mask;
+        words[bit >> 6] |= 1ULL << (bit & 63);
+    }
+}
+
+CardFilter::CardFilter(qint64 expectedCards, double targetFpRate)
+    : m_targetFpRate(std::clamp(targetFpRate, 1e-6, 0.5))
+{
+    m_bits.reset(expectedCards, m_targetFpRate);
+}
+
+bool CardFilter::luhnValid(quint64 key)
+{
+    return withCheckDigit(key / 10) == key;
+}
+
+bool CardFilter::luhnValid(const QString &cardNumber)
+{
+    quint64 key;
+    return cardKeyStrict(cardNumber, key) && luhnValid(key);
+}
+
+bool CardFilter::load(const QList<QSqlDatabase> &databases)
+{
+    qint64 total = 0;
+    for (const QSqlDatabase &db : databases) {
+        QSqlQuery count(db);
+        if (!count.exec("SELECT COUNT(*) FROM accounts WHERE closed_at IS NULL") || !count.next()) {
+            EventLog::error("sql.failed", "SELECT COUNT accounts", count.lastError().text());
+            return false;
+        }
+        total += count.value(0).toLongLong();
+    }
+
+    // Запас вдвое: фильтр не перестраивается на каждое добавление счёта.
+    Bits bits;
+    bits.reset(total * 2, m_targetFpRate);
+
+    qint64 inserted = 0;
+    qint64 nonLuhn = 0;
+
+    for (const QSqlDatabase &db : databases) {
+        QSqlQuery q(db);
+        q.setForwardOnly(true);
+        if (!q.exec("SELECT card_number FROM accounts WHERE closed_at IS NULL")) {
+            EventLog::error("sql.failed", "SELECT accounts", q.lastError().text());
+            return false;
+        }
+        // card_number — уже числовой ключ фильтра, разбирать строку не нужно.
+        while (q.next()) {
+            quint64 key = q.value(0).toULongLong();
+            bits.set(key);
+            ++inserted;
+            if (!luhnValid(key))
+                ++nonLuhn;
+        }
+    }
+
+    std::unique_lock<std::shared_mutex> lock(m_lock);
+    m_bits = std::move(bits);
+    m_inserted = inserted;
+    m_removed = 0;
+    m_nonLuhnCards = nonLuhn;
+    return true;
+}
+
+void CardFilter::add(const QString &cardNumber)
+{
+    quint64 key;
+    if (!cardKeyStrict(cardNumber, key))
+        return;
+
+    std::unique_lock<std::shared_mutex> lock(m_lock);
+    m_bits.set(key);
+    ++m_inserted;
+    if (!luhnValid(key))
+        ++m_nonLuhnCards;
+}
+
+void CardFilter::remove(const QString &cardNumber)
+{
+    quint64 key;
+    if (!cardKeyStrict(cardNumber, key))
+        return;
+
+    std::unique_lock<std::shared_mutex> lock(m_lock);
+    ++m_removed;
+    if (!luhnValid(key) && m_nonLuhnCards > 0)
+        --m_nonLuhnCards;
+}
+
+bool CardFilter::mayContain(const QString &cardNumber)
+{
+    m_lookups.fetch_add(1, std::memory_order_relaxed);
+
+    quint64 key;
+    if (!cardKeyStrict(cardNumber, key)) {
+        m_rejectedLuhn.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    std::shared_lock<std::shared_mutex> lock(m_lock);
+
+    if (m_nonLuhnCards == 0 && !luhnValid(key)) {
+        m_rejectedLuhn.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    if (!m_bits.test(key)) {
+        m_rejectedFilter.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+void CardFilter::reportFalsePositive()
+{
+    m_falsePositives.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool CardFilter::needsRebuild() const
+{
+    std::shared_lock<std::shared_mutex> lock(m_lock);
+    return m_removed * 4 > m_inserted || m_inserted > m_bits.capacity;
+}
+
+CardFilter::Stats CardFilter::stats() const
+{
+    Stats s;
+    {
+        std::shared_lock<std::shared_mutex> lock(m_lock);
+        s.cards = m_inserted - m_removed;
+        s.removed = m_removed;
+        s.bits = qint64(m_bits.mask + 1);
+        s.hashes = m_bits.hashes;
+        s.expectedFpRate = std::pow(1.0 - std::exp(-double(s.hashes) * m_inserted / s.bits),
+                                    s.hashes);
+    }
+
+    s.lookups = m_lookups.load(std::memory_order_relaxed);
+    s.rejectedLuhn = m_rejectedLuhn.load(std::memory_order_relaxed);
+    s.rejectedFilter = m_rejectedFilter.load(std::memory_order_relaxed);
+    s.falsePositives = m_falsePositives.load(std::memory_order_relaxed);
+
+    qint64 absent = s.rejectedFilter + s.falsePositives;
+    s.observedFpRate = absent > 0 ? double(s.falsePositives) / absent : 0.0;
+    return s;
+}
+
+int CardFilter::runBenchmark(QTextStream &out, int cards, qint64 lookups)
+{
+    CardFilter filter(cards);
+
+    // Существующие карты — чётные тела номеров, отсутствующие — нечётные:
+    // все номера проходят Луна и доходят до фильтра.
+    std::vector<QString> present;
+    std::vector<QString> absent;
+    present.reserve(cards);
+    absent.reserve(cards);
+    for (int i = 0; i < cards; ++i) {
+        present.push_back(QString::number(withCheckDigit(400000000000000ULL + 2ULL * i)));
+        absent.push_back(QString::number(withCheckDigit(400000000000001ULL + 2ULL * i)));
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    for (const QString &card : present)
+        filter.add(card);
+    double fillSeconds = timer.nsecsElapsed() / 1e9;
+
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int> cardDist(0, cards - 1);
+
+    qint64 presentMissed = 0;
+    qint64 absentPassed = 0;
+    timer.restart();
+    for (qint64 i = 0; i < lookups; ++i) {
+        if (i & 1) {
+            if (filter.mayContain(absent[cardDist(rng)]))
+                ++absentPassed;
+        } else if (!filter.mayContain(present[cardDist(rng)])) {
+            ++presentMissed;
+        }
+    }
+    qint64 lookupNs = timer.nsecsElapsed();
+
+    Stats s = filter.stats();
+    qint64 absentLookups = lookups / 2;
+
+    out << QString("cards         %1\n").arg(cards)
+        << QString("fill          %1 s\n").arg(fillSeconds, 0, 'f', 3)
+        << QString("bits          %1 (%2 на карту)\n").arg(s.bits).arg(double(s.bits) / cards, 0, 'f', 1)
+        << QString("hashes        %1\n").arg(s.hashes)
+        << QString("lookups       %1\n").arg(lookups)
+        << QString("ns/lookup     %1\n").arg(lookups > 0 ? double(lookupNs) / lookups : 0.0, 0, 'f', 1)
+        << QString("missed        %1\n").arg(presentMissed)
+        << QString("fp expected   %1\n").arg(s.expectedFpRate, 0, 'f', 5)
+        << QString("fp observed   %1\n").arg(absentLookups > 0 ? double(absentPassed) / absentLookups : 0.0,
+                                              0, 'f', 5);
+    out.flush();
+    return presentMissed == 0 ? 0 : 1;
+}
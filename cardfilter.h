@@ -0,0 +1,87 @@
+#ifndef CARDFILTER_H
+#define CARDFILTER_H
+
+#include <QString>
+#include <QList>
+#include <QSqlDatabase>
+#include <QTextStream>
+
+#include <atomic>
+#include <shared_mutex>
+#include <vector>
+
+// Фильтр существования карт перед обращением к БД: login и transferTo на
+// несуществующий номер отклоняются без запроса к SQLite.
+//
+// Сначала проверка Луна — пока в accounts нет номеров, которые её не
+// проходят (старые тестовые карты). Затем фильтр Блума по номеру карты,
+// хранящемуся числом: k бит из двух хешей. «Нет» — карты точно нет; «может
+// быть» — решает БД. Удалённая карта остаётся в битах ложным срабатыванием,
+// пока фильтр не перестроен (needsRebuild).
+class CardFilter
+{
+public:
+    struct Stats {
+        qint64 cards = 0;            // карт в фильтре
+        qint64 removed = 0;          // удалены, но ещё занимают биты
+        qint64 bits = 0;
+        int hashes = 0;
+        double expectedFpRate = 0.0; // по заполнению
+        qint64 lookups = 0;
+        qint64 rejectedLuhn = 0;
+        qint64 rejectedFilter = 0;
+        qint64 falsePositives = 0;   // фильтр пропустил, БД карту не нашла
+        double observedFpRate = 0.0; // от всех отсутствующих карт, дошедших до фильтра
+    };
+
+    explicit CardFilter(qint64 expectedCards = 1024, double targetFpRate = 0.01);
+
+    static bool luhnValid(const QString &cardNumber);
+
+    // Перестраивает фильтр по accounts всех шардов (см. ShardMap) с
+    // запасом на рост.
+    bool load(const QList<QSqlDatabase> &databases);
+
+    void add(const QString &cardNumber);
+    void remove(const QString &cardNumber);
+
+    // false — карты точно нет.
+    bool mayContain(const QString &cardNumber);
+    void reportFalsePositive();
+
+    // Удалённых или добавленных сверх расчёта стало много: пора load().
+    bool needsRebuild() const;
+
+    Stats stats() const;
+
+    static int runBenchmark(QTextStream &out, int cards, qint64 lookups);
+
+private:
+    struct Bits {
+        std::vector<quint64> words;
+        quint64 mask = 0;            // число бит - 1; число бит — степень двойки
+        int hashes = 1;
+        qint64 capacity = 0;
+
+        void reset(qint64 expectedCards, double targetFpRate);
+        bool test(quint64 key) const;
+        void set(quint64 key);
+    };
+
+    static bool luhnValid(quint64 key);
+
+    double m_targetFpRate;
+
+    mutable std::shared_mutex m_lock;
+    Bits m_bits;
+    qint64 m_inserted = 0;           // карт, оставивших биты
+    qint64 m_removed = 0;
+    qint64 m_nonLuhnCards = 0;
+
+    std::atomic<qint64> m_lookups{0};
+    std::atomic<qint64> m_rejectedLuhn{0};
+    std::atomic<qint64> m_rejectedFilter{0};
+    std::atomic<qint64> m_falsePositives{0};
+};
+
+#endif // CARDFILTER_H
@@ -0,0 +1,54 @@
+#ifndef CARDKEY_H
+#define CARDKEY_H
+
+#include <QString>
+#include <QVariant>
+
+// Номер карты в БД хранится числом (accounts.card_number — INTEGER PRIMARY
+// KEY, то есть сам rowid). 16 цифр помещаются в qint64; ведущие нули
+// восстанавливаются при чтении. Приложение работает со строкой, в число
+// номер переводится только при привязке к запросу.
+constexpr int CARD_NUMBER_DIGITS = 16;
+
+// -1 — не номер карты: такой ключ не найдёт ни одной строки.
+inline qint64 cardKey(const QString &cardNumber)
+{
+    if (cardNumber.isEmpty() || cardNumber.size() > CARD_NUMBER_DIGITS)
+        return -1;
+    for (QChar c : cardNumber) {
+        if (!c.isDigit())
+            return -1;
+    }
+    bool ok = false;
+    qint64 key = cardNumber.toLongLong(&ok);
+    return ok ? key : -1;
+}
+
+// Строго 16 цифр — номер, который вводит держатель карты. Ключ карты в
+// структурах в памяти (сессии, фильтр карт, лимиты, MemoryStore).
+inline bool cardKeyStrict(const QString &cardNumber, quint64 &key)
+{
+    if (cardNumber.size() != CARD_NUMBER_DIGITS)
+        return false;
+    qint64 k = cardKey(cardNumber);
+    if (k < 0)
+        return false;
+    key = quint64(k);
+    return true;
+}
+
+inline QString cardNumberFromKey(qint64 key)
+{
+    return QString::number(key).rightJustified(CARD_NUMBER_DIGITS, '0');
+}
+
+// Значение столбца card_number: число или, в архивных разделах, созданных
+// до перехода на числа, строка цифр.
+inline QString cardNumberFromStorage(const QVariant &value)
+{
+    bool ok = false;
+    qint64 key = value.toLongLong(&ok);
+    return ok ? cardNumberFromKey(key) : value.toString();
+}
+
+#endif // CARDKEY_H
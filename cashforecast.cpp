@@ -0,0 +1,221 @@
+#include "cashforecast.h"
+
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QVariant>
+#include <QSaveFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QMap>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+#include "eventlog.h"
+
+namespace {
+const QString TIMESTAMP_FORMAT = "yyyy-MM-dd HH:mm:ss";
+const int HOURS_PER_WEEK = 7 * 24;
+// 1970-01-01 — четверг: сдвиг, чтобы час недели 0 был полночью понедельника.
+const qint64 EPOCH_WEEK_OFFSET = 3 * 24;
+
+struct Accumulator {
+    CashForecast::Result result;
+    qint64 firstHour = -1;   // первый час с агрегатом в окне, часов от эпохи
+    std::array<qint64, HOURS_PER_WEEK> slotCents{};
+};
+
+qint64 hourIndex(const QDateTime &utc)
+{
+    return utc.toSecsSinceEpoch() / 3600;
+}
+
+QDateTime hourStart(qint64 index)
+{
+    return QDateTime::fromSecsSinceEpoch(index * 3600, Qt::UTC);
+}
+
+int weekSlot(qint64 index)
+{
+    return int((index + EPOCH_WEEK_OFFSET) % HOURS_PER_WEEK);
+}
+
+QString money(qint64 cents)
+{
+    return QString::number(cents / 100.0, 'f', 2);
+}
+
+void project(Accumulator &acc, qint64 nowHour, const QDateTime &now, const CashForecast::Options &options)
+{
+    CashForecast::Result &r = acc.result;
+    if (acc.firstHour < 0 || r.withdrawnCents <= 0)
+        return;
+
+    // Сколько раз каждый час недели встретился в окне истории.
+    std::array<int, HOURS_PER_WEEK> slotHours{};
+    for (qint64 h = acc.firstHour; h < nowHour; ++h)
+        ++slotHours[weekSlot(h)];
+    r.historyHours = int(nowHour - acc.firstHour);
+
+    double mean = r.historyHours > 0 ? double(r.withdrawnCents) / r.historyHours : 0.0;
+
+    // Текущий час уже идёт: остаток в cash_total отражает снятое с его
+    // начала, поэтому в первый шаг входит только оставшаяся доля.
+    double fraction = 1.0 - (now.toSecsSinceEpoch() - nowHour * 3600) / 3600.0;
+    double cash = double(r.cashCents);
+
+    for (qint64 h = nowHour; h < nowHour + options.horizonHours; ++h) {
+        int slot = weekSlot(h);
+        double expected = slotHours[slot] > 0 ? double(acc.slotCents[slot]) / slotHours[slot]
+                                              : mean;
+        double step = h == nowHour ? expected * fraction : expected;
+
+        if (step >= cash && step > 0) {
+            double start = h == nowHour ? 1.0 - fraction : 0.0;
+            double share = start + (cash / step) * (h == nowHour ? fraction : 1.0);
+            r.dryAt = hourStart(h).addSecs(qint64(share * 3600));
+            r.curve.append({ hourStart(h), qint64(step), 0 });
+            return;
+        }
+
+        cash -= step;
+        r.curve.append({ hourStart(h), qint64(step), qint64(cash) });
+    }
+}
+}
+
+bool CashForecast::compute(const QList<QSqlDatabase> &databases,
+                           const QDateTime &now,
+                           const Options &options,
+                           QList<Result> &results)
+{
+    results.clear();
+    if (databases.isEmpty())
+        return false;
+
+    const QDateTime nowUtc = now.toUTC();
+    const qint64 nowHour = hourIndex(nowUtc);
+    const qint64 fromHour = nowHour - qint64(options.historyWeeks) * HOURS_PER_WEEK;
+
+    QMap<int, Accumulator> devices;
+    {
+        QSqlQuery q(databases.first());
+        if (!q.exec("SELECT id, cash_total FROM atm_state ORDER BY id")) {
+            EventLog::error("sql.failed", "SELECT atm_state", q.lastError().text());
+            return false;
+        }
+        while (q.next()) {
+            Accumulator &acc = devices[q.value(0).toInt()];
+            acc.result.atmId = q.value(0).toInt();
+            acc.result.cashCents = std::llround(q.value(1).toDouble() * 100.0);
+            acc.result.computedAt = nowUtc;
+        }
+    }
+
+    // По первичному ключу (atm_id, hour): окно — не больше
+    // historyWeeks * 168 строк на банкомат в каждой БД.
+    for (const QSqlDatabase &db : databases) {
+        QSqlQuery q(db);
+        q.setForwardOnly(true);
+        q.prepare("SELECT atm_id, hour, withdrawn_cents, deposited_cents FROM cash_rollups"
+                  " WHERE hour >= :from AND hour < :to");
+        q.bindValue(":from", hourStart(fromHour).toString(TIMESTAMP_FORMAT));
+        q.bindValue(":to", hourStart(nowHour).toString(TIMESTAMP_FORMAT));
+        if (!q.exec()) {
+            EventLog::error("sql.failed", "SELECT cash_rollups", q.lastError().text());
+            return false;
+        }
+
+        while (q.next()) {
+            auto it = devices.find(q.value(0).toInt());
+            if (it == devices.end())
+                continue;
+
+            QDateTime ts = QDateTime::fromString(q.value(1).toString(), TIMESTAMP_FORMAT);
+            ts.setTimeSpec(Qt::UTC);
+            qint64 h = hourIndex(ts);
+            qint64 withdrawn = q.value(2).toLongLong();
+
+            Accumulator &acc = it.value();
+            acc.firstHour = acc.firstHour < 0 ? h : std::min(acc.firstHour, h);
+            acc.slotCents[weekSlot(h)] += withdrawn;
+            acc.result.withdrawnCents += withdrawn;
+            acc.result.depositedCents += q.value(3).toLongLong();
+        }
+    }
+
+    for (Accumulator &acc : devices) {
+        project(acc, nowHour, nowUtc, options);
+        results.append(acc.result);
+    }
+    return true;
+}
+
+bool CashForecast::exportCsv(const QString &path, const QList<Result> &results, QString &error)
+{
+    QDir().mkpath(QFileInfo(path).absolutePath());
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        error = file.errorString();
+        return false;
+    }
+
+    QTextStream out(&file);
+    out << "atm_id,hour_utc,expected_withdrawn,expected_cash,dry_at_utc\n";
+    for (const Result &r : results) {
+        QString dryAt = r.dryAt.isValid() ? r.dryAt.toString(TIMESTAMP_FORMAT) : QString();
+        for (const Point &p : r.curve) {
+            out << r.atmId << ',' << p.hour.toString(TIMESTAMP_FORMAT) << ','
+                << money(p.withdrawnCents) << ',' << money(p.cashCents) << ',' << dryAt << '\n';
+        }
+    }
+    out.flush();
+
+    if (!file.commit()) {
+        error = file.errorString();
+        return false;
+    }
+    return true;
+}
+
+QString CashForecast::defaultExportPath(const QString &databasePath)
+{
+    QFileInfo info(databasePath);
+    return info.absolutePath() + "/forecast/cash_"
+           + QDateTime::currentDateTime().toString("yyyyMMdd_HHmmss") + ".csv";
+}
+
+QString CashForecast::describe(const Result &result)
+{
+    if (result.historyHours == 0)
+        return QString("банкомат %1: нет истории снятий").arg(result.atmId);
+
+    double perDay = result.withdrawnCents / 100.0 / result.historyHours * 24;
+    QString prefix = QString("банкомат %1: снимают ~%2 в сутки, ")
+                         .arg(result.atmId)
+                         .arg(perDay, 0, 'f', 2);
+    if (!result.dryAt.isValid())
+        return prefix + "наличности хватит на весь горизонт прогноза";
+
+    double hours = result.computedAt.secsTo(result.dryAt) / 3600.0;
+    return prefix + QString("наличность кончится ~%1 (через %2 ч)")
+                        .arg(result.dryAt.toLocalTime().toString("dd.MM.yyyy HH:mm"))
+                        .arg(hours, 0, 'f', 1);
+}
+
+void CashForecast::printSummary(QTextStream &out, const QList<Result> &results)
+{
+    for (const Result &r : results) {
+        out << QString("atm         %1\n").arg(r.atmId)
+            << QString("cash        %1\n").arg(money(r.cashCents))
+            << QString("history     %1 h, withdrawn %2, deposited %3\n")
+                   .arg(r.historyHours)
+                   .arg(money(r.withdrawnCents))
+                   .arg(money(r.depositedCents))
+            << QString("dry at      %1\n")
+                   .arg(r.dryAt.isValid() ? r.dryAt.toString(TIMESTAMP_FORMAT) + " UTC"
+                                          : QString("-"));
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef CASHFORECAST_H
+#define CASHFORECAST_H
+
+#include <QString>
+#include <QList>
+#include <QDateTime>
+#include <QSqlDatabase>
+#include <QTextStream>
+
+// Прогноз, когда у банкомата кончится наличность. Считается только по
+// часовым агрегатам cash_rollups (их пополняет SqliteStore в транзакции
+// каждой операции), без прохода по transactions: за окно в несколько
+// недель это сотни строк на банкомат.
+//
+// Ожидаемое снятие за час — среднее по тому же часу недели за окно
+// истории; час, которого в окне ещё не было, берёт среднее за всё окно.
+// Взносы в кассету не поступают (deposit не меняет cash_total), поэтому
+// прогноз учитывает только снятия.
+class CashForecast
+{
+public:
+    struct Options {
+        int historyWeeks = 4;
+        int horizonHours = 14 * 24;
+    };
+
+    struct Point {
+        QDateTime hour;           // начало часа, UTC
+        qint64 withdrawnCents;    // ожидаемое снятие за час
+        qint64 cashCents;         // ожидаемый остаток в конце часа
+    };
+
+    struct Result {
+        int atmId = 0;
+        qint64 cashCents = 0;
+        QDateTime computedAt;     // UTC
+        int historyHours = 0;     // часов истории в окне
+        qint64 withdrawnCents = 0;     // снято за окно
+        qint64 depositedCents = 0;     // внесено за окно
+        QDateTime dryAt;          // invalid — не раньше горизонта или нет истории
+        QList<Point> curve;       // по часам до dryAt или до горизонта
+    };
+
+    // Банкоматы — строки atm_state первой БД; агрегаты суммируются по всем
+    // databases (взносы по картам шардов лежат в своих шардах).
+    static bool compute(const QList<QSqlDatabase> &databases,
+                        const QDateTime &now,
+                        const Options &options,
+                        QList<Result> &results);
+
+    // Одна строка на банкомат и час кривой прогноза.
+    static bool exportCsv(const QString &path, const QList<Result> &results, QString &error);
+    static QString defaultExportPath(const QString &databasePath);
+
+    // «кончится ~…» / «хватит дольше горизонта» для админки и консоли.
+    static QString describe(const Result &result);
+    static void printSummary(QTextStream &out, const QList<Result> &results);
+};
+
+#endif // CASHFORECAST_H
@@ -0,0 +1,481 @@
+#include "cdcfeed.h"
+
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QVariant>
+#include <QSaveFile>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QDir>
+#include <QTimer>
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+
+#include "cardkey.h"
+#include "eventlog.h"
+#include "transactiontype.h"
+
+namespace {
+const QString CONNECTION = "cdc_%1";
+const QString TIMESTAMP_FORMAT = "yyyy-MM-dd HH:mm:ss";
+const int ROWS_PER_SEGMENT = 10000;
+const int ROWS_PER_BATCH = 1000;
+// Серия COMMIT подряд — один проход.
+const int WAKE_DELAY_MS = 2;
+
+std::atomic<int> g_nextConnection{0};
+
+bool openConnection(const QString &connectionName, const QString &path)
+{
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+    db.setDatabaseName(path);
+    db.setConnectOptions("QSQLITE_OPEN_READONLY;QSQLITE_BUSY_TIMEOUT=5000");
+
+    if (!db.open()) {
+        EventLog::error("db.open_failed", "cdc connection", path + ": " + db.lastError().text());
+        return false;
+    }
+    return true;
+}
+
+QString segmentPath(const QString &directory, qint64 firstId)
+{
+    return QDir(directory).filePath(CdcFeed::segmentName(firstId));
+}
+}
+
+QString CdcFeed::directory(const QString &databasePath)
+{
+    QFileInfo info(databasePath);
+    return info.absolutePath() + "/cdc/" + info.completeBaseName();
+}
+
+QString CdcFeed::segmentName(qint64 firstId)
+{
+    return QString("feed_%1.csv").arg(firstId, 19, 10, QChar('0'));
+}
+
+QList<qint64> CdcFeed::segments(const QString &directory)
+{
+    QList<qint64> ids;
+    const QStringList names = QDir(directory).entryList({ "feed_*.csv" }, QDir::Files, QDir::Name);
+    for (const QString &name : names) {
+        bool ok = false;
+        qint64 id = name.mid(5, 19).toLongLong(&ok);
+        if (ok)
+            ids.append(id);
+    }
+    return ids;
+}
+
+QByteArray CdcFeed::formatRow(const Row &row)
+{
+    const TransactionRecord &rec = row.record;
+    return QString("%1,%2,%3,%4,%5,%6,%7\n")
+        .arg(rec.id)
+        .arg(rec.operationId)
+        .arg(row.cardNumber)
+        .arg(rec.timestamp.toString(TIMESTAMP_FORMAT))
+        .arg(QString::fromLatin1(transactionTypeInfo(rec.type).code))
+        .arg(rec.amount, 0, 'f', 2)
+        .arg(rec.balanceAfter, 0, 'f', 2)
+        .toUtf8();
+}
+
+bool CdcFeed::parseRow(const QByteArray &line, Row &row)
+{
+    const QList<QByteArray> fields = line.trimmed().split(',');
+    if (fields.size() != 7)
+        return false;
+
+    bool idOk = false, opOk = false, amountOk = false, balanceOk = false;
+    row.cardNumber = QString::fromLatin1(fields[2]);
+    row.record.id = fields[0].toLongLong(&idOk);
+    row.record.operationId = fields[1].toLongLong(&opOk);
+    row.record.timestamp = QDateTime::fromString(QString::fromLatin1(fields[3]), TIMESTAMP_FORMAT);
+    row.record.timestamp.setTimeSpec(Qt::UTC);
+    row.record.type = transactionTypeFromStorage(QString::fromLatin1(fields[4]));
+    row.record.amount = fields[5].toDouble(&amountOk);
+    row.record.balanceAfter = fields[6].toDouble(&balanceOk);
+    return idOk && opOk && amountOk && balanceOk && row.record.timestamp.isValid();
+}
+
+QString CdcFeed::cursorPath(const QString &directory, const QString &consumer)
+{
+    return QDir(directory).filePath("consumers/" + consumer + ".cursor");
+}
+
+bool CdcFeed::loadCursor(const QString &path, Cursor &cursor)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    const QList<QByteArray> fields = file.readAll().trimmed().split(' ');
+    if (fields.size() != 3)
+        return false;
+
+    bool ok[3] = {};
+    cursor.segment = fields[0].toLongLong(&ok[0]);
+    cursor.offset = fields[1].toLongLong(&ok[1]);
+    cursor.lastId = fields[2].toLongLong(&ok[2]);
+    return ok[0] && ok[1] && ok[2];
+}
+
+bool CdcFeed::saveCursor(const QString &path, const Cursor &cursor)
+{
+    QDir().mkpath(QFileInfo(path).absolutePath());
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        EventLog::error("cdc.cursor_failed", nullptr, path + ": " + file.errorString());
+        return false;
+    }
+    file.write(QString("%1 %2 %3\n")
+                   .arg(cursor.segment)
+                   .arg(cursor.offset)
+                   .arg(cursor.lastId)
+                   .toLatin1());
+    if (!file.commit()) {
+        EventLog::error("cdc.cursor_failed", nullptr, path + ": " + file.errorString());
+        return false;
+    }
+    return true;
+}
+
+CdcPublisher::CdcPublisher(const QString &databasePath, int intervalMs, QObject *parent)
+    : QObject(parent),
+    m_databasePath(databasePath),
+    m_directory(CdcFeed::directory(databasePath)),
+    m_connectionName(CONNECTION.arg(g_nextConnection++)),
+    m_intervalMs(intervalMs)
+{
+}
+
+CdcPublisher::~CdcPublisher()
+{
+    stop();
+}
+
+void CdcPublisher::start()
+{
+    if (!openConnection(m_connectionName, m_databasePath))
+        return;
+
+    if (!openFeed()) {
+        QSqlDatabase::database(m_connectionName, false).close();
+        QSqlDatabase::removeDatabase(m_connectionName);
+        return;
+    }
+
+    m_wakeTimer = new QTimer(this);
+    m_wakeTimer->setSingleShot(true);
+    connect(m_wakeTimer, &QTimer::timeout, this, [this]() { publishPending(); });
+
+    m_watcher = new QFileSystemWatcher(this);
+    connect(m_watcher, &QFileSystemWatcher::fileChanged, this, [this]() {
+        if (!m_wakeTimer->isActive())
+            m_wakeTimer->start(WAKE_DELAY_MS);
+    });
+    watchWal();
+
+    m_timer = new QTimer(this);
+    connect(m_timer, &QTimer::timeout, this, [this]() {
+        watchWal();
+        publishPending();
+    });
+    m_timer->start(m_intervalMs);
+
+    publishPending();
+}
+
+void CdcPublisher::stop()
+{
+    if (m_timer) {
+        m_timer->stop();
+        delete m_timer;
+        m_timer = nullptr;
+        delete m_wakeTimer;
+        m_wakeTimer = nullptr;
+        delete m_watcher;
+        m_watcher = nullptr;
+        publishPending();
+    }
+    m_segment.close();
+
+    if (QSqlDatabase::contains(m_connectionName)) {
+        QSqlDatabase::database(m_connectionName, false).close();
+        QSqlDatabase::removeDatabase(m_connectionName);
+    }
+}
+
+void CdcPublisher::watchWal()
+{
+    // -wal удаляется, когда закрывается последнее соединение с БД; таймер
+    // ставит наблюдение заново.
+    QString wal = m_databasePath + "-wal";
+    if (!m_watcher->files().contains(wal) && QFileInfo::exists(wal))
+        m_watcher->addPath(wal);
+}
+
+bool CdcPublisher::openFeed()
+{
+    QDir().mkpath(m_directory);
+
+    const QList<qint64> segments = CdcFeed::segments(m_directory);
+    if (segments.isEmpty()) {
+        // Новая лента начинается с текущего конца журнала.
+        QSqlQuery q(QSqlDatabase::database(m_connectionName));
+        if (!q.exec("SELECT COALESCE(MAX(id), 0) FROM transactions") || !q.next()) {
+            EventLog::error("sql.failed", "SELECT MAX(id) transactions", q.lastError().text());
+            return false;
+        }
+        m_lastId = q.value(0).toLongLong();
+        return openSegment(m_lastId + 1);
+    }
+
+    // Последний сегмент: id последней целой строки; недописанная при
+    // сбое строка отрезается.
+    qint64 first = segments.last();
+    QFile file(segmentPath(m_directory, first));
+    if (!file.open(QIODevice::ReadWrite)) {
+        EventLog::error("cdc.open_failed", nullptr, file.fileName() + ": " + file.errorString());
+        return false;
+    }
+
+    m_lastId = first - 1;
+    m_segmentRows = 0;
+    qint64 complete = 0;
+    while (true) {
+        QByteArray line = file.readLine();
+        if (line.isEmpty() || !line.endsWith('\n'))
+            break;
+        CdcFeed::Row row;
+        if (!CdcFeed::parseRow(line, row)) {
+            EventLog::error("cdc.corrupt", nullptr, file.fileName());
+            return false;
+        }
+        m_lastId = row.record.id;
+        ++m_segmentRows;
+        complete += line.size();
+    }
+    if (complete < file.size())
+        file.resize(complete);
+    file.close();
+
+    int rows = m_segmentRows;
+    if (!openSegment(first))
+        return false;
+    m_segmentRows = rows;
+    return true;
+}
+
+bool CdcPublisher::openSegment(qint64 firstId)
+{
+    m_segment.close();
+    m_segment.setFileName(segmentPath(m_directory, firstId));
+    if (!m_segment.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        EventLog::error("cdc.open_failed", nullptr,
+                        m_segment.fileName() + ": " + m_segment.errorString());
+        return false;
+    }
+    m_segmentRows = 0;
+    return true;
+}
+
+bool CdcPublisher::publishPending()
+{
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName, false);
+    if (!db.isOpen() || !m_segment.isOpen())
+        return false;
+
+    while (true) {
+        QSqlQuery q(db);
+        q.setForwardOnly(true);
+        q.prepare("SELECT id, operation_id, card_number, type, amount, balance_after, ts "
+                  "FROM transactions WHERE id > :last ORDER BY id LIMIT :n");
+        q.bindValue(":last", m_lastId);
+        q.bindValue(":n", ROWS_PER_BATCH);
+        if (!q.exec()) {
+            EventLog::error("sql.failed", "SELECT transactions cdc", q.lastError().text());
+            return false;
+        }
+
+        // Строки пишутся целиком, одной записью на порцию: читатель видит
+        // недописанной разве что последнюю строку.
+        QByteArray chunk;
+        qint64 chunkLastId = m_lastId;
+        int rows = 0;
+        auto flush = [&]() {
+            if (chunk.isEmpty())
+                return true;
+            if (m_segment.write(chunk) != chunk.size() || !m_segment.flush()) {
+                EventLog::error("cdc.write_failed", nullptr,
+                                m_segment.fileName() + ": " + m_segment.errorString());
+                return false;
+            }
+            chunk.clear();
+            m_lastId = chunkLastId;
+            return true;
+        };
+
+        while (q.next()) {
+            CdcFeed::Row row;
+            row.record.id = q.value(0).toLongLong();
+            row.record.operationId = q.value(1).toLongLong();
+            row.cardNumber = cardNumberFromStorage(q.value(2));
+            row.record.type = transactionTypeFromStorage(q.value(3));
+            row.record.amount = q.value(4).toDouble();
+            row.record.balanceAfter = q.value(5).toDouble();
+            row.record.timestamp = QDateTime::fromString(q.value(6).toString(), TIMESTAMP_FORMAT);
+            row.record.timestamp.setTimeSpec(Qt::UTC);
+
+            if (m_segmentRows >= ROWS_PER_SEGMENT) {
+                if (!flush() || !openSegment(row.record.id))
+                    return false;
+                prune();
+            }
+
+            chunk += CdcFeed::formatRow(row);
+            chunkLastId = row.record.id;
+            ++m_segmentRows;
+            ++rows;
+        }
+        q.finish();
+
+        if (!flush())
+            return false;
+
+        if (rows > 0)
+            emit published(m_lastId, rows);
+
+        if (rows < ROWS_PER_BATCH)
+            return true;
+    }
+}
+
+void CdcPublisher::prune()
+{
+    // Сегменты, которые прочитали все потребители. Пока потребителей нет,
+    // лента хранится целиком.
+    const QStringList cursors = QDir(m_directory + "/consumers")
+                                    .entryList({ "*.cursor" }, QDir::Files);
+    if (cursors.isEmpty())
+        return;
+
+    qint64 keepFrom = std::numeric_limits<qint64>::max();
+    for (const QString &name : cursors) {
+        CdcFeed::Cursor cursor;
+        if (!CdcFeed::loadCursor(m_directory + "/consumers/" + name, cursor))
+            return;
+        keepFrom = std::min(keepFrom, cursor.segment);
+    }
+
+    for (qint64 first : CdcFeed::segments(m_directory)) {
+        if (first >= keepFrom)
+            break;
+        QFile::remove(segmentPath(m_directory, first));
+    }
+}
+
+CdcReader::CdcReader(const QString &directory, const QString &consumer, QObject *parent)
+    : QObject(parent),
+    m_directory(directory),
+    m_cursorPath(CdcFeed::cursorPath(directory, consumer))
+{
+}
+
+bool CdcReader::open()
+{
+    if (!CdcFeed::loadCursor(m_cursorPath, m_committed)) {
+        const QList<qint64> segments = CdcFeed::segments(m_directory);
+        if (segments.isEmpty()) {
+            EventLog::error("cdc.no_feed", nullptr, m_directory);
+            return false;
+        }
+        m_committed = { segments.first(), 0, segments.first() - 1 };
+        // Курсор сразу на диске: с этого момента publisher не удалит
+        // непрочитанные сегменты.
+        if (!CdcFeed::saveCursor(m_cursorPath, m_committed))
+            return false;
+    }
+
+    m_position = m_committed;
+    watch();
+    return true;
+}
+
+bool CdcReader::read(int maxRows, QList<CdcFeed::Row> &rows)
+{
+    while (rows.size() < maxRows) {
+        QFile file(segmentPath(m_directory, m_position.segment));
+        if (!file.open(QIODevice::ReadOnly) || !file.seek(m_position.offset)) {
+            EventLog::error("cdc.open_failed", nullptr, file.fileName() + ": " + file.errorString());
+            return false;
+        }
+
+        while (rows.size() < maxRows) {
+            QByteArray line = file.readLine();
+            // Строку, которую publisher ещё дописывает, читаем в следующий раз.
+            if (line.isEmpty() || !line.endsWith('\n'))
+                break;
+
+            CdcFeed::Row row;
+            if (!CdcFeed::parseRow(line, row)) {
+                EventLog::error("cdc.corrupt", nullptr,
+                                file.fileName() + QString(" @%1").arg(m_position.offset));
+                return false;
+            }
+            m_position.offset += line.size();
+            if (row.record.id <= m_position.lastId)
+                continue;
+            m_position.lastId = row.record.id;
+            rows.append(row);
+        }
+        if (rows.size() >= maxRows)
+            break;
+
+        // Конец сегмента. Есть следующий — этот дописан до конца.
+        qint64 next = 0;
+        for (qint64 first : CdcFeed::segments(m_directory)) {
+            if (first > m_position.segment) {
+                next = first;
+                break;
+            }
+        }
+        if (next == 0)
+            break;
+        m_position.segment = next;
+        m_position.offset = 0;
+        watch();
+    }
+    return true;
+}
+
+bool CdcReader::commit()
+{
+    if (m_position.segment == m_committed.segment && m_position.offset == m_committed.offset)
+        return true;
+    if (!CdcFeed::saveCursor(m_cursorPath, m_position))
+        return false;
+    m_committed = m_position;
+    return true;
+}
+
+void CdcReader::watch()
+{
+    if (!m_watcher) {
+        m_watcher = new QFileSystemWatcher(this);
+        connect(m_watcher, &QFileSystemWatcher::fileChanged, this, &CdcReader::rowsAvailable);
+        connect(m_watcher, &QFileSystemWatcher::directoryChanged, this, &CdcReader::rowsAvailable);
+        m_watcher->addPath(m_directory);
+    }
+
+    const QStringList files = m_watcher->files();
+    if (!files.isEmpty())
+        m_watcher->removePaths(files);
+    m_watcher->addPath(segmentPath(m_directory, m_position.segment));
+}
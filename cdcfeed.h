@@ -0,0 +1,129 @@
+#ifndef CDCFEED_H
+#define CDCFEED_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include <QFile>
+
+#include "storage.h"
+
+class QFileSystemWatcher;
+class QTimer;
+
+// Лента изменений (CDC) журнала операций для внешних систем: антифрод,
+// бухгалтерия, SMS-уведомления. Зафиксированные строки transactions
+// дописываются по возрастанию id в сегменты cdc/<имя БД>/feed_<первый
+// id>.csv — по строке на операцию:
+//
+//   id,operation_id,card_number,ts,type,amount,balance_after
+//
+// ts — время UTC, как в transactions.
+// Писатель у каждого файла БД один, поэтому порядок id — порядок
+// фиксации. Потребители читают файлы (CdcReader) и не трогают БД; у
+// каждого свой курсор consumers/<имя>.cursor.
+class CdcFeed
+{
+public:
+    struct Row {
+        QString cardNumber;
+        TransactionRecord record;
+    };
+
+    // Позиция в ленте: сегмент, смещение в байтах и id последней строки.
+    struct Cursor {
+        qint64 segment = 0;
+        qint64 offset = 0;
+        qint64 lastId = 0;
+    };
+
+    static QString directory(const QString &databasePath);
+    static QString segmentName(qint64 firstId);
+    // Первые id сегментов по возрастанию.
+    static QList<qint64> segments(const QString &directory);
+
+    static QByteArray formatRow(const Row &row);
+    static bool parseRow(const QByteArray &line, Row &row);
+
+    static QString cursorPath(const QString &directory, const QString &consumer);
+    static bool loadCursor(const QString &path, Cursor &cursor);
+    static bool saveCursor(const QString &path, const Cursor &cursor);
+};
+
+// Переносит новые строки transactions в ленту. Работает в своём потоке на
+// своём соединении. Просыпается по изменению файла -wal базы — его меняет
+// каждый COMMIT любого писателя, в том числе администрирования и закрытия
+// дня, — и раз в intervalMs на случай, если уведомление потеряно. Чтение —
+// диапазон по первичному ключу от последнего перенесённого id.
+class CdcPublisher : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit CdcPublisher(const QString &databasePath,
+                          int intervalMs = 1000,
+                          QObject *parent = nullptr);
+    ~CdcPublisher() override;
+
+    bool publishPending();
+
+public slots:
+    void start();
+    void stop();
+
+signals:
+    void published(qint64 lastId, int rows);
+
+private:
+    bool openFeed();
+    bool openSegment(qint64 firstId);
+    void prune();
+    void watchWal();
+
+    QString m_databasePath;
+    QString m_directory;
+    QString m_connectionName;
+    int m_intervalMs;
+
+    QFile m_segment;
+    int m_segmentRows = 0;
+    qint64 m_lastId = 0;
+
+    QTimer *m_timer = nullptr;
+    QTimer *m_wakeTimer = nullptr;
+    QFileSystemWatcher *m_watcher = nullptr;
+};
+
+// Потребитель ленты. read отдаёт до maxRows строк после курсора и
+// запоминает позицию; commit сохраняет её в файл курсора — после сбоя
+// чтение продолжится с последнего commit (доставка «хотя бы один раз»).
+// rowsAvailable — лента дописана (QFileSystemWatcher), опрашивать не нужно.
+class CdcReader : public QObject
+{
+    Q_OBJECT
+
+public:
+    CdcReader(const QString &directory, const QString &consumer, QObject *parent = nullptr);
+
+    // Новый потребитель начинает с самого старого сегмента.
+    bool open();
+    bool read(int maxRows, QList<CdcFeed::Row> &rows);
+    bool commit();
+
+    qint64 lastId() const { return m_position.lastId; }
+
+signals:
+    void rowsAvailable();
+
+private:
+    void watch();
+
+    QString m_directory;
+    QString m_cursorPath;
+    CdcFeed::Cursor m_committed;
+    CdcFeed::Cursor m_position;
+    QFileSystemWatcher *m_watcher = nullptr;
+};
+
+#endif // CDCFEED_H
@@ -0,0 +1,311 @@
+#include "databasebackup.h"
+
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QVariant>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QDateTime>
+#include <QList>
+#include <QRegularExpression>
+#include <QThread>
+
+#include <algorithm>
+#include <limits>
+
+#include "eventlog.h"
+
+namespace {
+const QString CONNECTION = "backup_%1";
+const QString PART_SUFFIX = ".part";
+
+std::atomic<int> g_nextConnection{0};
+
+struct SchemaObject {
+    QString type;
+    QString name;
+    QString sql;
+};
+
+QString quoted(const QString &name)
+{
+    return "\"" + QString(name).replace("\"", "\"\"") + "\"";
+}
+
+// CREATE ... имя -> CREATE ... backup.имя. Таблицы в ON и FROM остаются
+// без схемы: индексы, триггеры и представления ссылаются на таблицы своей БД.
+QString inBackupSchema(const QString &sql)
+{
+    static const QRegularExpression head(
+        "^(CREATE\\s+(?:UNIQUE\\s+)?(?:TABLE|INDEX|VIEW|TRIGGER)\\s+)",
+        QRegularExpression::CaseInsensitiveOption);
+    return QString(sql).replace(head, "\\1backup.");
+}
+}
+
+DatabaseBackup::DatabaseBackup(const QString &databasePath,
+                               const QString &outputPath,
+                               int rowsPerStep,
+                               int pauseMs,
+                               QObject *parent)
+    : QObject(parent),
+    m_databasePath(databasePath),
+    m_outputPath(outputPath),
+    m_rowsPerStep(std::max(1, rowsPerStep)),
+    m_pauseMs(std::max(0, pauseMs))
+{
+}
+
+QString DatabaseBackup::defaultPath(const QString &databasePath)
+{
+    QFileInfo info(databasePath);
+    return info.absolutePath() + "/backup/" + info.completeBaseName() + "_"
+           + QDateTime::currentDateTime().toString("yyyyMMdd_HHmmss") + ".db";
+}
+
+void DatabaseBackup::run()
+{
+    EventLog::Scope scope("backup", QString());
+
+    m_summary = Summary();
+    m_timer.start();
+
+    const QString connectionName = CONNECTION.arg(g_nextConnection++);
+    const QString partPath = m_outputPath + PART_SUFFIX;
+    bool ok = false;
+
+    QDir().mkpath(QFileInfo(m_outputPath).absolutePath());
+    QFile::remove(partPath);
+
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+        db.setDatabaseName(m_databasePath);
+        db.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000");
+
+        if (!db.open()) {
+            EventLog::error("db.open_failed", "backup connection", db.lastError().text());
+        } else {
+            ok = copy(db, partPath);
+            db.close();
+        }
+    }
+    QSqlDatabase::removeDatabase(connectionName);
+
+    if (ok) {
+        QFile::remove(m_outputPath);
+        ok = QFile::rename(partPath, m_outputPath);
+        if (!ok)
+            EventLog::error("backup.rename_failed", nullptr, m_outputPath);
+    }
+    if (!ok)
+        QFile::remove(partPath);
+
+    m_summary.seconds = m_timer.nsecsElapsed() / 1e9;
+
+    if (ok) {
+        m_summary.path = m_outputPath;
+        m_summary.bytes = QFileInfo(m_outputPath).size();
+        EventLog::info("backup.done", nullptr,
+                       QString("rows=%1 bytes=%2 steps=%3 seconds=%4")
+                           .arg(m_summary.rows)
+                           .arg(m_summary.bytes)
+                           .arg(m_summary.steps)
+                           .arg(m_summary.seconds, 0, 'f', 1));
+        scope.succeed();
+    }
+    emit finished(ok, m_summary.rows, m_summary.path);
+}
+
+bool DatabaseBackup::copy(QSqlDatabase &db, const QString &partPath)
+{
+    QSqlQuery q(db);
+    q.prepare("ATTACH DATABASE :path AS backup");
+    q.bindValue(":path", partPath);
+    if (!q.exec()) {
+        EventLog::error("backup.attach_failed", "ATTACH", q.lastError().text());
+        return false;
+    }
+
+    // Журнал копии не нужен: недописанный файл всё равно удаляется.
+    bool ok = q.exec("PRAGMA main.page_size") && q.next();
+    if (ok) {
+        m_pageSize = q.value(0).toLongLong();
+        q.finish();
+        ok = q.exec(QString("PRAGMA backup.page_size = %1").arg(m_pageSize))
+             && q.exec("PRAGMA backup.journal_mode = OFF")
+             && q.exec("PRAGMA backup.synchronous = OFF");
+    }
+    if (!ok) {
+        EventLog::error("sql.failed", "PRAGMA backup", q.lastError().text());
+        q.exec("DETACH DATABASE backup");
+        return false;
+    }
+
+    // Первое чтение после BEGIN фиксирует снимок: всё ниже видит БД на
+    // этот момент, сколько бы ни длилась копия.
+    if (!db.transaction()) {
+        EventLog::error("tx.begin_failed", "BEGIN backup", db.lastError().text());
+        q.exec("DETACH DATABASE backup");
+        return false;
+    }
+
+    QList<SchemaObject> objects;
+    int userVersion = 0;
+    qint64 totalRows = 0;
+
+    ok = q.exec("SELECT type, name, sql FROM main.sqlite_master "
+                "WHERE sql IS NOT NULL AND name NOT LIKE 'sqlite_%' "
+                "ORDER BY CASE type WHEN 'table' THEN 0 ELSE 1 END, rowid");
+    while (ok && q.next())
+        objects.append({ q.value(0).toString(), q.value(1).toString(), q.value(2).toString() });
+
+    if (ok) {
+        ok = q.exec("PRAGMA main.user_version") && q.next();
+        if (ok)
+            userVersion = q.value(0).toInt();
+    }
+
+    for (const SchemaObject &object : objects) {
+        if (!ok || object.type != "table")
+            continue;
+        ok = q.exec("SELECT COUNT(*) FROM main." + quoted(object.name)) && q.next();
+        if (ok)
+            totalRows += q.value(0).toLongLong();
+    }
+    q.finish();
+
+    if (!ok)
+        EventLog::error("sql.failed", "SELECT backup schema", q.lastError().text());
+
+    // Таблицы, затем данные, затем индексы, представления и триггеры:
+    // индекс, построенный по готовой таблице, меньше и пишется быстрее.
+    for (const SchemaObject &object : objects) {
+        if (!ok || object.type != "table")
+            continue;
+        ok = q.exec(inBackupSchema(object.sql));
+        if (!ok)
+            EventLog::error("sql.failed", "CREATE backup table", q.lastError().text());
+        else
+            ++m_summary.tables;
+    }
+
+    for (const SchemaObject &object : objects) {
+        if (ok && object.type == "table")
+            ok = copyTable(db, object.name, totalRows);
+    }
+
+    for (const SchemaObject &object : objects) {
+        if (!ok || m_cancelled || object.type == "table")
+            continue;
+        ok = q.exec(inBackupSchema(object.sql));
+        if (!ok)
+            EventLog::error("sql.failed", "CREATE backup object", q.lastError().text());
+    }
+
+    // Счётчики AUTOINCREMENT переносятся как есть: в основной БД они могут
+    // быть больше MAX(id), если строки ушли в архив.
+    if (ok && !m_cancelled) {
+        ok = q.exec("DELETE FROM backup.sqlite_sequence")
+             && q.exec("INSERT INTO backup.sqlite_sequence (name, seq) "
+                       "SELECT name, seq FROM main.sqlite_sequence")
+             && q.exec(QString("PRAGMA backup.user_version = %1").arg(userVersion));
+        if (!ok)
+            EventLog::error("sql.failed", "COPY backup sqlite_sequence", q.lastError().text());
+    }
+
+    if (!ok || m_cancelled) {
+        db.rollback();
+        q.exec("DETACH DATABASE backup");
+        return false;
+    }
+
+    if (!db.commit()) {
+        EventLog::error("tx.commit_failed", "COMMIT backup", db.lastError().text());
+        db.rollback();
+        q.exec("DETACH DATABASE backup");
+        return false;
+    }
+
+    // Копия открывается тем же приложением, что и основная БД, — в WAL.
+    if (!q.exec("PRAGMA backup.journal_mode = WAL"))
+        EventLog::warning("backup.wal_failed", "PRAGMA journal_mode", q.lastError().text());
+    q.finish();
+
+    reportProgress(db, totalRows, true);
+    q.exec("DETACH DATABASE backup");
+    return true;
+}
+
+bool DatabaseBackup::copyTable(QSqlDatabase &db, const QString &table, qint64 totalRows)
+{
+    const QString name = quoted(table);
+    qint64 after = std::numeric_limits<qint64>::min();
+
+    QSqlQuery step(db);
+    while (!m_cancelled) {
+        step.prepare("SELECT MAX(rowid), COUNT(*) FROM ("
+                     " SELECT rowid FROM main." + name + " WHERE rowid > :after"
+                     " ORDER BY rowid LIMIT :n)");
+        step.bindValue(":after", after);
+        step.bindValue(":n", m_rowsPerStep);
+
+        if (!step.exec() || !step.next()) {
+            EventLog::error("sql.failed", "SELECT backup batch", step.lastError().text());
+            return false;
+        }
+        if (step.value(0).isNull())
+            return true;
+
+        qint64 last = step.value(0).toLongLong();
+        qint64 count = step.value(1).toLongLong();
+        step.finish();
+
+        step.prepare("INSERT INTO backup." + name + " SELECT * FROM main." + name
+                     + " WHERE rowid > :after AND rowid <= :last ORDER BY rowid");
+        step.bindValue(":after", after);
+        step.bindValue(":last", last);
+
+        if (!step.exec()) {
+            EventLog::error("sql.failed", "INSERT backup batch", step.lastError().text());
+            return false;
+        }
+
+        after = last;
+        m_summary.rows += count;
+        ++m_summary.steps;
+        reportProgress(db, totalRows);
+
+        // Пауза между порциями отдаёт диск терминалам.
+        if (m_pauseMs > 0)
+            QThread::msleep(m_pauseMs);
+    }
+    return false;
+}
+
+void DatabaseBackup::reportProgress(QSqlDatabase &db, qint64 totalRows, bool done)
+{
+    QSqlQuery q(db);
+    if (q.exec("PRAGMA backup.page_count") && q.next())
+        m_summary.bytes = q.value(0).toLongLong() * m_pageSize;
+
+    double seconds = m_timer.nsecsElapsed() / 1e9;
+    qint64 bytesPerSecond = seconds > 0 ? qint64(m_summary.bytes / seconds) : 0;
+    // 100% — только после фиксации: индексы строятся уже после строк.
+    int percent = done ? 100
+                       : totalRows > 0 ? int(std::min<qint64>(99, m_summary.rows * 100 / totalRows))
+                                       : 0;
+    emit progress(percent, m_summary.rows, bytesPerSecond);
+}
+
+void DatabaseBackup::printSummary(QTextStream &out, const Summary &s)
+{
+    double mb = s.bytes / (1024.0 * 1024.0);
+    out << QString("tables   %1\n").arg(s.tables)
+        << QString("rows     %1\n").arg(s.rows)
+        << QString("steps    %1\n").arg(s.steps)
+        << QString("size_mb  %1\n").arg(mb, 0, 'f', 1)
+        << QString("seconds  %1\n").arg(s.seconds, 0, 'f', 2)
+        << QString("mb/s     %1\n").arg(s.seconds > 0 ? mb / s.seconds : 0.0, 0, 'f', 1)
+        << QString("path     %1\n").arg(s.path);
+}
@@ -0,0 +1,70 @@
+#ifndef DATABASEBACKUP_H
+#define DATABASEBACKUP_H
+
+#include <QObject>
+#include <QString>
+#include <QSqlDatabase>
+#include <QElapsedTimer>
+#include <QTextStream>
+
+#include <atomic>
+
+// Резервная копия БД без остановки терминалов. Копия — согласованный
+// снимок: одна читающая транзакция на своём соединении держит снимок WAL
+// от первого шага до последнего, писатели при этом не ждут. Копия пишется
+// в подключённый (ATTACH) файл порциями по rowid, между порциями пауза;
+// индексы строятся в конце. Файл появляется под итоговым именем только
+// целиком.
+class DatabaseBackup : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Summary {
+        int tables = 0;
+        int steps = 0;
+        qint64 rows = 0;
+        qint64 bytes = 0;       // размер копии
+        double seconds = 0.0;
+        QString path;           // пусто — копия не создана
+    };
+
+    explicit DatabaseBackup(const QString &databasePath,
+                            const QString &outputPath,
+                            int rowsPerStep = 2000,
+                            int pauseMs = 20,
+                            QObject *parent = nullptr);
+
+    // Можно вызывать из любого потока; недописанный файл удаляется.
+    void cancel() { m_cancelled = true; }
+
+    const Summary &summary() const { return m_summary; }
+
+    // backup/atm_YYYYMMDD_HHMMSS.db рядом с БД.
+    static QString defaultPath(const QString &databasePath);
+
+    static void printSummary(QTextStream &out, const Summary &s);
+
+public slots:
+    void run();
+
+signals:
+    void progress(int percent, qint64 rows, qint64 bytesPerSecond);
+    void finished(bool ok, qint64 rows, const QString &path);
+
+private:
+    bool copy(QSqlDatabase &db, const QString &partPath);
+    bool copyTable(QSqlDatabase &db, const QString &table, qint64 totalRows);
+    void reportProgress(QSqlDatabase &db, qint64 totalRows, bool done = false);
+
+    QString m_databasePath;
+    QString m_outputPath;
+    int m_rowsPerStep;
+    int m_pauseMs;
+    std::atomic<bool> m_cancelled{false};
+    Summary m_summary;
+    QElapsedTimer m_timer;
+    qint64 m_pageSize = 0;
+};
+
+#endif // DATABASEBACKUP_H
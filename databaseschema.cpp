@@ -0,0 +1,463 @@
+#include "databaseschema.h"
+
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QStringList>
+#include <QList>
+#include <QVariant>
+
+#include "atmcontroller.h"
+#include "cardkey.h"
+#include "eventlog.h"
+
+namespace {
+struct Migration {
+    int version;
+    QStringList statements;
+    // Прагмы, которые SQLite не позволяет выполнять внутри транзакции.
+    QStringList pragmas = {};
+};
+
+// Миграции строго по возрастанию версии. Уже выпущенные шаги не меняются,
+// любое изменение схемы — новый шаг в конце списка.
+const QList<Migration> &migrations()
+{
+    static const QList<Migration> list = {
+        { 1, {
+              // Версия 1 повторяет исходную схему; IF NOT EXISTS / OR IGNORE
+              // позволяют принять БД, созданные до появления user_version.
+              "CREATE TABLE IF NOT EXISTS accounts ("
+              " card_number     TEXT PRIMARY KEY,"
+              " pin             TEXT NOT NULL,"
+              " balance         REAL NOT NULL,"
+              " failed_attempts INTEGER NOT NULL DEFAULT 0,"
+              " locked_until    DATETIME NULL"
+              ")",
+
+              "CREATE TABLE IF NOT EXISTS transactions ("
+              " id            INTEGER PRIMARY KEY AUTOINCREMENT,"
+              " card_number   TEXT NOT NULL,"
+              " type          TEXT NOT NULL,"
+              " amount        REAL NOT NULL,"
+              " balance_after REAL NOT NULL,"
+              " ts            DATETIME DEFAULT CURRENT_TIMESTAMP"
+              ")",
+
+              "CREATE TABLE IF NOT EXISTS atm_state ("
+              " id         INTEGER PRIMARY KEY CHECK (id = 1),"
+              " cash_total REAL NOT NULL"
+              ")",
+
+              "INSERT OR IGNORE INTO atm_state (id, cash_total) "
+              "VALUES (1, 100000.0)",
+          } },
+        { 2, {
+              "CREATE INDEX IF NOT EXISTS idx_transactions_card_ts "
+              "ON transactions (card_number, ts)",
+
+              "CREATE INDEX IF NOT EXISTS idx_transactions_ts "
+              "ON transactions (ts)",
+
+              // Каталог помесячных архивов: month = 'YYYY-MM'.
+              "CREATE TABLE IF NOT EXISTS archive_partitions ("
+              " month     TEXT PRIMARY KEY,"
+              " path      TEXT NOT NULL,"
+              " row_count INTEGER NOT NULL DEFAULT 0"
+              ")",
+          },
+          // WAL: архиватор и терминалы не блокируют друг друга на чтении.
+          { "PRAGMA journal_mode = WAL" } },
+        { 3, {
+              // Лимиты по классам карт: класс — префикс номера, выбирается
+              // самый длинный подходящий. Суммы в рублях, NULL — без лимита.
+              "CREATE TABLE IF NOT EXISTS card_limits ("
+              " card_prefix     TEXT PRIMARY KEY,"
+              " withdraw_hourly REAL NULL,"
+              " withdraw_daily  REAL NULL,"
+              " transfer_hourly REAL NULL,"
+              " transfer_daily  REAL NULL"
+              ")",
+
+              "INSERT OR IGNORE INTO card_limits VALUES ('', 30000, 100000, 50000, 200000)",
+          } },
+        { 4, {
+              // transactions.type: строка -> код TransactionType. SQLite не
+              // меняет тип столбца, поэтому таблица пересобирается. Счётчик
+              // AUTOINCREMENT переносится: id строк, уже ушедших в архив,
+              // не должны выдаваться повторно.
+              "CREATE TABLE transactions_v4 ("
+              " id            INTEGER PRIMARY KEY AUTOINCREMENT,"
+              " card_number   TEXT NOT NULL,"
+              " type          INTEGER NOT NULL,"
+              " amount        REAL NOT NULL,"
+              " balance_after REAL NOT NULL,"
+              " ts            DATETIME DEFAULT CURRENT_TIMESTAMP"
+              ")",
+
+              "INSERT INTO transactions_v4 (id, card_number, type, amount, balance_after, ts) "
+              "SELECT id, card_number,"
+              " CASE type"
+              "  WHEN 'withdraw'           THEN 1"
+              "  WHEN 'deposit'            THEN 2"
+              "  WHEN 'transfer_out'       THEN 3"
+              "  WHEN 'transfer_in'        THEN 4"
+              "  WHEN 'pin_change'         THEN 5"
+              "  WHEN 'admin_transfer_out' THEN 6"
+              "  WHEN 'admin_transfer_in'  THEN 7"
+              "  ELSE 0"
+              " END,"
+              " amount, balance_after, ts "
+              "FROM transactions",
+
+              "INSERT INTO sqlite_sequence (name, seq) "
+              "SELECT 'transactions_v4', 0 WHERE NOT EXISTS "
+              "(SELECT 1 FROM sqlite_sequence WHERE name = 'transactions_v4')",
+
+              "UPDATE sqlite_sequence SET seq = MAX(seq, "
+              "(SELECT IFNULL(MAX(seq), 0) FROM sqlite_sequence WHERE name = 'transactions')) "
+              "WHERE name = 'transactions_v4'",
+
+              "DROP TABLE transactions",
+
+              "ALTER TABLE transactions_v4 RENAME TO transactions",
+
+              "CREATE INDEX idx_transactions_card_ts ON transactions (card_number, ts)",
+
+              "CREATE INDEX idx_transactions_ts ON transactions (ts)",
+          } },
+        { 5, {
+              // Журнал только дописывается. Операция — строка ledger_operations,
+              // её ноги в transactions связаны operation_id. Существующие
+              // переводы писались двумя строками подряд в одной транзакции:
+              // зачисление, идущее сразу за списанием той же суммы, — вторая
+              // нога той же операции.
+              "CREATE TABLE ledger_operations ("
+              " id   INTEGER PRIMARY KEY AUTOINCREMENT,"
+              " type INTEGER NOT NULL,"
+              " ts   DATETIME"
+              ")",
+
+              "ALTER TABLE transactions ADD COLUMN operation_id INTEGER",
+
+              "UPDATE transactions SET operation_id = id - 1 "
+              "WHERE type IN (4, 7) AND EXISTS ("
+              " SELECT 1 FROM transactions p"
+              " WHERE p.id = transactions.id - 1"
+              " AND p.type = transactions.type - 1"
+              " AND p.amount = transactions.amount)",
+
+              "UPDATE transactions SET operation_id = id WHERE operation_id IS NULL",
+
+              "INSERT INTO ledger_operations (id, type, ts) "
+              "SELECT id, type, ts FROM transactions WHERE operation_id = id",
+
+              "CREATE INDEX idx_transactions_operation ON transactions (operation_id)",
+
+              "CREATE INDEX idx_transactions_card_id ON transactions (card_number, id)",
+
+              // accounts.balance — снимок на строке snapshot_id; текущий баланс —
+              // последний balance_after после снимка. Сейчас balance актуален,
+              // поэтому снимок ставится на последнюю строку карты.
+              "ALTER TABLE accounts ADD COLUMN snapshot_id INTEGER NOT NULL DEFAULT 0",
+
+              "UPDATE accounts SET snapshot_id = IFNULL("
+              "(SELECT MAX(id) FROM transactions t WHERE t.card_number = accounts.card_number), 0)",
+
+              "CREATE VIEW account_balances AS "
+              "SELECT a.card_number AS card_number,"
+              " IFNULL((SELECT t.balance_after FROM transactions t"
+              "  WHERE t.card_number = a.card_number AND t.id > a.snapshot_id"
+              "  ORDER BY t.id DESC LIMIT 1), a.balance) AS balance "
+              "FROM accounts a",
+
+              "CREATE TRIGGER transactions_append_only BEFORE UPDATE ON transactions "
+              "BEGIN SELECT RAISE(ABORT, 'transactions is append-only'); END",
+          } },
+        { 6, {
+              // Действия администратора. hash — SHA-256 от prev_hash и полей
+              // записи (см. AuditLog); записи не меняются и не удаляются.
+              "CREATE TABLE audit_log ("
+              " id          INTEGER PRIMARY KEY,"
+              " ts          DATETIME NOT NULL,"
+              " action      TEXT NOT NULL,"
+              " card_number TEXT,"
+              " details     TEXT,"
+              " prev_hash   TEXT NOT NULL,"
+              " hash        TEXT NOT NULL"
+              ")",
+
+              "CREATE TRIGGER audit_log_no_update BEFORE UPDATE ON audit_log "
+              "BEGIN SELECT RAISE(ABORT, 'audit_log is append-only'); END",
+
+              "CREATE TRIGGER audit_log_no_delete BEFORE DELETE ON audit_log "
+              "BEGIN SELECT RAISE(ABORT, 'audit_log is append-only'); END",
+          } },
+        { 7, {
+              // Номер карты — INTEGER (см. cardkey.h). В accounts это INTEGER
+              // PRIMARY KEY, то есть сам rowid: отдельного индекса по номеру
+              // больше нет, а ключи в индексах transactions — 8 байт вместо
+              // 16-символьной строки. Представление ссылается на обе таблицы
+              // и пересоздаётся после пересборки.
+              "DROP VIEW account_balances",
+
+              "CREATE TABLE accounts_v7 ("
+              " card_number     INTEGER PRIMARY KEY,"
+              " pin             TEXT NOT NULL,"
+              " balance         REAL NOT NULL,"
+              " failed_attempts INTEGER NOT NULL DEFAULT 0,"
+              " locked_until    DATETIME NULL,"
+              " snapshot_id     INTEGER NOT NULL DEFAULT 0"
+              ")",
+
+              "INSERT INTO accounts_v7 "
+              "(card_number, pin, balance, failed_attempts, locked_until, snapshot_id) "
+              "SELECT CAST(card_number AS INTEGER), pin, balance, failed_attempts,"
+              " locked_until, snapshot_id "
+              "FROM accounts",
+
+              "DROP TABLE accounts",
+
+              "ALTER TABLE accounts_v7 RENAME TO accounts",
+
+              "CREATE TABLE transactions_v7 ("
+              " id            INTEGER PRIMARY KEY AUTOINCREMENT,"
+              " card_number   INTEGER NOT NULL,"
+              " type          INTEGER NOT NULL,"
+              " amount        REAL NOT NULL,"
+              " balance_after REAL NOT NULL,"
+              " ts            DATETIME DEFAULT CURRENT_TIMESTAMP,"
+              " operation_id  INTEGER"
+              ")",
+
+              "INSERT INTO transactions_v7 "
+              "(id, card_number, type, amount, balance_after, ts, operation_id) "
+              "SELECT id, CAST(card_number AS INTEGER), type, amount, balance_after, ts,"
+              " operation_id "
+              "FROM transactions",
+
+              "INSERT INTO sqlite_sequence (name, seq) "
+              "SELECT 'transactions_v7', 0 WHERE NOT EXISTS "
+              "(SELECT 1 FROM sqlite_sequence WHERE name = 'transactions_v7')",
+
+              "UPDATE sqlite_sequence SET seq = MAX(seq, "
+              "(SELECT IFNULL(MAX(seq), 0) FROM sqlite_sequence WHERE name = 'transactions')) "
+              "WHERE name = 'transactions_v7'",
+
+              "DROP TABLE transactions",
+
+              "ALTER TABLE transactions_v7 RENAME TO transactions",
+
+              "CREATE INDEX idx_transactions_card_ts ON transactions (card_number, ts)",
+
+              "CREATE INDEX idx_transactions_ts ON transactions (ts)",
+
+              "CREATE INDEX idx_transactions_operation ON transactions (operation_id)",
+
+              "CREATE INDEX idx_transactions_card_id ON transactions (card_number, id)",
+
+              "CREATE VIEW account_balances AS "
+              "SELECT a.card_number AS card_number,"
+              " IFNULL((SELECT t.balance_after FROM transactions t"
+              "  WHERE t.card_number = a.card_number AND t.id > a.snapshot_id"
+              "  ORDER BY t.id DESC LIMIT 1), a.balance) AS balance "
+              "FROM accounts a",
+
+              "CREATE TRIGGER transactions_append_only BEFORE UPDATE ON transactions "
+              "BEGIN SELECT RAISE(ABORT, 'transactions is append-only'); END",
+          } },
+        { 8, {
+              // Журнал изменений для резервной БД (см. Replication). Пока
+              // захват не включён, таблица пуста.
+              "CREATE TABLE replication_log ("
+              " seq   INTEGER PRIMARY KEY AUTOINCREMENT,"
+              " ts_ms INTEGER NOT NULL,"
+              " stmt  TEXT NOT NULL"
+              ")",
+          } },
+        { 9, {
+              // Ноги операций между шардами (см. ShardedStore): по xid
+              // восстановление видит, что шард свою часть уже зафиксировал.
+              "CREATE TABLE shard_transfers ("
+              " xid          INTEGER PRIMARY KEY,"
+              " operation_id INTEGER NOT NULL"
+              ")",
+          } },
+        { 10, {
+              // Закрытие дня (см. EndOfDayBatch). dormant_since — дата, с
+              // которой счёт считается неактивным; проценты на него не
+              // начисляются. eod_chunks — план прогона по диапазонам
+              // номеров карт: done ставится в транзакции порции, поэтому
+              // прерванный прогон продолжается с первой невыполненной.
+              "ALTER TABLE accounts ADD COLUMN dormant_since TEXT",
+
+              "CREATE TABLE eod_runs ("
+              " business_date TEXT PRIMARY KEY,"
+              " rate_percent  REAL NOT NULL,"
+              " monthly_fee   REAL NOT NULL,"
+              " dormant_days  INTEGER NOT NULL,"
+              " started_at    DATETIME NOT NULL,"
+              " finished_at   DATETIME"
+              ")",
+
+              "CREATE TABLE eod_chunks ("
+              " business_date TEXT NOT NULL,"
+              " chunk         INTEGER NOT NULL,"
+              " from_key      INTEGER NOT NULL,"
+              " to_key        INTEGER NOT NULL,"
+              " done          INTEGER NOT NULL DEFAULT 0,"
+              " PRIMARY KEY (business_date, chunk)"
+              ")",
+          } },
+        { 11, {
+              // Часовые агрегаты наличных операций по банкоматам для
+              // прогноза (CashForecast). hour — начало часа UTC в формате
+              // ts. Дальше строки пополняет SqliteStore в транзакции
+              // операции; здесь — разовое заполнение по горячей таблице.
+              "CREATE TABLE cash_rollups ("
+              " atm_id          INTEGER NOT NULL,"
+              " hour            TEXT NOT NULL,"
+              " withdrawn_cents INTEGER NOT NULL DEFAULT 0,"
+              " withdrawals     INTEGER NOT NULL DEFAULT 0,"
+              " deposited_cents INTEGER NOT NULL DEFAULT 0,"
+              " deposits        INTEGER NOT NULL DEFAULT 0,"
+              " PRIMARY KEY (atm_id, hour)"
+              ") WITHOUT ROWID",
+
+              "INSERT INTO cash_rollups "
+              "SELECT 1, substr(ts, 1, 13) || ':00:00',"
+              " SUM(CASE WHEN type = 1 THEN CAST(round(amount * 100) AS INTEGER) ELSE 0 END),"
+              " SUM(type = 1),"
+              " SUM(CASE WHEN type = 2 THEN CAST(round(amount * 100) AS INTEGER) ELSE 0 END),"
+              " SUM(type = 2) "
+              "FROM transactions WHERE type IN (1, 2) "
+              "GROUP BY substr(ts, 1, 13)",
+          } },
+        { 12, {
+              // Закрытый счёт остаётся в accounts вместе со своими строками
+              // журнала: на них ссылаются вторые ноги переводов, сверка,
+              // аудит и лента изменений. Представление его не показывает —
+              // для терминала и админки счёта больше нет.
+              "ALTER TABLE accounts ADD COLUMN closed_at DATETIME NULL",
+
+              "DROP VIEW account_balances",
+
+              "CREATE VIEW account_balances AS "
+              "SELECT a.card_number AS card_number,"
+              " IFNULL((SELECT t.balance_after FROM transactions t"
+              "  WHERE t.card_number = a.card_number AND t.id > a.snapshot_id"
+              "  ORDER BY t.id DESC LIMIT 1), a.balance) AS balance "
+              "FROM accounts a WHERE a.closed_at IS NULL",
+          } },
+    };
+    return list;
+}
+}
+
+int DatabaseSchema::latestVersion()
+{
+    return migrations().isEmpty() ? 0 : migrations().last().version;
+}
+
+int DatabaseSchema::currentVersion(const QSqlDatabase &db)
+{
+    QSqlQuery query(db);
+    if (!query.exec("PRAGMA user_version")) {
+        EventLog::error("schema.version_read_failed", "PRAGMA user_version",
+                        query.lastError().text());
+        return -1;
+    }
+
+    if (!query.next())
+        return -1;
+
+    return query.value(0).toInt();
+}
+
+bool DatabaseSchema::migrate(QSqlDatabase &db)
+{
+    int version = currentVersion(db);
+    if (version < 0)
+        return false;
+
+    if (version == latestVersion())
+        return true;
+
+    if (version > latestVersion()) {
+        EventLog::error("schema.version_too_new", nullptr,
+                        QString("%1 > %2").arg(version).arg(latestVersion()));
+        return false;
+    }
+
+    for (const Migration &m : migrations()) {
+        if (m.version <= version)
+            continue;
+
+        QSqlQuery pragma(db);
+        for (const QString &sql : m.pragmas) {
+            if (!pragma.exec(sql)) {
+                EventLog::error("schema.migration_failed", "PRAGMA",
+                                pragma.lastError().text());
+                return false;
+            }
+        }
+        pragma.finish();
+
+        if (!db.transaction()) {
+            EventLog::error("tx.begin_failed", "BEGIN", db.lastError().text());
+            return false;
+        }
+
+        QSqlQuery query(db);
+        for (const QString &sql : m.statements) {
+            if (!query.exec(sql)) {
+                EventLog::error("schema.migration_failed", "DDL",
+                                query.lastError().text());
+                db.rollback();
+                return false;
+            }
+        }
+
+        // user_version пишется в заголовок файла в той же транзакции,
+        // поэтому прерванная миграция не оставит БД «наполовину новой».
+        if (!query.exec(QString("PRAGMA user_version = %1").arg(m.version))) {
+            EventLog::error("schema.migration_failed", "PRAGMA user_version",
+                            query.lastError().text());
+            db.rollback();
+            return false;
+        }
+
+        if (!db.commit()) {
+            EventLog::error("tx.commit_failed", "COMMIT", db.lastError().text());
+            return false;
+        }
+
+        version = m.version;
+    }
+
+    return true;
+}
+
+bool DatabaseSchema::seedTestData(QSqlDatabase &db)
+{
+    QSqlQuery ins(db);
+    ins.prepare("INSERT OR IGNORE INTO accounts (card_number, pin, balance) "
+                "VALUES (:card, :pin, :bal)");
+
+    ins.bindValue(":card", cardKey("1111222233334444"));
+    ins.bindValue(":pin", AtmController::hashPin("1234"));
+    ins.bindValue(":bal", 10000.0);
+    if (!ins.exec()) {
+        EventLog::error("sql.failed", "INSERT accounts", ins.lastError().text());
+        return false;
+    }
+
+    ins.bindValue(":card", cardKey("5555666677778888"));
+    ins.bindValue(":pin", AtmController::hashPin("0000"));
+    ins.bindValue(":bal", 5000.0);
+    if (!ins.exec()) {
+        EventLog::error("sql.failed", "INSERT accounts", ins.lastError().text());
+        return false;
+    }
+
+    return true;
+}
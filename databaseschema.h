@@ -0,0 +1,22 @@
+#ifndef DATABASESCHEMA_H
+#define DATABASESCHEMA_H
+
+#include <QSqlDatabase>
+
+// Версия схемы хранится в PRAGMA user_version. На актуальной БД запуск
+// сводится к одному чтению этой прагмы; миграции применяются по порядку
+// и только те, что ещё не применены.
+class DatabaseSchema
+{
+public:
+    static int latestVersion();
+
+    static int currentVersion(const QSqlDatabase &db);
+    static bool migrate(QSqlDatabase &db);
+
+    // Тестовые аккаунты добавляются только по явному запросу
+    // (флаг --seed-test-data), а не при каждом запуске.
+    static bool seedTestData(QSqlDatabase &db);
+};
+
+#endif // DATABASESCHEMA_H
@@ -0,0 +1,177 @@
+#include "databasestartup.h"
+
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QVariant>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QList>
+
+#include "cardfilter.h"
+#include "databaseschema.h"
+#include "eventlog.h"
+#include "replication.h"
+#include "shardmap.h"
+#include "sqlitestore.h"
+#include "velocitylimiter.h"
+
+namespace {
+const QString CONNECTION = "startup_%1";
+const int WARM_DAYS = 7;
+const QString TIMESTAMP_FORMAT = "yyyy-MM-dd HH:mm:ss";
+
+bool openConnection(const QString &connectionName, const QString &path)
+{
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+    db.setDatabaseName(path);
+    db.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000");
+
+    if (!db.open()) {
+        EventLog::error("db.open_failed", "startup connection", path + ": " + db.lastError().text());
+        return false;
+    }
+    return true;
+}
+}
+
+DatabaseStartup::DatabaseStartup(const QString &databasePath, bool seedTestData, QObject *parent)
+    : QObject(parent),
+    m_databasePath(databasePath),
+    m_seedTestData(seedTestData)
+{
+}
+
+void DatabaseStartup::run()
+{
+    EventLog::Scope scope("startup", QString());
+
+    QStringList connections;
+    bool ok = prepare(connections);
+
+    for (const QString &name : connections) {
+        QSqlDatabase::database(name, false).close();
+        QSqlDatabase::removeDatabase(name);
+    }
+
+    if (ok) {
+        EventLog::info("startup.prepared", nullptr,
+                       QString("migrate_ms=%1 snapshot_ms=%2 load_ms=%3 warmup_ms=%4"
+                               " accounts=%5 rows=%6")
+                           .arg(m_result.migrateMs)
+                           .arg(m_result.snapshotMs)
+                           .arg(m_result.loadMs)
+                           .arg(m_result.warmupMs)
+                           .arg(m_result.warmAccounts)
+                           .arg(m_result.warmRows));
+        scope.succeed();
+    }
+    emit finished(ok);
+}
+
+bool DatabaseStartup::prepare(QStringList &connections)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    emit stage("Проверка базы данных...");
+
+    QStringList paths = { m_databasePath };
+    const QString config = ShardMap::configPath(m_databasePath);
+    if (QFileInfo::exists(config)) {
+        ShardMap map;
+        QString error;
+        if (!ShardMap::parse(config, map, error)) {
+            EventLog::error("shard.config_invalid", nullptr, config + ": " + error);
+            return false;
+        }
+        for (int i = 1; i < map.count(); ++i)
+            paths.append(map.shards()[i].path);
+    }
+
+    QList<QSqlDatabase> databases;
+    for (const QString &path : paths) {
+        QString name = CONNECTION.arg(connections.size());
+        connections.append(name);
+        if (!openConnection(name, path))
+            return false;
+        databases.append(QSqlDatabase::database(name));
+    }
+
+    QSqlDatabase &db = databases.first();
+
+    // Резервная БД меняется только журналом основной; до --standby-promote
+    // терминал её не открывает.
+    if (Replication::isStandby(db)) {
+        EventLog::error("db.standby", "standby_state", db.databaseName());
+        return false;
+    }
+
+    for (QSqlDatabase &shard : databases) {
+        if (!DatabaseSchema::migrate(shard))
+            return false;
+    }
+
+    // Миграция могла пересобрать таблицу вместе с её триггерами захвата.
+    if (Replication::isCaptureEnabled(db) && !Replication::enableCapture(db))
+        return false;
+
+    if (m_seedTestData && !DatabaseSchema::seedTestData(db))
+        return false;
+    m_result.migrateMs = timer.restart();
+
+    emit stage("Снимок балансов...");
+    for (const QSqlDatabase &shard : databases) {
+        if (!SqliteStore::snapshotBalances(shard))
+            return false;
+    }
+    m_result.snapshotMs = timer.restart();
+
+    emit stage("Загрузка лимитов и фильтра карт...");
+    auto limiter = std::make_shared<VelocityLimiter>();
+    auto cardFilter = std::make_shared<CardFilter>();
+    if (!limiter->load(databases) || !cardFilter->load(databases))
+        return false;
+    m_result.limiter = limiter;
+    m_result.cardFilter = cardFilter;
+    m_result.loadMs = timer.restart();
+
+    // Прогрев не обязателен: сбой только пишется в журнал событий.
+    emit stage("Прогрев кэша...");
+    for (const QString &name : connections)
+        warmUp(name);
+    m_result.warmupMs = timer.restart();
+
+    return true;
+}
+
+bool DatabaseStartup::warmUp(const QString &connectionName)
+{
+    QSqlDatabase db = QSqlDatabase::database(connectionName);
+    QSqlQuery q(db);
+    q.setForwardOnly(true);
+
+    // Баланс каждой карты — как при входе: строка accounts и хвост индекса
+    // (card_number, id) после снимка.
+    if (!q.exec("SELECT COUNT(*), SUM(b.balance), SUM(length(a.pin)) "
+                "FROM accounts a JOIN account_balances b ON b.card_number = a.card_number")
+        || !q.next()) {
+        EventLog::warning("startup.warmup_failed", "accounts", q.lastError().text());
+        return false;
+    }
+    m_result.warmAccounts += q.value(0).toLongLong();
+    q.finish();
+
+    // Строки последних дней — первая страница истории и выписки — через
+    // индекс по ts.
+    QString since = QDateTime::currentDateTimeUtc().addDays(-WARM_DAYS).toString(TIMESTAMP_FORMAT);
+    q.prepare("SELECT COUNT(*), SUM(amount), SUM(balance_after) FROM transactions WHERE ts >= :since");
+    q.bindValue(":since", since);
+    if (!q.exec() || !q.next()) {
+        EventLog::warning("startup.warmup_failed", "transactions", q.lastError().text());
+        return false;
+    }
+    m_result.warmRows += q.value(0).toLongLong();
+    return true;
+}
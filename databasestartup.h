@@ -0,0 +1,63 @@
+#ifndef DATABASESTARTUP_H
+#define DATABASESTARTUP_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+
+#include <memory>
+
+class CardFilter;
+class VelocityLimiter;
+
+// Подготовка БД при запуске терминала в фоновом потоке, пока окно уже
+// показано в состоянии «запуск»: проверка на резервную БД, миграции
+// основной БД и шардов, триггеры захвата, снимок балансов, загрузка
+// лимитов и фильтра карт и прогрев кэша.
+//
+// Прогрев читает то, что понадобится первым входам: таблицу accounts с
+// балансами (по хвосту индекса (card_number, id) у каждой карты) и строки
+// журнала за последние дни. Соединения потока закрываются по окончании —
+// страницы остаются в кэше ОС.
+//
+// Соединения QSqlDatabase принадлежат потоку, который их открыл, поэтому
+// соединение по умолчанию, шарды и читатель открывает поток GUI после
+// finished (см. main).
+class DatabaseStartup : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Result {
+        std::shared_ptr<VelocityLimiter> limiter;
+        std::shared_ptr<CardFilter> cardFilter;
+        qint64 migrateMs = 0;
+        qint64 snapshotMs = 0;
+        qint64 loadMs = 0;
+        qint64 warmupMs = 0;
+        qint64 warmAccounts = 0;
+        qint64 warmRows = 0;
+    };
+
+    DatabaseStartup(const QString &databasePath, bool seedTestData, QObject *parent = nullptr);
+
+    // Читать после finished.
+    const Result &result() const { return m_result; }
+
+public slots:
+    void run();
+
+signals:
+    void stage(const QString &text);
+    void finished(bool ok);
+
+private:
+    bool prepare(QStringList &connections);
+    bool warmUp(const QString &connectionName);
+
+    QString m_databasePath;
+    bool m_seedTestData;
+    Result m_result;
+};
+
+#endif // DATABASESTARTUP_H
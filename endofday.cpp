@@ -0,0 +1,548 @@
+#include "endofday.h"
+
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QVariant>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+#include "cardkey.h"
+#include "databaseschema.h"
+#include "eventlog.h"
+#include "replication.h"
+#include "sqlitestore.h"
+#include "transactiontype.h"
+
+namespace {
+const QString PLAN_CONNECTION = "eod_plan";
+const QString WORKER_CONNECTION = "eod_%1_%2";
+const QString ARCHIVE_SCHEMA = "eod_cold";
+
+qint64 toCents(double amount)
+{
+    return std::llround(amount * 100.0);
+}
+
+QString money(qint64 cents)
+{
+    return QString::number(cents / 100.0, 'f', 2);
+}
+
+QString rangeCondition(qint64 to)
+{
+    return to == 0 ? QString("a.card_number >= :from")
+                   : QString("a.card_number >= :from AND a.card_number < :to");
+}
+
+bool openConnection(const QString &connectionName, const QString &path)
+{
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+    db.setDatabaseName(path);
+    db.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000");
+
+    if (!db.open()) {
+        EventLog::error("db.open_failed", "eod connection", path + ": " + db.lastError().text());
+        return false;
+    }
+    return true;
+}
+
+void closeConnection(const QString &connectionName)
+{
+    QSqlDatabase::database(connectionName, false).close();
+    QSqlDatabase::removeDatabase(connectionName);
+}
+
+// Начисления закрытия дня не считаются активностью клиента, иначе
+// счёт с процентами никогда не стал бы неактивным.
+const QString NOT_EOD_TYPE = QString("type NOT IN (%1, %2)")
+                                 .arg(int(TransactionType::Interest))
+                                 .arg(int(TransactionType::MonthlyFee));
+
+// Карты с операциями не раньше cutoff в архивных разделах. Закрытые
+// месяцы уже не меняются, поэтому набор собирается один раз на файл, а
+// порции проверяют по нему и по горячей таблице.
+bool collectArchivedActivity(QSqlDatabase &db, const QString &cutoff, QSet<qint64> &active)
+{
+    QSqlQuery parts(db);
+    parts.prepare("SELECT path FROM archive_partitions WHERE month >= :month ORDER BY month");
+    parts.bindValue(":month", cutoff.left(7));
+    if (!parts.exec()) {
+        EventLog::error("sql.failed", "SELECT archive_partitions", parts.lastError().text());
+        return false;
+    }
+
+    QStringList paths;
+    while (parts.next())
+        paths.append(parts.value(0).toString());
+    parts.finish();
+
+    for (const QString &path : paths) {
+        QSqlQuery q(db);
+        q.prepare("ATTACH DATABASE :path AS " + ARCHIVE_SCHEMA);
+        q.bindValue(":path", path);
+        if (!q.exec()) {
+            EventLog::error("archive.attach_failed", "ATTACH", path + ": " + q.lastError().text());
+            return false;
+        }
+
+        QSqlQuery cards(db);
+        cards.setForwardOnly(true);
+        cards.prepare("SELECT DISTINCT card_number FROM " + ARCHIVE_SCHEMA + ".transactions"
+                      " WHERE ts >= :cutoff AND " + NOT_EOD_TYPE);
+        cards.bindValue(":cutoff", cutoff);
+        bool ok = cards.exec();
+        if (!ok)
+            EventLog::error("sql.failed", "SELECT archived activity", cards.lastError().text());
+        while (ok && cards.next())
+            active.insert(cards.value(0).toLongLong());
+        cards.finish();
+
+        q.exec("DETACH DATABASE " + ARCHIVE_SCHEMA);
+        if (!ok)
+            return false;
+    }
+    return true;
+}
+}
+
+EndOfDayBatch::EndOfDayBatch(const QStringList &databasePaths,
+                             const Options &options,
+                             QObject *parent)
+    : QObject(parent),
+    m_date(options.businessDate.toString(Qt::ISODate)),
+    m_options(options)
+{
+    for (const QString &path : databasePaths) {
+        FilePlan file;
+        file.path = path;
+        file.options = options;
+        m_files.push_back(file);
+    }
+}
+
+void EndOfDayBatch::run()
+{
+    EventLog::Scope scope("eod", m_date);
+
+    QElapsedTimer timer;
+    timer.start();
+
+    m_summary = Summary();
+    m_summary.files = int(m_files.size());
+    m_cancelled = false;
+
+    std::vector<Chunk> chunks;
+    for (int i = 0; i < int(m_files.size()); ++i) {
+        if (!planFile(i, chunks)) {
+            emit finished(false, 0);
+            return;
+        }
+    }
+
+    std::vector<ChunkResult> results(chunks.size());
+    std::atomic<int> next(0);
+    std::atomic<int> done(0);
+
+    // Писатель у файла один: потоков больше, чем файлов, смысла нет —
+    // лишние ждали бы блокировку друг друга.
+    int threads = m_options.threads > 0 ? m_options.threads : int(m_files.size());
+    threads = std::min<int>(threads, int(chunks.size()));
+    {
+        std::vector<std::thread> workers;
+        workers.reserve(threads);
+        for (int t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t]() {
+                worker(t, chunks, results, next, done);
+            });
+        }
+        for (std::thread &w : workers)
+            w.join();
+    }
+
+    bool ok = true;
+    for (const ChunkResult &r : results) {
+        ok = ok && r.ok;
+        m_summary.accounts += r.accounts;
+        m_summary.interestRows += r.interestRows;
+        m_summary.interestCents += r.interestCents;
+        m_summary.feeRows += r.feeRows;
+        m_summary.feeCents += r.feeCents;
+        m_summary.dormantMarked += r.dormantMarked;
+        m_summary.reactivated += r.reactivated;
+    }
+
+    ok = finishFiles() && ok && !m_cancelled;
+    m_summary.seconds = timer.nsecsElapsed() / 1e9;
+
+    EventLog::info("eod.finished", nullptr,
+                   QString("date=%1 accounts=%2 interest=%3 fees=%4 dormant=%5 seconds=%6")
+                       .arg(m_date)
+                       .arg(m_summary.accounts)
+                       .arg(money(m_summary.interestCents))
+                       .arg(money(m_summary.feeCents))
+                       .arg(m_summary.dormantMarked)
+                       .arg(m_summary.seconds, 0, 'f', 1));
+
+    if (ok)
+        scope.succeed();
+    emit finished(ok, m_summary.accounts);
+}
+
+bool EndOfDayBatch::planFile(int file, std::vector<Chunk> &chunks)
+{
+    FilePlan &plan = m_files[file];
+
+    bool ok = openConnection(PLAN_CONNECTION, plan.path);
+    if (ok) {
+        QSqlDatabase db = QSqlDatabase::database(PLAN_CONNECTION);
+        if (Replication::isStandby(db)) {
+            EventLog::error("eod.standby", nullptr, plan.path);
+            ok = false;
+        }
+        ok = ok && DatabaseSchema::migrate(db);
+        if (ok && Replication::isCaptureEnabled(db))
+            ok = Replication::enableCapture(db);
+    }
+
+    // Строка прогона и план порций пишутся одной транзакцией: повторный
+    // запуск за ту же дату находит их и берёт параметры отсюда.
+    QSqlDatabase db = QSqlDatabase::database(PLAN_CONNECTION, false);
+    QSqlQuery q(db);
+    if (ok && !q.exec("BEGIN IMMEDIATE")) {
+        EventLog::error("tx.begin_failed", "BEGIN IMMEDIATE", q.lastError().text());
+        ok = false;
+    }
+
+    bool resumed = false;
+    if (ok) {
+        q.prepare("SELECT rate_percent, monthly_fee, dormant_days, finished_at"
+                  " FROM eod_runs WHERE business_date = :date");
+        q.bindValue(":date", m_date);
+        ok = q.exec();
+        if (ok && q.next()) {
+            resumed = true;
+            plan.options.ratePercent = q.value(0).toDouble();
+            plan.options.monthlyFee = q.value(1).toDouble();
+            plan.options.dormantDays = q.value(2).toInt();
+            plan.complete = !q.value(3).isNull();
+        }
+        if (!ok)
+            EventLog::error("sql.failed", "SELECT eod_runs", q.lastError().text());
+        q.finish();
+    }
+
+    if (ok && !resumed) {
+        q.prepare("INSERT INTO eod_runs"
+                  " (business_date, rate_percent, monthly_fee, dormant_days, started_at)"
+                  " VALUES (:date, :rate, :fee, :dormant, CURRENT_TIMESTAMP)");
+        q.bindValue(":date", m_date);
+        q.bindValue(":rate", plan.options.ratePercent);
+        q.bindValue(":fee", plan.options.monthlyFee);
+        q.bindValue(":dormant", plan.options.dormantDays);
+        ok = q.exec();
+        if (!ok)
+            EventLog::error("sql.failed", "INSERT eod_runs", q.lastError().text());
+    }
+
+    // Границы — каждый N-й номер карты по первичному ключу, один проход.
+    if (ok && !resumed) {
+        QList<qint64> bounds;
+        q.setForwardOnly(true);
+        ok = q.exec("SELECT card_number FROM accounts ORDER BY card_number");
+        for (qint64 i = 0; ok && q.next(); ++i) {
+            if (i > 0 && i % m_options.chunkAccounts == 0)
+                bounds.append(q.value(0).toLongLong());
+        }
+        if (!ok)
+            EventLog::error("sql.failed", "SELECT accounts.card_number", q.lastError().text());
+        q.finish();
+
+        q.prepare("INSERT INTO eod_chunks (business_date, chunk, from_key, to_key)"
+                  " VALUES (:date, :chunk, :from, :to)");
+        qint64 from = 0;
+        bounds.append(0);
+        for (int i = 0; ok && i < bounds.size(); ++i) {
+            q.bindValue(":date", m_date);
+            q.bindValue(":chunk", i);
+            q.bindValue(":from", from);
+            q.bindValue(":to", bounds[i]);
+            ok = q.exec();
+            if (!ok)
+                EventLog::error("sql.failed", "INSERT eod_chunks", q.lastError().text());
+            from = bounds[i];
+        }
+    }
+
+    int total = 0;
+    if (ok) {
+        q.prepare("SELECT chunk, from_key, to_key, done FROM eod_chunks"
+                  " WHERE business_date = :date ORDER BY chunk");
+        q.bindValue(":date", m_date);
+        ok = q.exec();
+        while (ok && q.next()) {
+            ++total;
+            if (q.value(3).toInt() != 0) {
+                ++m_summary.chunksResumed;
+                continue;
+            }
+            chunks.push_back({ file, q.value(0).toInt(),
+                               q.value(1).toLongLong(), q.value(2).toLongLong() });
+        }
+        if (!ok)
+            EventLog::error("sql.failed", "SELECT eod_chunks", q.lastError().text());
+        q.finish();
+    }
+
+    if (ok && !q.exec("COMMIT")) {
+        EventLog::error("tx.commit_failed", "COMMIT", q.lastError().text());
+        ok = false;
+    }
+    if (!ok && db.isOpen())
+        q.exec("ROLLBACK");
+    m_summary.chunks += total;
+
+    // Неактивность проверяется, только если за весь период видны операции:
+    // горячая таблица плюс архивные разделы периода.
+    const Options &o = plan.options;
+    plan.chargeFee = o.monthlyFee > 0 && o.businessDate.day() == 1;
+    plan.checkDormancy = o.dormantDays > 0;
+    if (ok && plan.checkDormancy && !plan.complete) {
+        QString cutoff = o.businessDate.addDays(-o.dormantDays).toString(Qt::ISODate) + " 00:00:00";
+        ok = collectArchivedActivity(db, cutoff, plan.archivedActive);
+    }
+
+    q = QSqlQuery();
+    closeConnection(PLAN_CONNECTION);
+
+    if (ok && resumed) {
+        EventLog::info("eod.resumed", nullptr,
+                       QString("%1 date=%2 pending=%3")
+                           .arg(plan.path).arg(m_date).arg(plan.complete ? 0 : total));
+    }
+    return ok;
+}
+
+void EndOfDayBatch::worker(int index,
+                           const std::vector<Chunk> &chunks,
+                           std::vector<ChunkResult> &results,
+                           std::atomic<int> &next,
+                           std::atomic<int> &done)
+{
+    // Соединения к файлам открываются по мере того, как поток берёт их
+    // порции.
+    QHash<int, QString> connections;
+
+    for (int i = next++; i < int(chunks.size()); i = next++) {
+        const Chunk &chunk = chunks[i];
+
+        if (m_cancelled) {
+            results[i].ok = false;
+            emit progress(++done, int(chunks.size()));
+            continue;
+        }
+
+        QString connectionName = connections.value(chunk.file);
+        if (connectionName.isEmpty()) {
+            connectionName = WORKER_CONNECTION.arg(index).arg(chunk.file);
+            if (!openConnection(connectionName, m_files[chunk.file].path)) {
+                QSqlDatabase::removeDatabase(connectionName);
+                results[i].ok = false;
+                emit progress(++done, int(chunks.size()));
+                continue;
+            }
+            connections.insert(chunk.file, connectionName);
+        }
+
+        results[i].ok = processChunk(connectionName, chunk, results[i]);
+        emit progress(++done, int(chunks.size()));
+    }
+
+    for (const QString &name : connections)
+        closeConnection(name);
+}
+
+bool EndOfDayBatch::processChunk(const QString &connectionName,
+                                 const Chunk &chunk,
+                                 ChunkResult &result)
+{
+    const FilePlan &plan = m_files[chunk.file];
+    const Options &o = plan.options;
+
+    QSqlDatabase db = QSqlDatabase::database(connectionName);
+    QSqlQuery q(db);
+    if (!q.exec("BEGIN IMMEDIATE")) {
+        EventLog::error("tx.begin_failed", "BEGIN IMMEDIATE", q.lastError().text());
+        return false;
+    }
+
+    auto fail = [&q](const char *what, const QSqlError &error) {
+        EventLog::error("sql.failed", what, error.text());
+        q.exec("ROLLBACK");
+        return false;
+    };
+
+    // Порцию мог завершить параллельный запуск за ту же дату.
+    q.prepare("SELECT done FROM eod_chunks WHERE business_date = :date AND chunk = :chunk");
+    q.bindValue(":date", m_date);
+    q.bindValue(":chunk", chunk.index);
+    if (!q.exec() || !q.next())
+        return fail("SELECT eod_chunks", q.lastError());
+    if (q.value(0).toInt() != 0) {
+        q.finish();
+        q.exec("COMMIT");
+        return true;
+    }
+    q.finish();
+
+    struct Row {
+        qint64 key;
+        qint64 balanceCents;
+        bool dormant;
+        bool active;
+    };
+    std::vector<Row> rows;
+
+    QString cutoff = o.businessDate.addDays(-o.dormantDays).toString(Qt::ISODate) + " 00:00:00";
+    QString date = o.businessDate.toString(Qt::ISODate);
+
+    // Порция читается целиком до записи: дальше в те же таблицы
+    // добавляются строки журнала. Карта администратора (ключ 0) не
+    // обслуживается.
+    QSqlQuery select(db);
+    select.setForwardOnly(true);
+    select.prepare("SELECT a.card_number, b.balance, a.dormant_since IS NOT NULL,"
+                   " EXISTS (SELECT 1 FROM transactions t WHERE t.card_number = a.card_number"
+                   "  AND t.ts >= :cutoff AND t." + NOT_EOD_TYPE + ") "
+                   "FROM accounts a JOIN account_balances b ON b.card_number = a.card_number "
+                   "WHERE a.card_number <> 0 AND " + rangeCondition(chunk.to)
+                   + " ORDER BY a.card_number");
+    select.bindValue(":cutoff", cutoff);
+    select.bindValue(":from", chunk.from);
+    if (chunk.to != 0)
+        select.bindValue(":to", chunk.to);
+    if (!select.exec())
+        return fail("SELECT eod chunk", select.lastError());
+    while (select.next()) {
+        qint64 key = select.value(0).toLongLong();
+        rows.push_back({ key, toCents(select.value(1).toDouble()), select.value(2).toBool(),
+                         select.value(3).toBool() || plan.archivedActive.contains(key) });
+    }
+    select.finish();
+
+    QSqlQuery dormancy(db);
+    dormancy.prepare("UPDATE accounts SET dormant_since = :since WHERE card_number = :card");
+
+    SqliteStore store(connectionName);
+    const double dailyRate = o.ratePercent / 100.0 / o.businessDate.daysInYear();
+
+    for (const Row &row : rows) {
+        bool dormant = row.dormant;
+        if (plan.checkDormancy && dormant == row.active) {
+            dormant = !row.active;
+            dormancy.bindValue(":since", dormant ? QVariant(date) : QVariant());
+            dormancy.bindValue(":card", row.key);
+            if (!dormancy.exec())
+                return fail("UPDATE accounts.dormant_since", dormancy.lastError());
+            if (dormant)
+                ++result.dormantMarked;
+            else
+                ++result.reactivated;
+        }
+
+        const QString card = cardNumberFromKey(row.key);
+        qint64 balance = row.balanceCents;
+        TransactionRecord entry;
+
+        qint64 interest = dormant || balance <= 0 ? 0 : std::llround(balance * dailyRate);
+        if (interest > 0) {
+            balance += interest;
+            if (!store.append(card, TransactionType::Interest, interest / 100.0,
+                              balance / 100.0, entry)) {
+                q.exec("ROLLBACK");
+                return false;
+            }
+            ++result.interestRows;
+            result.interestCents += interest;
+        }
+
+        // Комиссия не уводит баланс в минус: списывается не больше остатка.
+        qint64 fee = plan.chargeFee ? std::min(toCents(o.monthlyFee), balance) : 0;
+        if (fee > 0) {
+            balance -= fee;
+            if (!store.append(card, TransactionType::MonthlyFee, fee / 100.0,
+                              balance / 100.0, entry)) {
+                q.exec("ROLLBACK");
+                return false;
+            }
+            ++result.feeRows;
+            result.feeCents += fee;
+        }
+    }
+
+    q.prepare("UPDATE eod_chunks SET done = 1 WHERE business_date = :date AND chunk = :chunk");
+    q.bindValue(":date", m_date);
+    q.bindValue(":chunk", chunk.index);
+    if (!q.exec())
+        return fail("UPDATE eod_chunks", q.lastError());
+
+    if (!q.exec("COMMIT")) {
+        EventLog::error("tx.commit_failed", "COMMIT", q.lastError().text());
+        q.exec("ROLLBACK");
+        return false;
+    }
+
+    result.accounts = qint64(rows.size());
+    return true;
+}
+
+bool EndOfDayBatch::finishFiles()
+{
+    bool ok = true;
+    for (FilePlan &plan : m_files) {
+        if (plan.complete)
+            continue;
+        if (!openConnection(PLAN_CONNECTION, plan.path)) {
+            QSqlDatabase::removeDatabase(PLAN_CONNECTION);
+            ok = false;
+            continue;
+        }
+
+        // Прогон файла закрыт, только когда выполнены все порции — в том
+        // числе взятые параллельным запуском.
+        {
+            QSqlQuery q(QSqlDatabase::database(PLAN_CONNECTION));
+            q.prepare("UPDATE eod_runs SET finished_at = CURRENT_TIMESTAMP"
+                      " WHERE business_date = :date AND finished_at IS NULL"
+                      " AND NOT EXISTS (SELECT 1 FROM eod_chunks"
+                      "  WHERE business_date = :date AND done = 0)");
+            q.bindValue(":date", m_date);
+            if (!q.exec()) {
+                EventLog::error("sql.failed", "UPDATE eod_runs", q.lastError().text());
+                ok = false;
+            }
+            plan.complete = q.numRowsAffected() > 0;
+        }
+        closeConnection(PLAN_CONNECTION);
+    }
+    return ok;
+}
+
+void EndOfDayBatch::printSummary(QTextStream &out, const Summary &s)
+{
+    out << QString("files       %1\n").arg(s.files)
+        << QString("chunks      %1 (done earlier %2)\n").arg(s.chunks).arg(s.chunksResumed)
+        << QString("accounts    %1\n").arg(s.accounts)
+        << QString("interest    %1 rows, %2\n").arg(s.interestRows).arg(money(s.interestCents))
+        << QString("fees        %1 rows, %2\n").arg(s.feeRows).arg(money(s.feeCents))
+        << QString("dormant     +%1 -%2\n").arg(s.dormantMarked).arg(s.reactivated)
+        << QString("seconds     %1\n").arg(s.seconds, 0, 'f', 2)
+        << QString("accounts/s  %1\n").arg(s.seconds > 0 ? s.accounts / s.seconds : 0.0, 0, 'f', 0);
+}
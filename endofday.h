@@ -0,0 +1,122 @@
+#ifndef ENDOFDAY_H
+#define ENDOFDAY_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QDate>
+#include <QSet>
+#include <QTextStream>
+
+#include <atomic>
+#include <vector>
+
+// Закрытие дня по всем счетам: начисление процентов за день, ежемесячная
+// комиссия (в первый день месяца) и отметка неактивных счетов. Каждое
+// начисление — обычная строка журнала (Interest, MonthlyFee), баланс
+// по-прежнему считается из журнала.
+//
+// Счета делятся на порции по диапазонам номеров карт (keyset, без
+// OFFSET); план сохраняется в eod_chunks. Порция — одна транзакция
+// BEGIN IMMEDIATE: строки журнала, отметки неактивности и done порции
+// фиксируются вместе, поэтому прерванный прогон за ту же дату продолжается
+// с невыполненных порций и ничего не начисляет дважды. Порции короткие:
+// терминалы ждут блокировку записи не дольше одной порции.
+//
+// Файлов может быть несколько (шарды, см. ShardMap): у каждого свой план,
+// а порции разных файлов потоки пишут параллельно — писатели разных файлов
+// друг друга не ждут.
+class EndOfDayBatch : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Options {
+        QDate businessDate;
+        double ratePercent = 0.0;   // годовая ставка; 0 — без процентов
+        double monthlyFee = 0.0;    // 0 — без комиссии
+        int dormantDays = 365;      // 0 — без отметки неактивных
+        int chunkAccounts = 500;
+        int threads = 0;            // 0 — по потоку на файл
+    };
+
+    struct Summary {
+        int files = 0;
+        int chunks = 0;
+        int chunksResumed = 0;      // уже выполненные прежним прогоном
+        qint64 accounts = 0;
+        qint64 interestRows = 0;
+        qint64 interestCents = 0;
+        qint64 feeRows = 0;
+        qint64 feeCents = 0;
+        qint64 dormantMarked = 0;
+        qint64 reactivated = 0;
+        double seconds = 0.0;
+    };
+
+    explicit EndOfDayBatch(const QStringList &databasePaths,
+                           const Options &options,
+                           QObject *parent = nullptr);
+
+    // Можно вызывать из любого потока; прогон останавливается после
+    // текущих порций и продолжится следующим запуском за ту же дату.
+    void cancel() { m_cancelled = true; }
+
+    const Summary &summary() const { return m_summary; }
+
+    static void printSummary(QTextStream &out, const Summary &s);
+
+public slots:
+    void run();
+
+signals:
+    void progress(int chunksDone, int chunksTotal);
+    void finished(bool ok, qint64 accounts);
+
+private:
+    // Параметры прогона одного файла: при продолжении берутся из eod_runs,
+    // а не из командной строки.
+    struct FilePlan {
+        QString path;
+        Options options;
+        bool checkDormancy = false;
+        bool chargeFee = false;
+        bool complete = false;
+        QSet<qint64> archivedActive;   // карты с операциями периода в архиве
+    };
+
+    struct Chunk {
+        int file;
+        int index;
+        qint64 from;   // ключ карты, включительно
+        qint64 to;     // не включительно; 0 — до конца
+    };
+
+    struct ChunkResult {
+        bool ok = true;
+        qint64 accounts = 0;
+        qint64 interestRows = 0;
+        qint64 interestCents = 0;
+        qint64 feeRows = 0;
+        qint64 feeCents = 0;
+        qint64 dormantMarked = 0;
+        qint64 reactivated = 0;
+    };
+
+    bool planFile(int file, std::vector<Chunk> &chunks);
+    void worker(int index,
+                const std::vector<Chunk> &chunks,
+                std::vector<ChunkResult> &results,
+                std::atomic<int> &next,
+                std::atomic<int> &done);
+    bool processChunk(const QString &connectionName, const Chunk &chunk, ChunkResult &result);
+    bool finishFiles();
+
+    QString m_date;
+    Options m_options;
+    std::vector<FilePlan> m_files;
+    std::atomic<bool> m_cancelled{false};
+    Summary m_summary;
+};
+
+#endif // ENDOFDAY_H
@@ -0,0 +1,524 @@
+#include "eventlog.h"
+
+#include <QFile>
+#include <QDir>
+#include <QByteArray>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QTextStream>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+const int FLUSH_INTERVAL_MS = 50;
+const int BENCH_BATCH = 512;    // меньше кольца: бенчмарк не упирается в отбрасывание
+const char *const LOG_FILE_NAME = "events.jsonl";
+
+struct Event {
+    qint64 timestampNs;     // UTC, от эпохи
+    quint64 operationId;
+    qint64 latencyNs;       // -1, если не измерялась
+    const char *operation;  // только статические строки
+    const char *event;
+    const char *statement;
+    EventLog::Level level;
+    char card[5];
+    char detail[96];
+};
+
+// Кольцо одного производителя (поток-владелец) и одного потребителя
+// (поток сброса). Индексы растут монотонно, позиция — по маске.
+struct Ring {
+    static constexpr quint32 Capacity = 1024;
+    static constexpr quint32 Mask = Capacity - 1;
+
+    std::array<Event, Capacity> events;
+    std::atomic<quint32> head{0};
+    std::atomic<quint32> tail{0};
+    std::atomic<bool> retired{false};
+    std::atomic<quint64> dropped{0};
+
+    Event *reserve()
+    {
+        quint32 h = head.load(std::memory_order_relaxed);
+        quint32 t = tail.load(std::memory_order_acquire);
+        if (h - t >= Capacity) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        return &events[h & Mask];
+    }
+
+    void publish()
+    {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    template <typename F>
+    void drain(F &&consume)
+    {
+        quint32 t = tail.load(std::memory_order_relaxed);
+        quint32 h = head.load(std::memory_order_acquire);
+        while (t != h) {
+            consume(events[t & Mask]);
+            ++t;
+        }
+        tail.store(t, std::memory_order_release);
+    }
+};
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Ring>> rings;
+    quint64 droppedTotal = 0;
+};
+
+Registry &registry()
+{
+    static Registry r;
+    return r;
+}
+
+struct Writer {
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    QString directory;
+    qint64 maxFileBytes = 0;
+    int maxFiles = 0;
+    QFile file;
+};
+
+std::atomic<bool> s_running{false};
+std::atomic<quint64> s_nextOperationId{1};
+Writer *s_writer = nullptr;
+
+// Кольцо потока создаётся при первой записи; при завершении потока
+// помечается retired, и поток сброса освобождает его после слива.
+struct RingHandle {
+    Ring *ring = nullptr;
+    ~RingHandle()
+    {
+        if (ring)
+            ring->retired.store(true, std::memory_order_release);
+    }
+};
+
+thread_local RingHandle t_ring;
+thread_local EventLog::Scope *t_scope = nullptr;
+
+Ring *threadRing()
+{
+    if (!t_ring.ring) {
+        auto ring = std::make_unique<Ring>();
+        t_ring.ring = ring.get();
+        std::lock_guard<std::mutex> lock(registry().mutex);
+        registry().rings.push_back(std::move(ring));
+    }
+    return t_ring.ring;
+}
+
+qint64 steadyNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+qint64 wallNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void copyCardSuffix(const QString &card, char *out)
+{
+    const int n = card.size();
+    const QChar *data = card.constData();
+    int j = 0;
+    for (int i = std::max(0, n - 4); i < n; ++i)
+        out[j++] = data[i].toLatin1();
+    out[j] = '\0';
+}
+
+// UTF-16 -> UTF-8 прямо в слот события, без промежуточного QByteArray.
+// Обрезка — по целому символу; непарный суррогат заменяется на U+FFFD.
+void copyDetail(const QString &detail, char *out, int capacity)
+{
+    const ushort *s = detail.utf16();
+    const int n = detail.size();
+    int j = 0;
+
+    for (int i = 0; i < n; ++i) {
+        uint c = s[i];
+        int next = i;
+        if (c >= 0xD800 && c < 0xDC00 && i + 1 < n && s[i + 1] >= 0xDC00 && s[i + 1] < 0xE000)
+            c = 0x10000 + ((c - 0xD800) << 10) + (s[++next] - 0xDC00);
+        else if (c >= 0xD800 && c < 0xE000)
+            c = 0xFFFD;
+
+        const int length = c < 0x80 ? 1 : c < 0x800 ? 2 : c < 0x10000 ? 3 : 4;
+        if (j + length > capacity - 1)
+            break;
+
+        switch (length) {
+        case 1:
+            out[j++] = char(c);
+            break;
+        case 2:
+            out[j++] = char(0xC0 | (c >> 6));
+            out[j++] = char(0x80 | (c & 0x3F));
+            break;
+        case 3:
+            out[j++] = char(0xE0 | (c >> 12));
+            out[j++] = char(0x80 | ((c >> 6) & 0x3F));
+            out[j++] = char(0x80 | (c & 0x3F));
+            break;
+        default:
+            out[j++] = char(0xF0 | (c >> 18));
+            out[j++] = char(0x80 | ((c >> 12) & 0x3F));
+            out[j++] = char(0x80 | ((c >> 6) & 0x3F));
+            out[j++] = char(0x80 | (c & 0x3F));
+            break;
+        }
+        i = next;
+    }
+    out[j] = '\0';
+}
+
+const char *levelName(EventLog::Level level)
+{
+    switch (level) {
+    case EventLog::Level::Info:    return "info";
+    case EventLog::Level::Warning: return "warning";
+    case EventLog::Level::Error:   return "error";
+    }
+    return "info";
+}
+
+void appendJsonString(QByteArray &out, const char *s)
+{
+    out += '"';
+    for (; *s; ++s) {
+        unsigned char c = static_cast<unsigned char>(*s);
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += char(c);
+        } else if (c < 0x20) {
+            char buf[8];
+            std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += char(c);
+        }
+    }
+    out += '"';
+}
+
+void formatEvent(QByteArray &out, const Event &e)
+{
+    QDateTime ts = QDateTime::fromMSecsSinceEpoch(e.timestampNs / 1000000, Qt::UTC);
+
+    out += "{\"ts\":\"";
+    out += ts.toString("yyyy-MM-ddThh:mm:ss.zzz").toLatin1();
+    out += "Z\",\"level\":\"";
+    out += levelName(e.level);
+    out += "\",\"op\":";
+    out += QByteArray::number(e.operationId);
+    if (e.operation) {
+        out += ",\"operation\":";
+        appendJsonString(out, e.operation);
+    }
+    out += ",\"event\":";
+    appendJsonString(out, e.event);
+    if (e.card[0]) {
+        out += ",\"card\":";
+        appendJsonString(out, e.card);
+    }
+    if (e.statement) {
+        out += ",\"stmt\":";
+        appendJsonString(out, e.statement);
+    }
+    if (e.latencyNs >= 0) {
+        out += ",\"latency_us\":";
+        out += QByteArray::number(e.latencyNs / 1000.0, 'f', 1);
+    }
+    if (e.detail[0]) {
+        out += ",\"detail\":";
+        appendJsonString(out, e.detail);
+    }
+    out += "}\n";
+}
+
+bool openLogFile(Writer &w)
+{
+    w.file.setFileName(QDir(w.directory).filePath(LOG_FILE_NAME));
+    return w.file.open(QIODevice::WriteOnly | QIODevice::Append);
+}
+
+// events.jsonl -> events.1.jsonl -> ... -> events.<maxFiles-1>.jsonl
+void rotate(Writer &w)
+{
+    w.file.close();
+
+    QDir dir(w.directory);
+    auto rotated = [&](int i) {
+        return dir.filePath(QString("events.%1.jsonl").arg(i));
+    };
+
+    QFile::remove(rotated(w.maxFiles - 1));
+    for (int i = w.maxFiles - 2; i >= 1; --i)
+        QFile::rename(rotated(i), rotated(i + 1));
+    QFile::rename(dir.filePath(LOG_FILE_NAME), rotated(1));
+
+    openLogFile(w);
+}
+
+void flush(Writer &w)
+{
+    std::vector<Event> batch;
+    quint64 dropped = 0;
+
+    {
+        Registry &r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+
+        for (auto it = r.rings.begin(); it != r.rings.end();) {
+            Ring &ring = **it;
+            bool retired = ring.retired.load(std::memory_order_acquire);
+            ring.drain([&](const Event &e) { batch.push_back(e); });
+            dropped += ring.dropped.exchange(0, std::memory_order_relaxed);
+
+            if (retired)
+                it = r.rings.erase(it);
+            else
+                ++it;
+        }
+
+        r.droppedTotal += dropped;
+    }
+
+    if (batch.empty() && dropped == 0)
+        return;
+
+    // Кольца сливаются по очереди; stable_sort сохраняет порядок событий
+    // одного потока с одинаковой отметкой времени.
+    std::stable_sort(batch.begin(), batch.end(), [](const Event &a, const Event &b) {
+        return a.timestampNs < b.timestampNs;
+    });
+
+    QByteArray out;
+    out.reserve(int(batch.size()) * 160);
+    for (const Event &e : batch)
+        formatEvent(out, e);
+
+    if (dropped > 0) {
+        Event e{};
+        e.timestampNs = wallNs();
+        e.latencyNs = -1;
+        e.event = "eventlog.dropped";
+        e.level = EventLog::Level::Warning;
+        std::snprintf(e.detail, sizeof(e.detail), "%llu",
+                      static_cast<unsigned long long>(dropped));
+        formatEvent(out, e);
+    }
+
+    if (!w.file.isOpen())
+        return;
+
+    w.file.write(out);
+    w.file.flush();
+
+    if (w.maxFileBytes > 0 && w.file.size() >= w.maxFileBytes && w.maxFiles > 1)
+        rotate(w);
+}
+
+void writerLoop(Writer *w)
+{
+    std::unique_lock<std::mutex> lock(w->mutex);
+    while (!w->stopping) {
+        w->wake.wait_for(lock, std::chrono::milliseconds(FLUSH_INTERVAL_MS));
+        lock.unlock();
+        flush(*w);
+        lock.lock();
+    }
+    lock.unlock();
+    flush(*w);
+}
+}
+
+EventLog::Scope::Scope(const char *operation, const QString &cardNumber)
+    : m_operation(operation),
+    m_operationId(s_nextOperationId.fetch_add(1, std::memory_order_relaxed)),
+    m_startNs(steadyNs()),
+    m_previous(t_scope)
+{
+    copyCardSuffix(cardNumber, m_card);
+    t_scope = this;
+}
+
+EventLog::Scope::~Scope()
+{
+    record(m_ok ? Level::Info : Level::Warning,
+           m_ok ? "completed" : "failed",
+           nullptr, QString(), steadyNs() - m_startNs);
+    t_scope = m_previous;
+}
+
+void EventLog::start(const QString &directory, qint64 maxFileBytes, int maxFiles)
+{
+    if (s_running.load())
+        return;
+
+    QDir().mkpath(directory);
+
+    s_writer = new Writer();
+    s_writer->directory = directory;
+    s_writer->maxFileBytes = maxFileBytes;
+    s_writer->maxFiles = maxFiles;
+    openLogFile(*s_writer);
+
+    s_writer->thread = std::thread(writerLoop, s_writer);
+    s_running.store(true, std::memory_order_release);
+}
+
+void EventLog::stop()
+{
+    if (!s_running.exchange(false))
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(s_writer->mutex);
+        s_writer->stopping = true;
+    }
+    s_writer->wake.notify_one();
+    s_writer->thread.join();
+
+    s_writer->file.close();
+    delete s_writer;
+    s_writer = nullptr;
+}
+
+void EventLog::info(const char *event, const char *statement, const QString &detail)
+{
+    record(Level::Info, event, statement, detail, -1);
+}
+
+void EventLog::warning(const char *event, const char *statement, const QString &detail)
+{
+    record(Level::Warning, event, statement, detail, -1);
+}
+
+void EventLog::error(const char *event, const char *statement, const QString &detail)
+{
+    record(Level::Error, event, statement, detail, -1);
+}
+
+quint64 EventLog::droppedCount()
+{
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    quint64 total = registry().droppedTotal;
+    for (const auto &ring : registry().rings)
+        total += ring->dropped.load(std::memory_order_relaxed);
+    return total;
+}
+
+void EventLog::record(Level level,
+                      const char *event,
+                      const char *statement,
+                      const QString &detail,
+                      qint64 latencyNs)
+{
+    if (!s_running.load(std::memory_order_acquire))
+        return;
+
+    Ring *ring = threadRing();
+    Event *e = ring->reserve();
+    if (!e)
+        return;
+
+    const Scope *scope = t_scope;
+
+    e->timestampNs = wallNs();
+    e->operationId = scope ? scope->m_operationId : 0;
+    e->latencyNs = latencyNs;
+    e->operation = scope ? scope->m_operation : nullptr;
+    e->event = event;
+    e->statement = statement;
+    e->level = level;
+    std::memcpy(e->card, scope ? scope->m_card : "", scope ? sizeof(e->card) : 1);
+
+    copyDetail(detail, e->detail, sizeof(e->detail));
+
+    ring->publish();
+}
+
+int EventLog::runBenchmark(QTextStream &out, qint64 events)
+{
+    if (s_running.load()) {
+        out << "Журнал событий уже запущен.\n";
+        return 1;
+    }
+
+    QTemporaryDir directory;
+    if (!directory.isValid()) {
+        out << "Не удалось создать временный каталог.\n";
+        return 1;
+    }
+    start(directory.path());
+
+    Ring *ring = threadRing();
+    const QString card = "4000123412341234";
+    const QString detail = "amount=1500.00 balance=23840.50 atm=1";
+
+    // Замеряются только порции записи; между ними поток сброса успевает
+    // слить кольцо, как на пути операции терминала.
+    auto measure = [&](const auto &recordOne) {
+        qint64 ns = 0;
+        for (qint64 done = 0; done < events;) {
+            qint64 batch = std::min<qint64>(BENCH_BATCH, events - done);
+            QElapsedTimer timer;
+            timer.start();
+            for (qint64 i = 0; i < batch; ++i)
+                recordOne();
+            ns += timer.nsecsElapsed();
+            done += batch;
+
+            s_writer->wake.notify_one();
+            while (ring->tail.load(std::memory_order_acquire)
+                   != ring->head.load(std::memory_order_relaxed))
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return events > 0 ? double(ns) / events : 0.0;
+    };
+
+    double plainNs = measure([]() { info("bench.plain"); });
+    double detailNs = measure([&detail]() { info("bench.detail", "SELECT balance", detail); });
+    double scopeNs = measure([&card]() {
+        Scope scope("bench", card);
+        scope.succeed();
+    });
+
+    stop();
+
+    out << QString("events        %1\n").arg(events)
+        << QString("ns/event      %1\n").arg(plainNs, 0, 'f', 1)
+        << QString("ns/detail     %1\n").arg(detailNs, 0, 'f', 1)
+        << QString("ns/scope      %1\n").arg(scopeNs, 0, 'f', 1)
+        << QString("dropped       %1\n").arg(droppedCount())
+        << QString("budget        1000 ns/event\n");
+    out.flush();
+    return 0;
+}
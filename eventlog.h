@@ -0,0 +1,74 @@
+#ifndef EVENTLOG_H
+#define EVENTLOG_H
+
+#include <QString>
+#include <QTextStream>
+#include <QtGlobal>
+
+// Структурированный журнал событий. Запись события — копирование в
+// кольцевой буфер своего потока без блокировок и выделений памяти
+// (кроме первой записи потока, которая заводит его кольцо);
+// фоновый поток каждые 50 мс сливает буферы в logs/events.jsonl
+// (по строке JSON на событие) с ротацией по размеру. Если буфер полон,
+// событие отбрасывается и учитывается в счётчике dropped — вызывающий
+// поток никогда не ждёт диска.
+class EventLog
+{
+public:
+    enum class Level : quint8 { Info, Warning, Error };
+
+    // Контекст операции: номер операции, суффикс карты и время начала.
+    // События, записанные внутри области, получают их автоматически;
+    // при выходе пишется итоговое событие с задержкой операции.
+    class Scope
+    {
+    public:
+        Scope(const char *operation, const QString &cardNumber);
+        ~Scope();
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+        void succeed() { m_ok = true; }
+        quint64 operationId() const { return m_operationId; }
+
+    private:
+        friend class EventLog;
+
+        const char *m_operation;
+        quint64 m_operationId;
+        qint64 m_startNs;
+        char m_card[5];
+        bool m_ok = false;
+        Scope *m_previous;
+    };
+
+    static void start(const QString &directory,
+                      qint64 maxFileBytes = 8 * 1024 * 1024,
+                      int maxFiles = 5);
+    static void stop();
+
+    static void info(const char *event,
+                     const char *statement = nullptr,
+                     const QString &detail = QString());
+    static void warning(const char *event,
+                        const char *statement = nullptr,
+                        const QString &detail = QString());
+    static void error(const char *event,
+                      const char *statement = nullptr,
+                      const QString &detail = QString());
+
+    static quint64 droppedCount();
+
+    // Микробенчмарк записи: бюджет — до 1 мкс на событие на пути снятия.
+    static int runBenchmark(QTextStream &out, qint64 events);
+
+private:
+    static void record(Level level,
+                       const char *event,
+                       const char *statement,
+                       const QString &detail,
+                       qint64 latencyNs);
+};
+
+#endif // EVENTLOG_H
@@ -0,0 +1,179 @@
+#include "historybuffer.h"
+
+#include <QDateTime>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <numeric>
+
+namespace {
+// Дни от 1970-01-01 по дате григорианского календаря и обратно
+// (алгоритм Хиннанта, days_from_civil / civil_from_days).
+qint64 daysFromCivil(int y, int m, int d)
+{
+    y -= m <= 2;
+    const int era = (y >= 0 ? y : y - 399) / 400;
+    const int yoe = y - era * 400;
+    const int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    const int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return qint64(era) * 146097 + doe - 719468;
+}
+
+void civilFromDays(qint64 z, int &y, int &m, int &d)
+{
+    z += 719468;
+    const qint64 era = (z >= 0 ? z : z - 146096) / 146097;
+    const int doe = int(z - era * 146097);
+    const int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const int mp = (5 * doy + 2) / 153;
+    d = doy - (153 * mp + 2) / 5 + 1;
+    m = mp + (mp < 10 ? 3 : -9);
+    y = int(yoe + era * 400) + (m <= 2);
+}
+
+template <typename T>
+void permute(std::vector<T> &column, const std::vector<int> &order)
+{
+    std::vector<T> sorted;
+    sorted.reserve(order.size());
+    for (int i : order)
+        sorted.push_back(column[i]);
+    column.swap(sorted);
+}
+}
+
+void HistoryBuffer::reserve(int rows)
+{
+    m_ids.reserve(rows);
+    m_operationIds.reserve(rows);
+    m_types.reserve(rows);
+    m_amounts.reserve(rows);
+    m_balances.reserve(rows);
+    m_timestamps.reserve(rows);
+}
+
+void HistoryBuffer::clear()
+{
+    m_ids.clear();
+    m_operationIds.clear();
+    m_types.clear();
+    m_amounts.clear();
+    m_balances.clear();
+    m_timestamps.clear();
+}
+
+void HistoryBuffer::append(qint64 id,
+                           qint64 operationId,
+                           TransactionType type,
+                           qint64 amountCents,
+                           qint64 balanceCents,
+                           qint64 timestamp)
+{
+    m_ids.push_back(id);
+    m_operationIds.push_back(operationId);
+    m_types.push_back(quint8(type));
+    m_amounts.push_back(amountCents);
+    m_balances.push_back(balanceCents);
+    m_timestamps.push_back(timestamp);
+}
+
+void HistoryBuffer::append(const TransactionRecord &record)
+{
+    append(record.id, record.operationId, record.type,
+           std::llround(record.amount * 100.0), std::llround(record.balanceAfter * 100.0),
+           record.timestamp.isValid() ? record.timestamp.toSecsSinceEpoch() : -1);
+}
+
+void HistoryBuffer::append(const HistoryBuffer &other)
+{
+    m_ids.insert(m_ids.end(), other.m_ids.begin(), other.m_ids.end());
+    m_operationIds.insert(m_operationIds.end(), other.m_operationIds.begin(), other.m_operationIds.end());
+    m_types.insert(m_types.end(), other.m_types.begin(), other.m_types.end());
+    m_amounts.insert(m_amounts.end(), other.m_amounts.begin(), other.m_amounts.end());
+    m_balances.insert(m_balances.end(), other.m_balances.begin(), other.m_balances.end());
+    m_timestamps.insert(m_timestamps.end(), other.m_timestamps.begin(), other.m_timestamps.end());
+}
+
+TransactionRecord HistoryBuffer::record(int row) const
+{
+    TransactionRecord rec;
+    rec.id = m_ids[row];
+    rec.operationId = m_operationIds[row];
+    rec.type = type(row);
+    rec.amount = m_amounts[row] / 100.0;
+    rec.balanceAfter = m_balances[row] / 100.0;
+    rec.timestamp = QDateTime::fromSecsSinceEpoch(m_timestamps[row], Qt::UTC);
+    return rec;
+}
+
+void HistoryBuffer::sortNewestFirst()
+{
+    std::vector<int> order(m_ids.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [this](int a, int b) {
+        if (m_timestamps[a] != m_timestamps[b])
+            return m_timestamps[a] > m_timestamps[b];
+        return m_ids[a] > m_ids[b];
+    });
+
+    permute(m_ids, order);
+    permute(m_operationIds, order);
+    permute(m_types, order);
+    permute(m_amounts, order);
+    permute(m_balances, order);
+    permute(m_timestamps, order);
+}
+
+void HistoryBuffer::truncate(int rows)
+{
+    if (rows >= size())
+        return;
+    m_ids.resize(rows);
+    m_operationIds.resize(rows);
+    m_types.resize(rows);
+    m_amounts.resize(rows);
+    m_balances.resize(rows);
+    m_timestamps.resize(rows);
+}
+
+qint64 HistoryBuffer::parseTimestamp(const QString &ts)
+{
+    // yyyy-MM-dd HH:mm:ss; ISO-вариант с 'T' тоже принимается.
+    if (ts.size() < 19)
+        return -1;
+
+    auto number = [&ts](int from, int count, int &value) {
+        value = 0;
+        for (int i = from; i < from + count; ++i) {
+            int digit = ts[i].unicode() - '0';
+            if (digit < 0 || digit > 9)
+                return false;
+            value = value * 10 + digit;
+        }
+        return true;
+    };
+
+    int y, mo, d, h, mi, s;
+    if (!number(0, 4, y) || !number(5, 2, mo) || !number(8, 2, d)
+        || !number(11, 2, h) || !number(14, 2, mi) || !number(17, 2, s)
+        || mo < 1 || mo > 12 || d < 1 || d > 31)
+        return -1;
+
+    return daysFromCivil(y, mo, d) * 86400 + h * 3600 + mi * 60 + s;
+}
+
+QString HistoryBuffer::formatTimestamp(qint64 timestamp)
+{
+    qint64 days = timestamp >= 0 ? timestamp / 86400 : (timestamp - 86399) / 86400;
+    int seconds = int(timestamp - days * 86400);
+
+    int y, m, d;
+    civilFromDays(days, y, m, d);
+
+    char text[32];
+    int length = std::snprintf(text, sizeof(text), "%04d-%02d-%02d %02d:%02d:%02d",
+                               y, m, d, seconds / 3600, seconds / 60 % 60, seconds % 60);
+    return QString::fromLatin1(text, length);
+}
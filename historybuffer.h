@@ -0,0 +1,64 @@
+#ifndef HISTORYBUFFER_H
+#define HISTORYBUFFER_H
+
+#include <QString>
+
+#include <vector>
+
+#include "storage.h"
+#include "transactiontype.h"
+
+// Строки журнала по столбцам: id, operation_id, код типа, сумма и остаток
+// в копейках, время — секунды от эпохи (UTC). На строку нет ни QDateTime,
+// ни отдельного объекта: страница истории или порция выписки — шесть
+// непрерывных массивов, по одному выделению памяти на столбец при
+// reserve. TransactionRecord собирается по требованию (record).
+//
+// Буфер — хранилище TransactionHistoryModel и порций StatementExporter;
+// заполняется прямо из запроса (TransactionArchive).
+class HistoryBuffer
+{
+public:
+    void reserve(int rows);
+    void clear();
+
+    int size() const { return int(m_ids.size()); }
+    bool isEmpty() const { return m_ids.empty(); }
+
+    void append(qint64 id,
+                qint64 operationId,
+                TransactionType type,
+                qint64 amountCents,
+                qint64 balanceCents,
+                qint64 timestamp);
+    void append(const TransactionRecord &record);
+    void append(const HistoryBuffer &other);
+
+    qint64 id(int row) const { return m_ids[row]; }
+    qint64 operationId(int row) const { return m_operationIds[row]; }
+    TransactionType type(int row) const { return TransactionType(m_types[row]); }
+    qint64 amountCents(int row) const { return m_amounts[row]; }
+    qint64 balanceCents(int row) const { return m_balances[row]; }
+    qint64 timestamp(int row) const { return m_timestamps[row]; }
+
+    TransactionRecord record(int row) const;
+
+    // Новые первыми: по времени, при равном — по id.
+    void sortNewestFirst();
+    void truncate(int rows);
+
+    // Формат ts журнала, "yyyy-MM-dd HH:mm:ss" (UTC), без QDateTime.
+    // parseTimestamp: -1 — строка не в этом формате.
+    static qint64 parseTimestamp(const QString &ts);
+    static QString formatTimestamp(qint64 timestamp);
+
+private:
+    std::vector<qint64> m_ids;
+    std::vector<qint64> m_operationIds;
+    std::vector<quint8> m_types;
+    std::vector<qint64> m_amounts;
+    std::vector<qint64> m_balances;
+    std::vector<qint64> m_timestamps;
+};
+
+#endif // HISTORYBUFFER_H
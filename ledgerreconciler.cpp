@@ -0,0 +1,420 @@
+#include "ledgerreconciler.h"
+
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QVariant>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QList>
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+#include "cardkey.h"
+#include "eventlog.h"
+#include "transactiontype.h"
+
+namespace {
+const QString PLAN_CONNECTION = "reconcile_plan";
+const QString WORKER_CONNECTION = "reconcile_%1";
+const int SHARDS_PER_THREAD = 4;
+const std::size_t MAX_FINDINGS_PER_SHARD = 10000;
+
+qint64 toCents(double amount)
+{
+    return std::llround(amount * 100.0);
+}
+
+QString money(qint64 cents)
+{
+    return QString::number(cents / 100.0, 'f', 2);
+}
+
+QString rangeCondition(qint64 to)
+{
+    return to == 0 ? QString("card_number >= :from")
+                   : QString("card_number >= :from AND card_number < :to");
+}
+
+bool openReadOnly(const QString &connectionName, const QString &path)
+{
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+    db.setDatabaseName(path);
+    db.setConnectOptions("QSQLITE_OPEN_READONLY;QSQLITE_BUSY_TIMEOUT=5000");
+
+    if (!db.open()) {
+        EventLog::error("db.open_failed", "reconcile connection", db.lastError().text());
+        return false;
+    }
+    return true;
+}
+}
+
+LedgerReconciler::LedgerReconciler(const QString &databasePath,
+                                   int threads,
+                                   QObject *parent)
+    : QObject(parent),
+    m_databasePath(databasePath),
+    m_threads(threads > 0 ? threads : std::max(1, QThread::idealThreadCount()))
+{
+}
+
+void LedgerReconciler::run()
+{
+    EventLog::Scope scope("reconcile", QString());
+
+    QElapsedTimer timer;
+    timer.start();
+
+    m_summary = Summary();
+    m_summary.threads = m_threads;
+
+    std::vector<Shard> shards;
+    qint64 accounts = 0;
+    if (!planShards(shards, accounts)) {
+        emit finished(false, 0, 0, QString());
+        return;
+    }
+    m_summary.shards = int(shards.size());
+
+    std::vector<ShardResult> results(shards.size());
+    std::atomic<int> next(0);
+    std::atomic<int> done(0);
+
+    int threads = std::min<int>(m_threads, int(shards.size()));
+    {
+        std::vector<std::thread> workers;
+        workers.reserve(threads);
+        for (int t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t]() {
+                worker(t, shards, results, next, done);
+            });
+        }
+        for (std::thread &w : workers)
+            w.join();
+    }
+
+    bool ok = true;
+    for (const ShardResult &r : results) {
+        ok = ok && r.ok;
+        m_summary.accounts += r.accounts;
+        m_summary.rows += r.rows;
+        m_summary.mismatches += r.mismatches;
+        m_summary.gaps += r.gaps;
+        m_summary.orphans += r.orphans;
+    }
+    m_summary.seconds = timer.nsecsElapsed() / 1e9;
+
+    if (ok)
+        ok = writeReport(results);
+
+    EventLog::info("reconcile.finished", nullptr,
+                   QString("accounts=%1 rows=%2 mismatches=%3 gaps=%4 orphans=%5 seconds=%6")
+                       .arg(m_summary.accounts)
+                       .arg(m_summary.rows)
+                       .arg(m_summary.mismatches)
+                       .arg(m_summary.gaps)
+                       .arg(m_summary.orphans)
+                       .arg(m_summary.seconds, 0, 'f', 1));
+
+    if (ok)
+        scope.succeed();
+    emit finished(ok, m_summary.mismatches, m_summary.gaps, m_summary.reportPath);
+}
+
+bool LedgerReconciler::planShards(std::vector<Shard> &shards, qint64 &accounts)
+{
+    // Границы — каждый N-й номер карты по индексу первичного ключа: один
+    // проход по accounts, без OFFSET на каждую границу.
+    bool ok = openReadOnly(PLAN_CONNECTION, m_databasePath);
+
+    if (ok) {
+        QSqlDatabase db = QSqlDatabase::database(PLAN_CONNECTION);
+        QSqlQuery q(db);
+        q.setForwardOnly(true);
+
+        if (!q.exec("SELECT COUNT(*) FROM accounts") || !q.next()) {
+            EventLog::error("sql.failed", "SELECT COUNT accounts", q.lastError().text());
+            ok = false;
+        } else {
+            accounts = q.value(0).toLongLong();
+            q.finish();
+        }
+
+        int target = m_threads * SHARDS_PER_THREAD;
+        qint64 step = std::max<qint64>(1, accounts / target);
+
+        QList<qint64> bounds;
+        if (ok && accounts > step) {
+            if (!q.exec("SELECT card_number FROM accounts ORDER BY card_number")) {
+                EventLog::error("sql.failed", "SELECT accounts.card_number", q.lastError().text());
+                ok = false;
+            }
+            for (qint64 i = 0; ok && q.next(); ++i) {
+                if (i > 0 && i % step == 0 && bounds.size() < target - 1)
+                    bounds.append(q.value(0).toLongLong());
+            }
+        }
+
+        qint64 from = 0;
+        for (qint64 to : bounds) {
+            shards.push_back({ from, to });
+            from = to;
+        }
+        shards.push_back({ from, 0 });
+    }
+
+    QSqlDatabase::removeDatabase(PLAN_CONNECTION);
+    return ok;
+}
+
+void LedgerReconciler::worker(int index,
+                              const std::vector<Shard> &shards,
+                              std::vector<ShardResult> &results,
+                              std::atomic<int> &next,
+                              std::atomic<int> &done)
+{
+    const QString connectionName = WORKER_CONNECTION.arg(index);
+
+    if (!openReadOnly(connectionName, m_databasePath)) {
+        // Диапазоны заберут остальные потоки; если не открылся ни один,
+        // результаты останутся с ok = false.
+        QSqlDatabase::removeDatabase(connectionName);
+        for (int i = next++; i < int(shards.size()); i = next++) {
+            results[i].ok = false;
+            emit progress(++done, int(shards.size()));
+        }
+        return;
+    }
+
+    for (int i = next++; i < int(shards.size()); i = next++) {
+        results[i].ok = reconcileShard(connectionName, shards[i], results[i]);
+        emit progress(++done, int(shards.size()));
+    }
+
+    QSqlDatabase::database(connectionName, false).close();
+    QSqlDatabase::removeDatabase(connectionName);
+}
+
+bool LedgerReconciler::reconcileShard(const QString &connectionName,
+                                      const Shard &shard,
+                                      ShardResult &result)
+{
+    QSqlDatabase db = QSqlDatabase::database(connectionName);
+
+    // Счета и строки диапазона читаются из одного снимка. Снимок держится
+    // только на время диапазона, чтобы checkpoint WAL не откладывался на
+    // всю сверку.
+    if (!db.transaction()) {
+        EventLog::error("tx.begin_failed", "BEGIN reconcile", db.lastError().text());
+        return false;
+    }
+
+    QSqlQuery accounts(db);
+    accounts.setForwardOnly(true);
+    accounts.prepare("SELECT card_number, balance, snapshot_id FROM accounts WHERE "
+                     + rangeCondition(shard.to) + " ORDER BY card_number");
+
+    // Индекс (card_number, id) отдаёт строки сразу в порядке сверки —
+    // по картам и внутри карты по id, без сортировки.
+    QSqlQuery rows(db);
+    rows.setForwardOnly(true);
+    rows.prepare("SELECT card_number, id, type, amount, balance_after FROM transactions WHERE "
+                 + rangeCondition(shard.to) + " ORDER BY card_number, id");
+
+    for (QSqlQuery *q : { &accounts, &rows }) {
+        q->bindValue(":from", shard.from);
+        if (shard.to != 0)
+            q->bindValue(":to", shard.to);
+    }
+
+    if (!accounts.exec() || !rows.exec()) {
+        EventLog::error("sql.failed", "SELECT reconcile range",
+                        accounts.lastError().text() + rows.lastError().text());
+        db.rollback();
+        return false;
+    }
+
+    auto addFinding = [&result](Finding::Kind kind, const QString &card, qint64 id,
+                                qint64 expected, qint64 actual) {
+        if (result.findings.size() < MAX_FINDINGS_PER_SHARD)
+            result.findings.push_back({ kind, card, id, expected, actual });
+    };
+
+    bool haveAccount = false;
+    QString accountCard;
+    qint64 snapshotCents = 0;
+    qint64 snapshotId = 0;
+    auto nextAccount = [&]() {
+        haveAccount = accounts.next();
+        if (haveAccount) {
+            accountCard = cardNumberFromKey(accounts.value(0).toLongLong());
+            snapshotCents = toCents(accounts.value(1).toDouble());
+            snapshotId = accounts.value(2).toLongLong();
+            ++result.accounts;
+        }
+    };
+    nextAccount();
+
+    // accounts.balance — снимок на строке snapshot_id (0 — начальный баланс
+    // до первой строки). Снимок должен совпасть с balance_after своей
+    // строки, а первая строка после снимка — продолжать его.
+    QString card;
+    bool inCard = false;
+    bool matched = false;
+    bool snapshotChecked = false;
+    qint64 lastId = 0;
+    qint64 lastCents = 0;
+
+    auto checkSnapshot = [&]() {
+        snapshotChecked = true;
+        if (lastId != snapshotId || lastCents != snapshotCents) {
+            ++result.mismatches;
+            addFinding(Finding::Mismatch, card, snapshotId, lastCents, snapshotCents);
+        }
+    };
+
+    auto closeCard = [&]() {
+        if (!inCard || !matched)
+            return;
+        if (!snapshotChecked)
+            checkSnapshot();
+        nextAccount();
+    };
+
+    while (rows.next()) {
+        QString rowCard = cardNumberFromKey(rows.value(0).toLongLong());
+        qint64 id = rows.value(1).toLongLong();
+        TransactionType type = transactionTypeFromStorage(rows.value(2));
+        qint64 amountCents = toCents(rows.value(3).toDouble());
+        qint64 afterCents = toCents(rows.value(4).toDouble());
+        qint64 delta = transactionTypeInfo(type).balanceSign * amountCents;
+
+        if (!inCard || rowCard != card) {
+            closeCard();
+            card = rowCard;
+            inCard = true;
+
+            while (haveAccount && accountCard < card)
+                nextAccount();
+            matched = haveAccount && accountCard == card;
+            if (!matched) {
+                ++result.orphans;
+                addFinding(Finding::Orphan, card, id, 0, 0);
+            }
+
+            // Строки до снимка могли уйти в архив — тогда первая строка
+            // принимается как есть. Первая строка после снимка проверяется
+            // от него.
+            snapshotChecked = !matched || id > snapshotId;
+            if (matched && id > snapshotId && snapshotCents + delta != afterCents) {
+                ++result.gaps;
+                addFinding(Finding::Gap, card, id, snapshotCents + delta, afterCents);
+            }
+        } else {
+            if (!snapshotChecked && id > snapshotId)
+                checkSnapshot();
+
+            qint64 expected = lastCents + delta;
+            if (expected != afterCents) {
+                ++result.gaps;
+                addFinding(Finding::Gap, card, id, expected, afterCents);
+            }
+        }
+
+        lastId = id;
+        lastCents = afterCents;
+        ++result.rows;
+    }
+    closeCard();
+
+    // Счета без строк в горячей таблице: сверять не с чем, только считаем.
+    while (haveAccount)
+        nextAccount();
+
+    bool ok = rows.lastError().type() == QSqlError::NoError;
+    if (!ok)
+        EventLog::error("sql.failed", "SELECT reconcile rows", rows.lastError().text());
+
+    accounts.finish();
+    rows.finish();
+    db.rollback();
+    return ok;
+}
+
+bool LedgerReconciler::writeReport(const std::vector<ShardResult> &results)
+{
+    QString dir = QFileInfo(m_databasePath).absolutePath() + "/reports";
+    QDir().mkpath(dir);
+
+    QString path = dir + "/reconcile_"
+                   + QDateTime::currentDateTime().toString("yyyyMMdd_HHmmss") + ".txt";
+
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+        EventLog::error("reconcile.report_failed", nullptr, path + ": " + file.errorString());
+        return false;
+    }
+    m_summary.reportPath = path;
+
+    QTextStream out(&file);
+    out << "Сверка журнала " << QFileInfo(m_databasePath).absoluteFilePath() << "\n"
+        << "Завершена " << QDateTime::currentDateTimeUtc().toString("yyyy-MM-dd HH:mm:ss")
+        << " UTC\n\n";
+    printSummary(out, m_summary);
+
+    out << "\nПроверяется горячая таблица transactions. Первая строка карты\n"
+           "проверяется от снимка accounts.balance, если она новее снимка; иначе\n"
+           "более ранние строки лежат в архивных разделах и она принимается как есть.\n\n";
+
+    // Диапазоны идут по возрастанию номеров, внутри диапазона строки уже
+    // упорядочены по карте и id — сортировка не нужна.
+    bool truncated = false;
+    for (const ShardResult &r : results) {
+        truncated = truncated || r.findings.size() >= MAX_FINDINGS_PER_SHARD;
+
+        for (const Finding &f : r.findings) {
+            switch (f.kind) {
+            case Finding::Mismatch:
+                out << "MISMATCH " << f.cardNumber << " snapshot_id=" << f.id
+                    << " balance_after=" << money(f.expectedCents)
+                    << " balance=" << money(f.actualCents) << "\n";
+                break;
+            case Finding::Gap:
+                out << "GAP      " << f.cardNumber << " id=" << f.id
+                    << " expected=" << money(f.expectedCents)
+                    << " balance_after=" << money(f.actualCents) << "\n";
+                break;
+            case Finding::Orphan:
+                out << "ORPHAN   " << f.cardNumber << " id=" << f.id << "\n";
+                break;
+            }
+        }
+    }
+
+    if (truncated)
+        out << QString("\nВ части диапазонов показаны первые %1 записей; счётчики выше полные.\n")
+                   .arg(int(MAX_FINDINGS_PER_SHARD));
+
+    out.flush();
+    return file.error() == QFile::NoError;
+}
+
+void LedgerReconciler::printSummary(QTextStream &out, const Summary &s)
+{
+    out << QString("threads     %1\n").arg(s.threads)
+        << QString("shards      %1\n").arg(s.shards)
+        << QString("accounts    %1\n").arg(s.accounts)
+        << QString("rows        %1\n").arg(s.rows)
+        << QString("seconds     %1\n").arg(s.seconds, 0, 'f', 2)
+        << QString("rows/s      %1\n").arg(s.seconds > 0 ? s.rows / s.seconds : 0.0, 0, 'f', 0)
+        << QString("mismatches  %1\n").arg(s.mismatches)
+        << QString("gaps        %1\n").arg(s.gaps)
+        << QString("orphans     %1\n").arg(s.orphans);
+}
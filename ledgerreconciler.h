@@ -0,0 +1,92 @@
+#ifndef LEDGERRECONCILER_H
+#define LEDGERRECONCILER_H
+
+#include <QObject>
+#include <QString>
+#include <QTextStream>
+
+#include <atomic>
+#include <vector>
+
+// Сверка журнала: для каждой карты переигрывает цепочку balance_after в
+// transactions и сверяет снимок accounts.balance со строкой snapshot_id.
+//
+// Номера карт делятся на диапазоны (примерно поровну счетов); диапазоны
+// раздаются потокам по одному. Каждый поток читает через своё соединение
+// только для чтения, диапазон — в одной читающей транзакции: в WAL это
+// снимок, терминалы продолжают писать и не ждут сверку.
+class LedgerReconciler : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Summary {
+        int threads = 0;
+        int shards = 0;
+        qint64 accounts = 0;
+        qint64 rows = 0;
+        qint64 mismatches = 0;   // снимок accounts.balance не совпал с журналом
+        qint64 gaps = 0;         // разрыв цепочки: строка не следует из предыдущей
+        qint64 orphans = 0;      // строки по карте, которой нет в accounts
+        double seconds = 0.0;
+        QString reportPath;
+    };
+
+    // threads = 0 — по числу ядер.
+    explicit LedgerReconciler(const QString &databasePath,
+                              int threads = 0,
+                              QObject *parent = nullptr);
+
+    const Summary &summary() const { return m_summary; }
+
+    static void printSummary(QTextStream &out, const Summary &s);
+
+public slots:
+    void run();
+
+signals:
+    void progress(int shardsDone, int shardsTotal);
+    void finished(bool ok, qint64 mismatches, qint64 gaps, const QString &reportPath);
+
+private:
+    struct Shard {
+        qint64 from;     // ключ карты (cardKey), включительно
+        qint64 to;       // не включительно; 0 — до конца
+    };
+
+    struct Finding {
+        enum Kind { Mismatch, Gap, Orphan };
+
+        Kind kind;
+        QString cardNumber;
+        qint64 id;           // строка журнала (для Mismatch — snapshot_id)
+        qint64 expectedCents;
+        qint64 actualCents;
+    };
+
+    struct ShardResult {
+        bool ok = true;
+        qint64 accounts = 0;
+        qint64 rows = 0;
+        qint64 mismatches = 0;
+        qint64 gaps = 0;
+        qint64 orphans = 0;
+        std::vector<Finding> findings;
+    };
+
+    bool planShards(std::vector<Shard> &shards, qint64 &accounts);
+    void worker(int index,
+                const std::vector<Shard> &shards,
+                std::vector<ShardResult> &results,
+                std::atomic<int> &next,
+                std::atomic<int> &done);
+    bool reconcileShard(const QString &connectionName, const Shard &shard,
+                        ShardResult &result);
+    bool writeReport(const std::vector<ShardResult> &results);
+
+    QString m_databasePath;
+    int m_threads;
+    Summary m_summary;
+};
+
+#endif // LEDGERRECONCILER_H
@@ -1,140 +1,789 @@
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QCommandLineOption>
 #include <QSqlDatabase>
-#include <QSqlQuery>
 #include <QSqlError>
-#include <QDebug>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QRegularExpression>
+#include <QThread>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QMessageBox>
+
+#include <cstring>
+#include <memory>
 
 #include "mainwindow.h"
-#include "atmcontroller.h"
+#include "cardfilter.h"
+#include "cashforecast.h"
+#include "cdcfeed.h"
+#include "auditlog.h"
+#include "databasebackup.h"
+#include "databaseschema.h"
+#include "databasestartup.h"
+#include "endofday.h"
+#include "eventlog.h"
+#include "ledgerreconciler.h"
+#include "readsnapshot.h"
+#include "replication.h"
+#include "shardedstore.h"
+#include "shardmap.h"
+#include "sqlitestore.h"
+#include "standbyapplier.h"
+#include "stressharness.h"
+#include "velocitylimiter.h"
+
+// Подготовка БД — в DatabaseStartup, в фоне. Здесь, в потоке GUI,
+// открываются соединения, которыми дальше пользуются окна: соединение по
+// умолчанию, шарды и читатель.
+static const char *const DATABASE_FILE = "atm.db";
 
-static bool initDatabase()
+static bool openDatabase()
 {
+    EventLog::Scope scope("open_database", QString());
+
     QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE");
-    db.setDatabaseName("atm.db");
+    db.setDatabaseName(DATABASE_FILE);
+    // URI нужен для ATTACH архивных разделов в режиме только для чтения.
+    db.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000;QSQLITE_OPEN_URI");
 
     if (!db.open()) {
-        qDebug() << "Не удалось открыть БД:" << db.lastError().text();
+        EventLog::error("db.open_failed", nullptr, db.lastError().text());
         return false;
     }
 
-    QSqlQuery query;
-
-    if (!query.exec(
-            "CREATE TABLE IF NOT EXISTS accounts ("
-            " card_number     TEXT PRIMARY KEY,"
-            " pin             TEXT NOT NULL,"          
-            " balance         REAL NOT NULL,"
-            " failed_attempts INTEGER NOT NULL DEFAULT 0,"
-            " locked_until    DATETIME NULL"
-            ")"))
-    {
-        qDebug() << "Ошибка создания таблицы accounts:"
-                 << query.lastError().text();
+    if (!ShardMap::open(db.databaseName()))
         return false;
+
+    // Операции между шардами, прерванные сбоем, дописываются до первой
+    // новой операции. Незавершённые остаются в журнале до следующего запуска.
+    if (ShardMap::active()) {
+        int completed = 0;
+        ShardedStore(ShardMap::active()).recover(completed);
     }
 
-    if (!query.exec(
-            "CREATE TABLE IF NOT EXISTS transactions ("
-            " id            INTEGER PRIMARY KEY AUTOINCREMENT,"
-            " card_number   TEXT NOT NULL,"
-            " type          TEXT NOT NULL,"
-            " amount        REAL NOT NULL,"
-            " balance_after REAL NOT NULL,"
-            " ts            DATETIME DEFAULT CURRENT_TIMESTAMP"
-            ")"))
-    {
-        qDebug() << "Ошибка создания таблицы transactions:"
-                 << query.lastError().text();
+    if (!ReadSnapshot::open(db.databaseName()))
         return false;
+
+    scope.succeed();
+    return true;
+}
+
+static bool hasFlag(int argc, char *argv[], const char *flag)
+{
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], flag) == 0)
+            return true;
     }
+    return false;
+}
 
-    if (!query.exec(
-            "CREATE TABLE IF NOT EXISTS atm_state ("
-            " id         INTEGER PRIMARY KEY CHECK (id = 1),"
-            " cash_total REAL NOT NULL"
-            ")"))
-    {
-        qDebug() << "Ошибка создания таблицы atm_state:"
-                 << query.lastError().text();
-        return false;
+// Нагрузочный режим работает без GUI, поэтому обходится QCoreApplication.
+static int runStress(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption stressOption("stress", "Запустить нагрузочную проверку.");
+    QCommandLineOption dbOption("stress-db", "Файл БД для проверки (пересоздаётся).",
+                                "path", "atm_stress.db");
+    QCommandLineOption threadsOption("stress-threads", "Уровни параллелизма через запятую.",
+                                     "list", "1,2,4,8,16");
+    QCommandLineOption opsOption("stress-ops", "Операций на поток.", "count", "500");
+    QCommandLineOption accountsOption("stress-accounts", "Число счетов.", "count", "50");
+    QCommandLineOption engineOption("stress-engine", "Хранилище: sqlite или memory.",
+                                    "engine", "sqlite");
+    parser.addOptions({ stressOption, dbOption, threadsOption, opsOption, accountsOption,
+                        engineOption });
+    parser.process(app);
+
+    StressHarness::Options options;
+    options.engine = parser.value(engineOption);
+    options.databasePath = parser.value(dbOption);
+    options.opsPerThread = parser.value(opsOption).toInt();
+    options.accounts = parser.value(accountsOption).toInt();
+
+    options.threadCounts.clear();
+    for (const QString &part : parser.value(threadsOption).split(',')) {
+        int n = part.trimmed().toInt();
+        if (n > 0)
+            options.threadCounts.append(n);
     }
 
-    if (!query.exec("SELECT COUNT(*) FROM atm_state")) {
-        qDebug() << "Ошибка SELECT COUNT(*) FROM atm_state:"
-                 << query.lastError().text();
-        return false;
+    QTextStream out(stdout);
+
+    if (QFileInfo(options.databasePath).fileName() == "atm.db") {
+        out << "Файл БД проверки пересоздаётся; рабочий atm.db использовать нельзя.\n";
+        return 2;
+    }
+    if (options.engine != "sqlite" && options.engine != "memory") {
+        out << "Неизвестное хранилище: " << options.engine << "\n";
+        return 2;
+    }
+    if (options.accounts < 2 || options.opsPerThread <= 0 || options.threadCounts.isEmpty()) {
+        out << "Некорректные параметры нагрузочной проверки.\n";
+        return 2;
     }
 
-    int atmCount = 0;
-    if (query.next()) {
-        atmCount = query.value(0).toInt();
+    EventLog::start(QCoreApplication::applicationDirPath() + "/logs");
+
+    StressHarness harness(options);
+    int rc = harness.run(out) ? 0 : 1;
+
+    EventLog::stop();
+    return rc;
+}
+
+static int runLimitBenchmark(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption benchOption("bench-limits", "Микробенчмарк проверки лимитов.");
+    QCommandLineOption cardsOption("bench-cards", "Число карт.", "count", "1000000");
+    QCommandLineOption checksOption("bench-checks", "Число проверок.", "count", "10000000");
+    parser.addOptions({ benchOption, cardsOption, checksOption });
+    parser.process(app);
+
+    int cards = parser.value(cardsOption).toInt();
+    qint64 checks = parser.value(checksOption).toLongLong();
+
+    QTextStream out(stdout);
+    if (cards <= 0 || checks < 0) {
+        out << "Некорректные параметры бенчмарка.\n";
+        return 2;
     }
 
-    if (atmCount == 0) {
-        QSqlQuery ins;
-        if (!ins.exec("INSERT INTO atm_state (id, cash_total) "
-                      "VALUES (1, 100000.0)"))
-        {
-            qDebug() << "Ошибка вставки начального состояния atm_state:"
-                     << ins.lastError().text();
-            return false;
+    return VelocityLimiter::runBenchmark(out, cards, checks);
+}
+
+static int runCardFilterBenchmark(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption benchOption("bench-card-filter", "Микробенчмарк фильтра карт.");
+    QCommandLineOption cardsOption("bench-cards", "Число карт.", "count", "1000000");
+    QCommandLineOption lookupsOption("bench-lookups", "Число проверок.", "count", "10000000");
+    parser.addOptions({ benchOption, cardsOption, lookupsOption });
+    parser.process(app);
+
+    int cards = parser.value(cardsOption).toInt();
+    qint64 lookups = parser.value(lookupsOption).toLongLong();
+
+    QTextStream out(stdout);
+    if (cards <= 0 || lookups < 0) {
+        out << "Некорректные параметры бенчмарка.\n";
+        return 2;
+    }
+
+    return CardFilter::runBenchmark(out, cards, lookups);
+}
+
+static int runEventLogBenchmark(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption benchOption("bench-eventlog", "Микробенчмарк записи в журнал событий.");
+    QCommandLineOption eventsOption("bench-events", "Число событий каждого вида.", "count", "1000000");
+    parser.addOptions({ benchOption, eventsOption });
+    parser.process(app);
+
+    qint64 events = parser.value(eventsOption).toLongLong();
+
+    QTextStream out(stdout);
+    if (events < 0) {
+        out << "Некорректные параметры бенчмарка.\n";
+        return 2;
+    }
+
+    return EventLog::runBenchmark(out, events);
+}
+
+// Сверка журнала без GUI: для больших БД и запуска по расписанию. Рабочий
+// atm.db можно сверять, не останавливая терминалы.
+static int runReconcile(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption reconcileOption("reconcile", "Сверить журнал с балансами счетов.");
+    QCommandLineOption dbOption("reconcile-db", "Файл БД.", "path", "atm.db");
+    QCommandLineOption threadsOption("reconcile-threads", "Число потоков (0 — по числу ядер).",
+                                     "count", "0");
+    parser.addOptions({ reconcileOption, dbOption, threadsOption });
+    parser.process(app);
+
+    QString path = parser.value(dbOption);
+    int threads = parser.value(threadsOption).toInt();
+
+    QTextStream out(stdout);
+    if (!QFileInfo::exists(path) || threads < 0) {
+        out << "Некорректные параметры сверки.\n";
+        return 2;
+    }
+
+    EventLog::start(QCoreApplication::applicationDirPath() + "/logs");
+
+    LedgerReconciler reconciler(path, threads);
+    reconciler.run();
+
+    const LedgerReconciler::Summary &s = reconciler.summary();
+    LedgerReconciler::printSummary(out, s);
+    out << "report      " << s.reportPath << "\n";
+    out.flush();
+
+    EventLog::stop();
+
+    if (s.reportPath.isEmpty())
+        return 1;
+    return s.mismatches + s.gaps + s.orphans > 0 ? 3 : 0;
+}
+
+// Проверка цепочки audit_log без GUI, в том числе по копии БД.
+static int runAuditVerify(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption verifyOption("verify-audit", "Проверить цепочку хешей audit_log.");
+    QCommandLineOption dbOption("verify-audit-db", "Файл БД (шарды — по shards.conf рядом).",
+                                "path", "atm.db");
+    QCommandLineOption threadsOption("verify-audit-threads", "Число потоков (0 — по числу ядер).",
+                                     "count", "0");
+    parser.addOptions({ verifyOption, dbOption, threadsOption });
+    parser.process(app);
+
+    QString path = parser.value(dbOption);
+    int threads = parser.value(threadsOption).toInt();
+
+    QTextStream out(stdout);
+    if (!QFileInfo::exists(path) || threads < 0) {
+        out << "Некорректные параметры проверки.\n";
+        return 2;
+    }
+
+    // У каждого шарда своя цепочка audit_log.
+    QStringList paths = { path };
+    const QString config = ShardMap::configPath(path);
+    if (QFileInfo::exists(config)) {
+        ShardMap map;
+        QString error;
+        if (!ShardMap::parse(config, map, error)) {
+            out << config << ": " << error << "\n";
+            return 2;
         }
+        for (int i = 1; i < map.count(); ++i)
+            paths.append(map.shards()[i].path);
     }
 
-    if (!query.exec("SELECT COUNT(*) FROM accounts")) {
-        qDebug() << "Ошибка SELECT COUNT(*) FROM accounts:"
-                 << query.lastError().text();
-        return false;
+    EventLog::start(QCoreApplication::applicationDirPath() + "/logs");
+
+    AuditVerifier verifier(paths, threads);
+    bool ok = false;
+    QObject::connect(&verifier, &AuditVerifier::finished,
+                     [&ok](bool finishedOk, qint64, qint64, qint64, const QString &) {
+                         ok = finishedOk;
+                     });
+    verifier.run();
+
+    AuditVerifier::printSummary(out, verifier.summary());
+    out.flush();
+
+    EventLog::stop();
+
+    if (!ok)
+        return 1;
+    return verifier.summary().broken > 0 ? 3 : 0;
+}
+
+// Резервная копия без GUI: для запуска по расписанию (cron, планировщик
+// заданий) рядом с работающими терминалами.
+static int runBackup(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption backupOption("backup", "Сделать резервную копию БД.");
+    QCommandLineOption dbOption("backup-db", "Файл БД.", "path", "atm.db");
+    QCommandLineOption outOption("backup-out", "Файл копии (по умолчанию backup/<имя>_<время>.db).",
+                                 "path");
+    QCommandLineOption rowsOption("backup-step-rows", "Строк за шаг.", "count", "2000");
+    QCommandLineOption pauseOption("backup-pause-ms", "Пауза между шагами, мс.", "ms", "20");
+    parser.addOptions({ backupOption, dbOption, outOption, rowsOption, pauseOption });
+    parser.process(app);
+
+    QString path = parser.value(dbOption);
+    QString out = parser.isSet(outOption) ? parser.value(outOption)
+                                          : DatabaseBackup::defaultPath(path);
+    int rows = parser.value(rowsOption).toInt();
+    int pauseMs = parser.value(pauseOption).toInt();
+
+    QTextStream stream(stdout);
+    if (!QFileInfo::exists(path) || rows <= 0 || pauseMs < 0
+        || QFileInfo(out).absoluteFilePath() == QFileInfo(path).absoluteFilePath()) {
+        stream << "Некорректные параметры резервного копирования.\n";
+        return 2;
+    }
+
+    EventLog::start(QCoreApplication::applicationDirPath() + "/logs");
+
+    DatabaseBackup backup(path, out, rows, pauseMs);
+    bool ok = false;
+    QObject::connect(&backup, &DatabaseBackup::finished,
+                     [&ok](bool finishedOk, qint64, const QString &) { ok = finishedOk; });
+    backup.run();
+
+    DatabaseBackup::printSummary(stream, backup.summary());
+    stream.flush();
+
+    EventLog::stop();
+    return ok ? 0 : 1;
+}
+
+// Закрытие дня без GUI: запускается по расписанию после закрытия
+// операционного дня, терминалы продолжают работать.
+static int runEndOfDay(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption eodOption("eod", "Закрыть день: проценты, комиссия, неактивные счета.");
+    QCommandLineOption dbOption("eod-db", "Файл БД (шарды — по shards.conf рядом).", "path", "atm.db");
+    QCommandLineOption dateOption("eod-date", "Закрываемый день, YYYY-MM-DD (по умолчанию вчера).",
+                                  "date");
+    QCommandLineOption rateOption("eod-rate", "Годовая ставка, %.", "percent", "0");
+    QCommandLineOption feeOption("eod-fee", "Комиссия за месяц (списывается 1-го числа).", "amount", "0");
+    QCommandLineOption dormantOption("eod-dormant-days", "Дней без операций до неактивности (0 — не отмечать).",
+                                     "days", "365");
+    QCommandLineOption chunkOption("eod-chunk", "Счетов в порции.", "count", "500");
+    QCommandLineOption threadsOption("eod-threads", "Число потоков (0 — по потоку на файл).",
+                                     "count", "0");
+    parser.addOptions({ eodOption, dbOption, dateOption, rateOption, feeOption,
+                        dormantOption, chunkOption, threadsOption });
+    parser.process(app);
+
+    QString path = parser.value(dbOption);
+    EndOfDayBatch::Options options;
+    options.businessDate = parser.isSet(dateOption)
+                               ? QDate::fromString(parser.value(dateOption), Qt::ISODate)
+                               : QDate::currentDate().addDays(-1);
+    options.ratePercent = parser.value(rateOption).toDouble();
+    options.monthlyFee = parser.value(feeOption).toDouble();
+    options.dormantDays = parser.value(dormantOption).toInt();
+    options.chunkAccounts = parser.value(chunkOption).toInt();
+    options.threads = parser.value(threadsOption).toInt();
+
+    QTextStream out(stdout);
+    if (!QFileInfo::exists(path) || !options.businessDate.isValid()
+        || options.ratePercent < 0 || options.monthlyFee < 0 || options.dormantDays < 0
+        || options.chunkAccounts <= 0 || options.threads < 0) {
+        out << "Некорректные параметры закрытия дня.\n";
+        return 2;
     }
 
-    int count = 0;
-    if (query.next()) {
-        count = query.value(0).toInt();
+    QStringList paths = { QFileInfo(path).absoluteFilePath() };
+    const QString config = ShardMap::configPath(path);
+    if (QFileInfo::exists(config)) {
+        ShardMap map;
+        QString error;
+        if (!ShardMap::parse(config, map, error)) {
+            out << config << ": " << error << "\n";
+            return 2;
+        }
+        for (int i = 1; i < map.count(); ++i)
+            paths.append(map.shards()[i].path);
     }
 
-    if (count == 0) {
-        qDebug() << "Таблица accounts пуста, добавляю тестовые данные...";
+    EventLog::start(QCoreApplication::applicationDirPath() + "/logs");
 
-        QString pin1 = AtmController::hashPin("1234");
-        QString pin2 = AtmController::hashPin("0000");
+    EndOfDayBatch batch(paths, options);
+    bool ok = false;
+    QObject::connect(&batch, &EndOfDayBatch::finished,
+                     [&ok](bool finishedOk, qint64) { ok = finishedOk; });
+    batch.run();
 
-        QSqlQuery ins;
-        ins.prepare("INSERT INTO accounts (card_number, pin, balance) "
-                    "VALUES (:card, :pin, :bal)");
+    EndOfDayBatch::printSummary(out, batch.summary());
+    out.flush();
 
-        ins.bindValue(":card", "1111222233334444");
-        ins.bindValue(":pin", pin1);
-        ins.bindValue(":bal", 10000.0);
-        if (!ins.exec()) {
-            qDebug() << "Ошибка вставки аккаунта 1:"
-                     << ins.lastError().text();
-            return false;
+    EventLog::stop();
+    return ok ? 0 : 1;
+}
+
+// Прогноз наличности без GUI: итог в консоль, кривая по часам — в CSV.
+static int runCashForecast(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption forecastOption("cash-forecast", "Прогноз, когда кончится наличность банкомата.");
+    QCommandLineOption dbOption("cash-forecast-db", "Файл БД (шарды — по shards.conf рядом).",
+                                "path", "atm.db");
+    QCommandLineOption weeksOption("cash-forecast-weeks", "Недель истории.", "count", "4");
+    QCommandLineOption outOption("cash-forecast-out", "Файл CSV (по умолчанию forecast/cash_<время>.csv).",
+                                 "path");
+    parser.addOptions({ forecastOption, dbOption, weeksOption, outOption });
+    parser.process(app);
+
+    QString path = parser.value(dbOption);
+    CashForecast::Options options;
+    options.historyWeeks = parser.value(weeksOption).toInt();
+    QString outPath = parser.isSet(outOption) ? parser.value(outOption)
+                                              : CashForecast::defaultExportPath(path);
+
+    QTextStream out(stdout);
+    if (!QFileInfo::exists(path) || options.historyWeeks <= 0) {
+        out << "Некорректные параметры прогноза.\n";
+        return 2;
+    }
+
+    QStringList paths = { path };
+    const QString config = ShardMap::configPath(path);
+    if (QFileInfo::exists(config)) {
+        ShardMap map;
+        QString error;
+        if (!ShardMap::parse(config, map, error)) {
+            out << config << ": " << error << "\n";
+            return 2;
         }
+        for (int i = 1; i < map.count(); ++i)
+            paths.append(map.shards()[i].path);
+    }
+
+    EventLog::start(QCoreApplication::applicationDirPath() + "/logs");
 
-        ins.bindValue(":card", "5555666677778888");
-        ins.bindValue(":pin", pin2);
-        ins.bindValue(":bal", 5000.0);
-        if (!ins.exec()) {
-            qDebug() << "Ошибка вставки аккаунта 2:"
-                     << ins.lastError().text();
-            return false;
+    QStringList connections;
+    QList<QSqlDatabase> databases;
+    bool ok = true;
+    for (const QString &file : paths) {
+        QString name = QString("forecast_%1").arg(connections.size());
+        connections.append(name);
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", name);
+        db.setDatabaseName(file);
+        db.setConnectOptions("QSQLITE_OPEN_READONLY;QSQLITE_BUSY_TIMEOUT=5000");
+        if (!db.open()) {
+            EventLog::error("db.open_failed", "forecast connection", file + ": " + db.lastError().text());
+            ok = false;
+            break;
         }
+        databases.append(db);
     }
 
-    return true;
+    QList<CashForecast::Result> results;
+    ok = ok && CashForecast::compute(databases, QDateTime::currentDateTimeUtc(), options, results);
+
+    QString error;
+    if (ok && !CashForecast::exportCsv(outPath, results, error)) {
+        EventLog::error("forecast.export_failed", nullptr, outPath + ": " + error);
+        ok = false;
+    }
+
+    if (ok) {
+        CashForecast::printSummary(out, results);
+        out << "csv         " << outPath << "\n";
+    }
+    out.flush();
+
+    databases.clear();
+    for (const QString &name : connections) {
+        QSqlDatabase::database(name, false).close();
+        QSqlDatabase::removeDatabase(name);
+    }
+
+    EventLog::stop();
+    return ok ? 0 : 1;
+}
+
+// Чтение ленты изменений (cdc/) потребителем: строки — в stdout, курсор
+// сохраняется после каждой порции. --cdc-follow — ждать новых строк.
+static int runCdcTail(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption tailOption("cdc-tail", "Вывести новые строки журнала из ленты cdc/.");
+    QCommandLineOption dbOption("cdc-db", "Файл БД (шард) ленты.", "path", "atm.db");
+    QCommandLineOption consumerOption("cdc-consumer", "Имя потребителя (курсор).", "name");
+    QCommandLineOption batchOption("cdc-batch", "Строк за одно чтение.", "rows", "100");
+    QCommandLineOption followOption("cdc-follow", "Ждать новых строк.");
+    parser.addOptions({ tailOption, dbOption, consumerOption, batchOption, followOption });
+    parser.process(app);
+
+    QString consumer = parser.value(consumerOption);
+    int batch = parser.value(batchOption).toInt();
+
+    QTextStream out(stdout);
+    if (!QRegularExpression("^[A-Za-z0-9_-]+$").match(consumer).hasMatch() || batch <= 0) {
+        out << "Некорректные параметры ленты.\n";
+        return 2;
+    }
+
+    EventLog::start(QCoreApplication::applicationDirPath() + "/logs");
+
+    CdcReader reader(CdcFeed::directory(parser.value(dbOption)), consumer);
+    if (!reader.open()) {
+        EventLog::stop();
+        return 1;
+    }
+
+    // Строки уходят в stdout, курсор сохраняется после каждой выведенной
+    // порции.
+    auto drain = [&]() {
+        while (true) {
+            QList<CdcFeed::Row> rows;
+            if (!reader.read(batch, rows))
+                return false;
+            for (const CdcFeed::Row &row : rows)
+                out << CdcFeed::formatRow(row);
+            out.flush();
+            if (!reader.commit())
+                return false;
+            if (rows.size() < batch)
+                return true;
+        }
+    };
+
+    int rc = drain() ? 0 : 1;
+    if (rc == 0 && parser.isSet(followOption)) {
+        QObject::connect(&reader, &CdcReader::rowsAvailable, &app, [&]() {
+            if (!drain())
+                QCoreApplication::exit(1);
+        });
+        rc = app.exec();
+    }
+
+    EventLog::stop();
+    return rc;
+}
+
+// Резервная БД по журналу изменений: подготовка, применение журнала,
+// переключение. Основная БД при этом работает как обычно.
+static int runStandby(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption initOption("standby-init",
+                                  "Включить захват на основной БД и создать резервную. Архивные "
+                                  "разделы не переносятся: каталог archive/ основной БД должен "
+                                  "быть общим и доступным резервному хосту по тому же пути. С shards.conf "
+                                  "на несколько шардов захват не включается.");
+    QCommandLineOption applyOption("standby", "Применять журнал к резервной БД.");
+    QCommandLineOption promoteOption("standby-promote",
+                                     "Догнать журнал и сделать резервную БД рабочей.");
+    QCommandLineOption offOption("standby-capture-off",
+                                 "Выключить захват на основной БД и очистить журнал.");
+    QCommandLineOption primaryOption("standby-primary", "Основная БД.", "path", "atm.db");
+    QCommandLineOption dbOption("standby-db", "Резервная БД.", "path", "atm_standby.db");
+    QCommandLineOption logOption("standby-log",
+                                 "Каталог сегментов (по умолчанию replication/ рядом с основной БД).",
+                                 "path");
+    QCommandLineOption intervalOption("standby-interval-ms", "Пауза между проходами, мс.",
+                                      "ms", "1000");
+    QCommandLineOption batchOption("standby-batch", "Записей журнала на транзакцию.",
+                                   "count", "1000");
+    QCommandLineOption onceOption("standby-once", "Один проход и выход.");
+    parser.addOptions({ initOption, applyOption, promoteOption, offOption, primaryOption,
+                        dbOption, logOption, intervalOption, batchOption, onceOption });
+    parser.process(app);
+
+    QString primary = parser.value(primaryOption);
+    QString standby = parser.value(dbOption);
+    QString logDirectory = parser.isSet(logOption) ? parser.value(logOption)
+                                                   : Replication::logDirectory(primary);
+    int intervalMs = parser.value(intervalOption).toInt();
+    int batch = parser.value(batchOption).toInt();
+
+    QTextStream out(stdout);
+    if (intervalMs <= 0 || batch <= 0
+        || QFileInfo(primary).absoluteFilePath() == QFileInfo(standby).absoluteFilePath()) {
+        out << "Некорректные параметры резервной БД.\n";
+        return 2;
+    }
+
+    EventLog::start(QCoreApplication::applicationDirPath() + "/logs");
+
+    int rc = 0;
+    if (parser.isSet(initOption) || parser.isSet(offOption)) {
+        if (!QFileInfo::exists(primary)) {
+            out << "Основная БД не найдена.\n";
+            rc = 2;
+        } else if (parser.isSet(offOption)) {
+            QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", "standby_capture");
+            db.setDatabaseName(primary);
+            db.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000");
+            rc = db.open() && Replication::disableCapture(db) ? 0 : 1;
+            db.close();
+        } else {
+            rc = Replication::initStandby(primary, standby) ? 0 : 1;
+            if (rc == 0)
+                out << "Архивные разделы не реплицируются; каталог "
+                    << QFileInfo(primary).absolutePath() << "/archive"
+                    << " должен быть доступен резервному хосту по тому же пути.\n";
+        }
+        QSqlDatabase::removeDatabase("standby_capture");
+    } else {
+        StandbyApplier applier(standby, logDirectory, batch);
+        StandbyApplier::Status status;
+        if (!QFileInfo::exists(standby) || !applier.open()) {
+            out << "Резервная БД не найдена или не является резервной.\n";
+            rc = 2;
+        } else if (parser.isSet(promoteOption)) {
+            rc = applier.promote(status) ? 0 : 1;
+            StandbyApplier::printStatus(out, status);
+        } else {
+            // Без --standby-once цикл кончается только сбоем применения.
+            bool applied = false;
+            while ((applied = applier.applyPending(status))) {
+                StandbyApplier::printStatus(out, status);
+                out.flush();
+                if (parser.isSet(onceOption))
+                    break;
+                QThread::msleep(intervalMs);
+            }
+            rc = applied ? 0 : 1;
+        }
+    }
+    out.flush();
+
+    EventLog::stop();
+    return rc;
 }
 
 int main(int argc, char *argv[])
 {
+    QElapsedTimer startupTimer;
+    startupTimer.start();
+
+    if (hasFlag(argc, argv, "--stress"))
+        return runStress(argc, argv);
+    if (hasFlag(argc, argv, "--bench-limits"))
+        return runLimitBenchmark(argc, argv);
+    if (hasFlag(argc, argv, "--bench-card-filter"))
+        return runCardFilterBenchmark(argc, argv);
+    if (hasFlag(argc, argv, "--bench-eventlog"))
+        return runEventLogBenchmark(argc, argv);
+    if (hasFlag(argc, argv, "--reconcile"))
+        return runReconcile(argc, argv);
+    if (hasFlag(argc, argv, "--verify-audit"))
+        return runAuditVerify(argc, argv);
+    if (hasFlag(argc, argv, "--backup"))
+        return runBackup(argc, argv);
+    if (hasFlag(argc, argv, "--eod"))
+        return runEndOfDay(argc, argv);
+    if (hasFlag(argc, argv, "--cash-forecast"))
+        return runCashForecast(argc, argv);
+    if (hasFlag(argc, argv, "--cdc-tail"))
+        return runCdcTail(argc, argv);
+    if (hasFlag(argc, argv, "--standby-init") || hasFlag(argc, argv, "--standby")
+        || hasFlag(argc, argv, "--standby-promote") || hasFlag(argc, argv, "--standby-capture-off"))
+        return runStandby(argc, argv);
+
     QApplication a(argc, argv);
 
-    if (!initDatabase()) {
-        return -1;
-    }
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption seedOption("seed-test-data",
+                                  "Добавить тестовые аккаунты в atm.db.");
+    parser.addOption(seedOption);
+    parser.process(a);
+
+    EventLog::start(QCoreApplication::applicationDirPath() + "/logs");
 
+    // Окно показывается сразу, вход открывается, когда БД готова.
     MainWindow w;
+    w.setStarting("подготовка базы данных...");
     w.show();
-    return a.exec();
+    QTimer::singleShot(0, &w, [&startupTimer]() {
+        EventLog::info("startup.first_frame", nullptr,
+                       QString("ms=%1").arg(startupTimer.elapsed()));
+    });
+
+    QThread startupThread;
+    auto *startup = new DatabaseStartup(DATABASE_FILE, parser.isSet(seedOption));
+    startup->moveToThread(&startupThread);
+    QObject::connect(&startupThread, &QThread::started, startup, &DatabaseStartup::run);
+    QObject::connect(startup, &DatabaseStartup::stage, &w, &MainWindow::setStarting);
+
+    // Захват включён (--standby-init): пока терминал работает, журнал
+    // уходит в сегменты для резервной БД.
+    QThread shipperThread;
+    LogShipper *shipper = nullptr;
+
+    // Лента изменений для внешних систем (cdc/): по издателю на файл БД.
+    QThread cdcThread;
+    QList<CdcPublisher *> publishers;
+
+    QObject::connect(startup, &DatabaseStartup::finished, &w, [&](bool ok) {
+        startupThread.quit();
+        startupThread.wait();
+
+        if (!ok || !openDatabase()) {
+            QMessageBox::critical(&w, "Ошибка",
+                                  "Не удалось подготовить базу данных, см. журнал событий.");
+            QCoreApplication::exit(-1);
+            return;
+        }
+
+        if (Replication::isCaptureEnabled(QSqlDatabase::database())) {
+            shipper = new LogShipper(QSqlDatabase::database().databaseName());
+            shipper->moveToThread(&shipperThread);
+            QObject::connect(&shipperThread, &QThread::started, shipper, &LogShipper::start);
+            QObject::connect(&shipperThread, &QThread::finished, shipper, &QObject::deleteLater);
+            shipperThread.start();
+        }
+
+        for (const QSqlDatabase &db : ShardMap::databases()) {
+            auto *publisher = new CdcPublisher(db.databaseName());
+            publisher->moveToThread(&cdcThread);
+            QObject::connect(&cdcThread, &QThread::started, publisher, &CdcPublisher::start);
+            QObject::connect(&cdcThread, &QThread::finished, publisher, &QObject::deleteLater);
+            publishers.append(publisher);
+        }
+        cdcThread.start();
+
+        w.setVelocityLimiter(startup->result().limiter);
+        w.setCardFilter(startup->result().cardFilter);
+        w.setReady();
+        EventLog::info("startup.ready", nullptr, QString("ms=%1").arg(startupTimer.elapsed()));
+    });
+
+    startupThread.start();
+    int rc = a.exec();
+
+    // Окно закрыли до конца подготовки: run() доработает, поток завершится.
+    startupThread.quit();
+    startupThread.wait();
+    delete startup;
+
+    if (shipper) {
+        QMetaObject::invokeMethod(shipper, "stop", Qt::BlockingQueuedConnection);
+        shipperThread.quit();
+        shipperThread.wait();
+    }
+
+    for (CdcPublisher *publisher : publishers)
+        QMetaObject::invokeMethod(publisher, "stop", Qt::BlockingQueuedConnection);
+    cdcThread.quit();
+    cdcThread.wait();
+
+    ReadSnapshot::close();
+    ShardMap::close();
+    EventLog::stop();
+    return rc;
 }
 
 
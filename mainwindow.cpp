@@ -16,8 +16,18 @@
 #include <QDialog>
 #include <QDialogButtonBox>
 #include <QLabel>
+#include <QDateEdit>
+#include <QComboBox>
+#include <QFormLayout>
+#include <QProgressDialog>
+#include <QSqlDatabase>
+#include <QThread>
 
 #include "admindialog.h"
+#include "atmevents.h"
+#include "shardmap.h"
+#include "statementexporter.h"
+#include "transactionhistorymodel.h"
 
 namespace {
 const QString ADMIN_CARD = "0000000000000000";
@@ -26,12 +36,20 @@ const QString ADMIN_CARD = "0000000000000000";
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
 {
+    m_events = new AtmEvents(this);
+    m_atm.setEvents(m_events);
+
     m_stack = new QStackedWidget(this);
     setCentralWidget(m_stack);
 
     setupLoginPage();
     setupMenuPage();
 
+    connect(m_events, &AtmEvents::transactionCommitted,
+            this, &MainWindow::onTransactionCommitted);
+    connect(m_events, &AtmEvents::balanceChanged,
+            this, &MainWindow::onBalanceChanged);
+
     showLoginPage();
     setWindowTitle("ATM (Qt + SQLite)");
     resize(600, 450);
@@ -41,6 +59,31 @@ MainWindow::~MainWindow()
 {
 }
 
+void MainWindow::setVelocityLimiter(std::shared_ptr<VelocityLimiter> limiter)
+{
+    m_atm.setVelocityLimiter(std::move(limiter));
+}
+
+void MainWindow::setCardFilter(std::shared_ptr<CardFilter> filter)
+{
+    m_cardFilter = filter;
+    m_atm.setCardFilter(std::move(filter));
+}
+
+void MainWindow::setStarting(const QString &stage)
+{
+    m_loginPage->setEnabled(false);
+    m_loginStatusLabel->setText("Запуск: " + stage);
+}
+
+void MainWindow::setReady()
+{
+    m_atm.openStorage();
+    m_loginPage->setEnabled(true);
+    m_loginStatusLabel->clear();
+    m_cardEdit->setFocus();
+}
+
 void MainWindow::setupLoginPage()
 {
     m_loginPage = new QWidget(this);
@@ -98,19 +141,29 @@ void MainWindow::setupMenuPage()
     buttonsRow->addWidget(m_transferButton);
 
     m_historyButton    = new QPushButton("История операций", m_menuPage);
+    m_statementButton  = new QPushButton("Выписка за период", m_menuPage);
     m_changePinButton  = new QPushButton("Сменить PIN", m_menuPage);
     m_logoutButton     = new QPushButton("Завершить сеанс", m_menuPage);
 
-    m_historyList = new QListWidget(m_menuPage);
-    m_historyList->setContextMenuPolicy(Qt::CustomContextMenu);
+    m_historyModel = new TransactionHistoryModel(10, this);
+
+    m_historyView = new QListView(m_menuPage);
+    m_historyView->setModel(m_historyModel);
+    m_historyView->setUniformItemSizes(true);
+    m_historyView->setContextMenuPolicy(Qt::CustomContextMenu);
+
+    m_historyEmptyLabel = new QLabel("Операций пока нет.", m_menuPage);
+    m_historyEmptyLabel->hide();
 
     layout->addWidget(m_balanceLabel);
     layout->addLayout(buttonsRow);
     layout->addWidget(m_historyButton);
+    layout->addWidget(m_statementButton);
     layout->addWidget(m_changePinButton);
     layout->addWidget(m_logoutButton);
     layout->addWidget(new QLabel("Последние операции:", m_menuPage));
-    layout->addWidget(m_historyList);
+    layout->addWidget(m_historyEmptyLabel);
+    layout->addWidget(m_historyView);
     layout->addStretch();
 
     connect(m_withdrawButton, &QPushButton::clicked,
@@ -121,14 +174,23 @@ void MainWindow::setupMenuPage()
             this, &MainWindow::onTransferClicked);
     connect(m_historyButton, &QPushButton::clicked,
             this, &MainWindow::onShowHistoryClicked);
+    connect(m_statementButton, &QPushButton::clicked,
+            this, &MainWindow::onStatementClicked);
     connect(m_changePinButton, &QPushButton::clicked,
             this, &MainWindow::onChangePinClicked);
     connect(m_logoutButton, &QPushButton::clicked,
             this, &MainWindow::onLogoutClicked);
 
-    connect(m_historyList, &QListWidget::customContextMenuRequested,
+    connect(m_historyView, &QListView::customContextMenuRequested,
             this, &MainWindow::onHistoryContextMenuRequested);
 
+    connect(m_historyModel, &TransactionHistoryModel::pageLoaded,
+            this, &MainWindow::updateHistoryPlaceholder);
+    connect(m_historyModel, &TransactionHistoryModel::rowsInserted,
+            this, &MainWindow::updateHistoryPlaceholder);
+    connect(m_historyModel, &TransactionHistoryModel::modelReset,
+            this, &MainWindow::updateHistoryPlaceholder);
+
     m_stack->addWidget(m_menuPage);
 }
 
@@ -143,16 +205,41 @@ void MainWindow::showLoginPage()
 void MainWindow::showMenuPage()
 {
     updateBalanceLabel();
-    m_historyList->clear();
+    onShowHistoryClicked();
     m_stack->setCurrentWidget(m_menuPage);
 }
 
 void MainWindow::updateBalanceLabel()
 {
-    double balance = m_atm.currentBalance();
+    setBalance(m_atm.currentBalance());
+}
+
+void MainWindow::setBalance(double balance)
+{
+    m_balance = balance;
     m_balanceLabel->setText(QString("Баланс: %1").arg(balance, 0, 'f', 2));
 }
 
+void MainWindow::updateHistoryPlaceholder()
+{
+    bool empty = m_historyModel->rowCount() == 0 && m_historyModel->isExhausted()
+                 && m_atm.isLoggedIn();
+    m_historyEmptyLabel->setVisible(empty);
+}
+
+void MainWindow::onTransactionCommitted(const QString &cardNumber,
+                                        const TransactionRecord &record)
+{
+    if (cardNumber == m_atm.currentCardNumber())
+        m_historyModel->prepend(record);
+}
+
+void MainWindow::onBalanceChanged(const QString &cardNumber, double balance)
+{
+    if (cardNumber == m_atm.currentCardNumber())
+        setBalance(balance);
+}
+
 void MainWindow::showError(const QString &msg)
 {
     QMessageBox::warning(this, "Ошибка", msg);
@@ -163,10 +250,7 @@ void MainWindow::showInfo(const QString &msg)
     QMessageBox::information(this, "Информация", msg);
 }
 
-void MainWindow::printReceipt(const QString &operation,
-                              double amount,
-                              double balanceAfter,
-                              const QString &extra)
+void MainWindow::printReceipt(const TransactionRecord &entry, const QString &extra)
 {
     auto reply = QMessageBox::question(
         this,
@@ -183,10 +267,13 @@ void MainWindow::printReceipt(const QString &operation,
     if (maskedCard.size() > 4)
         maskedCard = QString("**** **** **** %1").arg(card.right(4));
 
-    QString timestamp = QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss");
-    QString fileName = QString("receipt_%1_%2.txt")
+    // В журнале время UTC, в чеке — местное.
+    QDateTime localTime = entry.timestamp.toLocalTime();
+    QString timestamp = localTime.toString("yyyyMMdd_hhmmss");
+    QString fileName = QString("receipt_%1_%2_%3.txt")
                            .arg(card.right(4))
-                           .arg(timestamp);
+                           .arg(timestamp)
+                           .arg(entry.id);
 
     QDir dir(QCoreApplication::applicationDirPath() + "/receipts");
     if (!dir.exists()) dir.mkpath(".");
@@ -201,14 +288,14 @@ void MainWindow::printReceipt(const QString &operation,
 
     QTextStream out(&file);
     out << "ATM RECEIPT\n";
-    out << "Date: " << QDateTime::currentDateTime()
-                           .toString("yyyy-MM-dd hh:mm:ss") << "\n";
+    out << "Date: " << localTime.toString("yyyy-MM-dd hh:mm:ss") << "\n";
+    out << "Transaction: " << entry.id << "\n";
     out << "Card: " << maskedCard << "\n";
-    out << "Operation: " << operation << "\n";
-    out << "Amount: " << amount << "\n";
+    out << "Operation: " << QString::fromUtf8(transactionTypeInfo(entry.type).receiptLabel) << "\n";
+    out << "Amount: " << entry.amount << "\n";
     if (!extra.isEmpty())
         out << extra << "\n";
-    out << "Balance after: " << balanceAfter << "\n";
+    out << "Balance after: " << entry.balanceAfter << "\n";
 
     file.close();
 
@@ -232,6 +319,7 @@ void MainWindow::onLoginClicked()
 
     if (card == ADMIN_CARD && pin == "9999") {
         AdminDialog dlg(this);
+        dlg.setCardFilter(m_cardFilter);
         dlg.exec();
         m_pinEdit->clear();
         return;
@@ -247,6 +335,7 @@ void MainWindow::onLoginClicked()
 void MainWindow::onLogoutClicked()
 {
     m_atm.logout();
+    m_historyModel->reset({});
     showLoginPage();
 }
 
@@ -288,16 +377,14 @@ void MainWindow::onWithdrawClicked()
         return;
     }
 
-    if (!m_atm.withdraw(amount)) {
-        showError("Невозможно снять сумму (недостаточно средств или денег в банкомате).");
+    OperationResult result = m_atm.withdraw(amount);
+    if (!result) {
+        showError(QString::fromUtf8(operationErrorInfo(result.error).message));
         return;
     }
 
-    updateBalanceLabel();
-    double newBalance = m_atm.currentBalance();
-
     showInfo("Операция снятия выполнена.");
-    printReceipt("Снятие", amount, newBalance);
+    printReceipt(result.entry);
 }
 
 void MainWindow::onDepositClicked()
@@ -338,57 +425,24 @@ void MainWindow::onDepositClicked()
         return;
     }
 
-    if (!m_atm.deposit(amount)) {
-        showError("Ошибка при пополнении.");
+    OperationResult result = m_atm.deposit(amount);
+    if (!result) {
+        showError(QString::fromUtf8(operationErrorInfo(result.error).message));
         return;
     }
 
-    updateBalanceLabel();
-    double newBalance = m_atm.currentBalance();
-
     showInfo("Счёт пополнен.");
-    printReceipt("Пополнение", amount, newBalance);
+    printReceipt(result.entry);
 }
 
 void MainWindow::onShowHistoryClicked()
 {
-    m_historyList->clear();
-    m_lastTransactions = m_atm.lastTransactions(10);
-
-    for (int i = 0; i < m_lastTransactions.size(); ++i) {
-        const auto &rec = m_lastTransactions[i];
-
-        QString typeText;
-        if (rec.type == "withdraw")
-            typeText = "Снятие";
-        else if (rec.type == "deposit")
-            typeText = "Поступление";
-        else if (rec.type == "transfer_out")
-            typeText = "Перевод (списание)";
-        else if (rec.type == "transfer_in")
-            typeText = "Перевод (зачисление)";
-        else if (rec.type == "pin_change")
-            typeText = "Смена PIN";
-        else if (rec.type == "admin_transfer_out")
-            typeText = "Админ. перевод (списание)";
-        else if (rec.type == "admin_transfer_in")
-            typeText = "Админ. перевод (зачисление)";
-        else
-            typeText = rec.type;
-
-        QString line = QString("%1 | %2 | %3 | баланс после: %4")
-                           .arg(rec.timestamp.toString("yyyy-MM-dd hh:mm:ss"))
-                           .arg(typeText)
-                           .arg(rec.amount, 0, 'f', 2)
-                           .arg(rec.balanceAfter, 0, 'f', 2);
-
-        auto *item = new QListWidgetItem(line);
-        item->setData(Qt::UserRole, i);
-        m_historyList->addItem(item);
-    }
-
-    if (m_lastTransactions.isEmpty())
-        m_historyList->addItem("Операций пока нет.");
+    // Полная перезагрузка только по кнопке: после операций строки
+    // приходят сигналом AtmEvents::transactionCommitted.
+    m_historyModel->reset([this](qint64 beforeId, int limit, HistoryBuffer &page) {
+        return m_atm.lastTransactions(limit, beforeId, page);
+    });
+    m_historyView->scrollToTop();
 }
 
 void MainWindow::onChangePinClicked()
@@ -445,8 +499,9 @@ void MainWindow::onChangePinClicked()
         return;
     }
 
-    if (!m_atm.changePin(oldPin, newPin1)) {
-        showError("Не удалось сменить PIN. Проверьте текущий PIN.");
+    OperationResult result = m_atm.changePin(oldPin, newPin1);
+    if (!result) {
+        showError(QString::fromUtf8(operationErrorInfo(result.error).message));
         return;
     }
 
@@ -509,60 +564,120 @@ void MainWindow::onTransferClicked()
         return;
     }
 
-    if (!m_atm.transferTo(targetCard, amount)) {
-        showError("Не удалось выполнить перевод. Проверьте сумму и номер карты.");
+    OperationResult result = m_atm.transferTo(targetCard, amount);
+    if (!result) {
+        showError(QString::fromUtf8(operationErrorInfo(result.error).message));
         return;
     }
 
-    updateBalanceLabel();
-    double newBalance = m_atm.currentBalance();
-
     showInfo("Перевод выполнен.");
-    printReceipt("Перевод", amount, newBalance,
-                 QString("Получатель: %1").arg(targetCard));
+    printReceipt(result.entry, QString("Получатель: %1").arg(targetCard));
 }
 
 
 void MainWindow::onHistoryContextMenuRequested(const QPoint &pos)
 {
-    QListWidgetItem *item = m_historyList->itemAt(pos);
-    if (!item)
+    QModelIndex index = m_historyView->indexAt(pos);
+    if (!index.isValid())
         return;
 
-    bool ok = false;
-    int idx = item->data(Qt::UserRole).toInt(&ok);
-    if (!ok || idx < 0 || idx >= m_lastTransactions.size())
+    // Копия: пока открыто меню, сверху может добавиться новая строка.
+    std::optional<TransactionRecord> rec = m_historyModel->record(index.row());
+    if (!rec)
         return;
 
     QMenu menu(this);
     QAction *printAct = menu.addAction("Печатать чек");
 
-    QAction *chosen = menu.exec(m_historyList->viewport()->mapToGlobal(pos));
+    QAction *chosen = menu.exec(m_historyView->viewport()->mapToGlobal(pos));
     if (chosen != printAct)
         return;
 
-    const auto &rec = m_lastTransactions[idx];
-
-    QString typeText;
-    if (rec.type == "withdraw")
-        typeText = "Снятие";
-    else if (rec.type == "deposit")
-        typeText = "Поступление";
-    else if (rec.type == "transfer_out")
-        typeText = "Перевод (списание)";
-    else if (rec.type == "transfer_in")
-        typeText = "Перевод (зачисление)";
-    else if (rec.type == "pin_change")
-        typeText = "Смена PIN";
-    else if (rec.type == "admin_transfer_out")
-        typeText = "Админ. перевод (списание)";
-    else if (rec.type == "admin_transfer_in")
-        typeText = "Админ. перевод (зачисление)";
-    else
-        typeText = rec.type;
-
-    printReceipt(typeText, rec.amount, rec.balanceAfter);
+    printReceipt(*rec);
 }
 
+void MainWindow::onStatementClicked()
+{
+    if (!m_atm.isLoggedIn()) {
+        showError("Сначала войдите в систему.");
+        return;
+    }
+
+    QDialog dlg(this);
+    dlg.setWindowTitle("Выписка");
+
+    auto *form = new QFormLayout(&dlg);
+
+    auto *fromEdit = new QDateEdit(QDate::currentDate().addMonths(-1), &dlg);
+    auto *toEdit = new QDateEdit(QDate::currentDate(), &dlg);
+    for (QDateEdit *edit : { fromEdit, toEdit }) {
+        edit->setCalendarPopup(true);
+        edit->setDisplayFormat("yyyy-MM-dd");
+    }
 
+    auto *formatBox = new QComboBox(&dlg);
+    formatBox->addItem("CSV", int(StatementExporter::Format::Csv));
+    formatBox->addItem("Текст для печати", int(StatementExporter::Format::Text));
 
+    auto *buttons = new QDialogButtonBox(QDialogButtonBox::Ok | QDialogButtonBox::Cancel, &dlg);
+
+    form->addRow("С:", fromEdit);
+    form->addRow("По:", toEdit);
+    form->addRow("Формат:", formatBox);
+    form->addRow(buttons);
+
+    connect(buttons, &QDialogButtonBox::accepted, &dlg, &QDialog::accept);
+    connect(buttons, &QDialogButtonBox::rejected, &dlg, &QDialog::reject);
+
+    if (dlg.exec() != QDialog::Accepted)
+        return;
+
+    QDate from = fromEdit->date();
+    QDate to = toEdit->date();
+    if (from > to) {
+        showError("Начало периода позже конца.");
+        return;
+    }
+
+    auto format = StatementExporter::Format(formatBox->currentData().toInt());
+    QString card = m_atm.currentCardNumber();
+    QString path = QCoreApplication::applicationDirPath() + "/statements/"
+                   + StatementExporter::defaultFileName(card, from, to, format);
+
+    // Выгрузка идёт в своём потоке: терминал работает дальше, окно
+    // прогресса не модальное. Файл БД — шард карты.
+    auto *thread = new QThread();
+    auto *exporter = new StatementExporter(ShardMap::databaseFor(card).databaseName(),
+                                           card, from, to, format, path);
+    exporter->moveToThread(thread);
+
+    auto *progress = new QProgressDialog("Формирование выписки...", "Отмена", 0, 100, this);
+    progress->setMinimumDuration(500);
+    progress->setAutoClose(false);
+    progress->setAutoReset(false);
+
+    connect(thread, &QThread::started, exporter, &StatementExporter::run);
+    connect(exporter, &StatementExporter::finished, thread, &QThread::quit);
+    connect(thread, &QThread::finished, exporter, &QObject::deleteLater);
+    connect(thread, &QThread::finished, thread, &QObject::deleteLater);
+
+    connect(progress, &QProgressDialog::canceled, this, [exporter]() { exporter->cancel(); });
+    connect(exporter, &StatementExporter::progress, progress,
+            [progress](int percent, qint64 rows) {
+                progress->setValue(percent);
+                progress->setLabelText(QString("Формирование выписки: строк %1").arg(rows));
+            });
+
+    connect(exporter, &StatementExporter::finished, this,
+            [this, progress](bool ok, qint64 rows, const QString &file) {
+                progress->disconnect();
+                progress->deleteLater();
+
+                if (ok)
+                    showInfo(QString("Выписка сохранена (%1 строк):\n%2").arg(rows).arg(file));
+                else
+                    showError("Выписка не сформирована.");
+            });
+
+    thread->start();
+}
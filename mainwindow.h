@@ -6,12 +6,16 @@
 #include <QLineEdit>
 #include <QPushButton>
 #include <QLabel>
-#include <QListWidget>
+#include <QListView>
 #include <QList>
 #include <QPoint>
 
 #include "atmcontroller.h"
 
+class AtmEvents;
+class CardFilter;
+class TransactionHistoryModel;
+
 class MainWindow : public QMainWindow
 {
     Q_OBJECT
@@ -20,6 +24,14 @@ public:
     MainWindow(QWidget *parent = nullptr);
     ~MainWindow();
 
+    void setVelocityLimiter(std::shared_ptr<VelocityLimiter> limiter);
+    void setCardFilter(std::shared_ptr<CardFilter> filter);
+
+    // Пока БД готовится в фоне, вход недоступен, а на странице входа —
+    // текущий этап. setReady открывает хранилище терминала.
+    void setStarting(const QString &stage);
+    void setReady();
+
 private slots:
     void onLoginClicked();
     void onLogoutClicked();
@@ -29,21 +41,26 @@ private slots:
     void onShowHistoryClicked();
     void onChangePinClicked();
     void onTransferClicked();
+    void onStatementClicked();
 
     void onHistoryContextMenuRequested(const QPoint &pos);
 
+    void onTransactionCommitted(const QString &cardNumber,
+                                const TransactionRecord &record);
+    void onBalanceChanged(const QString &cardNumber, double balance);
+
 private:
     void setupLoginPage();
     void setupMenuPage();
     void showLoginPage();
     void showMenuPage();
     void updateBalanceLabel();
+    void setBalance(double balance);
+    void updateHistoryPlaceholder();
     void showError(const QString &msg);
     void showInfo(const QString &msg);
-    void printReceipt(const QString &operation,
-                      double amount,
-                      double balanceAfter,
-                      const QString &extra = QString());
+    // Чек по зафиксированной строке журнала: время, id и остаток — из неё.
+    void printReceipt(const TransactionRecord &entry, const QString &extra = QString());
 
     QWidget *m_loginPage = nullptr;
     QWidget *m_menuPage  = nullptr;
@@ -54,19 +71,24 @@ private:
     QLineEdit *m_pinEdit  = nullptr;
     QLabel    *m_loginStatusLabel = nullptr;
 
-    QLabel      *m_balanceLabel = nullptr;
-    QListWidget *m_historyList  = nullptr;
+    QLabel    *m_balanceLabel = nullptr;
+    QListView *m_historyView  = nullptr;
+    QLabel    *m_historyEmptyLabel = nullptr;
 
     QPushButton *m_withdrawButton   = nullptr;
     QPushButton *m_depositButton    = nullptr;
     QPushButton *m_historyButton    = nullptr;
     QPushButton *m_changePinButton  = nullptr;
     QPushButton *m_transferButton   = nullptr;
+    QPushButton *m_statementButton  = nullptr;
     QPushButton *m_logoutButton     = nullptr;
 
     AtmController m_atm;
+    AtmEvents *m_events = nullptr;
+    std::shared_ptr<CardFilter> m_cardFilter;
+    TransactionHistoryModel *m_historyModel = nullptr;
 
-    QList<AtmController::TransactionRecord> m_lastTransactions;
+    double m_balance = 0.0;
 };
 
 #endif // MAINWINDOW_H
@@ -0,0 +1,468 @@
+#include "memorystore.h"
+
+#include <QElapsedTimer>
+
+#include <algorithm>
+#include <cmath>
+
+#include "cardkey.h"
+#include "historybuffer.h"
+
+MemoryStore::MemoryStore(int expectedAccounts)
+{
+    int capacity = 16;
+    while (capacity < expectedAccounts * 2)
+        capacity <<= 1;
+    m_slots.resize(capacity);
+}
+
+quint64 MemoryStore::mix(quint64 key)
+{
+    // Финализатор splitmix64: соседние номера карт расходятся по таблице.
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebULL;
+    key ^= key >> 31;
+    return key;
+}
+
+int MemoryStore::stripeOf(quint64 key) const
+{
+    return int((mix(key) >> 32) % StripeCount);
+}
+
+int MemoryStore::findSlot(quint64 key) const
+{
+    const quint64 mask = m_slots.size() - 1;
+    quint64 i = mix(key) & mask;
+
+    // Заполнение не выше половины, поэтому пустой слот всегда найдётся.
+    while (m_slots[i].state != Slot::Empty) {
+        if (m_slots[i].key == key)
+            return int(i);
+        i = (i + 1) & mask;
+    }
+    return -1;
+}
+
+void MemoryStore::rehash(int capacity)
+{
+    std::vector<Slot> old;
+    old.swap(m_slots);
+    m_slots.resize(capacity);
+
+    const quint64 mask = quint64(capacity) - 1;
+    for (Slot &slot : old) {
+        if (slot.state != Slot::Used)
+            continue;
+        quint64 i = mix(slot.key) & mask;
+        while (m_slots[i].state != Slot::Empty)
+            i = (i + 1) & mask;
+        m_slots[i] = std::move(slot);
+    }
+}
+
+AccountRecord MemoryStore::toRecord(const Slot &slot) const
+{
+    AccountRecord rec;
+    rec.cardNumber = cardNumberFromKey(qint64(slot.key));
+    rec.pinHash = slot.pinHash;
+    rec.balance = slot.balance;
+    rec.failedAttempts = slot.failedAttempts;
+    if (slot.lockedUntilMs != 0)
+        rec.lockedUntil = QDateTime::fromMSecsSinceEpoch(slot.lockedUntilMs);
+    return rec;
+}
+
+TransactionRecord MemoryStore::appendLocked(Slot &slot, TransactionType type,
+                                            double amount, double balanceAfter,
+                                            qint64 operationId)
+{
+    std::lock_guard<std::mutex> ledger(m_ledgerLock);
+
+    if (operationId == 0)
+        operationId = ++m_lastOperation;
+    m_ledger.push_back({ slot.key, amount, balanceAfter,
+                         QDateTime::currentMSecsSinceEpoch(), slot.lastEntry,
+                         operationId, type });
+    slot.lastEntry = qint64(m_ledger.size()) - 1;
+    return toTransaction(slot.lastEntry);
+}
+
+TransactionRecord MemoryStore::toTransaction(qint64 index) const
+{
+    const LedgerEntry &entry = m_ledger[index];
+    TransactionRecord rec;
+    rec.id = index + 1;
+    rec.operationId = entry.operationId;
+    rec.type = entry.type;
+    rec.amount = entry.amount;
+    rec.balanceAfter = entry.balanceAfter;
+    rec.timestamp = QDateTime::fromMSecsSinceEpoch(entry.timestampMs);
+    return rec;
+}
+
+std::optional<AccountRecord> MemoryStore::account(const QString &cardNumber) const
+{
+    quint64 key;
+    if (!cardKeyStrict(cardNumber, key))
+        return std::nullopt;
+
+    std::shared_lock<std::shared_mutex> table(m_tableLock);
+    int i = findSlot(key);
+    if (i < 0)
+        return std::nullopt;
+
+    std::lock_guard<std::mutex> stripe(m_stripes[stripeOf(key)]);
+    return toRecord(m_slots[i]);
+}
+
+bool MemoryStore::addAccount(const AccountRecord &account)
+{
+    quint64 key;
+    if (!cardKeyStrict(account.cardNumber, key))
+        return false;
+
+    std::unique_lock<std::shared_mutex> table(m_tableLock);
+    if (findSlot(key) >= 0)
+        return false;
+
+    if ((m_used + 1) * 2 > int(m_slots.size()))
+        rehash(int(m_slots.size()) * 2);
+
+    const quint64 mask = m_slots.size() - 1;
+    quint64 i = mix(key) & mask;
+    while (m_slots[i].state != Slot::Empty)
+        i = (i + 1) & mask;
+
+    Slot &slot = m_slots[i];
+    slot.key = key;
+    slot.state = Slot::Used;
+    slot.pinHash = account.pinHash;
+    slot.balance = account.balance;
+    slot.failedAttempts = account.failedAttempts;
+    slot.lockedUntilMs = account.lockedUntil.isValid()
+                             ? account.lockedUntil.toMSecsSinceEpoch() : 0;
+    slot.lastEntry = -1;
+    ++m_used;
+    return true;
+}
+
+bool MemoryStore::setLoginState(const QString &cardNumber,
+                                int failedAttempts,
+                                const QDateTime &lockedUntil)
+{
+    quint64 key;
+    if (!cardKeyStrict(cardNumber, key))
+        return false;
+
+    std::shared_lock<std::shared_mutex> table(m_tableLock);
+    int i = findSlot(key);
+    if (i < 0)
+        return false;
+
+    std::lock_guard<std::mutex> stripe(m_stripes[stripeOf(key)]);
+    m_slots[i].failedAttempts = failedAttempts;
+    m_slots[i].lockedUntilMs = lockedUntil.isValid() ? lockedUntil.toMSecsSinceEpoch() : 0;
+    return true;
+}
+
+bool MemoryStore::changePin(const QString &cardNumber,
+                            const QString &oldPinHash,
+                            const QString &newPinHash,
+                            OperationResult &result)
+{
+    quint64 key;
+    if (!cardKeyStrict(cardNumber, key))
+        return result.fail(OperationError::InvalidCard);
+
+    QElapsedTimer phase;
+    phase.start();
+
+    std::shared_lock<std::shared_mutex> table(m_tableLock);
+    int i = findSlot(key);
+    if (i < 0)
+        return result.fail(OperationError::AccountNotFound);
+
+    std::lock_guard<std::mutex> stripe(m_stripes[stripeOf(key)]);
+    result.timings.lockNs = phase.nsecsElapsed();
+
+    Slot &slot = m_slots[i];
+    if (slot.pinHash != oldPinHash)
+        return result.fail(OperationError::WrongPin);
+
+    slot.pinHash = newPinHash;
+    slot.failedAttempts = 0;
+    slot.lockedUntilMs = 0;
+    result.entry = appendLocked(slot, TransactionType::PinChange, 0.0, slot.balance);
+    result.timings.writeNs = phase.nsecsElapsed() - result.timings.lockNs;
+    return true;
+}
+
+std::optional<double> MemoryStore::balance(const QString &cardNumber) const
+{
+    quint64 key;
+    if (!cardKeyStrict(cardNumber, key))
+        return std::nullopt;
+
+    std::shared_lock<std::shared_mutex> table(m_tableLock);
+    int i = findSlot(key);
+    if (i < 0)
+        return std::nullopt;
+
+    std::lock_guard<std::mutex> stripe(m_stripes[stripeOf(key)]);
+    return m_slots[i].balance;
+}
+
+double MemoryStore::atmCash() const
+{
+    std::lock_guard<std::mutex> cash(m_cashLock);
+    return m_atmCash;
+}
+
+bool MemoryStore::setAtmCash(double cash)
+{
+    std::lock_guard<std::mutex> lock(m_cashLock);
+    m_atmCash = cash;
+    return true;
+}
+
+bool MemoryStore::withdraw(const QString &cardNumber, double amount, OperationResult &result)
+{
+    quint64 key;
+    if (!cardKeyStrict(cardNumber, key))
+        return result.fail(OperationError::InvalidCard);
+
+    QElapsedTimer phase;
+    phase.start();
+
+    std::shared_lock<std::shared_mutex> table(m_tableLock);
+    int i = findSlot(key);
+    if (i < 0)
+        return result.fail(OperationError::AccountNotFound);
+
+    std::lock_guard<std::mutex> stripe(m_stripes[stripeOf(key)]);
+    std::lock_guard<std::mutex> cash(m_cashLock);
+    result.timings.lockNs = phase.nsecsElapsed();
+
+    Slot &slot = m_slots[i];
+    if (amount > slot.balance)
+        return result.fail(OperationError::InsufficientFunds);
+    if (amount > m_atmCash)
+        return result.fail(OperationError::AtmOutOfCash);
+
+    slot.balance -= amount;
+    m_atmCash -= amount;
+    result.entry = appendLocked(slot, TransactionType::Withdraw, amount, slot.balance);
+    result.timings.writeNs = phase.nsecsElapsed() - result.timings.lockNs;
+    return true;
+}
+
+bool MemoryStore::deposit(const QString &cardNumber, double amount, OperationResult &result)
+{
+    quint64 key;
+    if (!cardKeyStrict(cardNumber, key))
+        return result.fail(OperationError::InvalidCard);
+
+    QElapsedTimer phase;
+    phase.start();
+
+    std::shared_lock<std::shared_mutex> table(m_tableLock);
+    int i = findSlot(key);
+    if (i < 0)
+        return result.fail(OperationError::AccountNotFound);
+
+    std::lock_guard<std::mutex> stripe(m_stripes[stripeOf(key)]);
+    result.timings.lockNs = phase.nsecsElapsed();
+
+    Slot &slot = m_slots[i];
+    slot.balance += amount;
+    result.entry = appendLocked(slot, TransactionType::Deposit, amount, slot.balance);
+    result.timings.writeNs = phase.nsecsElapsed() - result.timings.lockNs;
+    return true;
+}
+
+bool MemoryStore::transfer(const QString &fromCard,
+                           const QString &toCard,
+                           double amount,
+                           TransactionType outType,
+                           TransactionType inType,
+                           OperationResult &result)
+{
+    quint64 fromKey, targetKey;
+    if (!cardKeyStrict(fromCard, fromKey) || !cardKeyStrict(toCard, targetKey))
+        return result.fail(OperationError::InvalidCard);
+    if (fromKey == targetKey)
+        return result.fail(OperationError::SameCard);
+
+    QElapsedTimer phase;
+    phase.start();
+
+    std::shared_lock<std::shared_mutex> table(m_tableLock);
+    int from = findSlot(fromKey);
+    int to = findSlot(targetKey);
+    if (from < 0 || to < 0)
+        return result.fail(OperationError::AccountNotFound);
+
+    int first = std::min(stripeOf(fromKey), stripeOf(targetKey));
+    int second = std::max(stripeOf(fromKey), stripeOf(targetKey));
+
+    std::unique_lock<std::mutex> firstLock(m_stripes[first]);
+    std::unique_lock<std::mutex> secondLock;
+    if (second != first)
+        secondLock = std::unique_lock<std::mutex>(m_stripes[second]);
+
+    result.timings.lockNs = phase.nsecsElapsed();
+
+    Slot &source = m_slots[from];
+    Slot &target = m_slots[to];
+    if (amount > source.balance)
+        return result.fail(OperationError::InsufficientFunds);
+
+    source.balance -= amount;
+    target.balance += amount;
+    result.entry = appendLocked(source, outType, amount, source.balance);
+    appendLocked(target, inType, amount, target.balance, result.entry.operationId);
+    result.timings.writeNs = phase.nsecsElapsed() - result.timings.lockNs;
+    return true;
+}
+
+void MemoryStore::forEachAccount(
+    const std::function<void(const AccountRecord &)> &visit) const
+{
+    std::shared_lock<std::shared_mutex> table(m_tableLock);
+
+    for (const Slot &slot : m_slots) {
+        if (slot.state != Slot::Used)
+            continue;
+
+        AccountRecord rec;
+        {
+            std::lock_guard<std::mutex> stripe(m_stripes[stripeOf(slot.key)]);
+            rec = toRecord(slot);
+        }
+        visit(rec);
+    }
+}
+
+bool MemoryStore::append(const QString &cardNumber,
+                         TransactionType type,
+                         double amount,
+                         double balanceAfter,
+                         TransactionRecord &entry)
+{
+    quint64 key;
+    if (!cardKeyStrict(cardNumber, key))
+        return false;
+
+    std::shared_lock<std::shared_mutex> table(m_tableLock);
+    int i = findSlot(key);
+    if (i < 0)
+        return false;
+
+    std::lock_guard<std::mutex> stripe(m_stripes[stripeOf(key)]);
+    entry = appendLocked(m_slots[i], type, amount, balanceAfter);
+    return true;
+}
+
+QList<TransactionRecord> MemoryStore::history(const QString &cardNumber,
+                                              int limit,
+                                              qint64 beforeId) const
+{
+    QList<TransactionRecord> list;
+
+    quint64 key;
+    if (!cardKeyStrict(cardNumber, key))
+        return list;
+
+    std::shared_lock<std::shared_mutex> table(m_tableLock);
+    int i = findSlot(key);
+    if (i < 0)
+        return list;
+
+    std::lock_guard<std::mutex> stripe(m_stripes[stripeOf(key)]);
+    std::lock_guard<std::mutex> ledger(m_ledgerLock);
+
+    qint64 e = m_slots[i].lastEntry;
+    while (e >= 0 && beforeId > 0 && e + 1 >= beforeId)
+        e = m_ledger[e].previousForCard;
+
+    for (; e >= 0 && list.size() < limit; e = m_ledger[e].previousForCard)
+        list.append(toTransaction(e));
+
+    return list;
+}
+
+bool MemoryStore::historyInto(const QString &cardNumber,
+                              int limit,
+                              qint64 beforeId,
+                              HistoryBuffer &out) const
+{
+    quint64 key;
+    if (!cardKeyStrict(cardNumber, key))
+        return true;
+
+    std::shared_lock<std::shared_mutex> table(m_tableLock);
+    int i = findSlot(key);
+    if (i < 0)
+        return true;
+
+    std::lock_guard<std::mutex> stripe(m_stripes[stripeOf(key)]);
+    std::lock_guard<std::mutex> ledger(m_ledgerLock);
+
+    qint64 e = m_slots[i].lastEntry;
+    while (e >= 0 && beforeId > 0 && e + 1 >= beforeId)
+        e = m_ledger[e].previousForCard;
+
+    out.reserve(out.size() + limit);
+    for (int rows = 0; e >= 0 && rows < limit; e = m_ledger[e].previousForCard, ++rows) {
+        const LedgerEntry &entry = m_ledger[e];
+        out.append(e + 1, entry.operationId, entry.type,
+                   std::llround(entry.amount * 100.0), std::llround(entry.balanceAfter * 100.0),
+                   entry.timestampMs / 1000);
+    }
+    return true;
+}
+
+std::optional<double> MemoryStore::balanceAt(const QString &cardNumber,
+                                             const QDateTime &at) const
+{
+    quint64 key;
+    if (!cardKeyStrict(cardNumber, key))
+        return std::nullopt;
+
+    std::shared_lock<std::shared_mutex> table(m_tableLock);
+    int i = findSlot(key);
+    if (i < 0)
+        return std::nullopt;
+
+    std::lock_guard<std::mutex> stripe(m_stripes[stripeOf(key)]);
+    std::lock_guard<std::mutex> ledger(m_ledgerLock);
+
+    qint64 atMs = at.toMSecsSinceEpoch();
+    qint64 first = -1;
+    for (qint64 e = m_slots[i].lastEntry; e >= 0; e = m_ledger[e].previousForCard) {
+        if (m_ledger[e].timestampMs <= atMs)
+            return m_ledger[e].balanceAfter;
+        first = e;
+    }
+
+    if (first < 0)
+        return std::nullopt;
+
+    const LedgerEntry &entry = m_ledger[first];
+    return entry.balanceAfter - transactionTypeInfo(entry.type).balanceSign * entry.amount;
+}
+
+void MemoryStore::forEachEntry(
+    const std::function<void(const QString &cardNumber,
+                             const TransactionRecord &)> &visit) const
+{
+    // Обход под блокировкой журнала: посетитель не должен обращаться
+    // к этому же хранилищу.
+    std::lock_guard<std::mutex> ledger(m_ledgerLock);
+
+    for (size_t e = 0; e < m_ledger.size(); ++e)
+        visit(cardNumberFromKey(qint64(m_ledger[e].key)), toTransaction(qint64(e)));
+}
@@ -0,0 +1,134 @@
+#ifndef MEMORYSTORE_H
+#define MEMORYSTORE_H
+
+#include <array>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+
+#include "storage.h"
+
+// Хранилище целиком в памяти: для нагрузочных прогонов без диска и как
+// основа кэша перед SQLite.
+//
+// Счета лежат в хэш-таблице с открытой адресацией по 64-битному ключу
+// (16-значный номер карты помещается в quint64). Денежные операции
+// берут только мьютекс полосы своей карты (lock striping), поэтому
+// операции по разным картам идут параллельно. Добавление счёта может
+// перестроить таблицу и берёт её эксклюзивно.
+//
+// Порядок блокировок: таблица (shared) -> полосы по возрастанию ->
+// наличность -> журнал.
+class MemoryStore : public AccountStore, public LedgerStore
+{
+public:
+    explicit MemoryStore(int expectedAccounts = 1024);
+
+    std::optional<AccountRecord> account(const QString &cardNumber) const override;
+    bool addAccount(const AccountRecord &account) override;
+
+    bool setLoginState(const QString &cardNumber,
+                       int failedAttempts,
+                       const QDateTime &lockedUntil) override;
+    bool changePin(const QString &cardNumber,
+                   const QString &oldPinHash,
+                   const QString &newPinHash,
+                   OperationResult &result) override;
+
+    std::optional<double> balance(const QString &cardNumber) const override;
+
+    double atmCash() const override;
+    bool setAtmCash(double cash) override;
+
+    bool withdraw(const QString &cardNumber,
+                  double amount,
+                  OperationResult &result) override;
+    bool deposit(const QString &cardNumber,
+                 double amount,
+                 OperationResult &result) override;
+    bool transfer(const QString &fromCard,
+                  const QString &toCard,
+                  double amount,
+                  TransactionType outType,
+                  TransactionType inType,
+                  OperationResult &result) override;
+
+    void forEachAccount(
+        const std::function<void(const AccountRecord &)> &visit) const override;
+
+    bool append(const QString &cardNumber,
+                TransactionType type,
+                double amount,
+                double balanceAfter,
+                TransactionRecord &entry) override;
+
+    QList<TransactionRecord> history(const QString &cardNumber,
+                                     int limit,
+                                     qint64 beforeId) const override;
+    bool historyInto(const QString &cardNumber,
+                     int limit,
+                     qint64 beforeId,
+                     HistoryBuffer &out) const override;
+
+    std::optional<double> balanceAt(const QString &cardNumber,
+                                    const QDateTime &at) const override;
+
+    void forEachEntry(
+        const std::function<void(const QString &cardNumber,
+                                 const TransactionRecord &)> &visit) const override;
+
+private:
+    static constexpr int StripeCount = 64;
+
+    struct Slot {
+        enum State : quint8 { Empty, Used };
+
+        quint64 key = 0;
+        State state = Empty;
+        int failedAttempts = 0;
+        double balance = 0.0;
+        qint64 lockedUntilMs = 0;   // 0 — не заблокирована
+        qint64 lastEntry = -1;      // индекс последней строки журнала карты
+        QString pinHash;
+    };
+
+    struct LedgerEntry {
+        quint64 key;
+        double amount;
+        double balanceAfter;
+        qint64 timestampMs;
+        qint64 previousForCard;     // цепочка строк одной карты
+        qint64 operationId;
+        TransactionType type;
+    };
+
+    static quint64 mix(quint64 key);
+
+    int stripeOf(quint64 key) const;
+    int findSlot(quint64 key) const;
+    void rehash(int capacity);
+
+    AccountRecord toRecord(const Slot &slot) const;
+    // Вызывается под мьютексом полосы карты; журнал блокирует сам.
+    // operationId = 0 — новая операция.
+    TransactionRecord appendLocked(Slot &slot, TransactionType type,
+                                   double amount, double balanceAfter,
+                                   qint64 operationId = 0);
+    // Под мьютексом журнала.
+    TransactionRecord toTransaction(qint64 index) const;
+
+    mutable std::shared_mutex m_tableLock;
+    mutable std::array<std::mutex, StripeCount> m_stripes;
+    std::vector<Slot> m_slots;
+    int m_used = 0;
+
+    mutable std::mutex m_cashLock;
+    double m_atmCash = 0.0;
+
+    mutable std::mutex m_ledgerLock;
+    std::deque<LedgerEntry> m_ledger;
+    qint64 m_lastOperation = 0;
+};
+
+#endif // MEMORYSTORE_H
@@ -0,0 +1,67 @@
+#ifndef OPERATIONERROR_H
+#define OPERATIONERROR_H
+
+#include <QtGlobal>
+
+#include <cstddef>
+
+// Причина отказа операции терминала. Код пишется в журнал событий, текст
+// показывается держателю карты.
+enum class OperationError : quint8 {
+    None              = 0,
+    NotLoggedIn       = 1,
+    InvalidAmount     = 2,
+    InvalidCard       = 3,
+    AccountNotFound   = 4,
+    SameCard          = 5,
+    InsufficientFunds = 6,
+    AtmOutOfCash      = 7,
+    LimitExceeded     = 8,
+    WrongPin          = 9,
+    InvalidPin        = 10,
+    DatabaseBusy      = 11,
+    StorageFailed     = 12,
+};
+
+struct OperationErrorInfo {
+    OperationError error;
+    const char *code;      // журнал событий
+    const char *message;   // сообщение на экране терминала
+};
+
+constexpr OperationErrorInfo OPERATION_ERRORS[] = {
+    { OperationError::None,              "ok",                 "Операция выполнена." },
+    { OperationError::NotLoggedIn,       "not_logged_in",      "Сначала войдите в систему." },
+    { OperationError::InvalidAmount,     "invalid_amount",     "Некорректная сумма." },
+    { OperationError::InvalidCard,       "invalid_card",       "Некорректный номер карты." },
+    { OperationError::AccountNotFound,   "account_not_found",  "Карта не найдена." },
+    { OperationError::SameCard,          "same_card",          "Нельзя перевести на ту же карту." },
+    { OperationError::InsufficientFunds, "insufficient_funds", "Недостаточно средств на счёте." },
+    { OperationError::AtmOutOfCash,      "atm_out_of_cash",    "В банкомате недостаточно наличных." },
+    { OperationError::LimitExceeded,     "limit_exceeded",     "Превышен лимит операций по карте." },
+    { OperationError::WrongPin,          "wrong_pin",          "Неверный текущий PIN." },
+    { OperationError::InvalidPin,        "invalid_pin",        "Некорректный новый PIN." },
+    { OperationError::DatabaseBusy,      "database_busy",      "Система занята, повторите операцию." },
+    { OperationError::StorageFailed,     "storage_failed",     "Ошибка хранилища, операция не выполнена." },
+};
+
+constexpr std::size_t OPERATION_ERROR_COUNT =
+    sizeof(OPERATION_ERRORS) / sizeof(OPERATION_ERRORS[0]);
+
+constexpr bool operationErrorsIndexed()
+{
+    for (std::size_t i = 0; i < OPERATION_ERROR_COUNT; ++i) {
+        if (std::size_t(OPERATION_ERRORS[i].error) != i)
+            return false;
+    }
+    return true;
+}
+static_assert(operationErrorsIndexed(), "OPERATION_ERRORS must be indexed by code");
+
+constexpr const OperationErrorInfo &operationErrorInfo(OperationError error)
+{
+    return std::size_t(error) < OPERATION_ERROR_COUNT ? OPERATION_ERRORS[std::size_t(error)]
+                                                      : OPERATION_ERRORS[std::size_t(OperationError::StorageFailed)];
+}
+
+#endif // OPERATIONERROR_H
@@ -0,0 +1,72 @@
+#include "readsnapshot.h"
+
+#include <QSqlError>
+
+#include "eventlog.h"
+
+namespace {
+const QString READ_CONNECTION = "atm_read";
+int g_openSnapshots = 0;
+}
+
+bool ReadSnapshot::open(const QString &databasePath)
+{
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", READ_CONNECTION);
+    db.setDatabaseName(databasePath);
+    // URI нужен для ATTACH архивных разделов, как и у основного соединения.
+    db.setConnectOptions("QSQLITE_OPEN_READONLY;QSQLITE_OPEN_URI;QSQLITE_BUSY_TIMEOUT=5000");
+
+    if (!db.open()) {
+        EventLog::error("db.open_failed", "read connection", db.lastError().text());
+        QSqlDatabase::removeDatabase(READ_CONNECTION);
+        return false;
+    }
+
+    return true;
+}
+
+void ReadSnapshot::close()
+{
+    if (!QSqlDatabase::contains(READ_CONNECTION))
+        return;
+
+    QSqlDatabase::database(READ_CONNECTION, false).close();
+    QSqlDatabase::removeDatabase(READ_CONNECTION);
+}
+
+QString ReadSnapshot::connectionName()
+{
+    return READ_CONNECTION;
+}
+
+bool ReadSnapshot::isActive(const QSqlDatabase &db)
+{
+    return g_openSnapshots > 0 && db.connectionName() == READ_CONNECTION;
+}
+
+ReadSnapshot::ReadSnapshot()
+{
+    if (QSqlDatabase::contains(READ_CONNECTION))
+        m_db = QSqlDatabase::database(READ_CONNECTION);
+
+    if (!m_db.isOpen()) {
+        m_db = QSqlDatabase::database();
+        return;
+    }
+
+    // BEGIN DEFERRED: снимок фиксируется первым SELECT и держится до
+    // деструктора.
+    m_active = m_db.transaction();
+    if (m_active)
+        ++g_openSnapshots;
+    else
+        EventLog::warning("tx.begin_failed", "BEGIN read", m_db.lastError().text());
+}
+
+ReadSnapshot::~ReadSnapshot()
+{
+    if (m_active) {
+        m_db.rollback();
+        --g_openSnapshots;
+    }
+}
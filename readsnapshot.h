@@ -0,0 +1,38 @@
+#ifndef READSNAPSHOT_H
+#define READSNAPSHOT_H
+
+#include <QString>
+#include <QSqlDatabase>
+
+// Отдельное соединение только для чтения к atm.db (поток GUI). В режиме
+// WAL читатель работает со своим снимком и не держит блокировок, которые
+// ждали бы пишущие операции терминала.
+//
+// Объект ReadSnapshot открывает транзакцию чтения: все запросы внутри
+// одного обновления экрана видят одно и то же состояние БД. Архивные
+// разделы под снимком не читаются: DETACH внутри транзакции не проходит.
+class ReadSnapshot
+{
+public:
+    static bool open(const QString &databasePath);
+    static void close();
+    static QString connectionName();
+    // Открыт ли снимок на этом соединении (только поток GUI).
+    static bool isActive(const QSqlDatabase &db);
+
+    ReadSnapshot();
+    ~ReadSnapshot();
+
+    ReadSnapshot(const ReadSnapshot &) = delete;
+    ReadSnapshot &operator=(const ReadSnapshot &) = delete;
+
+    // Соединение читателя; если оно не открыто — соединение по умолчанию
+    // без снимка.
+    QSqlDatabase database() const { return m_db; }
+
+private:
+    QSqlDatabase m_db;
+    bool m_active = false;
+};
+
+#endif // READSNAPSHOT_H
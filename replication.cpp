@@ -0,0 +1,469 @@
+#include "replication.h"
+
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QVariant>
+#include <QStringList>
+#include <QFileInfo>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QDataStream>
+#include <QDateTime>
+#include <QTimer>
+
+#include <atomic>
+
+#include "databasebackup.h"
+#include "eventlog.h"
+#include "shardmap.h"
+
+namespace {
+// Всё, что нужно терминалу после переключения на резерв. Служебные
+// таблицы (replication_log, sqlite_sequence) не реплицируются.
+const QStringList TABLES = {
+    "accounts", "atm_state", "card_limits", "archive_partitions",
+    "ledger_operations", "transactions", "audit_log", "eod_runs", "eod_chunks",
+    "cash_rollups",
+};
+const QStringList EVENTS = { "INSERT", "UPDATE", "DELETE" };
+const QString TRIGGER = "repl_%1_%2";
+const QString CONNECTION = "replication_%1";
+const QString NOW_MS = "CAST((julianday('now') - 2440587.5) * 86400000 AS INTEGER)";
+const int RECORDS_PER_SEGMENT = 10000;
+const quint32 SEGMENT_MAGIC = 0x41544d52;   // "ATMR"
+const QString HEARTBEAT_FILE = "heartbeat";
+
+std::atomic<int> g_nextConnection{0};
+
+QString triggerName(const QString &table, const QString &event)
+{
+    return TRIGGER.arg(table, event.toLower());
+}
+
+bool tableColumns(const QSqlDatabase &db, const QString &table,
+                  QStringList &columns, QStringList &keys)
+{
+    QSqlQuery q(db);
+    if (!q.exec("PRAGMA table_info(" + table + ")")) {
+        EventLog::error("sql.failed", "PRAGMA table_info", q.lastError().text());
+        return false;
+    }
+    while (q.next()) {
+        columns.append(q.value(1).toString());
+        if (q.value(5).toInt() > 0)
+            keys.append(q.value(1).toString());
+    }
+    if (keys.isEmpty()) {
+        EventLog::error("replication.no_key", nullptr, table);
+        return false;
+    }
+    return true;
+}
+
+// 'INSERT OR REPLACE INTO t (a, b) VALUES (' || quote(NEW.a) || ', ' || ... || ')'.
+// quote() записывает REAL без потери точности.
+QString rowImage(const QString &table, const QStringList &columns)
+{
+    QStringList values;
+    for (const QString &column : columns)
+        values.append("quote(NEW." + column + ")");
+    return QString("'INSERT OR REPLACE INTO %1 (%2) VALUES (' || %3 || ')'")
+        .arg(table, columns.join(", "), values.join(" || ', ' || "));
+}
+
+QString deleteByKey(const QString &table, const QStringList &keys)
+{
+    QStringList conditions;
+    for (const QString &key : keys)
+        conditions.append(QString("'%1 = ' || quote(OLD.%1)").arg(key));
+    return QString("'DELETE FROM %1 WHERE ' || %2")
+        .arg(table, conditions.join(" || ' AND ' || "));
+}
+
+bool dropTriggers(QSqlQuery &q)
+{
+    for (const QString &table : TABLES) {
+        for (const QString &event : EVENTS) {
+            if (!q.exec("DROP TRIGGER IF EXISTS " + triggerName(table, event))) {
+                EventLog::error("sql.failed", "DROP TRIGGER", q.lastError().text());
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Захват пишет журнал одного файла. При нескольких шардах счета и операции
+// шардов 1..N на резерв не попали бы, а нога наличных в шарде 0 — попала бы.
+bool isSharded(const QString &databasePath)
+{
+    const QString config = ShardMap::configPath(databasePath);
+    if (!QFileInfo::exists(config))
+        return false;
+
+    ShardMap map;
+    QString error;
+    if (!ShardMap::parse(config, map, error)) {
+        EventLog::error("shard.config_invalid", nullptr, config + ": " + error);
+        return true;
+    }
+    return map.count() > 1;
+}
+
+bool openConnection(const QString &connectionName, const QString &path)
+{
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+    db.setDatabaseName(path);
+    db.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000");
+
+    if (!db.open()) {
+        EventLog::error("db.open_failed", "replication connection", db.lastError().text());
+        return false;
+    }
+    return true;
+}
+}
+
+bool Replication::enableCapture(QSqlDatabase &db)
+{
+    if (isSharded(db.databaseName())) {
+        EventLog::error("replication.sharded", nullptr, db.databaseName());
+        return false;
+    }
+
+    // Триггеры пересоздаются в одной транзакции записи: между удалением
+    // старого и созданием нового ни одно изменение не проскочит мимо журнала.
+    QSqlQuery q(db);
+    if (!q.exec("BEGIN IMMEDIATE")) {
+        EventLog::error("tx.begin_failed", "BEGIN IMMEDIATE", q.lastError().text());
+        return false;
+    }
+
+    bool ok = dropTriggers(q);
+    for (const QString &table : TABLES) {
+        QStringList columns;
+        QStringList keys;
+        ok = ok && tableColumns(db, table, columns, keys);
+        if (!ok)
+            break;
+
+        for (const QString &event : EVENTS) {
+            QString statement = event == "DELETE" ? deleteByKey(table, keys)
+                                                  : rowImage(table, columns);
+            ok = q.exec(QString("CREATE TRIGGER %1 AFTER %2 ON %3 BEGIN "
+                                "INSERT INTO replication_log (ts_ms, stmt) VALUES (%4, %5); "
+                                "END")
+                            .arg(triggerName(table, event), event, table, NOW_MS, statement));
+            if (!ok) {
+                EventLog::error("sql.failed", "CREATE TRIGGER", q.lastError().text());
+                break;
+            }
+        }
+    }
+
+    if (!ok) {
+        db.rollback();
+        return false;
+    }
+    if (!db.commit()) {
+        EventLog::error("tx.commit_failed", "COMMIT", db.lastError().text());
+        db.rollback();
+        return false;
+    }
+    return true;
+}
+
+bool Replication::disableCapture(QSqlDatabase &db)
+{
+    QSqlQuery q(db);
+    if (!q.exec("BEGIN IMMEDIATE")) {
+        EventLog::error("tx.begin_failed", "BEGIN IMMEDIATE", q.lastError().text());
+        return false;
+    }
+
+    if (!dropTriggers(q) || !q.exec("DELETE FROM replication_log")) {
+        EventLog::error("sql.failed", "DELETE replication_log", q.lastError().text());
+        db.rollback();
+        return false;
+    }
+
+    if (!db.commit()) {
+        EventLog::error("tx.commit_failed", "COMMIT", db.lastError().text());
+        db.rollback();
+        return false;
+    }
+    return true;
+}
+
+bool Replication::isCaptureEnabled(const QSqlDatabase &db)
+{
+    // Любой из триггеров: миграция, пересобравшая таблицу, уносит только её.
+    QSqlQuery q(db);
+    return q.exec("SELECT 1 FROM sqlite_master "
+                  "WHERE type = 'trigger' AND name LIKE 'repl\\_%' ESCAPE '\\'")
+           && q.next();
+}
+
+bool Replication::isStandby(const QSqlDatabase &db)
+{
+    QSqlQuery q(db);
+    return q.exec("SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = 'standby_state'")
+           && q.next();
+}
+
+QString Replication::logDirectory(const QString &databasePath)
+{
+    return QFileInfo(databasePath).absolutePath() + "/replication";
+}
+
+bool Replication::initStandby(const QString &primaryPath, const QString &standbyPath)
+{
+    EventLog::Scope scope("standby_init", QString());
+
+    const QString primaryConnection = CONNECTION.arg(g_nextConnection++);
+    bool ok = openConnection(primaryConnection, primaryPath);
+    if (ok) {
+        QSqlDatabase db = QSqlDatabase::database(primaryConnection);
+        ok = enableCapture(db);
+        db.close();
+    }
+    QSqlDatabase::removeDatabase(primaryConnection);
+    if (!ok)
+        return false;
+
+    // Снимок копии включает replication_log вместе с изменениями, которые
+    // он описывает: всё до seq из sqlite_sequence в копии уже есть.
+    DatabaseBackup backup(primaryPath, standbyPath);
+    QObject::connect(&backup, &DatabaseBackup::finished,
+                     [&ok](bool finishedOk, qint64, const QString &) { ok = finishedOk; });
+    backup.run();
+    if (!ok)
+        return false;
+
+    const QString standbyConnection = CONNECTION.arg(g_nextConnection++);
+    ok = openConnection(standbyConnection, standbyPath);
+    qint64 appliedSeq = 0;
+    if (ok) {
+        QSqlDatabase db = QSqlDatabase::database(standbyConnection);
+        QSqlQuery q(db);
+        ok = q.exec("BEGIN IMMEDIATE");
+
+        if (ok) {
+            ok = q.exec("SELECT IFNULL((SELECT seq FROM sqlite_sequence "
+                        "WHERE name = 'replication_log'), 0)") && q.next();
+            if (ok)
+                appliedSeq = q.value(0).toLongLong();
+            q.finish();
+        }
+
+        ok = ok && dropTriggers(q)
+             && q.exec("DELETE FROM replication_log")
+             && q.exec("CREATE TABLE standby_state ("
+                       " id          INTEGER PRIMARY KEY CHECK (id = 1),"
+                       " applied_seq INTEGER NOT NULL,"
+                       " applied_ms  INTEGER NOT NULL"
+                       ")");
+        if (ok) {
+            q.prepare("INSERT INTO standby_state (id, applied_seq, applied_ms) "
+                      "VALUES (1, :seq, :ms)");
+            q.bindValue(":seq", appliedSeq);
+            q.bindValue(":ms", QDateTime::currentMSecsSinceEpoch());
+            ok = q.exec();
+        }
+
+        if (!ok) {
+            EventLog::error("sql.failed", "CREATE standby_state", q.lastError().text());
+            db.rollback();
+        } else if (!db.commit()) {
+            EventLog::error("tx.commit_failed", "COMMIT", db.lastError().text());
+            db.rollback();
+            ok = false;
+        }
+        db.close();
+    }
+    QSqlDatabase::removeDatabase(standbyConnection);
+
+    if (!ok) {
+        QFile::remove(standbyPath);
+        return false;
+    }
+
+    // Файлы архивных разделов не реплицируются, а archive_partitions хранит
+    // их абсолютные пути: резерв видит архив, только пока этот каталог
+    // общий для обоих хостов.
+    EventLog::info("standby.initialized", nullptr,
+                   QString("path=%1 seq=%2 shared_archive=%3")
+                       .arg(standbyPath)
+                       .arg(appliedSeq)
+                       .arg(QFileInfo(primaryPath).absolutePath() + "/archive"));
+    scope.succeed();
+    return true;
+}
+
+QString Replication::segmentName(qint64 firstSeq)
+{
+    return QString("log_%1.bin").arg(firstSeq, 19, 10, QChar('0'));
+}
+
+bool Replication::writeSegment(const QString &path, const QList<Record> &records)
+{
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        EventLog::error("replication.write_failed", nullptr, path + ": " + file.errorString());
+        return false;
+    }
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_15);
+    out << SEGMENT_MAGIC << qint32(records.size());
+    for (const Record &r : records)
+        out << r.seq << r.commitMs << r.statement;
+
+    if (out.status() != QDataStream::Ok || !file.commit()) {
+        EventLog::error("replication.write_failed", nullptr, path + ": " + file.errorString());
+        return false;
+    }
+    return true;
+}
+
+bool Replication::readSegment(const QString &path, QList<Record> &records)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        EventLog::error("replication.read_failed", nullptr, path + ": " + file.errorString());
+        return false;
+    }
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_15);
+
+    quint32 magic = 0;
+    qint32 count = 0;
+    in >> magic >> count;
+    if (magic != SEGMENT_MAGIC || count < 0) {
+        EventLog::error("replication.bad_segment", nullptr, path);
+        return false;
+    }
+
+    records.reserve(records.size() + count);
+    for (qint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        Record r;
+        in >> r.seq >> r.commitMs >> r.statement;
+        records.append(r);
+    }
+
+    if (in.status() != QDataStream::Ok) {
+        EventLog::error("replication.bad_segment", nullptr, path);
+        return false;
+    }
+    return true;
+}
+
+bool Replication::writeHeartbeat(const QString &logDirectory)
+{
+    const QString path = QDir(logDirectory).filePath(HEARTBEAT_FILE);
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)
+        || file.write(QByteArray::number(QDateTime::currentMSecsSinceEpoch())) < 0
+        || !file.commit())
+    {
+        EventLog::error("replication.write_failed", nullptr, path + ": " + file.errorString());
+        return false;
+    }
+    return true;
+}
+
+qint64 Replication::readHeartbeat(const QString &logDirectory)
+{
+    QFile file(QDir(logDirectory).filePath(HEARTBEAT_FILE));
+    if (!file.open(QIODevice::ReadOnly))
+        return 0;
+    return file.readAll().trimmed().toLongLong();
+}
+
+LogShipper::LogShipper(const QString &databasePath, int intervalMs, QObject *parent)
+    : QObject(parent),
+    m_databasePath(databasePath),
+    m_logDirectory(Replication::logDirectory(databasePath)),
+    m_connectionName(CONNECTION.arg(g_nextConnection++)),
+    m_intervalMs(intervalMs)
+{
+}
+
+LogShipper::~LogShipper()
+{
+    stop();
+}
+
+void LogShipper::start()
+{
+    if (!openConnection(m_connectionName, m_databasePath))
+        return;
+
+    QDir().mkpath(m_logDirectory);
+
+    m_timer = new QTimer(this);
+    connect(m_timer, &QTimer::timeout, this, [this]() { shipPending(); });
+    m_timer->start(m_intervalMs);
+}
+
+void LogShipper::stop()
+{
+    if (m_timer) {
+        m_timer->stop();
+        delete m_timer;
+        m_timer = nullptr;
+        shipPending();
+    }
+
+    if (QSqlDatabase::contains(m_connectionName)) {
+        QSqlDatabase::database(m_connectionName, false).close();
+        QSqlDatabase::removeDatabase(m_connectionName);
+    }
+}
+
+bool LogShipper::shipPending()
+{
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName, false);
+    if (!db.isOpen())
+        return false;
+
+    while (true) {
+        QList<Replication::Record> records;
+
+        QSqlQuery q(db);
+        q.setForwardOnly(true);
+        q.prepare("SELECT seq, ts_ms, stmt FROM replication_log ORDER BY seq LIMIT :n");
+        q.bindValue(":n", RECORDS_PER_SEGMENT);
+        if (!q.exec()) {
+            EventLog::error("sql.failed", "SELECT replication_log", q.lastError().text());
+            return false;
+        }
+        while (q.next())
+            records.append({ q.value(0).toLongLong(), q.value(1).toLongLong(),
+                             q.value(2).toString() });
+        q.finish();
+
+        if (records.isEmpty())
+            return Replication::writeHeartbeat(m_logDirectory);
+
+        QString path = QDir(m_logDirectory).filePath(Replication::segmentName(records.first().seq));
+        if (!Replication::writeSegment(path, records))
+            return false;
+
+        // Сегмент уже на диске. Если удаление не пройдёт, записи уйдут
+        // повторно, и резерв пропустит их по seq.
+        q.prepare("DELETE FROM replication_log WHERE seq <= :last");
+        q.bindValue(":last", records.last().seq);
+        if (!q.exec()) {
+            EventLog::error("sql.failed", "DELETE replication_log", q.lastError().text());
+            return false;
+        }
+
+        emit shipped(records.last().seq, int(records.size()));
+
+        if (records.size() < RECORDS_PER_SEGMENT)
+            return Replication::writeHeartbeat(m_logDirectory);
+    }
+}
@@ -0,0 +1,101 @@
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include <QObject>
+#include <QString>
+#include <QList>
+#include <QSqlDatabase>
+
+class QTimer;
+
+// Резервная БД по журналу изменений (log shipping). Триггеры на
+// реплицируемых таблицах пишут в replication_log готовую к повтору
+// инструкцию — INSERT OR REPLACE с образом строки или DELETE по ключу — в
+// той же транзакции, что и само изменение. В журнал попадает ровно
+// зафиксированное и в порядке фиксации (seq), от любого писателя:
+// AtmController, администрирование, снимки балансов, архиватор.
+//
+// LogShipper переносит журнал в файлы сегментов, StandbyApplier
+// применяет их к резервной БД. Всё — обычные локальные файлы.
+//
+// Файлы архивных разделов (archive/*.db) не переносятся: удаление
+// перенесённых строк из transactions реплицируется, а строки
+// archive_partitions указывают на абсолютные пути основной БД. Каталог
+// archive/ должен быть общим для основного и резервного хоста и доступен
+// по тому же пути, иначе после --standby-promote архивной истории нет.
+//
+// Захват ведётся по одному файлу БД, поэтому с shards.conf на несколько
+// шардов он не включается (replication.sharded): резерв получил бы ногу
+// наличных из шарда 0 без операций остальных шардов.
+class Replication
+{
+public:
+    struct Record {
+        qint64 seq = 0;
+        qint64 commitMs = 0;   // время фиксации на основной БД, мс от эпохи
+        QString statement;
+    };
+
+    // Триггеры захвата (пересоздаются, если миграция пересобрала таблицу).
+    // false — в том числе, если рядом с БД shards.conf на несколько шардов.
+    static bool enableCapture(QSqlDatabase &db);
+    // Убирает триггеры и очищает replication_log.
+    static bool disableCapture(QSqlDatabase &db);
+    static bool isCaptureEnabled(const QSqlDatabase &db);
+
+    // На резервной БД есть standby_state; терминал её не открывает.
+    static bool isStandby(const QSqlDatabase &db);
+
+    // replication/ рядом с основной БД.
+    static QString logDirectory(const QString &databasePath);
+
+    // Включает захват на основной БД, снимает с неё копию (DatabaseBackup)
+    // и делает копию резервной: триггеры захвата удаляются, в standby_state
+    // записывается последний seq, уже вошедший в снимок.
+    static bool initStandby(const QString &primaryPath, const QString &standbyPath);
+
+    // Сегмент log_<первый seq>.bin; имена упорядочены как seq.
+    static QString segmentName(qint64 firstSeq);
+    static bool writeSegment(const QString &path, const QList<Record> &records);
+    static bool readSegment(const QString &path, QList<Record> &records);
+
+    // Отметка прохода LogShipper (время в мс) в каталоге сегментов:
+    // по ней резерв отличает пустой журнал от остановившейся передачи.
+    static bool writeHeartbeat(const QString &logDirectory);
+    // 0 — отметки нет.
+    static qint64 readHeartbeat(const QString &logDirectory);
+};
+
+// Переносит replication_log в сегменты и удаляет перенесённые строки.
+// Работает в своём потоке на своём соединении; проход — раз в intervalMs,
+// то есть резерв отстаёт от основной БД примерно на интервал. Каждый
+// удачный проход, даже пустой, обновляет отметку heartbeat.
+class LogShipper : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit LogShipper(const QString &databasePath,
+                        int intervalMs = 1000,
+                        QObject *parent = nullptr);
+    ~LogShipper() override;
+
+    // Один проход: все накопившиеся записи — в сегменты.
+    bool shipPending();
+
+public slots:
+    void start();
+    void stop();
+
+signals:
+    void shipped(qint64 lastSeq, int records);
+
+private:
+    QString m_databasePath;
+    QString m_logDirectory;
+    QString m_connectionName;
+    int m_intervalMs;
+    QTimer *m_timer = nullptr;
+};
+
+#endif // REPLICATION_H
@@ -0,0 +1,194 @@
+#include "sessionmanager.h"
+
+#include <algorithm>
+
+#include "cardkey.h"
+
+namespace {
+const int INDEX_BITS = 28;
+const quint32 INDEX_MASK = (1u << INDEX_BITS) - 1;
+}
+
+SessionManager::SessionManager(qint64 idleTimeoutMs)
+    : m_idleTimeoutMs(std::max<qint64>(1, idleTimeoutMs))
+{
+    // Срок сессии всегда меньше полного оборота колеса: ведро срока
+    // не совпадает с текущим.
+    m_tickMs = std::max<qint64>(1, (m_idleTimeoutMs + WheelSlots - 3) / (WheelSlots - 2));
+}
+
+SessionManager::Handle SessionManager::makeHandle(quint32 generation, int shard, quint32 index)
+{
+    return (Handle(generation) << 32) | (Handle(shard) << INDEX_BITS) | Handle(index);
+}
+
+bool SessionManager::split(Handle handle, int &shard, quint32 &index, quint32 &generation) const
+{
+    generation = quint32(handle >> 32);
+    shard = int((handle >> INDEX_BITS) & 0xf);
+    index = quint32(handle) & INDEX_MASK;
+    return generation != 0;
+}
+
+qint64 SessionManager::tickOf(qint64 ms) const
+{
+    return ms / m_tickMs;
+}
+
+void SessionManager::schedule(Shard &shard, quint32 index, qint64 dueMs)
+{
+    Session &s = shard.sessions[index];
+    s.dueTick = std::max(tickOf(dueMs) + 1, shard.tick + 1);
+    shard.wheel[s.dueTick % WheelSlots].push_back({ index, s.generation });
+}
+
+void SessionManager::release(Shard &shard, quint32 index)
+{
+    Session &s = shard.sessions[index];
+    if (++s.generation == 0)
+        s.generation = 1;
+    s.card = 0;
+    s.nextFree = shard.freeHead;
+    shard.freeHead = index;
+    --shard.active;
+}
+
+int SessionManager::advance(Shard &shard, qint64 nowMs)
+{
+    qint64 nowTick = tickOf(nowMs);
+    if (nowTick <= shard.tick)
+        return 0;
+
+    qint64 from = shard.tick;
+    qint64 steps = std::min<qint64>(nowTick - from, WheelSlots);
+    shard.tick = nowTick;
+
+    int expired = 0;
+    std::vector<WheelEntry> bucket;
+
+    for (qint64 step = 1; step <= steps; ++step) {
+        bucket.clear();
+        bucket.swap(shard.wheel[(from + step) % WheelSlots]);
+
+        for (const WheelEntry &e : bucket) {
+            Session &s = shard.sessions[e.index];
+            if (s.nextFree != InUse || s.generation != e.generation)
+                continue;   // сессия закрыта, запись устарела
+
+            if (s.dueTick > nowTick) {
+                shard.wheel[s.dueTick % WheelSlots].push_back(e);
+                continue;
+            }
+
+            qint64 dueMs = s.lastActiveMs + m_idleTimeoutMs;
+            if (dueMs <= nowMs) {
+                release(shard, e.index);
+                ++expired;
+            } else {
+                schedule(shard, e.index, dueMs);
+            }
+        }
+    }
+
+    return expired;
+}
+
+SessionManager::Handle SessionManager::open(const QString &cardNumber, qint64 nowMs)
+{
+    quint64 card;
+    if (!cardKeyStrict(cardNumber, card))
+        return 0;
+
+    int shardIndex = int(m_nextShard++ % ShardCount);
+    Shard &shard = m_shards[shardIndex];
+    std::lock_guard<std::mutex> lock(shard.lock);
+
+    advance(shard, nowMs);
+
+    quint32 index;
+    if (shard.freeHead != NoSlot) {
+        index = shard.freeHead;
+        shard.freeHead = shard.sessions[index].nextFree;
+    } else {
+        if (shard.sessions.size() > INDEX_MASK)
+            return 0;
+        index = quint32(shard.sessions.size());
+        shard.sessions.emplace_back();
+    }
+
+    Session &s = shard.sessions[index];
+    s.card = card;
+    s.lastActiveMs = nowMs;
+    s.nextFree = InUse;
+    ++shard.active;
+
+    schedule(shard, index, nowMs + m_idleTimeoutMs);
+    return makeHandle(s.generation, shardIndex, index);
+}
+
+void SessionManager::close(Handle handle)
+{
+    int shardIndex;
+    quint32 index, generation;
+    if (!split(handle, shardIndex, index, generation))
+        return;
+
+    Shard &shard = m_shards[shardIndex];
+    std::lock_guard<std::mutex> lock(shard.lock);
+
+    if (index >= shard.sessions.size())
+        return;
+    const Session &s = shard.sessions[index];
+    if (s.nextFree != InUse || s.generation != generation)
+        return;
+
+    // Запись в колесе остаётся и отбрасывается, когда до неё дойдёт очередь.
+    release(shard, index);
+}
+
+std::optional<QString> SessionManager::touch(Handle handle, qint64 nowMs)
+{
+    int shardIndex;
+    quint32 index, generation;
+    if (!split(handle, shardIndex, index, generation))
+        return std::nullopt;
+
+    Shard &shard = m_shards[shardIndex];
+    std::lock_guard<std::mutex> lock(shard.lock);
+
+    advance(shard, nowMs);
+
+    if (index >= shard.sessions.size())
+        return std::nullopt;
+    Session &s = shard.sessions[index];
+    if (s.nextFree != InUse || s.generation != generation)
+        return std::nullopt;
+
+    if (s.lastActiveMs + m_idleTimeoutMs <= nowMs) {
+        release(shard, index);
+        return std::nullopt;
+    }
+
+    s.lastActiveMs = std::max(s.lastActiveMs, nowMs);
+    return cardNumberFromKey(qint64(s.card));
+}
+
+int SessionManager::expire(qint64 nowMs)
+{
+    int expired = 0;
+    for (Shard &shard : m_shards) {
+        std::lock_guard<std::mutex> lock(shard.lock);
+        expired += advance(shard, nowMs);
+    }
+    return expired;
+}
+
+int SessionManager::activeCount() const
+{
+    int total = 0;
+    for (const Shard &shard : m_shards) {
+        std::lock_guard<std::mutex> lock(shard.lock);
+        total += shard.active;
+    }
+    return total;
+}
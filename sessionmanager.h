@@ -0,0 +1,87 @@
+#ifndef SESSIONMANAGER_H
+#define SESSIONMANAGER_H
+
+#include <QString>
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+// Сессии держателей карт для AtmController, обслуживающего много
+// терминалов сразу.
+//
+// Дескриптор — непрозрачное 64-битное число: поколение, шард и индекс
+// строки таблицы. Строка освобождённой сессии переиспользуется с новым
+// поколением, поэтому старый дескриптор её уже не находит. Строка — 32
+// байта (номер карты хранится числом).
+//
+// Неактивные сессии снимаются колесом таймеров: по одному ведру на тик,
+// сессия стоит в ведре своего срока. touch() только обновляет время;
+// когда колесо доходит до ведра, продлённые сессии переставляются на
+// новый срок, истёкшие освобождаются. Колесо проворачивается попутно при
+// open/touch своего шарда — отдельного таймера на сессию нет.
+class SessionManager
+{
+public:
+    using Handle = quint64;   // 0 — нет сессии
+
+    explicit SessionManager(qint64 idleTimeoutMs = 2 * 60 * 1000);
+
+    // 0 — номер карты не 16 цифр.
+    Handle open(const QString &cardNumber, qint64 nowMs);
+    void close(Handle handle);
+
+    // Номер карты сессии; продлевает её. nullopt — сессия закрыта или истекла.
+    std::optional<QString> touch(Handle handle, qint64 nowMs);
+
+    // Проворачивает колёса всех шардов; возвращает число снятых сессий.
+    int expire(qint64 nowMs);
+
+    int activeCount() const;
+
+private:
+    static constexpr int ShardCount = 16;
+    static constexpr int WheelSlots = 64;
+    static constexpr quint32 InUse = 0xffffffffu;
+    static constexpr quint32 NoSlot = 0xfffffffeu;
+
+    struct Session {
+        quint64 card = 0;
+        qint64 lastActiveMs = 0;
+        qint64 dueTick = 0;           // ведро колеса, где стоит сессия
+        quint32 generation = 1;
+        quint32 nextFree = NoSlot;    // InUse — сессия занята
+    };
+
+    struct WheelEntry {
+        quint32 index;
+        quint32 generation;
+    };
+
+    struct Shard {
+        mutable std::mutex lock;
+        std::vector<Session> sessions;
+        quint32 freeHead = NoSlot;
+        int active = 0;
+        qint64 tick = 0;              // последний обработанный тик
+        std::array<std::vector<WheelEntry>, WheelSlots> wheel;
+    };
+
+
+    static Handle makeHandle(quint32 generation, int shard, quint32 index);
+    bool split(Handle handle, int &shard, quint32 &index, quint32 &generation) const;
+
+    qint64 tickOf(qint64 ms) const;
+    void schedule(Shard &shard, quint32 index, qint64 dueMs);
+    void release(Shard &shard, quint32 index);
+    int advance(Shard &shard, qint64 nowMs);
+
+    qint64 m_idleTimeoutMs;
+    qint64 m_tickMs;
+    std::atomic<quint32> m_nextShard{0};
+    std::array<Shard, ShardCount> m_shards;
+};
+
+#endif // SESSIONMANAGER_H
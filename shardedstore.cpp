@@ -0,0 +1,497 @@
+#include "shardedstore.h"
+
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QVariant>
+#include <QHash>
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+
+#include <algorithm>
+
+#include "cardkey.h"
+#include "eventlog.h"
+
+namespace {
+const QString TIMESTAMP_FORMAT = "yyyy-MM-dd HH:mm:ss";
+
+qint64 lap(QElapsedTimer &timer)
+{
+    qint64 ns = timer.nsecsElapsed();
+    timer.restart();
+    return ns;
+}
+
+// xid должен быть уникален между процессами-терминалами, которые пишут в
+// одни и те же шарды, поэтому он случайный, а не счётчик процесса.
+qint64 nextXid()
+{
+    qint64 xid = 0;
+    while (xid == 0)
+        xid = qint64(QRandomGenerator::global()->generate64() >> 1);
+    return xid;
+}
+}
+
+ShardedStore::ShardedStore(std::shared_ptr<const ShardMap> map,
+                           const QString &readConnectionName)
+    : m_map(std::move(map))
+    , m_ownerThread(QThread::currentThread())
+{
+    for (int i = 0; i < m_map->count(); ++i) {
+        m_stores.push_back(std::make_unique<SqliteStore>(
+            ShardMap::connectionName(i), i == 0 ? readConnectionName : QString()));
+    }
+}
+
+bool ShardedStore::prepareLog(QSqlDatabase &db)
+{
+    QSqlQuery q(db);
+    bool ok = q.exec("PRAGMA journal_mode = WAL")
+              && q.exec("CREATE TABLE IF NOT EXISTS pending ("
+                        " xid  INTEGER PRIMARY KEY,"
+                        " type INTEGER NOT NULL,"
+                        " ts   TEXT NOT NULL"
+                        ")")
+              && q.exec("CREATE TABLE IF NOT EXISTS pending_legs ("
+                        " xid         INTEGER NOT NULL,"
+                        " shard       INTEGER NOT NULL,"
+                        " card_number INTEGER,"
+                        " type        INTEGER NOT NULL,"
+                        " delta       REAL NOT NULL"
+                        ")")
+              && q.exec("CREATE INDEX IF NOT EXISTS idx_pending_legs_xid ON pending_legs(xid)");
+    if (!ok)
+        EventLog::error("sql.failed", "CREATE shard_log", q.lastError().text());
+    return ok;
+}
+
+SqliteStore &ShardedStore::store(int shard) const
+{
+    return *m_stores[shard];
+}
+
+SqliteStore &ShardedStore::storeFor(const QString &cardNumber) const
+{
+    return store(m_map->shardFor(cardNumber));
+}
+
+QSqlDatabase ShardedStore::logDatabase() const
+{
+    return SqliteStore::threadConnection(ShardMap::logConnectionName(), m_ownerThread);
+}
+
+std::optional<AccountRecord> ShardedStore::account(const QString &cardNumber) const
+{
+    return storeFor(cardNumber).account(cardNumber);
+}
+
+bool ShardedStore::addAccount(const AccountRecord &account)
+{
+    return storeFor(account.cardNumber).addAccount(account);
+}
+
+bool ShardedStore::setLoginState(const QString &cardNumber,
+                                 int failedAttempts,
+                                 const QDateTime &lockedUntil)
+{
+    return storeFor(cardNumber).setLoginState(cardNumber, failedAttempts, lockedUntil);
+}
+
+bool ShardedStore::changePin(const QString &cardNumber,
+                             const QString &oldPinHash,
+                             const QString &newPinHash,
+                             OperationResult &result)
+{
+    return storeFor(cardNumber).changePin(cardNumber, oldPinHash, newPinHash, result);
+}
+
+std::optional<double> ShardedStore::balance(const QString &cardNumber) const
+{
+    return storeFor(cardNumber).balance(cardNumber);
+}
+
+double ShardedStore::atmCash() const
+{
+    return store(0).atmCash();
+}
+
+bool ShardedStore::setAtmCash(double cash)
+{
+    return store(0).setAtmCash(cash);
+}
+
+bool ShardedStore::withdraw(const QString &cardNumber, double amount, OperationResult &result)
+{
+    int shard = m_map->shardFor(cardNumber);
+    if (shard == 0)
+        return store(0).withdraw(cardNumber, amount, result);
+
+    return runDistributed(TransactionType::Withdraw,
+                          { { shard, { cardNumber, TransactionType::Withdraw, -amount } },
+                            { 0, { QString(), TransactionType::Withdraw, -amount } } },
+                          result, {});
+}
+
+bool ShardedStore::deposit(const QString &cardNumber, double amount, OperationResult &result)
+{
+    return storeFor(cardNumber).deposit(cardNumber, amount, result);
+}
+
+bool ShardedStore::transfer(const QString &fromCard,
+                            const QString &toCard,
+                            double amount,
+                            TransactionType outType,
+                            TransactionType inType,
+                            OperationResult &result)
+{
+    return transfer(fromCard, toCard, amount, outType, inType, result, {});
+}
+
+bool ShardedStore::transfer(const QString &fromCard,
+                            const QString &toCard,
+                            double amount,
+                            TransactionType outType,
+                            TransactionType inType,
+                            OperationResult &result,
+                            const AuditHook &inTransaction)
+{
+    if (fromCard == toCard)
+        return result.fail(OperationError::SameCard);
+
+    int fromShard = m_map->shardFor(fromCard);
+    int toShard = m_map->shardFor(toCard);
+
+    // Аудит живёт в шарде 0: перевод внутри другого шарда с записью аудита
+    // тоже распределённый.
+    if (fromShard == toShard && (!inTransaction || fromShard == 0)) {
+        return store(fromShard).transfer(fromCard, toCard, amount, outType, inType,
+                                         result, inTransaction);
+    }
+
+    return runDistributed(outType,
+                          { { fromShard, { fromCard, outType, -amount } },
+                            { toShard, { toCard, inType, amount } } },
+                          result, inTransaction);
+}
+
+bool ShardedStore::runDistributed(TransactionType type,
+                                  const QList<ShardLeg> &legs,
+                                  OperationResult &result,
+                                  const AuditHook &inTransaction)
+{
+    QElapsedTimer phase;
+    phase.start();
+
+    // Участники в порядке первой ноги: первым проверяется источник, и
+    // причина отказа та же, что и в одном файле.
+    QList<int> participants;
+    for (const ShardLeg &leg : legs) {
+        if (!participants.contains(leg.shard))
+            participants.append(leg.shard);
+    }
+    if (inTransaction && !participants.contains(0))
+        participants.append(0);
+
+    // Блокировки — по возрастанию номера шарда: встречные операции не
+    // ждут друг друга по кругу.
+    QList<int> lockOrder = participants;
+    std::sort(lockOrder.begin(), lockOrder.end());
+
+    QList<int> begun;
+    auto abort = [&]() {
+        for (int shard : begun)
+            store(shard).rollbackPrepared();
+        result.entry = TransactionRecord();
+    };
+
+    for (int shard : lockOrder) {
+        if (!store(shard).beginPrepared(result)) {
+            abort();
+            return false;
+        }
+        begun.append(shard);
+    }
+    result.timings.lockNs = lap(phase);
+
+    const qint64 xid = nextXid();
+    const QString ts = QDateTime::currentDateTimeUtc().toString(TIMESTAMP_FORMAT);
+
+    bool haveEntry = false;
+    for (int shard : participants) {
+        QList<SqliteStore::Leg> part;
+        for (const ShardLeg &leg : legs) {
+            if (leg.shard == shard)
+                part.append(leg.leg);
+        }
+
+        QList<TransactionRecord> entries;
+        if (!store(shard).prepareLegs(xid, type, part, ts, true, result, entries)) {
+            abort();
+            return false;
+        }
+        if (!haveEntry && !entries.isEmpty()) {
+            result.entry = entries.first();
+            haveEntry = true;
+        }
+    }
+
+    if (inTransaction) {
+        QSqlDatabase db = store(0).connection();
+        if (!inTransaction(db, result.entry)) {
+            abort();
+            return result.fail(OperationError::StorageFailed);
+        }
+    }
+    result.timings.writeNs = lap(phase);
+
+    if (!writeDecision(xid, type, ts, legs)) {
+        abort();
+        return result.fail(OperationError::StorageFailed);
+    }
+
+    // Решение записано: операция состоялась. Шард, который не смог
+    // зафиксироваться, получит свои ноги через recover().
+    bool complete = true;
+    for (int shard : lockOrder) {
+        OperationResult commit;
+        complete = store(shard).commitPrepared(commit) && complete;
+    }
+    if (complete)
+        forgetDecision(xid);
+    else
+        EventLog::error("shard.commit_incomplete", nullptr, QString("xid=%1").arg(xid));
+
+    result.timings.commitNs = lap(phase);
+    return true;
+}
+
+bool ShardedStore::writeDecision(qint64 xid,
+                                 TransactionType type,
+                                 const QString &ts,
+                                 const QList<ShardLeg> &legs)
+{
+    QSqlDatabase db = logDatabase();
+    QSqlQuery q(db);
+    if (!q.exec("BEGIN IMMEDIATE")) {
+        EventLog::error("tx.begin_failed", "BEGIN IMMEDIATE", q.lastError().text());
+        return false;
+    }
+
+    q.prepare("INSERT INTO pending (xid, type, ts) VALUES (:xid, :type, :ts)");
+    q.bindValue(":xid", xid);
+    q.bindValue(":type", transactionTypeCode(type));
+    q.bindValue(":ts", ts);
+    bool ok = q.exec();
+
+    if (ok) {
+        q.prepare("INSERT INTO pending_legs (xid, shard, card_number, type, delta) "
+                  "VALUES (:xid, :shard, :card, :type, :delta)");
+        for (const ShardLeg &leg : legs) {
+            q.bindValue(":xid", xid);
+            q.bindValue(":shard", leg.shard);
+            if (leg.leg.cardNumber.isEmpty())
+                q.bindValue(":card", QVariant(QVariant::LongLong));
+            else
+                q.bindValue(":card", cardKey(leg.leg.cardNumber));
+            q.bindValue(":type", transactionTypeCode(leg.leg.type));
+            q.bindValue(":delta", leg.leg.delta);
+            ok = q.exec();
+            if (!ok)
+                break;
+        }
+    }
+
+    if (!ok) {
+        EventLog::error("sql.failed", "INSERT pending", q.lastError().text());
+        db.rollback();
+        return false;
+    }
+    if (!db.commit()) {
+        EventLog::error("tx.commit_failed", "COMMIT", db.lastError().text());
+        db.rollback();
+        return false;
+    }
+    return true;
+}
+
+void ShardedStore::forgetDecision(qint64 xid)
+{
+    // Не удалённая строка безопасна: recover() увидит отметки xid во всех
+    // шардах и просто удалит её.
+    QSqlDatabase db = logDatabase();
+    QSqlQuery q(db);
+    if (!q.exec("BEGIN IMMEDIATE")) {
+        EventLog::warning("tx.begin_failed", "BEGIN IMMEDIATE", q.lastError().text());
+        return;
+    }
+
+    q.prepare("DELETE FROM pending_legs WHERE xid = :xid");
+    q.bindValue(":xid", xid);
+    bool ok = q.exec();
+    if (ok) {
+        q.prepare("DELETE FROM pending WHERE xid = :xid");
+        q.bindValue(":xid", xid);
+        ok = q.exec();
+    }
+
+    if (!ok || !db.commit()) {
+        EventLog::warning("sql.failed", "DELETE pending", q.lastError().text());
+        db.rollback();
+    }
+}
+
+bool ShardedStore::recover(int &completed)
+{
+    completed = 0;
+
+    struct Pending {
+        qint64 xid = 0;
+        TransactionType type = TransactionType::Unknown;
+        QString ts;
+        QList<ShardLeg> legs;
+    };
+
+    QSqlDatabase db = logDatabase();
+    QSqlQuery q(db);
+    if (!q.exec("SELECT xid, type, ts FROM pending ORDER BY xid")) {
+        EventLog::error("sql.failed", "SELECT pending", q.lastError().text());
+        return false;
+    }
+
+    QList<Pending> pending;
+    QHash<qint64, int> indexOf;
+    while (q.next()) {
+        Pending p;
+        p.xid = q.value(0).toLongLong();
+        p.type = transactionTypeFromStorage(q.value(1));
+        p.ts = q.value(2).toString();
+        indexOf.insert(p.xid, pending.size());
+        pending.append(p);
+    }
+
+    if (!q.exec("SELECT xid, shard, card_number, type, delta FROM pending_legs ORDER BY rowid")) {
+        EventLog::error("sql.failed", "SELECT pending_legs", q.lastError().text());
+        return false;
+    }
+    while (q.next()) {
+        auto it = indexOf.constFind(q.value(0).toLongLong());
+        if (it == indexOf.constEnd())
+            continue;
+
+        ShardLeg leg;
+        leg.shard = q.value(1).toInt();
+        if (!q.value(2).isNull())
+            leg.leg.cardNumber = cardNumberFromKey(q.value(2).toLongLong());
+        leg.leg.type = transactionTypeFromStorage(q.value(3));
+        leg.leg.delta = q.value(4).toDouble();
+        pending[it.value()].legs.append(leg);
+    }
+    q.finish();
+
+    bool allDone = true;
+    for (const Pending &p : pending) {
+        QList<int> shards;
+        for (const ShardLeg &leg : p.legs) {
+            if (!shards.contains(leg.shard))
+                shards.append(leg.shard);
+        }
+
+        bool done = true;
+        for (int shard : shards) {
+            if (shard < 0 || shard >= m_map->count()) {
+                EventLog::error("shard.recover_failed", nullptr,
+                                QString("xid=%1 shard=%2").arg(p.xid).arg(shard));
+                done = false;
+                continue;
+            }
+
+            // Отметка xid проверяется под блокировкой записи: если операция
+            // ещё идёт в другом процессе, её COMMIT случится раньше.
+            OperationResult result;
+            if (!store(shard).beginPrepared(result)) {
+                done = false;
+                continue;
+            }
+
+            std::optional<bool> applied = store(shard).hasPrepared(p.xid);
+            if (!applied.has_value() || applied.value()) {
+                store(shard).rollbackPrepared();
+                done = done && applied.has_value();
+                continue;
+            }
+
+            QList<SqliteStore::Leg> part;
+            for (const ShardLeg &leg : p.legs) {
+                if (leg.shard == shard)
+                    part.append(leg.leg);
+            }
+
+            QList<TransactionRecord> entries;
+            if (!store(shard).prepareLegs(p.xid, p.type, part, p.ts, false, result, entries)) {
+                store(shard).rollbackPrepared();
+                done = false;
+                continue;
+            }
+            if (!store(shard).commitPrepared(result))
+                done = false;
+        }
+
+        if (done) {
+            forgetDecision(p.xid);
+            ++completed;
+        } else {
+            EventLog::error("shard.recover_failed", nullptr, QString("xid=%1").arg(p.xid));
+            allDone = false;
+        }
+    }
+
+    if (completed > 0)
+        EventLog::info("shard.recovered", nullptr, QString("operations=%1").arg(completed));
+    return allDone;
+}
+
+void ShardedStore::forEachAccount(
+    const std::function<void(const AccountRecord &)> &visit) const
+{
+    for (const auto &shard : m_stores)
+        shard->forEachAccount(visit);
+}
+
+bool ShardedStore::append(const QString &cardNumber,
+                          TransactionType type,
+                          double amount,
+                          double balanceAfter,
+                          TransactionRecord &entry)
+{
+    return storeFor(cardNumber).append(cardNumber, type, amount, balanceAfter, entry);
+}
+
+QList<TransactionRecord> ShardedStore::history(const QString &cardNumber,
+                                               int limit,
+                                               qint64 beforeId) const
+{
+    return storeFor(cardNumber).history(cardNumber, limit, beforeId);
+}
+
+bool ShardedStore::historyInto(const QString &cardNumber,
+                               int limit,
+                               qint64 beforeId,
+                               HistoryBuffer &out) const
+{
+    return storeFor(cardNumber).historyInto(cardNumber, limit, beforeId, out);
+}
+
+std::optional<double> ShardedStore::balanceAt(const QString &cardNumber,
+                                              const QDateTime &at) const
+{
+    return storeFor(cardNumber).balanceAt(cardNumber, at);
+}
+
+void ShardedStore::forEachEntry(
+    const std::function<void(const QString &cardNumber,
+                             const TransactionRecord &)> &visit) const
+{
+    for (const auto &shard : m_stores)
+        shard->forEachEntry(visit);
+}
@@ -0,0 +1,134 @@
+#ifndef SHARDEDSTORE_H
+#define SHARDEDSTORE_H
+
+#include <QSqlDatabase>
+#include <QThread>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "shardmap.h"
+#include "sqlitestore.h"
+#include "storage.h"
+
+// Хранилище поверх нескольких шардов (см. ShardMap): по SqliteStore на
+// шард. Операция одной карты целиком уходит в её шард. Перевод между
+// шардами и снятие с карты не из шарда 0 (наличность банкомата — в шарде
+// 0) проводятся двухфазной фиксацией:
+//
+//   1. BEGIN IMMEDIATE на всех участниках в порядке номеров шардов;
+//      ноги и отметка xid пишутся в открытые транзакции.
+//   2. Решение — строка xid с ногами в журнале координатора
+//      (shard_log.db). Это точка фиксации операции.
+//   3. COMMIT участников, затем строка журнала удаляется.
+//
+// Сбой до шага 2 откатывает участников сам: их транзакции не
+// зафиксированы. Сбой после — recover() при следующем запуске дописывает
+// ноги шардам, у которых нет отметки xid.
+class ShardedStore : public AccountStore, public LedgerStore
+{
+public:
+    using AuditHook = std::function<bool(QSqlDatabase &, const TransactionRecord &)>;
+
+    // readConnectionName — соединение-читатель шарда 0 (см. SqliteStore).
+    explicit ShardedStore(std::shared_ptr<const ShardMap> map,
+                          const QString &readConnectionName = QString());
+
+    std::optional<AccountRecord> account(const QString &cardNumber) const override;
+    bool addAccount(const AccountRecord &account) override;
+
+    bool setLoginState(const QString &cardNumber,
+                       int failedAttempts,
+                       const QDateTime &lockedUntil) override;
+    bool changePin(const QString &cardNumber,
+                   const QString &oldPinHash,
+                   const QString &newPinHash,
+                   OperationResult &result) override;
+
+    std::optional<double> balance(const QString &cardNumber) const override;
+
+    double atmCash() const override;
+    bool setAtmCash(double cash) override;
+
+    bool withdraw(const QString &cardNumber,
+                  double amount,
+                  OperationResult &result) override;
+    bool deposit(const QString &cardNumber,
+                 double amount,
+                 OperationResult &result) override;
+    bool transfer(const QString &fromCard,
+                  const QString &toCard,
+                  double amount,
+                  TransactionType outType,
+                  TransactionType inType,
+                  OperationResult &result) override;
+
+    // Как SqliteStore::transfer с inTransaction: запись аудита пишется в
+    // шард 0 в той же фиксации, что и ноги перевода.
+    bool transfer(const QString &fromCard,
+                  const QString &toCard,
+                  double amount,
+                  TransactionType outType,
+                  TransactionType inType,
+                  OperationResult &result,
+                  const AuditHook &inTransaction);
+
+    // Обход шардов по порядку; внутри шарда — как у SqliteStore.
+    void forEachAccount(
+        const std::function<void(const AccountRecord &)> &visit) const override;
+
+    bool append(const QString &cardNumber,
+                TransactionType type,
+                double amount,
+                double balanceAfter,
+                TransactionRecord &entry) override;
+
+    QList<TransactionRecord> history(const QString &cardNumber,
+                                     int limit,
+                                     qint64 beforeId) const override;
+    bool historyInto(const QString &cardNumber,
+                     int limit,
+                     qint64 beforeId,
+                     HistoryBuffer &out) const override;
+
+    std::optional<double> balanceAt(const QString &cardNumber,
+                                    const QDateTime &at) const override;
+
+    void forEachEntry(
+        const std::function<void(const QString &cardNumber,
+                                 const TransactionRecord &)> &visit) const override;
+
+    // Доводит до конца операции, решение по которым записано, а ноги
+    // зафиксированы не везде. completed — сколько завершено.
+    bool recover(int &completed);
+
+    // Таблицы журнала координатора.
+    static bool prepareLog(QSqlDatabase &db);
+
+private:
+    struct ShardLeg {
+        int shard = 0;
+        SqliteStore::Leg leg;
+    };
+
+    SqliteStore &store(int shard) const;
+    SqliteStore &storeFor(const QString &cardNumber) const;
+    QSqlDatabase logDatabase() const;
+
+    bool runDistributed(TransactionType type,
+                        const QList<ShardLeg> &legs,
+                        OperationResult &result,
+                        const AuditHook &inTransaction);
+    bool writeDecision(qint64 xid,
+                       TransactionType type,
+                       const QString &ts,
+                       const QList<ShardLeg> &legs);
+    void forgetDecision(qint64 xid);
+
+    std::shared_ptr<const ShardMap> m_map;
+    std::vector<std::unique_ptr<SqliteStore>> m_stores;
+    QThread *m_ownerThread;
+};
+
+#endif // SHARDEDSTORE_H
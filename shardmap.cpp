@@ -0,0 +1,231 @@
+#include "shardmap.h"
+
+#include <QSqlError>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QTextStream>
+#include <QStringList>
+
+#include "cardkey.h"
+#include "databaseschema.h"
+#include "eventlog.h"
+#include "shardedstore.h"
+
+namespace {
+const QString CONFIG_FILE = "shards.conf";
+const QString LOG_FILE = "shard_log.db";
+const QString CONNECTION = "shard_%1";
+const QString LOG_CONNECTION = "shard_log";
+
+std::shared_ptr<const ShardMap> g_active;
+
+bool openConnection(const QString &connectionName, const QString &path)
+{
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+    db.setDatabaseName(path);
+    // URI нужен для ATTACH архивных разделов шарда в режиме только для чтения.
+    db.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000;QSQLITE_OPEN_URI");
+
+    if (!db.open()) {
+        EventLog::error("db.open_failed", "shard connection", path + ": " + db.lastError().text());
+        return false;
+    }
+    return true;
+}
+}
+
+QString ShardMap::configPath(const QString &databasePath)
+{
+    return QFileInfo(databasePath).absolutePath() + "/" + CONFIG_FILE;
+}
+
+bool ShardMap::parse(const QString &configPath, ShardMap &map, QString &error)
+{
+    QFile file(configPath);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        error = file.errorString();
+        return false;
+    }
+
+    const QDir base = QFileInfo(configPath).absoluteDir();
+    map = ShardMap();
+
+    QTextStream in(&file);
+    int lineNumber = 0;
+    while (!in.atEnd()) {
+        QString line = in.readLine();
+        ++lineNumber;
+        int comment = line.indexOf('#');
+        if (comment >= 0)
+            line.truncate(comment);
+        line = line.simplified();
+        if (line.isEmpty())
+            continue;
+
+        const QStringList parts = line.split(' ');
+        if (parts[0] == "mode" && parts.size() == 2
+            && (parts[1] == "range" || parts[1] == "hash")) {
+            map.m_mode = parts[1] == "range" ? Mode::Range : Mode::Hash;
+        } else if (parts[0] == "shard" && (parts.size() == 2 || parts.size() == 3)) {
+            Shard shard;
+            shard.path = QDir::cleanPath(base.absoluteFilePath(parts[1]));
+            shard.from = parts.size() == 3 ? cardKey(parts[2]) : 0;
+            if (shard.from < 0) {
+                error = QString("строка %1: граница не номер карты").arg(lineNumber);
+                return false;
+            }
+            map.m_shards.append(shard);
+        } else {
+            error = QString("строка %1: не разобрана").arg(lineNumber);
+            return false;
+        }
+    }
+
+    if (map.m_shards.isEmpty()) {
+        error = "нет ни одного шарда";
+        return false;
+    }
+
+    // Границы range идут по возрастанию от нуля: у каждого номера ровно
+    // один шард.
+    for (int i = 0; i < map.m_shards.size(); ++i) {
+        qint64 from = map.m_shards[i].from;
+        bool ordered = map.m_mode == Mode::Hash ? from == 0
+                       : i == 0                 ? from == 0
+                                                : from > map.m_shards[i - 1].from;
+        if (!ordered) {
+            error = QString("шард %1: неверная граница").arg(i);
+            return false;
+        }
+        for (int j = 0; j < i; ++j) {
+            if (map.m_shards[j].path == map.m_shards[i].path) {
+                error = QString("шард %1: файл уже занят шардом %2").arg(i).arg(j);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool ShardMap::open(const QString &databasePath)
+{
+    const QString config = configPath(databasePath);
+    if (!QFileInfo::exists(config))
+        return true;
+
+    auto map = std::make_shared<ShardMap>();
+    QString error;
+    if (!parse(config, *map, error)) {
+        EventLog::error("shard.config_invalid", nullptr, config + ": " + error);
+        return false;
+    }
+    if (map->m_shards.first().path != QFileInfo(databasePath).absoluteFilePath()) {
+        EventLog::error("shard.config_invalid", nullptr, config + ": шард 0 — не " + databasePath);
+        return false;
+    }
+
+    bool ok = true;
+    for (int i = 1; ok && i < map->count(); ++i) {
+        ok = openConnection(connectionName(i), map->m_shards[i].path);
+        if (ok) {
+            QSqlDatabase db = QSqlDatabase::database(connectionName(i));
+            ok = DatabaseSchema::migrate(db);
+        }
+    }
+
+    if (ok) {
+        ok = openConnection(LOG_CONNECTION, QFileInfo(config).absolutePath() + "/" + LOG_FILE);
+        if (ok) {
+            QSqlDatabase db = QSqlDatabase::database(LOG_CONNECTION);
+            ok = ShardedStore::prepareLog(db);
+        }
+    }
+
+    g_active = map;
+    if (!ok) {
+        close();
+        return false;
+    }
+
+    EventLog::info("shard.opened", nullptr,
+                   QString("shards=%1 mode=%2")
+                       .arg(map->count())
+                       .arg(map->mode() == Mode::Range ? "range" : "hash"));
+    return true;
+}
+
+void ShardMap::close()
+{
+    if (!g_active)
+        return;
+
+    for (int i = 1; i < g_active->count(); ++i) {
+        if (QSqlDatabase::contains(connectionName(i))) {
+            QSqlDatabase::database(connectionName(i), false).close();
+            QSqlDatabase::removeDatabase(connectionName(i));
+        }
+    }
+    if (QSqlDatabase::contains(LOG_CONNECTION)) {
+        QSqlDatabase::database(LOG_CONNECTION, false).close();
+        QSqlDatabase::removeDatabase(LOG_CONNECTION);
+    }
+    g_active.reset();
+}
+
+std::shared_ptr<const ShardMap> ShardMap::active()
+{
+    return g_active;
+}
+
+QString ShardMap::connectionFor(const QString &cardNumber)
+{
+    return g_active ? connectionName(g_active->shardFor(cardNumber)) : QString();
+}
+
+QSqlDatabase ShardMap::databaseFor(const QString &cardNumber)
+{
+    QString name = connectionFor(cardNumber);
+    return name.isEmpty() ? QSqlDatabase::database() : QSqlDatabase::database(name);
+}
+
+QList<QSqlDatabase> ShardMap::databases()
+{
+    QList<QSqlDatabase> result = { QSqlDatabase::database() };
+    for (int i = 1; g_active && i < g_active->count(); ++i)
+        result.append(QSqlDatabase::database(connectionName(i)));
+    return result;
+}
+
+QString ShardMap::connectionName(int shard)
+{
+    return shard == 0 ? QString() : CONNECTION.arg(shard);
+}
+
+QString ShardMap::logConnectionName()
+{
+    return LOG_CONNECTION;
+}
+
+int ShardMap::shardFor(qint64 key) const
+{
+    if (key < 0 || m_shards.size() == 1)
+        return 0;
+
+    if (m_mode == Mode::Hash) {
+        // Номера карт идут плотными сериями; умножение на нечётную
+        // константу (Фибоначчи) разносит соседние номера по шардам.
+        quint64 h = quint64(key) * 0x9E3779B97F4A7C15ull;
+        return int((h >> 32) % quint64(m_shards.size()));
+    }
+
+    int shard = 0;
+    for (int i = 1; i < m_shards.size() && m_shards[i].from <= key; ++i)
+        shard = i;
+    return shard;
+}
+
+int ShardMap::shardFor(const QString &cardNumber) const
+{
+    return shardFor(cardKey(cardNumber));
+}
@@ -0,0 +1,69 @@
+#ifndef SHARDMAP_H
+#define SHARDMAP_H
+
+#include <QString>
+#include <QList>
+#include <QSqlDatabase>
+
+#include <memory>
+
+// Разбиение счетов и журнала по нескольким файлам БД (шардам): у каждого
+// файла свой писатель, операции по картам разных шардов не ждут друг
+// друга. Карта читается при запуске из shards.conf рядом с atm.db; без
+// файла всё хранится в одном atm.db.
+//
+//   mode range                          # или hash
+//   shard atm.db                        # шард 0 — сама atm.db
+//   shard atm_1.db 5000000000000000     # range: первый номер карты шарда
+//
+// range — шард карты тот, чья нижняя граница последняя не больше номера;
+// hash — хеш номера по модулю числа шардов. Шард 0 — основная БД: в ней
+// же наличность банкомата, лимиты и журнал аудита.
+class ShardMap
+{
+public:
+    enum class Mode { Range, Hash };
+
+    struct Shard {
+        QString path;
+        qint64 from = 0;   // только для range
+    };
+
+    // shards.conf рядом с БД.
+    static QString configPath(const QString &databasePath);
+
+    // Разбор файла; при false в error — номер строки и причина.
+    static bool parse(const QString &configPath, ShardMap &map, QString &error);
+
+    // Если shards.conf есть — открывает шарды 1..N-1 и журнал координатора
+    // (shard_log.db), применяет к шардам миграции. Шард 0 — соединение по
+    // умолчанию, его открывает вызывающий.
+    static bool open(const QString &databasePath);
+    static void close();
+
+    // nullptr — шардирование не настроено.
+    static std::shared_ptr<const ShardMap> active();
+
+    // Имя соединения шарда карты; без шардирования — соединение по
+    // умолчанию (пустое имя).
+    static QString connectionFor(const QString &cardNumber);
+    static QSqlDatabase databaseFor(const QString &cardNumber);
+    // Все шарды, начиная с основной БД.
+    static QList<QSqlDatabase> databases();
+
+    static QString connectionName(int shard);
+    static QString logConnectionName();
+
+    Mode mode() const { return m_mode; }
+    const QList<Shard> &shards() const { return m_shards; }
+    int count() const { return m_shards.size(); }
+
+    int shardFor(qint64 key) const;
+    int shardFor(const QString &cardNumber) const;
+
+private:
+    Mode m_mode = Mode::Range;
+    QList<Shard> m_shards;
+};
+
+#endif // SHARDMAP_H
@@ -0,0 +1,914 @@
+#include "sqlitestore.h"
+
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QVariant>
+#include <QStringList>
+#include <QThreadStorage>
+#include <QElapsedTimer>
+
+#include <cmath>
+
+#include "cardkey.h"
+#include "eventlog.h"
+#include "transactionarchive.h"
+
+namespace {
+const QString TIMESTAMP_FORMAT = "yyyy-MM-dd HH:mm:ss";
+const int ATM_ID = 1;   // atm_state.id
+
+// Клоны соединений, открытые в потоке; удаляются при его завершении.
+struct ThreadConnections {
+    QStringList names;
+
+    ~ThreadConnections()
+    {
+        for (const QString &name : names) {
+            QSqlDatabase::database(name, false).close();
+            QSqlDatabase::removeDatabase(name);
+        }
+    }
+};
+
+QThreadStorage<ThreadConnections *> threadConnections;
+
+qint64 lap(QElapsedTimer &timer)
+{
+    qint64 ns = timer.nsecsElapsed();
+    timer.restart();
+    return ns;
+}
+
+// SQLITE_BUSY (5) и SQLITE_LOCKED (6): блокировку держит другой писатель
+// дольше busy_timeout — операцию можно повторить.
+OperationError errorOf(const QSqlError &error)
+{
+    QString code = error.nativeErrorCode();
+    return code == "5" || code == "6" ? OperationError::DatabaseBusy
+                                      : OperationError::StorageFailed;
+}
+}
+
+SqliteStore::SqliteStore(const QString &connectionName,
+                         const QString &readConnectionName)
+    : m_connectionName(connectionName)
+    , m_readConnectionName(readConnectionName)
+    , m_ownerThread(QThread::currentThread())
+{
+}
+
+QSqlDatabase SqliteStore::connectionFor(const QString &connectionName) const
+{
+    return threadConnection(connectionName, m_ownerThread);
+}
+
+QSqlDatabase SqliteStore::threadConnection(const QString &connectionName, QThread *ownerThread)
+{
+    QString base = connectionName.isEmpty() ? QString(QSqlDatabase::defaultConnection)
+                                            : connectionName;
+    if (QThread::currentThread() == ownerThread)
+        return QSqlDatabase::database(base);
+
+    QString name = QString("%1@%2").arg(base)
+                       .arg(quintptr(QThread::currentThreadId()), 0, 16);
+    if (QSqlDatabase::contains(name))
+        return QSqlDatabase::database(name);
+
+    QSqlDatabase db = QSqlDatabase::cloneDatabase(base, name);
+    if (!db.open()) {
+        EventLog::error("db.open_failed", "thread connection", db.lastError().text());
+        return db;
+    }
+
+    if (!threadConnections.hasLocalData())
+        threadConnections.setLocalData(new ThreadConnections);
+    threadConnections.localData()->names.append(name);
+    return db;
+}
+
+QSqlDatabase SqliteStore::database() const
+{
+    return connectionFor(m_connectionName);
+}
+
+QSqlDatabase SqliteStore::readDatabase() const
+{
+    if (!m_readConnectionName.isEmpty() && QSqlDatabase::contains(m_readConnectionName)) {
+        QSqlDatabase db = connectionFor(m_readConnectionName);
+        if (db.isOpen())
+            return db;
+    }
+    return database();
+}
+
+std::optional<AccountRecord> SqliteStore::account(const QString &cardNumber) const
+{
+    QSqlDatabase db = database();
+    if (!db.isOpen()) {
+        EventLog::error("db.not_open");
+        return std::nullopt;
+    }
+
+    QSqlQuery query(db);
+    query.prepare("SELECT a.pin, b.balance, a.failed_attempts, a.locked_until "
+                  "FROM accounts a JOIN account_balances b ON b.card_number = a.card_number "
+                  "WHERE a.card_number = :card");
+    query.bindValue(":card", cardKey(cardNumber));
+
+    if (!query.exec()) {
+        EventLog::error("sql.failed", "SELECT accounts.pin", query.lastError().text());
+        return std::nullopt;
+    }
+
+    if (!query.next())
+        return std::nullopt;
+
+    AccountRecord rec;
+    rec.cardNumber = cardNumber;
+    rec.pinHash = query.value(0).toString();
+    rec.balance = query.value(1).toDouble();
+    rec.failedAttempts = query.value(2).toInt();
+    if (!query.value(3).isNull())
+        rec.lockedUntil = query.value(3).toDateTime();
+    return rec;
+}
+
+bool SqliteStore::addAccount(const AccountRecord &account)
+{
+    QSqlDatabase db = database();
+    if (!db.isOpen()) {
+        EventLog::error("db.not_open");
+        return false;
+    }
+
+    if (cardKey(account.cardNumber) < 0) {
+        EventLog::error("account.invalid_card", nullptr, account.cardNumber);
+        return false;
+    }
+
+    QSqlQuery query(db);
+    query.prepare("INSERT INTO accounts (card_number, pin, balance) "
+                  "VALUES (:card, :pin, :bal)");
+    query.bindValue(":card", cardKey(account.cardNumber));
+    query.bindValue(":pin", account.pinHash);
+    query.bindValue(":bal", account.balance);
+
+    if (!query.exec()) {
+        EventLog::error("sql.failed", "INSERT accounts", query.lastError().text());
+        return false;
+    }
+
+    return true;
+}
+
+bool SqliteStore::setLoginState(const QString &cardNumber,
+                                int failedAttempts,
+                                const QDateTime &lockedUntil)
+{
+    QSqlDatabase db = database();
+    if (!db.isOpen()) {
+        EventLog::error("db.not_open");
+        return false;
+    }
+
+    QSqlQuery query(db);
+    query.prepare("UPDATE accounts "
+                  "SET failed_attempts = :fa, locked_until = :lu "
+                  "WHERE card_number = :card");
+    query.bindValue(":fa", failedAttempts);
+    if (lockedUntil.isValid())
+        query.bindValue(":lu", lockedUntil);
+    else
+        query.bindValue(":lu", QVariant(QVariant::DateTime));
+    query.bindValue(":card", cardKey(cardNumber));
+
+    if (!query.exec()) {
+        EventLog::error("sql.failed", "UPDATE accounts.failed_attempts",
+                        query.lastError().text());
+        return false;
+    }
+
+    return true;
+}
+
+bool SqliteStore::changePin(const QString &cardNumber,
+                            const QString &oldPinHash,
+                            const QString &newPinHash,
+                            OperationResult &result)
+{
+    QSqlDatabase db = database();
+    if (!db.isOpen()) {
+        EventLog::error("db.not_open");
+        return result.fail(OperationError::StorageFailed);
+    }
+
+    QElapsedTimer phase;
+    phase.start();
+
+    if (!beginWrite(db, result))
+        return false;
+    result.timings.lockNs = lap(phase);
+
+    QSqlQuery query(db);
+    query.prepare("SELECT pin FROM accounts WHERE card_number = :card");
+    query.bindValue(":card", cardKey(cardNumber));
+    if (!query.exec()) {
+        EventLog::error("sql.failed", "SELECT accounts.pin", query.lastError().text());
+        db.rollback();
+        return result.fail(OperationError::StorageFailed);
+    }
+    std::optional<QString> pin;
+    if (query.next())
+        pin = query.value(0).toString();
+    query.finish();
+
+    std::optional<double> balance = balanceOn(db, cardNumber);
+    result.timings.readNs = lap(phase);
+
+    OperationError refusal = !pin.has_value() || !balance.has_value()
+                                 ? OperationError::AccountNotFound
+                             : pin.value() != oldPinHash ? OperationError::WrongPin
+                                                         : OperationError::None;
+    if (refusal != OperationError::None) {
+        db.rollback();
+        return result.fail(refusal);
+    }
+
+    query.prepare("UPDATE accounts "
+                  "SET pin = :pin, failed_attempts = 0, locked_until = NULL "
+                  "WHERE card_number = :card");
+    query.bindValue(":pin", newPinHash);
+    query.bindValue(":card", cardKey(cardNumber));
+    if (!query.exec()) {
+        EventLog::error("sql.failed", "UPDATE accounts.pin", query.lastError().text());
+        db.rollback();
+        return result.fail(OperationError::StorageFailed);
+    }
+
+    QString ts = QDateTime::currentDateTimeUtc().toString(TIMESTAMP_FORMAT);
+    qint64 operationId = openOperation(db, TransactionType::PinChange, ts);
+    if (operationId == 0
+        || !appendLeg(db, operationId, cardNumber, TransactionType::PinChange,
+                      0.0, balance.value(), ts, result.entry))
+    {
+        db.rollback();
+        result.entry = TransactionRecord();
+        return result.fail(OperationError::StorageFailed);
+    }
+    result.timings.writeNs = lap(phase);
+
+    if (!commitWrite(db, result)) {
+        result.entry = TransactionRecord();
+        return false;
+    }
+    result.timings.commitNs = lap(phase);
+    return true;
+}
+
+std::optional<double> SqliteStore::balance(const QString &cardNumber) const
+{
+    return balanceOn(readDatabase(), cardNumber);
+}
+
+std::optional<double> SqliteStore::balanceOn(const QSqlDatabase &db,
+                                             const QString &cardNumber) const
+{
+    if (!db.isOpen()) {
+        EventLog::error("db.not_open");
+        return std::nullopt;
+    }
+
+    QSqlQuery query(db);
+    query.prepare("SELECT balance FROM account_balances WHERE card_number = :card");
+    query.bindValue(":card", cardKey(cardNumber));
+
+    if (!query.exec()) {
+        EventLog::error("sql.failed", "SELECT account_balances", query.lastError().text());
+        return std::nullopt;
+    }
+
+    if (!query.next())
+        return std::nullopt;
+
+    return query.value(0).toDouble();
+}
+
+double SqliteStore::atmCash() const
+{
+    return getAtmCash();
+}
+
+bool SqliteStore::setAtmCash(double cash)
+{
+    return updateAtmCash(cash);
+}
+
+double SqliteStore::getAtmCash() const
+{
+    QSqlDatabase db = database();
+    if (!db.isOpen()) {
+        EventLog::error("db.not_open");
+        return 0.0;
+    }
+
+    QSqlQuery query(db);
+    if (!query.exec("SELECT cash_total FROM atm_state WHERE id = 1")) {
+        EventLog::error("sql.failed", "SELECT atm_state.cash_total", query.lastError().text());
+        return 0.0;
+    }
+
+    if (query.next()) {
+        return query.value(0).toDouble();
+    }
+
+    return 0.0;
+}
+
+bool SqliteStore::updateAtmCash(double newCash)
+{
+    QSqlDatabase db = database();
+    if (!db.isOpen()) {
+        EventLog::error("db.not_open");
+        return false;
+    }
+
+    QSqlQuery query(db);
+    query.prepare("UPDATE atm_state SET cash_total = :cash WHERE id = 1");
+    query.bindValue(":cash", newCash);
+
+    if (!query.exec()) {
+        EventLog::error("sql.failed", "UPDATE atm_state.cash_total", query.lastError().text());
+        return false;
+    }
+
+    return true;
+}
+
+bool SqliteStore::addCashRollup(QSqlDatabase &db,
+                                TransactionType type,
+                                double amount,
+                                const QString &ts)
+{
+    bool withdraw = type == TransactionType::Withdraw;
+
+    QSqlQuery query(db);
+    query.prepare("INSERT INTO cash_rollups"
+                  " (atm_id, hour, withdrawn_cents, withdrawals, deposited_cents, deposits)"
+                  " VALUES (:atm, :hour, :w, :wn, :d, :dn)"
+                  " ON CONFLICT (atm_id, hour) DO UPDATE SET"
+                  " withdrawn_cents = withdrawn_cents + excluded.withdrawn_cents,"
+                  " withdrawals = withdrawals + excluded.withdrawals,"
+                  " deposited_cents = deposited_cents + excluded.deposited_cents,"
+                  " deposits = deposits + excluded.deposits");
+    qint64 cents = std::llround(amount * 100.0);
+    query.bindValue(":atm", ATM_ID);
+    query.bindValue(":hour", ts.left(13) + ":00:00");
+    query.bindValue(":w", withdraw ? cents : 0);
+    query.bindValue(":wn", withdraw ? 1 : 0);
+    query.bindValue(":d", withdraw ? 0 : cents);
+    query.bindValue(":dn", withdraw ? 0 : 1);
+
+    if (!query.exec()) {
+        EventLog::error("sql.failed", "UPSERT cash_rollups", query.lastError().text());
+        return false;
+    }
+    return true;
+}
+
+bool SqliteStore::beginWrite(QSqlDatabase &db, OperationResult &result)
+{
+    QSqlQuery query(db);
+    if (!query.exec("BEGIN IMMEDIATE")) {
+        EventLog::error("tx.begin_failed", "BEGIN IMMEDIATE", query.lastError().text());
+        return result.fail(errorOf(query.lastError()));
+    }
+    return true;
+}
+
+bool SqliteStore::commitWrite(QSqlDatabase &db, OperationResult &result)
+{
+    if (!db.commit()) {
+        QSqlError error = db.lastError();
+        EventLog::error("tx.commit_failed", "COMMIT", error.text());
+        db.rollback();
+        return result.fail(errorOf(error));
+    }
+    return true;
+}
+
+qint64 SqliteStore::openOperation(QSqlDatabase &db, TransactionType type, const QString &ts)
+{
+    QSqlQuery query(db);
+    query.prepare("INSERT INTO ledger_operations (type, ts) VALUES (:type, :ts)");
+    query.bindValue(":type", transactionTypeCode(type));
+    query.bindValue(":ts", ts);
+
+    if (!query.exec()) {
+        EventLog::error("sql.failed", "INSERT ledger_operations", query.lastError().text());
+        return 0;
+    }
+
+    return query.lastInsertId().toLongLong();
+}
+
+bool SqliteStore::appendLeg(QSqlDatabase &db,
+                            qint64 operationId,
+                            const QString &cardNumber,
+                            TransactionType type,
+                            double amount,
+                            double balanceAfter,
+                            const QString &ts,
+                            TransactionRecord &entry)
+{
+    QSqlQuery query(db);
+    query.prepare("INSERT INTO transactions "
+                  "(card_number, type, amount, balance_after, ts, operation_id) "
+                  "VALUES (:card, :type, :amount, :bal, :ts, :op)");
+    query.bindValue(":card", cardKey(cardNumber));
+    query.bindValue(":type", transactionTypeCode(type));
+    query.bindValue(":amount", amount);
+    query.bindValue(":bal", balanceAfter);
+    query.bindValue(":ts", ts);
+    query.bindValue(":op", operationId);
+
+    if (!query.exec()) {
+        EventLog::error("sql.failed", "INSERT transactions", query.lastError().text());
+        return false;
+    }
+
+    entry.id = query.lastInsertId().toLongLong();
+    entry.operationId = operationId;
+    entry.type = type;
+    entry.amount = amount;
+    entry.balanceAfter = balanceAfter;
+    entry.timestamp = QDateTime::fromString(ts, TIMESTAMP_FORMAT);
+    entry.timestamp.setTimeSpec(Qt::UTC);
+    return true;
+}
+
+bool SqliteStore::withdraw(const QString &cardNumber, double amount, OperationResult &result)
+{
+    QSqlDatabase db = database();
+    if (!db.isOpen()) {
+        EventLog::error("db.not_open");
+        return result.fail(OperationError::StorageFailed);
+    }
+
+    QElapsedTimer phase;
+    phase.start();
+
+    if (!beginWrite(db, result))
+        return false;
+    result.timings.lockNs = lap(phase);
+
+    std::optional<double> balance = balanceOn(db, cardNumber);
+    double atmCash = getAtmCash();
+    result.timings.readNs = lap(phase);
+
+    OperationError refusal = !balance.has_value()       ? OperationError::AccountNotFound
+                             : amount > balance.value() ? OperationError::InsufficientFunds
+                             : amount > atmCash         ? OperationError::AtmOutOfCash
+                                                        : OperationError::None;
+    if (refusal != OperationError::None) {
+        db.rollback();
+        return result.fail(refusal);
+    }
+
+    double newBalance = balance.value() - amount;
+    QString ts = QDateTime::currentDateTimeUtc().toString(TIMESTAMP_FORMAT);
+
+    // Наличность банкомата — одна строка atm_state и пока обновляется на
+    // месте; балансы карт считаются из журнала.
+    if (!updateAtmCash(atmCash - amount)
+        || !addCashRollup(db, TransactionType::Withdraw, amount, ts)) {
+        db.rollback();
+        return result.fail(OperationError::StorageFailed);
+    }
+
+    qint64 operationId = openOperation(db, TransactionType::Withdraw, ts);
+    if (operationId == 0
+        || !appendLeg(db, operationId, cardNumber, TransactionType::Withdraw,
+                      amount, newBalance, ts, result.entry))
+    {
+        db.rollback();
+        result.entry = TransactionRecord();
+        return result.fail(OperationError::StorageFailed);
+    }
+    result.timings.writeNs = lap(phase);
+
+    if (!commitWrite(db, result)) {
+        result.entry = TransactionRecord();
+        return false;
+    }
+    result.timings.commitNs = lap(phase);
+    return true;
+}
+
+bool SqliteStore::deposit(const QString &cardNumber, double amount, OperationResult &result)
+{
+    QSqlDatabase db = database();
+    if (!db.isOpen()) {
+        EventLog::error("db.not_open");
+        return result.fail(OperationError::StorageFailed);
+    }
+
+    QElapsedTimer phase;
+    phase.start();
+
+    if (!beginWrite(db, result))
+        return false;
+    result.timings.lockNs = lap(phase);
+
+    std::optional<double> balance = balanceOn(db, cardNumber);
+    result.timings.readNs = lap(phase);
+    if (!balance.has_value()) {
+        db.rollback();
+        return result.fail(OperationError::AccountNotFound);
+    }
+
+    double newBalance = balance.value() + amount;
+    QString ts = QDateTime::currentDateTimeUtc().toString(TIMESTAMP_FORMAT);
+
+    qint64 operationId = openOperation(db, TransactionType::Deposit, ts);
+    if (operationId == 0
+        || !addCashRollup(db, TransactionType::Deposit, amount, ts)
+        || !appendLeg(db, operationId, cardNumber, TransactionType::Deposit,
+                      amount, newBalance, ts, result.entry))
+    {
+        db.rollback();
+        result.entry = TransactionRecord();
+        return result.fail(OperationError::StorageFailed);
+    }
+    result.timings.writeNs = lap(phase);
+
+    if (!commitWrite(db, result)) {
+        result.entry = TransactionRecord();
+        return false;
+    }
+    result.timings.commitNs = lap(phase);
+    return true;
+}
+
+bool SqliteStore::transfer(const QString &fromCard,
+                           const QString &toCard,
+                           double amount,
+                           TransactionType outType,
+                           TransactionType inType,
+                           OperationResult &result)
+{
+    return transfer(fromCard, toCard, amount, outType, inType, result, {});
+}
+
+bool SqliteStore::transfer(const QString &fromCard,
+                           const QString &toCard,
+                           double amount,
+                           TransactionType outType,
+                           TransactionType inType,
+                           OperationResult &result,
+                           const std::function<bool(QSqlDatabase &, const TransactionRecord &)> &inTransaction)
+{
+    QSqlDatabase db = database();
+    if (!db.isOpen()) {
+        EventLog::error("db.not_open");
+        return result.fail(OperationError::StorageFailed);
+    }
+
+    if (fromCard == toCard)
+        return result.fail(OperationError::SameCard);
+
+    QElapsedTimer phase;
+    phase.start();
+
+    if (!beginWrite(db, result))
+        return false;
+    result.timings.lockNs = lap(phase);
+
+    std::optional<double> sourceBalance = balanceOn(db, fromCard);
+    std::optional<double> targetBalance = balanceOn(db, toCard);
+    result.timings.readNs = lap(phase);
+
+    OperationError refusal = !sourceBalance.has_value() || !targetBalance.has_value()
+                                 ? OperationError::AccountNotFound
+                             : amount > sourceBalance.value() ? OperationError::InsufficientFunds
+                                                              : OperationError::None;
+    if (refusal != OperationError::None) {
+        db.rollback();
+        return result.fail(refusal);
+    }
+
+    QString ts = QDateTime::currentDateTimeUtc().toString(TIMESTAMP_FORMAT);
+
+    // Обе ноги — одна операция: списание и зачисление с общим operation_id.
+    qint64 operationId = openOperation(db, outType, ts);
+    TransactionRecord toEntry;
+    if (operationId == 0
+        || !appendLeg(db, operationId, fromCard, outType,
+                      amount, sourceBalance.value() - amount, ts, result.entry)
+        || !appendLeg(db, operationId, toCard, inType,
+                      amount, targetBalance.value() + amount, ts, toEntry)
+        || (inTransaction && !inTransaction(db, result.entry)))
+    {
+        db.rollback();
+        result.entry = TransactionRecord();
+        return result.fail(OperationError::StorageFailed);
+    }
+    result.timings.writeNs = lap(phase);
+
+    if (!commitWrite(db, result)) {
+        result.entry = TransactionRecord();
+        return false;
+    }
+    result.timings.commitNs = lap(phase);
+    return true;
+}
+
+bool SqliteStore::beginPrepared(OperationResult &result)
+{
+    QSqlDatabase db = database();
+    if (!db.isOpen()) {
+        EventLog::error("db.not_open");
+        return result.fail(OperationError::StorageFailed);
+    }
+    return beginWrite(db, result);
+}
+
+bool SqliteStore::prepareLegs(qint64 xid,
+                              TransactionType operationType,
+                              const QList<Leg> &legs,
+                              const QString &ts,
+                              bool check,
+                              OperationResult &result,
+                              QList<TransactionRecord> &entries)
+{
+    QSqlDatabase db = database();
+
+    qint64 operationId = openOperation(db, operationType, ts);
+    if (operationId == 0)
+        return result.fail(OperationError::StorageFailed);
+
+    for (const Leg &leg : legs) {
+        if (leg.cardNumber.isEmpty()) {
+            double atmCash = getAtmCash();
+            if (check && atmCash + leg.delta < 0)
+                return result.fail(OperationError::AtmOutOfCash);
+            if (!updateAtmCash(atmCash + leg.delta)
+                || !addCashRollup(db, operationType, std::abs(leg.delta), ts))
+                return result.fail(OperationError::StorageFailed);
+            continue;
+        }
+
+        std::optional<double> balance = balanceOn(db, leg.cardNumber);
+        if (!balance.has_value())
+            return result.fail(OperationError::AccountNotFound);
+        if (check && balance.value() + leg.delta < 0)
+            return result.fail(OperationError::InsufficientFunds);
+
+        TransactionRecord entry;
+        if (!appendLeg(db, operationId, leg.cardNumber, leg.type, std::abs(leg.delta),
+                       balance.value() + leg.delta, ts, entry))
+            return result.fail(OperationError::StorageFailed);
+        entries.append(entry);
+    }
+
+    QSqlQuery query(db);
+    query.prepare("INSERT INTO shard_transfers (xid, operation_id) VALUES (:xid, :op)");
+    query.bindValue(":xid", xid);
+    query.bindValue(":op", operationId);
+    if (!query.exec()) {
+        EventLog::error("sql.failed", "INSERT shard_transfers", query.lastError().text());
+        return result.fail(OperationError::StorageFailed);
+    }
+    return true;
+}
+
+bool SqliteStore::commitPrepared(OperationResult &result)
+{
+    QSqlDatabase db = database();
+    return commitWrite(db, result);
+}
+
+void SqliteStore::rollbackPrepared()
+{
+    database().rollback();
+}
+
+std::optional<bool> SqliteStore::hasPrepared(qint64 xid) const
+{
+    QSqlQuery query(database());
+    query.prepare("SELECT 1 FROM shard_transfers WHERE xid = :xid");
+    query.bindValue(":xid", xid);
+    if (!query.exec()) {
+        EventLog::error("sql.failed", "SELECT shard_transfers", query.lastError().text());
+        return std::nullopt;
+    }
+    return query.next();
+}
+
+void SqliteStore::forEachAccount(
+    const std::function<void(const AccountRecord &)> &visit) const
+{
+    QSqlDatabase db = readDatabase();
+    if (!db.isOpen()) {
+        EventLog::error("db.not_open");
+        return;
+    }
+
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    if (!query.exec("SELECT a.card_number, a.pin, b.balance, a.failed_attempts, a.locked_until "
+                    "FROM accounts a JOIN account_balances b ON b.card_number = a.card_number"))
+    {
+        EventLog::error("sql.failed", "SELECT accounts", query.lastError().text());
+        return;
+    }
+
+    while (query.next()) {
+        AccountRecord rec;
+        rec.cardNumber = cardNumberFromKey(query.value(0).toLongLong());
+        rec.pinHash = query.value(1).toString();
+        rec.balance = query.value(2).toDouble();
+        rec.failedAttempts = query.value(3).toInt();
+        if (!query.value(4).isNull())
+            rec.lockedUntil = query.value(4).toDateTime();
+        visit(rec);
+    }
+}
+
+bool SqliteStore::append(const QString &cardNumber,
+                         TransactionType type,
+                         double amount,
+                         double balanceAfter,
+                         TransactionRecord &entry)
+{
+    QSqlDatabase db = database();
+    if (!db.isOpen()) {
+        EventLog::error("db.not_open");
+        return false;
+    }
+
+    // SAVEPOINT работает и внутри уже открытой транзакции вызывающего
+    // (корректировка баланса из администрирования), и сам по себе.
+    QSqlQuery query(db);
+    if (!query.exec("SAVEPOINT ledger_append")) {
+        EventLog::error("tx.begin_failed", "SAVEPOINT", query.lastError().text());
+        return false;
+    }
+
+    // Время задаётся здесь в формате CURRENT_TIMESTAMP (UTC), чтобы
+    // вернуть вызывающему ту же строку, что потом прочитает история.
+    QString ts = QDateTime::currentDateTimeUtc().toString(TIMESTAMP_FORMAT);
+
+    qint64 operationId = openOperation(db, type, ts);
+    if (operationId == 0
+        || !appendLeg(db, operationId, cardNumber, type, amount, balanceAfter, ts, entry))
+    {
+        query.exec("ROLLBACK TO ledger_append");
+        query.exec("RELEASE ledger_append");
+        return false;
+    }
+
+    if (!query.exec("RELEASE ledger_append")) {
+        EventLog::error("tx.commit_failed", "RELEASE", query.lastError().text());
+        return false;
+    }
+
+    return true;
+}
+
+QList<TransactionRecord> SqliteStore::history(const QString &cardNumber,
+                                              int limit,
+                                              qint64 beforeId) const
+{
+    QSqlDatabase db = readDatabase();
+    if (!db.isOpen()) {
+        EventLog::error("db.not_open");
+        return {};
+    }
+
+    return TransactionArchive::history(db, cardNumber, limit, beforeId);
+}
+
+bool SqliteStore::historyInto(const QString &cardNumber,
+                              int limit,
+                              qint64 beforeId,
+                              HistoryBuffer &out) const
+{
+    QSqlDatabase db = readDatabase();
+    if (!db.isOpen()) {
+        EventLog::error("db.not_open");
+        return false;
+    }
+
+    return TransactionArchive::history(db, cardNumber, limit, beforeId, out);
+}
+
+std::optional<double> SqliteStore::balanceAt(const QString &cardNumber,
+                                             const QDateTime &at) const
+{
+    QSqlDatabase db = readDatabase();
+    if (!db.isOpen()) {
+        EventLog::error("db.not_open");
+        return std::nullopt;
+    }
+
+    return TransactionArchive::balanceAt(db, cardNumber, at);
+}
+
+bool SqliteStore::snapshotBalances(const QSqlDatabase &db, int batchSize)
+{
+    QSqlQuery q(db);
+    qint64 after = -1;
+    qint64 updated = 0;
+
+    // Порции по диапазону номеров карт: блокировка записи держится
+    // недолго, терминалы успевают проводить операции между порциями.
+    while (true) {
+        if (!q.exec("BEGIN IMMEDIATE")) {
+            EventLog::error("tx.begin_failed", "BEGIN IMMEDIATE", q.lastError().text());
+            return false;
+        }
+
+        QSqlQuery step(db);
+        step.prepare("SELECT MAX(card_number) FROM ("
+                     " SELECT card_number FROM accounts WHERE card_number > :after"
+                     " ORDER BY card_number LIMIT :n)");
+        step.bindValue(":after", after);
+        step.bindValue(":n", batchSize);
+
+        if (!step.exec() || !step.next()) {
+            EventLog::error("sql.failed", "SELECT snapshot batch", step.lastError().text());
+            q.exec("ROLLBACK");
+            return false;
+        }
+
+        if (step.value(0).isNull()) {
+            step.finish();
+            q.exec("COMMIT");
+            break;
+        }
+
+        qint64 last = step.value(0).toLongLong();
+        step.finish();
+
+        step.prepare("UPDATE accounts SET (balance, snapshot_id) = ("
+                     " SELECT t.balance_after, t.id FROM transactions t"
+                     " WHERE t.card_number = accounts.card_number"
+                     " ORDER BY t.id DESC LIMIT 1) "
+                     "WHERE card_number > :after AND card_number <= :last"
+                     " AND EXISTS (SELECT 1 FROM transactions t"
+                     "  WHERE t.card_number = accounts.card_number"
+                     "  AND t.id > accounts.snapshot_id)");
+        step.bindValue(":after", after);
+        step.bindValue(":last", last);
+
+        if (!step.exec()) {
+            EventLog::error("sql.failed", "UPDATE accounts.snapshot", step.lastError().text());
+            q.exec("ROLLBACK");
+            return false;
+        }
+        updated += step.numRowsAffected();
+
+        if (!q.exec("COMMIT")) {
+            EventLog::error("tx.commit_failed", "COMMIT", q.lastError().text());
+            q.exec("ROLLBACK");
+            return false;
+        }
+
+        after = last;
+    }
+
+    EventLog::info("balances.snapshot", nullptr, QString("accounts=%1").arg(updated));
+    return true;
+}
+
+void SqliteStore::forEachEntry(
+    const std::function<void(const QString &cardNumber,
+                             const TransactionRecord &)> &visit) const
+{
+    QSqlDatabase db = readDatabase();
+    if (!db.isOpen()) {
+        EventLog::error("db.not_open");
+        return;
+    }
+
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    if (!query.exec("SELECT id, card_number, type, amount, balance_after, ts, operation_id "
+                    "FROM transactions ORDER BY id"))
+    {
+        EventLog::error("sql.failed", "SELECT transactions", query.lastError().text());
+        return;
+    }
+
+    while (query.next()) {
+        TransactionRecord rec;
+        rec.id = query.value(0).toLongLong();
+        rec.type = transactionTypeFromStorage(query.value(2));
+        rec.amount = query.value(3).toDouble();
+        rec.balanceAfter = query.value(4).toDouble();
+        rec.timestamp = QDateTime::fromString(query.value(5).toString(), TIMESTAMP_FORMAT);
+        rec.timestamp.setTimeSpec(Qt::UTC);
+        rec.operationId = query.value(6).toLongLong();
+        visit(cardNumberFromKey(query.value(1).toLongLong()), rec);
+    }
+}
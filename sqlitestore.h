@@ -0,0 +1,164 @@
+#ifndef SQLITESTORE_H
+#define SQLITESTORE_H
+
+#include <QSqlDatabase>
+#include <QThread>
+
+#include "storage.h"
+
+// Хранилище поверх atm.db. Каждому потоку нужно своё соединение
+// QSqlDatabase, поэтому имя соединения задаётся явно; пустое имя —
+// соединение по умолчанию. Если хранилище вызывают из другого потока (один
+// AtmController на много сессий), этот поток получает клон соединения,
+// который закрывается при завершении потока.
+//
+// Отображаемые данные (balance, history, forEach*) читаются через
+// соединение readConnectionName, если оно открыто (см. ReadSnapshot), —
+// так отчёты не конкурируют с записью. Денежные операции читают и пишут
+// только через основное соединение внутри своей транзакции.
+//
+// Журнал transactions только дописывается: денежная операция — строка в
+// ledger_operations и её ноги в transactions, без UPDATE счетов.
+// accounts.balance — снимок баланса на строке accounts.snapshot_id;
+// текущий баланс — balance_after последней строки карты после снимка
+// (представление account_balances, один поиск по индексу).
+class SqliteStore : public AccountStore, public LedgerStore
+{
+public:
+    explicit SqliteStore(const QString &connectionName = QString(),
+                         const QString &readConnectionName = QString());
+
+    std::optional<AccountRecord> account(const QString &cardNumber) const override;
+    bool addAccount(const AccountRecord &account) override;
+
+    bool setLoginState(const QString &cardNumber,
+                       int failedAttempts,
+                       const QDateTime &lockedUntil) override;
+    bool changePin(const QString &cardNumber,
+                   const QString &oldPinHash,
+                   const QString &newPinHash,
+                   OperationResult &result) override;
+
+    std::optional<double> balance(const QString &cardNumber) const override;
+
+    double atmCash() const override;
+    bool setAtmCash(double cash) override;
+
+    bool withdraw(const QString &cardNumber,
+                  double amount,
+                  OperationResult &result) override;
+    bool deposit(const QString &cardNumber,
+                 double amount,
+                 OperationResult &result) override;
+    bool transfer(const QString &fromCard,
+                  const QString &toCard,
+                  double amount,
+                  TransactionType outType,
+                  TransactionType inType,
+                  OperationResult &result) override;
+
+    // Тот же перевод; перед COMMIT вызывает inTransaction на соединении
+    // перевода (админка пишет так запись аудита). false — перевод откатывается.
+    bool transfer(const QString &fromCard,
+                  const QString &toCard,
+                  double amount,
+                  TransactionType outType,
+                  TransactionType inType,
+                  OperationResult &result,
+                  const std::function<bool(QSqlDatabase &, const TransactionRecord &)> &inTransaction);
+
+    void forEachAccount(
+        const std::function<void(const AccountRecord &)> &visit) const override;
+
+    bool append(const QString &cardNumber,
+                TransactionType type,
+                double amount,
+                double balanceAfter,
+                TransactionRecord &entry) override;
+
+    QList<TransactionRecord> history(const QString &cardNumber,
+                                     int limit,
+                                     qint64 beforeId) const override;
+    bool historyInto(const QString &cardNumber,
+                     int limit,
+                     qint64 beforeId,
+                     HistoryBuffer &out) const override;
+
+    std::optional<double> balanceAt(const QString &cardNumber,
+                                    const QDateTime &at) const override;
+
+    void forEachEntry(
+        const std::function<void(const QString &cardNumber,
+                                 const TransactionRecord &)> &visit) const override;
+
+    // Нога распределённой операции (см. ShardedStore). Пустой cardNumber —
+    // наличность банкомата; delta < 0 — списание.
+    struct Leg {
+        QString cardNumber;
+        TransactionType type = TransactionType::Unknown;
+        double delta = 0.0;
+    };
+
+    // Участник двухфазной фиксации. beginPrepared — BEGIN IMMEDIATE;
+    // prepareLegs пишет ноги и отметку xid в shard_transfers, не фиксируя;
+    // commitPrepared / rollbackPrepared завершают транзакцию. check = false —
+    // без проверки остатка и наличности (восстановление уже принятого
+    // решения). entries — строки журнала карт в порядке ног.
+    bool beginPrepared(OperationResult &result);
+    bool prepareLegs(qint64 xid,
+                     TransactionType operationType,
+                     const QList<Leg> &legs,
+                     const QString &ts,
+                     bool check,
+                     OperationResult &result,
+                     QList<TransactionRecord> &entries);
+    bool commitPrepared(OperationResult &result);
+    void rollbackPrepared();
+    // Ноги с этим xid уже зафиксированы; nullopt — ошибка чтения.
+    std::optional<bool> hasPrepared(qint64 xid) const;
+    // Соединение, на котором открыта транзакция участника.
+    QSqlDatabase connection() const { return database(); }
+
+    // Соединение connectionName для текущего потока: в потоке ownerThread —
+    // само соединение, в остальных — клон, закрываемый вместе с потоком.
+    static QSqlDatabase threadConnection(const QString &connectionName, QThread *ownerThread);
+
+    // Переносит текущие балансы в accounts.balance порциями по batchSize
+    // счетов. Вызывается при старте и перед архивацией: строки, на которые
+    // опирается текущий баланс, не должны уходить из горячей таблицы.
+    static bool snapshotBalances(const QSqlDatabase &db, int batchSize = 1000);
+
+private:
+    QSqlDatabase database() const;
+    QSqlDatabase readDatabase() const;
+    QSqlDatabase connectionFor(const QString &connectionName) const;
+
+    std::optional<double> balanceOn(const QSqlDatabase &db, const QString &cardNumber) const;
+
+    // BEGIN IMMEDIATE: баланс читается уже под блокировкой записи, поэтому
+    // параллельная операция не может вклиниться между чтением и записью.
+    // При отказе — result.error (DatabaseBusy, если блокировку не дождались).
+    bool beginWrite(QSqlDatabase &db, OperationResult &result);
+    bool commitWrite(QSqlDatabase &db, OperationResult &result);
+    qint64 openOperation(QSqlDatabase &db, TransactionType type, const QString &ts);
+    bool appendLeg(QSqlDatabase &db,
+                   qint64 operationId,
+                   const QString &cardNumber,
+                   TransactionType type,
+                   double amount,
+                   double balanceAfter,
+                   const QString &ts,
+                   TransactionRecord &entry);
+
+    double getAtmCash() const;
+    bool updateAtmCash(double newCash);
+    // Часовой агрегат снятий и взносов банкомата (см. CashForecast) —
+    // в транзакции операции, без отдельного прохода по журналу.
+    bool addCashRollup(QSqlDatabase &db, TransactionType type, double amount, const QString &ts);
+
+    QString m_connectionName;
+    QString m_readConnectionName;
+    QThread *m_ownerThread;
+};
+
+#endif // SQLITESTORE_H
@@ -0,0 +1,184 @@
+#include "standbyapplier.h"
+
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QVariant>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+
+#include <algorithm>
+#include <atomic>
+
+#include "eventlog.h"
+
+namespace {
+const QString CONNECTION = "standby_%1";
+const QString SEGMENT_PATTERN = "log_*.bin";
+
+std::atomic<int> g_nextConnection{0};
+}
+
+StandbyApplier::StandbyApplier(const QString &standbyPath,
+                               const QString &logDirectory,
+                               int batchSize)
+    : m_standbyPath(standbyPath),
+    m_logDirectory(logDirectory),
+    m_connectionName(CONNECTION.arg(g_nextConnection++)),
+    m_batchSize(std::max(1, batchSize))
+{
+}
+
+StandbyApplier::~StandbyApplier()
+{
+    if (QSqlDatabase::contains(m_connectionName)) {
+        QSqlDatabase::database(m_connectionName, false).close();
+        QSqlDatabase::removeDatabase(m_connectionName);
+    }
+}
+
+bool StandbyApplier::open()
+{
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", m_connectionName);
+    db.setDatabaseName(m_standbyPath);
+    db.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000");
+
+    if (!db.open()) {
+        EventLog::error("db.open_failed", "standby connection", db.lastError().text());
+        return false;
+    }
+    if (!Replication::isStandby(db)) {
+        EventLog::error("standby.not_standby", nullptr, m_standbyPath);
+        return false;
+    }
+    return true;
+}
+
+bool StandbyApplier::readAppliedSeq(QSqlDatabase &db, Status &status)
+{
+    QSqlQuery q(db);
+    if (!q.exec("SELECT applied_seq, applied_ms FROM standby_state WHERE id = 1") || !q.next()) {
+        EventLog::error("sql.failed", "SELECT standby_state", q.lastError().text());
+        return false;
+    }
+    status.appliedSeq = q.value(0).toLongLong();
+    status.appliedCommitMs = q.value(1).toLongLong();
+    return true;
+}
+
+bool StandbyApplier::applyPending(Status &status)
+{
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName, false);
+    if (!db.isOpen())
+        return false;
+
+    status.applied = 0;
+    status.lagMs = 0;
+    if (!readAppliedSeq(db, status))
+        return false;
+
+    // Отставание считается от последнего, что пришло с основной, — даже
+    // если применять нечего: остановившаяся передача видна как растущее
+    // отставание, а не как 0.
+    qint64 receivedMs = std::max(status.appliedCommitMs, Replication::readHeartbeat(m_logDirectory));
+
+    QDir dir(m_logDirectory);
+    const QStringList segments = dir.entryList({ SEGMENT_PATTERN }, QDir::Files, QDir::Name);
+
+    for (const QString &name : segments) {
+        const QString path = dir.filePath(name);
+        receivedMs = std::max(receivedMs, QFileInfo(path).lastModified().toMSecsSinceEpoch());
+
+        QList<Replication::Record> records;
+        if (!Replication::readSegment(path, records))
+            return false;
+
+        int from = 0;
+        while (from < records.size() && records[from].seq <= status.appliedSeq)
+            ++from;
+
+        while (from < records.size()) {
+            int to = std::min<int>(from + m_batchSize, records.size());
+            if (!applyBatch(db, records, from, to, status))
+                return false;
+            from = to;
+        }
+
+        // Всё из сегмента уже в резервной БД вместе с applied_seq.
+        QFile::remove(path);
+    }
+
+    status.receivedMs = receivedMs;
+    status.lagMs = std::max<qint64>(0, QDateTime::currentMSecsSinceEpoch() - receivedMs);
+    return true;
+}
+
+bool StandbyApplier::applyBatch(QSqlDatabase &db, const QList<Replication::Record> &records,
+                                int from, int to, Status &status)
+{
+    QSqlQuery q(db);
+    if (!q.exec("BEGIN IMMEDIATE")) {
+        EventLog::error("tx.begin_failed", "BEGIN IMMEDIATE", q.lastError().text());
+        return false;
+    }
+
+    for (int i = from; i < to; ++i) {
+        if (!q.exec(records[i].statement)) {
+            EventLog::error("standby.apply_failed", nullptr,
+                            QString("seq=%1 %2").arg(records[i].seq).arg(q.lastError().text()));
+            db.rollback();
+            return false;
+        }
+    }
+
+    const Replication::Record &last = records[to - 1];
+    q.prepare("UPDATE standby_state SET applied_seq = :seq, applied_ms = :ms WHERE id = 1");
+    q.bindValue(":seq", last.seq);
+    q.bindValue(":ms", last.commitMs);
+    if (!q.exec()) {
+        EventLog::error("sql.failed", "UPDATE standby_state", q.lastError().text());
+        db.rollback();
+        return false;
+    }
+
+    if (!db.commit()) {
+        EventLog::error("tx.commit_failed", "COMMIT", db.lastError().text());
+        db.rollback();
+        return false;
+    }
+
+    status.appliedSeq = last.seq;
+    status.appliedCommitMs = last.commitMs;
+    status.applied += to - from;
+    return true;
+}
+
+bool StandbyApplier::promote(Status &status)
+{
+    EventLog::Scope scope("standby_promote", QString());
+
+    if (!applyPending(status))
+        return false;
+
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName, false);
+    QSqlQuery q(db);
+    if (!q.exec("DROP TABLE standby_state")) {
+        EventLog::error("sql.failed", "DROP standby_state", q.lastError().text());
+        return false;
+    }
+
+    EventLog::info("standby.promoted", nullptr,
+                   QString("path=%1 seq=%2").arg(m_standbyPath).arg(status.appliedSeq));
+    scope.succeed();
+    return true;
+}
+
+void StandbyApplier::printStatus(QTextStream &out, const Status &s)
+{
+    out << QString("applied_seq %1  applied %2  lag_ms %3  commit %4\n")
+               .arg(s.appliedSeq)
+               .arg(s.applied)
+               .arg(s.lagMs)
+               .arg(QDateTime::fromMSecsSinceEpoch(s.appliedCommitMs).toString(Qt::ISODate));
+}
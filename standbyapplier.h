@@ -0,0 +1,55 @@
+#ifndef STANDBYAPPLIER_H
+#define STANDBYAPPLIER_H
+
+#include <QString>
+#include <QList>
+#include <QSqlDatabase>
+#include <QTextStream>
+
+#include "replication.h"
+
+// Применяет сегменты журнала (см. Replication) к резервной БД. Порция
+// записей и отметка applied_seq в standby_state фиксируются одной
+// транзакцией, поэтому после сбоя применение продолжается с того же места,
+// а повторно пришедшие записи пропускаются по seq.
+class StandbyApplier
+{
+public:
+    struct Status {
+        qint64 appliedSeq = 0;
+        qint64 appliedCommitMs = 0;  // время фиксации последней применённой записи
+        qint64 applied = 0;          // за этот вызов
+        qint64 receivedMs = 0;       // последний сегмент или отметка прохода LogShipper
+        qint64 lagMs = 0;            // от receivedMs до сейчас
+    };
+
+    explicit StandbyApplier(const QString &standbyPath,
+                            const QString &logDirectory,
+                            int batchSize = 1000);
+    ~StandbyApplier();
+
+    bool open();
+
+    // Применяет всё, что есть в сегментах; полностью применённые сегменты
+    // удаляются.
+    bool applyPending(Status &status);
+
+    // Догоняет журнал и делает БД обычной: standby_state удаляется,
+    // терминал может её открыть. Захват на новой основной включается
+    // отдельно (--standby-init в обратную сторону).
+    bool promote(Status &status);
+
+    static void printStatus(QTextStream &out, const Status &s);
+
+private:
+    bool readAppliedSeq(QSqlDatabase &db, Status &status);
+    bool applyBatch(QSqlDatabase &db, const QList<Replication::Record> &records,
+                    int from, int to, Status &status);
+
+    QString m_standbyPath;
+    QString m_logDirectory;
+    QString m_connectionName;
+    int m_batchSize;
+};
+
+#endif // STANDBYAPPLIER_H
@@ -0,0 +1,209 @@
+#include "statementexporter.h"
+
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QVariant>
+#include <QSaveFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QDateTime>
+#include <QTextStream>
+
+#include <algorithm>
+#include <cmath>
+
+#include "eventlog.h"
+#include "historybuffer.h"
+#include "transactionarchive.h"
+#include "transactiontype.h"
+
+namespace {
+const QString CONNECTION = "statement_%1";
+const int ROWS_PER_PAGE = 60;
+const int LINE_WIDTH = 80;
+// Строк в одной порции чтения.
+const int BATCH_ROWS = 512;
+
+std::atomic<int> g_nextConnection{0};
+
+QString money(double amount)
+{
+    return QString::number(amount, 'f', 2);
+}
+
+QString maskedCard(const QString &card)
+{
+    return card.size() > 4 ? QString("**** **** **** %1").arg(card.right(4)) : card;
+}
+
+QString csvField(const QString &value)
+{
+    if (!value.contains(',') && !value.contains('"') && !value.contains('\n'))
+        return value;
+    QString quoted = value;
+    quoted.replace("\"", "\"\"");
+    return "\"" + quoted + "\"";
+}
+
+void writeTextColumns(QTextStream &out)
+{
+    out << QString("Дата").leftJustified(21)
+        << QString("Операция").leftJustified(30)
+        << QString("Сумма").rightJustified(14)
+        << QString("Остаток").rightJustified(15) << "\n"
+        << QString(LINE_WIDTH, '-') << "\n";
+}
+}
+
+StatementExporter::StatementExporter(const QString &databasePath,
+                                     const QString &cardNumber,
+                                     const QDate &from,
+                                     const QDate &to,
+                                     Format format,
+                                     const QString &outputPath,
+                                     QObject *parent)
+    : QObject(parent),
+    m_databasePath(databasePath),
+    m_cardNumber(cardNumber),
+    m_from(from),
+    m_to(to),
+    m_format(format),
+    m_outputPath(outputPath)
+{
+}
+
+QString StatementExporter::defaultFileName(const QString &cardNumber,
+                                           const QDate &from,
+                                           const QDate &to,
+                                           Format format)
+{
+    return QString("statement_%1_%2_%3.%4")
+        .arg(cardNumber.right(4))
+        .arg(from.toString("yyyyMMdd"))
+        .arg(to.toString("yyyyMMdd"))
+        .arg(format == Format::Csv ? "csv" : "txt");
+}
+
+void StatementExporter::run()
+{
+    EventLog::Scope scope("statement_export", m_cardNumber);
+
+    const QString connectionName = CONNECTION.arg(g_nextConnection++);
+    qint64 rows = 0;
+    bool ok = false;
+
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+        db.setDatabaseName(m_databasePath);
+        // URI нужен для ATTACH архивных разделов в режиме только для чтения.
+        db.setConnectOptions("QSQLITE_OPEN_READONLY;QSQLITE_OPEN_URI;QSQLITE_BUSY_TIMEOUT=5000");
+
+        if (!db.open()) {
+            EventLog::error("db.open_failed", "statement connection", db.lastError().text());
+        } else {
+            QDir().mkpath(QFileInfo(m_outputPath).absolutePath());
+
+            QSaveFile file(m_outputPath);
+            if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+                EventLog::error("statement.open_failed", nullptr,
+                                m_outputPath + ": " + file.errorString());
+            } else {
+                QDateTime from(m_from, QTime(0, 0), Qt::UTC);
+                QDateTime to(m_to.addDays(1), QTime(0, 0), Qt::UTC);
+
+                double opening = TransactionArchive::balanceAt(db, m_cardNumber, from.addSecs(-1))
+                                     .value_or(0.0);
+                double closing = opening;
+                double credits = 0.0;
+                double debits = 0.0;
+
+                QTextStream out(&file);
+                int page = 1;
+                int lastPercent = -1;
+                qint64 totalDays = std::max<qint64>(1, m_from.daysTo(m_to) + 1);
+
+                if (m_format == Format::Csv) {
+                    out << "id,operation_id,timestamp,type,description,amount,balance_after\n";
+                } else {
+                    out << "ВЫПИСКА ПО КАРТЕ " << maskedCard(m_cardNumber) << "\n"
+                        << "Период: " << m_from.toString("yyyy-MM-dd") << " — "
+                        << m_to.toString("yyyy-MM-dd") << " (UTC)\n"
+                        << "Входящий остаток: " << money(opening) << "\n\n";
+                    writeTextColumns(out);
+                }
+
+                qint64 fromDay = QDate(1970, 1, 1).daysTo(m_from);
+
+                bool streamed = TransactionArchive::forEachBatchInRange(
+                    db, m_cardNumber, from, to, BATCH_ROWS,
+                    [&](const HistoryBuffer &batch) {
+                        if (m_cancelled)
+                            return false;
+
+                        for (int i = 0; i < batch.size(); ++i) {
+                            const TransactionTypeInfo &info = transactionTypeInfo(batch.type(i));
+                            qint64 signedCents = info.balanceSign * batch.amountCents(i);
+                            double signedAmount = signedCents / 100.0;
+                            double balanceAfter = batch.balanceCents(i) / 100.0;
+                            QString ts = HistoryBuffer::formatTimestamp(batch.timestamp(i));
+
+                            if (m_format == Format::Csv) {
+                                out << batch.id(i) << ',' << batch.operationId(i) << ','
+                                    << ts << ',' << info.code << ','
+                                    << csvField(QString::fromUtf8(info.displayName)) << ','
+                                    << money(signedAmount) << ',' << money(balanceAfter) << '\n';
+                            } else {
+                                if (rows > 0 && rows % ROWS_PER_PAGE == 0) {
+                                    out << "\f" << "Лист " << ++page << "\n\n";
+                                    writeTextColumns(out);
+                                }
+                                out << ts.leftJustified(21)
+                                    << QString::fromUtf8(info.displayName).leftJustified(30, ' ', true)
+                                    << money(signedAmount).rightJustified(14)
+                                    << money(balanceAfter).rightJustified(15) << "\n";
+                            }
+
+                            if (signedCents > 0)
+                                credits += signedAmount;
+                            else
+                                debits -= signedAmount;
+                            closing = balanceAfter;
+                            ++rows;
+                        }
+
+                        // Прогресс — раз на порцию, по дате её последней строки.
+                        qint64 day = batch.timestamp(batch.size() - 1) / 86400;
+                        int percent = int(std::clamp<qint64>((day - fromDay) * 100 / totalDays, 0, 99));
+                        if (percent != lastPercent) {
+                            lastPercent = percent;
+                            emit progress(percent, rows);
+                        }
+                        return true;
+                    });
+
+                if (m_format == Format::Text) {
+                    out << QString(LINE_WIDTH, '-') << "\n"
+                        << "Операций: " << rows
+                        << "   Поступления: " << money(credits)
+                        << "   Списания: " << money(debits) << "\n"
+                        << "Исходящий остаток: " << money(closing) << "\n";
+                }
+                out.flush();
+
+                if (streamed && !m_cancelled && file.commit()) {
+                    ok = true;
+                    emit progress(100, rows);
+                } else {
+                    file.cancelWriting();
+                }
+            }
+            db.close();
+        }
+    }
+    QSqlDatabase::removeDatabase(connectionName);
+
+    if (ok)
+        scope.succeed();
+    emit finished(ok, rows, ok ? m_outputPath : QString());
+}
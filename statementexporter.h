@@ -0,0 +1,58 @@
+#ifndef STATEMENTEXPORTER_H
+#define STATEMENTEXPORTER_H
+
+#include <QObject>
+#include <QString>
+#include <QDate>
+
+#include <atomic>
+
+// Выписка по карте за период в файл: CSV или текст фиксированной ширины
+// для печати. Работает в отдельном потоке на своём соединении только для
+// чтения; строки идут курсором порциями по столбцам прямо в файл
+// (TransactionArchive::forEachBatchInRange), поэтому память не зависит от
+// длины периода. Файл
+// пишется через QSaveFile и появляется только целиком.
+class StatementExporter : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum class Format { Csv, Text };
+
+    // Период — даты from..to включительно.
+    StatementExporter(const QString &databasePath,
+                      const QString &cardNumber,
+                      const QDate &from,
+                      const QDate &to,
+                      Format format,
+                      const QString &outputPath,
+                      QObject *parent = nullptr);
+
+    // Можно вызывать из любого потока; файл не создаётся.
+    void cancel() { m_cancelled = true; }
+
+    static QString defaultFileName(const QString &cardNumber,
+                                   const QDate &from,
+                                   const QDate &to,
+                                   Format format);
+
+public slots:
+    void run();
+
+signals:
+    // percent — доля периода, пройденная по времени строк.
+    void progress(int percent, qint64 rows);
+    void finished(bool ok, qint64 rows, const QString &path);
+
+private:
+    QString m_databasePath;
+    QString m_cardNumber;
+    QDate m_from;
+    QDate m_to;
+    Format m_format;
+    QString m_outputPath;
+    std::atomic<bool> m_cancelled{false};
+};
+
+#endif // STATEMENTEXPORTER_H
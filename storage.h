@@ -0,0 +1,157 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <QString>
+#include <QList>
+#include <QDateTime>
+#include <QMetaType>
+
+#include <functional>
+#include <optional>
+
+#include "operationerror.h"
+#include "transactiontype.h"
+
+class HistoryBuffer;
+
+struct TransactionRecord {
+    qint64 id = 0;
+    qint64 operationId = 0;   // общий для всех строк одной операции (ноги перевода)
+    TransactionType type = TransactionType::Unknown;
+    double amount = 0.0;
+    double balanceAfter = 0.0;
+    QDateTime timestamp;
+};
+Q_DECLARE_METATYPE(TransactionRecord)
+
+// Время фаз денежной операции, нс. lock — ожидание блокировки записи,
+// read — чтение баланса и наличности, write — строки журнала, commit —
+// фиксация; total — весь вызов AtmController, включая проверку лимита.
+struct OperationTimings {
+    qint64 lockNs = 0;
+    qint64 readNs = 0;
+    qint64 writeNs = 0;
+    qint64 commitNs = 0;
+    qint64 totalNs = 0;
+};
+
+// Итог денежной операции: всё, что нужно экрану и чеку, без повторного
+// запроса. entry — зафиксированная строка журнала карты (id, время,
+// баланс после); при отказе — error и пустая entry.
+struct OperationResult {
+    OperationError error = OperationError::None;
+    TransactionRecord entry;
+    OperationTimings timings;
+
+    bool ok() const { return error == OperationError::None; }
+    explicit operator bool() const { return ok(); }
+
+    bool fail(OperationError e)
+    {
+        error = e;
+        return false;
+    }
+
+    static OperationResult failure(OperationError e)
+    {
+        OperationResult r;
+        r.error = e;
+        return r;
+    }
+};
+
+struct AccountRecord {
+    QString cardNumber;
+    QString pinHash;
+    double balance = 0.0;
+    int failedAttempts = 0;
+    QDateTime lockedUntil;   // невалидная дата — карта не заблокирована
+};
+
+// Хранилище счетов и наличности банкомата. Денежные операции выполняются
+// целиком внутри реализации вместе с записью строк журнала операций,
+// поэтому AtmController не знает, SQLite это или память.
+class AccountStore
+{
+public:
+    virtual ~AccountStore() = default;
+
+    virtual std::optional<AccountRecord> account(const QString &cardNumber) const = 0;
+    virtual bool addAccount(const AccountRecord &account) = 0;
+
+    virtual bool setLoginState(const QString &cardNumber,
+                               int failedAttempts,
+                               const QDateTime &lockedUntil) = 0;
+    // Смена PIN вместе со строкой журнала PinChange: хэш старого PIN
+    // сверяется, а баланс для balance_after читается под той же блокировкой
+    // записи, что и сама строка, — операция карты между ними не теряется.
+    virtual bool changePin(const QString &cardNumber,
+                           const QString &oldPinHash,
+                           const QString &newPinHash,
+                           OperationResult &result) = 0;
+
+    virtual std::optional<double> balance(const QString &cardNumber) const = 0;
+
+    virtual double atmCash() const = 0;
+    virtual bool setAtmCash(double cash) = 0;
+
+    // result.entry — записанная строка журнала карты; при false —
+    // result.error. Хранилище заполняет фазы lock..commit в result.timings.
+    virtual bool withdraw(const QString &cardNumber,
+                          double amount,
+                          OperationResult &result) = 0;
+    virtual bool deposit(const QString &cardNumber,
+                         double amount,
+                         OperationResult &result) = 0;
+    // Получатель обязан существовать; outType/inType — типы строк журнала
+    // для списания и зачисления (TransferOut/TransferIn и т.п.);
+    // result.entry — строка списания.
+    virtual bool transfer(const QString &fromCard,
+                          const QString &toCard,
+                          double amount,
+                          TransactionType outType,
+                          TransactionType inType,
+                          OperationResult &result) = 0;
+
+    virtual void forEachAccount(
+        const std::function<void(const AccountRecord &)> &visit) const = 0;
+};
+
+// Журнал операций: только добавление, история — новые первыми. Каждая
+// операция получает свой id; строки перевода (списание и зачисление)
+// связаны общим operationId.
+class LedgerStore
+{
+public:
+    virtual ~LedgerStore() = default;
+
+    // Отдельная операция из одной строки (смена PIN, корректировка).
+    virtual bool append(const QString &cardNumber,
+                        TransactionType type,
+                        double amount,
+                        double balanceAfter,
+                        TransactionRecord &entry) = 0;
+
+    // beforeId > 0 — следующая страница: строки с id < beforeId.
+    virtual QList<TransactionRecord> history(const QString &cardNumber,
+                                             int limit,
+                                             qint64 beforeId) const = 0;
+
+    // То же по столбцам, дописывается в out (см. HistoryBuffer).
+    virtual bool historyInto(const QString &cardNumber,
+                             int limit,
+                             qint64 beforeId,
+                             HistoryBuffer &out) const = 0;
+
+    // Баланс карты на момент at — balance_after последней строки не позже
+    // at. nullopt — по карте нет ни одной строки.
+    virtual std::optional<double> balanceAt(const QString &cardNumber,
+                                            const QDateTime &at) const = 0;
+
+    // Все строки в порядке id.
+    virtual void forEachEntry(
+        const std::function<void(const QString &cardNumber,
+                                 const TransactionRecord &)> &visit) const = 0;
+};
+
+#endif // STORAGE_H
@@ -0,0 +1,301 @@
+#include "stressharness.h"
+
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QFile>
+#include <QHash>
+#include <QElapsedTimer>
+
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "atmcontroller.h"
+#include "databaseschema.h"
+#include "eventlog.h"
+#include "memorystore.h"
+#include "sqlitestore.h"
+
+namespace {
+const QString MAIN_CONNECTION = "stress_main";
+const QString TEST_PIN = "1234";
+const double EPSILON = 0.005;
+}
+
+bool StressHarness::LevelReport::invariantsHold() const
+{
+    return std::fabs(balanceDrift) < EPSILON
+           && std::fabs(cashDrift) < EPSILON
+           && negativeBalances == 0
+           && chainBreaks == 0
+           && finalMismatches == 0
+           && unbalancedTransfers == 0
+           && openSessions == 0;
+}
+
+StressHarness::StressHarness(const Options &options)
+    : m_options(options)
+{
+}
+
+QString StressHarness::cardFor(int index) const
+{
+    return QString("4000%1").arg(index, 12, 10, QChar('0'));
+}
+
+bool StressHarness::prepareDatabase(const QString &connectionName)
+{
+    const QString &path = m_options.databasePath;
+    QFile::remove(path);
+    QFile::remove(path + "-wal");
+    QFile::remove(path + "-shm");
+
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+    db.setDatabaseName(path);
+    db.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000");
+
+    if (!db.open()) {
+        EventLog::error("db.open_failed", "stress connection", path + ": " + db.lastError().text());
+        return false;
+    }
+
+    if (!DatabaseSchema::migrate(db))
+        return false;
+
+    if (!db.transaction())
+        return false;
+
+    SqliteStore store(connectionName);
+    if (!seedStore(store)) {
+        db.rollback();
+        return false;
+    }
+
+    return db.commit();
+}
+
+bool StressHarness::seedStore(AccountStore &accounts)
+{
+    QString pinHash = AtmController::hashPin(TEST_PIN);
+    for (int i = 0; i < m_options.accounts; ++i) {
+        AccountRecord account;
+        account.cardNumber = cardFor(i);
+        account.pinHash = pinHash;
+        account.balance = m_options.initialBalance;
+        if (!accounts.addAccount(account))
+            return false;
+    }
+
+    return accounts.setAtmCash(m_options.initialAtmCash);
+}
+
+StressHarness::LevelReport StressHarness::runLevel(int threads)
+{
+    LevelReport report;
+    report.threads = threads;
+
+    const bool inMemory = m_options.engine == "memory";
+
+    {
+        std::shared_ptr<MemoryStore> memory;
+        std::shared_ptr<SqliteStore> sqlite;
+
+        if (inMemory) {
+            memory = std::make_shared<MemoryStore>(m_options.accounts);
+            if (!seedStore(*memory))
+                memory.reset();
+        } else if (prepareDatabase(MAIN_CONNECTION)) {
+            sqlite = std::make_shared<SqliteStore>(MAIN_CONNECTION);
+        }
+
+        if (!memory && !sqlite) {
+            report.finalMismatches = -1;
+        } else {
+            std::atomic<qint64> attempted{0};
+            std::atomic<qint64> succeeded{0};
+            std::atomic<qint64> withdrawnCents{0};
+            std::atomic<qint64> depositedCents{0};
+
+            auto runOps = [&](AtmController &atm, int t) {
+                std::mt19937 rng(m_options.seed + threads * 1000u + t);
+                std::uniform_int_distribution<int> cardDist(0, m_options.accounts - 1);
+                std::uniform_int_distribution<int> otherDist(1, m_options.accounts - 1);
+                std::uniform_int_distribution<int> opDist(0, 99);
+                std::uniform_int_distribution<int> centsDist(100, 50000);
+
+                for (int i = 0; i < m_options.opsPerThread; ++i) {
+                    int index = cardDist(rng);
+                    QString card = cardFor(index);
+                    QString other = cardFor((index + otherDist(rng)) % m_options.accounts);
+                    int cents = centsDist(rng);
+                    double amount = cents / 100.0;
+                    int op = opDist(rng);
+
+                    ++attempted;
+                    bool ok = false;
+
+                    if (op < 5) {
+                        ok = atm.adminTransfer(card, other, amount).ok();
+                    } else if (AtmController::SessionHandle session =
+                                   atm.openSession(card, TEST_PIN)) {
+                        if (op < 40) {
+                            ok = atm.withdraw(session, amount).ok();
+                            if (ok)
+                                withdrawnCents += cents;
+                        } else if (op < 75) {
+                            ok = atm.deposit(session, amount).ok();
+                            if (ok)
+                                depositedCents += cents;
+                        } else {
+                            ok = atm.transferTo(session, other, amount).ok();
+                        }
+                        atm.closeSession(session);
+                    }
+
+                    if (ok)
+                        ++succeeded;
+                }
+            };
+
+            // Один контроллер на все потоки: каждая операция — своя сессия.
+            // SqliteStore сам открывает потокам клоны основного соединения.
+            std::unique_ptr<AtmController> atm;
+            if (inMemory)
+                atm = std::make_unique<AtmController>(memory, memory);
+            else
+                atm = std::make_unique<AtmController>(MAIN_CONNECTION);
+
+            QElapsedTimer timer;
+            timer.start();
+
+            std::vector<std::thread> workers;
+            workers.reserve(threads);
+
+            for (int t = 0; t < threads; ++t)
+                workers.emplace_back([&, t]() { runOps(*atm, t); });
+
+            for (auto &w : workers)
+                w.join();
+
+            report.openSessions = atm->sessions().activeCount();
+            atm.reset();
+
+            report.seconds = timer.nsecsElapsed() / 1e9;
+            report.attempted = attempted;
+            report.succeeded = succeeded;
+
+            if (inMemory)
+                checkInvariants(*memory, *memory, withdrawnCents, depositedCents, report);
+            else
+                checkInvariants(*sqlite, *sqlite, withdrawnCents, depositedCents, report);
+        }
+
+        sqlite.reset();
+        if (!inMemory)
+            QSqlDatabase::database(MAIN_CONNECTION, false).close();
+    }
+
+    if (!inMemory)
+        QSqlDatabase::removeDatabase(MAIN_CONNECTION);
+    return report;
+}
+
+void StressHarness::checkInvariants(const AccountStore &accounts,
+                                    const LedgerStore &ledger,
+                                    qint64 withdrawnCents,
+                                    qint64 depositedCents,
+                                    LevelReport &report)
+{
+    QHash<QString, double> balances;
+    double total = 0.0;
+    accounts.forEachAccount([&](const AccountRecord &account) {
+        balances.insert(account.cardNumber, account.balance);
+        total += account.balance;
+        if (account.balance < -EPSILON)
+            ++report.negativeBalances;
+    });
+
+    double expectedTotal = m_options.accounts * m_options.initialBalance
+                           + (depositedCents - withdrawnCents) / 100.0;
+    report.balanceDrift = total - expectedTotal;
+
+    double cash = accounts.atmCash();
+    report.cashDrift = cash - (m_options.initialAtmCash - withdrawnCents / 100.0);
+    if (cash < -EPSILON)
+        ++report.negativeBalances;
+
+    // Повторное проигрывание истории: каждая строка должна продолжать
+    // цепочку balance_after предыдущей строки той же карты.
+    // Ноги перевода связаны operationId: ровно две строки, сумма движений 0.
+    QHash<QString, double> lastBalance;
+    QHash<qint64, qint64> transferNet;
+    QHash<qint64, int> transferLegs;
+    ledger.forEachEntry([&](const QString &card, const TransactionRecord &rec) {
+        int sign = transactionTypeInfo(rec.type).balanceSign;
+        double running = lastBalance.value(card, m_options.initialBalance);
+        double expected = running + sign * rec.amount;
+        if (std::fabs(expected - rec.balanceAfter) > EPSILON)
+            ++report.chainBreaks;
+        lastBalance.insert(card, rec.balanceAfter);
+
+        switch (rec.type) {
+        case TransactionType::TransferOut:
+        case TransactionType::TransferIn:
+        case TransactionType::AdminTransferOut:
+        case TransactionType::AdminTransferIn:
+            transferNet[rec.operationId] += sign * std::llround(rec.amount * 100.0);
+            ++transferLegs[rec.operationId];
+            break;
+        default:
+            break;
+        }
+    });
+
+    for (auto it = transferLegs.cbegin(); it != transferLegs.cend(); ++it) {
+        if (it.value() != 2 || transferNet.value(it.key()) != 0)
+            ++report.unbalancedTransfers;
+    }
+
+    for (auto it = balances.cbegin(); it != balances.cend(); ++it) {
+        double replayed = lastBalance.value(it.key(), m_options.initialBalance);
+        if (std::fabs(replayed - it.value()) > EPSILON)
+            ++report.finalMismatches;
+    }
+}
+
+bool StressHarness::run(QTextStream &out)
+{
+    bool allOk = true;
+
+    out << "threads  attempted  succeeded  seconds   ops/s     "
+           "balance_drift  cash_drift  negative  chain_breaks  final_mismatch  unbalanced  sessions  result\n";
+
+    for (int threads : m_options.threadCounts) {
+        LevelReport r = runLevel(threads);
+        bool ok = r.invariantsHold();
+        allOk = allOk && ok;
+
+        double opsPerSec = r.seconds > 0 ? r.succeeded / r.seconds : 0.0;
+
+        out << QString("%1  %2  %3  %4  %5  %6  %7  %8  %9  %10  %11  %12  %13\n")
+                   .arg(r.threads, 7)
+                   .arg(r.attempted, 9)
+                   .arg(r.succeeded, 9)
+                   .arg(r.seconds, 7, 'f', 3)
+                   .arg(opsPerSec, 8, 'f', 1)
+                   .arg(r.balanceDrift, 13, 'f', 2)
+                   .arg(r.cashDrift, 10, 'f', 2)
+                   .arg(r.negativeBalances, 8)
+                   .arg(r.chainBreaks, 12)
+                   .arg(r.finalMismatches, 14)
+                   .arg(r.unbalancedTransfers, 10)
+                   .arg(r.openSessions, 8)
+                   .arg(ok ? "OK" : "FAIL");
+        out.flush();
+    }
+
+    return allOk;
+}
@@ -0,0 +1,67 @@
+#ifndef STRESSHARNESS_H
+#define STRESSHARNESS_H
+
+#include <QString>
+#include <QList>
+#include <QTextStream>
+
+class AccountStore;
+class LedgerStore;
+
+// Нагрузочная проверка сохранения денег. Для каждого уровня параллелизма
+// создаёт чистое хранилище (SQLite-файл или MemoryStore), запускает потоки
+// со случайными withdraw / deposit / transferTo / adminTransfer через один
+// общий AtmController (у каждой операции своя сессия) и после завершения
+// проверяет инварианты через интерфейсы хранилища.
+class StressHarness
+{
+public:
+    struct Options {
+        QString engine = "sqlite";   // "sqlite" | "memory"
+        QString databasePath = "atm_stress.db";
+        QList<int> threadCounts = { 1, 2, 4, 8, 16 };
+        int opsPerThread = 500;
+        int accounts = 50;
+        double initialBalance = 10000.0;
+        double initialAtmCash = 1000000.0;
+        unsigned seed = 1;
+    };
+
+    struct LevelReport {
+        int threads = 0;
+        qint64 attempted = 0;
+        qint64 succeeded = 0;
+        double seconds = 0.0;
+
+        double balanceDrift = 0.0;   // Σbalance - ожидаемая сумма
+        double cashDrift = 0.0;      // cash_total - ожидаемый остаток
+        int negativeBalances = 0;
+        int chainBreaks = 0;         // строки, где balance_after не сходится с историей
+        int finalMismatches = 0;     // карты, где accounts.balance != последний balance_after
+        int unbalancedTransfers = 0; // переводы, чьи ноги не образуют пару на одну сумму
+        int openSessions = 0;        // сессии, оставшиеся открытыми после прогона
+
+        bool invariantsHold() const;
+    };
+
+    explicit StressHarness(const Options &options);
+
+    // Возвращает true, если инварианты выполнены на всех уровнях.
+    bool run(QTextStream &out);
+
+private:
+    bool prepareDatabase(const QString &connectionName);
+    bool seedStore(AccountStore &accounts);
+    LevelReport runLevel(int threads);
+    void checkInvariants(const AccountStore &accounts,
+                         const LedgerStore &ledger,
+                         qint64 withdrawnCents,
+                         qint64 depositedCents,
+                         LevelReport &report);
+
+    QString cardFor(int index) const;
+
+    Options m_options;
+};
+
+#endif // STRESSHARNESS_H
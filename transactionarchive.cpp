@@ -0,0 +1,628 @@
+#include "transactionarchive.h"
+
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QVariant>
+#include <QFileInfo>
+#include <QDir>
+#include <QDate>
+#include <QUrl>
+#include <QSet>
+#include <QPair>
+#include <QThread>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "cardkey.h"
+#include "eventlog.h"
+#include "readsnapshot.h"
+#include "sqlitestore.h"
+
+namespace {
+const QString ARCHIVER_CONNECTION = "archiver";
+
+QList<QPair<QString, QString>> partitions(const QSqlDatabase &db)
+{
+    QList<QPair<QString, QString>> list;
+
+    QSqlQuery q(db);
+    if (!q.exec("SELECT month, path FROM archive_partitions ORDER BY month DESC")) {
+        EventLog::error("sql.failed", "SELECT archive_partitions", q.lastError().text());
+        return list;
+    }
+
+    while (q.next())
+        list.append({ q.value(0).toString(), q.value(1).toString() });
+
+    return list;
+}
+
+// Столбцы запроса: id, type, amount, balance_after, ts, operation_id.
+// seen — id уже прочитанных строк: порция, перенесённая в архив, но ещё
+// не удалённая из горячей таблицы (обрыв между файлами), не должна
+// показываться дважды.
+void readColumns(QSqlQuery &q, HistoryBuffer &out, QSet<qint64> &seen)
+{
+    while (q.next()) {
+        qint64 id = q.value(0).toLongLong();
+        if (seen.contains(id))
+            continue;
+        seen.insert(id);
+
+        out.append(id, q.value(5).toLongLong(), transactionTypeFromStorage(q.value(1)),
+                   std::llround(q.value(2).toDouble() * 100.0),
+                   std::llround(q.value(3).toDouble() * 100.0),
+                   HistoryBuffer::parseTimestamp(q.value(4).toString()));
+    }
+}
+
+bool attachReadOnly(const QSqlDatabase &db, const QString &path)
+{
+    // ATTACH в открытой транзакции чтения проходит, а DETACH — нет
+    // («database is locked»): раздел остался бы подключённым, и следующий
+    // ATTACH упал бы. Под ReadSnapshot архив не читается.
+    if (ReadSnapshot::isActive(db)) {
+        EventLog::error("archive.attach_in_snapshot", nullptr, path);
+        return false;
+    }
+
+    QString uri = QUrl::fromLocalFile(path).toString(QUrl::FullyEncoded) + "?mode=ro";
+
+    QSqlQuery attach(db);
+    attach.prepare("ATTACH DATABASE :uri AS cold_ro");
+    attach.bindValue(":uri", uri);
+    if (!attach.exec()) {
+        EventLog::error("archive.attach_failed", "ATTACH",
+                        path + ": " + attach.lastError().text());
+        return false;
+    }
+    return true;
+}
+
+void detachReadOnly(const QSqlDatabase &db)
+{
+    QSqlQuery detach(db);
+    if (!detach.exec("DETACH DATABASE cold_ro"))
+        EventLog::error("archive.detach_failed", "DETACH", detach.lastError().text());
+}
+
+// balance_after последней строки карты не позже ts.
+std::optional<double> lastBalanceBefore(const QSqlDatabase &db, const QString &table,
+                                        const QString &cardNumber, const QString &ts)
+{
+    QSqlQuery q(db);
+    q.prepare("SELECT balance_after FROM " + table + " "
+              "WHERE card_number = :card AND ts <= :ts "
+              "ORDER BY ts DESC, id DESC LIMIT 1");
+    q.bindValue(":card", cardKey(cardNumber));
+    q.bindValue(":ts", ts);
+
+    if (!q.exec()) {
+        EventLog::error("sql.failed", "SELECT balance_after", q.lastError().text());
+        return std::nullopt;
+    }
+    if (!q.next())
+        return std::nullopt;
+    return q.value(0).toDouble();
+}
+
+// Баланс до первой строки карты в таблице.
+std::optional<double> openingBalance(const QSqlDatabase &db, const QString &table,
+                                     const QString &cardNumber)
+{
+    QSqlQuery q(db);
+    q.prepare("SELECT type, amount, balance_after FROM " + table + " "
+              "WHERE card_number = :card ORDER BY ts, id LIMIT 1");
+    q.bindValue(":card", cardKey(cardNumber));
+
+    if (!q.exec()) {
+        EventLog::error("sql.failed", "SELECT opening balance", q.lastError().text());
+        return std::nullopt;
+    }
+    if (!q.next())
+        return std::nullopt;
+
+    int sign = transactionTypeInfo(transactionTypeFromStorage(q.value(0))).balanceSign;
+    return q.value(2).toDouble() - sign * q.value(1).toDouble();
+}
+
+// Строки одной таблицы периода порциями в batch; after — id последней
+// отданной строки: строка, уже прочитанная из раздела и ещё не удалённая
+// из горячей таблицы, второй раз не отдаётся.
+bool streamRange(const QSqlDatabase &db, const QString &table,
+                 const QString &cardNumber, const QString &from, const QString &to,
+                 qint64 &after, bool &stopped, HistoryBuffer &batch, int batchRows,
+                 const std::function<bool(const HistoryBuffer &)> &visit)
+{
+    QSqlQuery q(db);
+    q.setForwardOnly(true);
+    q.prepare("SELECT id, type, amount, balance_after, ts, operation_id FROM " + table + " "
+              "WHERE card_number = :card AND ts >= :from AND ts < :to AND id > :after "
+              "ORDER BY ts, id");
+    q.bindValue(":card", cardKey(cardNumber));
+    q.bindValue(":from", from);
+    q.bindValue(":to", to);
+    q.bindValue(":after", after);
+
+    if (!q.exec()) {
+        EventLog::error("sql.failed", "SELECT transactions range", q.lastError().text());
+        return false;
+    }
+
+    while (q.next()) {
+        after = q.value(0).toLongLong();
+        batch.append(after, q.value(5).toLongLong(), transactionTypeFromStorage(q.value(1)),
+                     std::llround(q.value(2).toDouble() * 100.0),
+                     std::llround(q.value(3).toDouble() * 100.0),
+                     HistoryBuffer::parseTimestamp(q.value(4).toString()));
+
+        if (batch.size() >= batchRows) {
+            bool more = visit(batch);
+            batch.clear();
+            if (!more) {
+                stopped = true;
+                return true;
+            }
+        }
+    }
+    return q.lastError().type() == QSqlError::NoError;
+}
+}
+
+QString TransactionArchive::partitionPath(const QSqlDatabase &db, const QString &month)
+{
+    QString dir = QFileInfo(db.databaseName()).absolutePath() + "/archive";
+    QString name = month;
+    name.replace('-', '_');
+    return dir + "/transactions_" + name + ".db";
+}
+
+bool TransactionArchive::createPartitionSchema(const QSqlDatabase &db,
+                                               const QString &schemaName)
+{
+    QSqlQuery q(db);
+
+    if (!q.exec("CREATE TABLE IF NOT EXISTS " + schemaName + ".transactions ("
+                " id            INTEGER PRIMARY KEY,"
+                " card_number   INTEGER NOT NULL,"
+                " type          INTEGER NOT NULL,"
+                " amount        REAL NOT NULL,"
+                " balance_after REAL NOT NULL,"
+                " ts            DATETIME,"
+                " operation_id  INTEGER"
+                ")"))
+    {
+        EventLog::error("sql.failed", "CREATE TABLE archive.transactions",
+                        q.lastError().text());
+        return false;
+    }
+
+    // В разделах, созданных до перехода на числовой номер карты,
+    // card_number остаётся TEXT: число при сравнении с ним приводится к
+    // строке, а номера карт не начинаются с нуля.
+
+    // Разделы, созданные до связывания ног перевода, получают столбец.
+    bool hasOperation = false;
+    if (q.exec("PRAGMA " + schemaName + ".table_info(transactions)")) {
+        while (q.next())
+            hasOperation = hasOperation || q.value(1).toString() == "operation_id";
+    }
+    if (!hasOperation
+        && !q.exec("ALTER TABLE " + schemaName + ".transactions ADD COLUMN operation_id INTEGER"))
+    {
+        EventLog::error("sql.failed", "ALTER TABLE archive.transactions",
+                        q.lastError().text());
+        return false;
+    }
+
+    if (!q.exec("CREATE INDEX IF NOT EXISTS " + schemaName + ".idx_transactions_card_ts "
+                "ON transactions (card_number, ts)"))
+    {
+        EventLog::error("sql.failed", "CREATE INDEX archive.idx_transactions_card_ts",
+                        q.lastError().text());
+        return false;
+    }
+
+    return true;
+}
+
+QList<TransactionRecord>
+TransactionArchive::history(const QSqlDatabase &db, const QString &cardNumber, int limit,
+                            qint64 beforeId)
+{
+    HistoryBuffer rows;
+    history(db, cardNumber, limit, beforeId, rows);
+
+    QList<TransactionRecord> list;
+    list.reserve(rows.size());
+    for (int i = 0; i < rows.size(); ++i)
+        list.append(rows.record(i));
+    return list;
+}
+
+bool TransactionArchive::history(const QSqlDatabase &db, const QString &cardNumber, int limit,
+                                 qint64 beforeId, HistoryBuffer &out)
+{
+    QSet<qint64> seen;
+    HistoryBuffer rows;
+    rows.reserve(limit);
+
+    // id растут вместе с ts, поэтому id последней показанной строки —
+    // достаточный курсор страницы.
+    qint64 before = beforeId > 0 ? beforeId : std::numeric_limits<qint64>::max();
+
+    QSqlQuery hot(db);
+    hot.setForwardOnly(true);
+    hot.prepare("SELECT id, type, amount, balance_after, ts, operation_id "
+                "FROM transactions "
+                "WHERE card_number = :card AND id < :before "
+                "ORDER BY ts DESC, id DESC "
+                "LIMIT :limit");
+    hot.bindValue(":card", cardKey(cardNumber));
+    hot.bindValue(":before", before);
+    hot.bindValue(":limit", limit);
+
+    if (!hot.exec()) {
+        EventLog::error("sql.failed", "SELECT transactions", hot.lastError().text());
+        return false;
+    }
+    readColumns(hot, rows, seen);
+    hot.finish();
+
+    for (const auto &part : partitions(db)) {
+        // Разделы идут от новых к старым: как только набран limit строк
+        // и самая старая из них новее раздела, дальше искать незачем.
+        if (rows.size() >= limit
+            && HistoryBuffer::formatTimestamp(rows.timestamp(rows.size() - 1)).left(7) > part.first)
+            break;
+
+        if (!QFileInfo::exists(part.second))
+            continue;
+
+        if (!attachReadOnly(db, part.second))
+            continue;
+
+        QSqlQuery cold(db);
+        cold.setForwardOnly(true);
+        cold.prepare("SELECT id, type, amount, balance_after, ts, operation_id "
+                     "FROM cold_ro.transactions "
+                     "WHERE card_number = :card AND id < :before "
+                     "ORDER BY ts DESC, id DESC "
+                     "LIMIT :limit");
+        cold.bindValue(":card", cardKey(cardNumber));
+        cold.bindValue(":before", before);
+        cold.bindValue(":limit", limit);
+
+        if (cold.exec())
+            readColumns(cold, rows, seen);
+        else
+            EventLog::error("sql.failed", "SELECT archive.transactions",
+                            cold.lastError().text());
+        cold.finish();
+
+        detachReadOnly(db);
+
+        rows.sortNewestFirst();
+        rows.truncate(limit);
+    }
+
+    out.append(rows);
+    return true;
+}
+
+bool TransactionArchive::forEachBatchInRange(const QSqlDatabase &db,
+                                             const QString &cardNumber,
+                                             const QDateTime &from,
+                                             const QDateTime &to,
+                                             int batchRows,
+                                             const std::function<bool(const HistoryBuffer &)> &visit)
+{
+    QString fromTs = from.toUTC().toString("yyyy-MM-dd HH:mm:ss");
+    QString toTs = to.toUTC().toString("yyyy-MM-dd HH:mm:ss");
+    QString fromMonth = fromTs.left(7);
+    QString toMonth = toTs.left(7);
+
+    qint64 after = 0;
+    bool stopped = false;
+
+    // Один буфер на весь период: столбцы выделяются один раз.
+    HistoryBuffer batch;
+    batch.reserve(batchRows);
+
+    QList<QPair<QString, QString>> parts = partitions(db);
+    for (auto it = parts.crbegin(); it != parts.crend() && !stopped; ++it) {
+        if (it->first < fromMonth || it->first > toMonth || !QFileInfo::exists(it->second))
+            continue;
+
+        if (!attachReadOnly(db, it->second))
+            return false;
+        bool ok = streamRange(db, "cold_ro.transactions", cardNumber, fromTs, toTs,
+                              after, stopped, batch, batchRows, visit);
+        detachReadOnly(db);
+        if (!ok)
+            return false;
+    }
+
+    if (!stopped && !streamRange(db, "transactions", cardNumber, fromTs, toTs,
+                                 after, stopped, batch, batchRows, visit))
+        return false;
+
+    if (!stopped && !batch.isEmpty())
+        stopped = !visit(batch);
+
+    return !stopped;
+}
+
+std::optional<double>
+TransactionArchive::balanceAt(const QSqlDatabase &db, const QString &cardNumber,
+                              const QDateTime &at)
+{
+    QString ts = at.toUTC().toString("yyyy-MM-dd HH:mm:ss");
+
+    std::optional<double> balance = lastBalanceBefore(db, "transactions", cardNumber, ts);
+    if (balance.has_value())
+        return balance;
+
+    // Разделы идут от новых к старым; раньше месяца at смотреть незачем.
+    QList<QPair<QString, QString>> parts = partitions(db);
+    for (const auto &part : parts) {
+        if (part.first > ts.left(7) || !QFileInfo::exists(part.second))
+            continue;
+        if (!attachReadOnly(db, part.second))
+            continue;
+        balance = lastBalanceBefore(db, "cold_ro.transactions", cardNumber, ts);
+        detachReadOnly(db);
+        if (balance.has_value())
+            return balance;
+    }
+
+    // До at операций не было: баланс до самой ранней строки карты.
+    for (auto it = parts.crbegin(); it != parts.crend(); ++it) {
+        if (!QFileInfo::exists(it->second) || !attachReadOnly(db, it->second))
+            continue;
+        balance = openingBalance(db, "cold_ro.transactions", cardNumber);
+        detachReadOnly(db);
+        if (balance.has_value())
+            return balance;
+    }
+    return openingBalance(db, "transactions", cardNumber);
+}
+
+TransactionArchiver::TransactionArchiver(const QString &databasePath,
+                                         int batchSize,
+                                         int pauseMs,
+                                         QObject *parent)
+    : QObject(parent),
+    m_databasePath(databasePath),
+    m_batchSize(batchSize),
+    m_pauseMs(pauseMs)
+{
+}
+
+void TransactionArchiver::run()
+{
+    EventLog::Scope scope("archive", QString());
+
+    bool ok = true;
+    qint64 moved = 0;
+
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", ARCHIVER_CONNECTION);
+        db.setDatabaseName(m_databasePath);
+        db.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000");
+
+        if (!db.open()) {
+            EventLog::error("db.open_failed", nullptr, db.lastError().text());
+            ok = false;
+        } else {
+            // Текущий баланс опирается на строки после снимка. Граница
+            // месяца и последний id берутся один раз и до снимка: снимок
+            // покрывает все строки с id не больше coveredId, и переносятся
+            // только они — строки, записанные во время прогона, в том числе
+            // после смены месяца, остаются в основной БД.
+            QString cutoff;
+            qint64 coveredId = 0;
+            QSqlQuery bound(db);
+            if (!bound.exec("SELECT strftime('%Y-%m-01 00:00:00', 'now'), IFNULL(MAX(id), 0) "
+                            "FROM transactions")
+                || !bound.next())
+            {
+                EventLog::error("sql.failed", "SELECT MAX(id) FROM transactions",
+                                bound.lastError().text());
+                ok = false;
+            } else {
+                cutoff = bound.value(0).toString();
+                coveredId = bound.value(1).toLongLong();
+            }
+            bound.finish();
+
+            ok = ok && SqliteStore::snapshotBalances(db);
+
+            while (ok) {
+                QSqlQuery q(db);
+                q.prepare("SELECT substr(MIN(ts), 1, 7) FROM transactions "
+                          "WHERE ts < :cutoff AND id <= :covered");
+                q.bindValue(":cutoff", cutoff);
+                q.bindValue(":covered", coveredId);
+                if (!q.exec()) {
+                    EventLog::error("sql.failed", "SELECT MIN(ts) FROM transactions",
+                                    q.lastError().text());
+                    ok = false;
+                    break;
+                }
+
+                if (!q.next() || q.value(0).isNull())
+                    break;
+
+                QString month = q.value(0).toString();
+                q.finish();
+
+                qint64 before = moved;
+                if (!archiveMonth(db, month, coveredId, moved))
+                    ok = false;
+                else if (moved == before)
+                    break;
+            }
+
+            db.close();
+        }
+    }
+
+    QSqlDatabase::removeDatabase(ARCHIVER_CONNECTION);
+
+    if (ok)
+        scope.succeed();
+    emit finished(ok, moved);
+}
+
+bool TransactionArchiver::archiveMonth(QSqlDatabase &db,
+                                       const QString &month,
+                                       qint64 coveredId,
+                                       qint64 &moved)
+{
+    QString path = TransactionArchive::partitionPath(db, month);
+    QDir().mkpath(QFileInfo(path).absolutePath());
+
+    QDate first = QDate::fromString(month + "-01", "yyyy-MM-dd");
+    if (!first.isValid()) {
+        EventLog::error("archive.bad_month", nullptr, month);
+        return false;
+    }
+    QString from = first.toString("yyyy-MM-dd") + " 00:00:00";
+    QString to = first.addMonths(1).toString("yyyy-MM-dd") + " 00:00:00";
+
+    QSqlQuery q(db);
+    q.prepare("ATTACH DATABASE :path AS cold");
+    q.bindValue(":path", path);
+    if (!q.exec()) {
+        EventLog::error("archive.attach_failed", "ATTACH",
+                        path + ": " + q.lastError().text());
+        return false;
+    }
+
+    bool ok = TransactionArchive::createPartitionSchema(db, "cold");
+
+    if (ok) {
+        // Раздел регистрируется до переноса, чтобы история видела его
+        // с первой же перенесённой порции.
+        q.prepare("INSERT OR IGNORE INTO archive_partitions (month, path, row_count) "
+                  "VALUES (:month, :path, 0)");
+        q.bindValue(":month", month);
+        q.bindValue(":path", path);
+        if (!q.exec()) {
+            EventLog::error("sql.failed", "INSERT archive_partitions",
+                            q.lastError().text());
+            ok = false;
+        }
+    }
+
+    // Порция переносится в два шага: копия в раздел фиксируется сама по
+    // себе, затем из основной БД удаляются только строки, уже лежащие в
+    // разделе. В WAL SQLite не фиксирует два файла атомарно, поэтому одна
+    // общая транзакция при сбое могла бы удалить строки, не сохранив их в
+    // архиве. Сбой между шагами оставляет строки в обоих файлах — история
+    // отсеивает повтор по id, а следующий запуск (INSERT OR IGNORE) доделает
+    // порцию.
+    while (ok) {
+        QSqlQuery step(db);
+        step.prepare("SELECT MAX(id) FROM ("
+                     " SELECT id FROM main.transactions"
+                     " WHERE ts >= :from AND ts < :to AND id <= :covered"
+                     " ORDER BY id LIMIT :n)");
+        step.bindValue(":from", from);
+        step.bindValue(":to", to);
+        step.bindValue(":covered", coveredId);
+        step.bindValue(":n", m_batchSize);
+
+        if (!step.exec() || !step.next()) {
+            EventLog::error("sql.failed", "SELECT batch", step.lastError().text());
+            ok = false;
+            break;
+        }
+
+        if (step.value(0).isNull())
+            break;
+
+        qint64 maxId = step.value(0).toLongLong();
+        step.finish();
+
+        if (!q.exec("BEGIN")) {
+            EventLog::error("tx.begin_failed", "BEGIN", q.lastError().text());
+            ok = false;
+            break;
+        }
+
+        step.prepare("INSERT OR IGNORE INTO cold.transactions "
+                     "(id, card_number, type, amount, balance_after, ts, operation_id) "
+                     "SELECT id, card_number, type, amount, balance_after, ts, operation_id "
+                     "FROM main.transactions "
+                     "WHERE ts >= :from AND ts < :to AND id <= :max");
+        step.bindValue(":from", from);
+        step.bindValue(":to", to);
+        step.bindValue(":max", maxId);
+        if (!step.exec()) {
+            EventLog::error("sql.failed", "INSERT archive.transactions",
+                            step.lastError().text());
+            q.exec("ROLLBACK");
+            ok = false;
+            break;
+        }
+
+        if (!q.exec("COMMIT")) {
+            EventLog::error("tx.commit_failed", "COMMIT archive", q.lastError().text());
+            q.exec("ROLLBACK");
+            ok = false;
+            break;
+        }
+
+        if (!q.exec("BEGIN IMMEDIATE")) {
+            EventLog::error("tx.begin_failed", "BEGIN IMMEDIATE", q.lastError().text());
+            ok = false;
+            break;
+        }
+
+        step.prepare("DELETE FROM main.transactions "
+                     "WHERE ts >= :from AND ts < :to "
+                     "AND id IN (SELECT id FROM cold.transactions WHERE id <= :max)");
+        step.bindValue(":from", from);
+        step.bindValue(":to", to);
+        step.bindValue(":max", maxId);
+        if (!step.exec()) {
+            EventLog::error("sql.failed", "DELETE transactions", step.lastError().text());
+            q.exec("ROLLBACK");
+            ok = false;
+            break;
+        }
+        int batch = step.numRowsAffected();
+
+        step.prepare("UPDATE main.archive_partitions "
+                     "SET row_count = row_count + :n WHERE month = :month");
+        step.bindValue(":n", batch);
+        step.bindValue(":month", month);
+        if (!step.exec()) {
+            EventLog::error("sql.failed", "UPDATE archive_partitions",
+                            step.lastError().text());
+            q.exec("ROLLBACK");
+            ok = false;
+            break;
+        }
+
+        if (!q.exec("COMMIT")) {
+            EventLog::error("tx.commit_failed", "COMMIT", q.lastError().text());
+            q.exec("ROLLBACK");
+            ok = false;
+            break;
+        }
+
+        moved += batch;
+        emit progress(month, moved);
+
+        if (m_pauseMs > 0)
+            QThread::msleep(m_pauseMs);
+    }
+
+    q.exec("DETACH DATABASE cold");
+    return ok;
+}
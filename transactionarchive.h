@@ -0,0 +1,81 @@
+#ifndef TRANSACTIONARCHIVE_H
+#define TRANSACTIONARCHIVE_H
+
+#include <QObject>
+#include <QString>
+#include <QList>
+#include <QSqlDatabase>
+
+#include "historybuffer.h"
+#include "storage.h"
+
+// Закрытые месяцы таблицы transactions переносятся в отдельные файлы
+// archive/transactions_YYYY_MM.db. Каталог разделов хранится в
+// archive_partitions основной БД; для чтения раздел подключается через
+// ATTACH в режиме только для чтения.
+class TransactionArchive
+{
+public:
+    static QString partitionPath(const QSqlDatabase &db, const QString &month);
+
+    // История карты по горячей таблице и архивным разделам, новые первыми.
+    // beforeId > 0 — следующая страница: только строки с id < beforeId.
+    static QList<TransactionRecord>
+    history(const QSqlDatabase &db, const QString &cardNumber, int limit,
+            qint64 beforeId = 0);
+
+    // То же по столбцам: строки пишутся в out прямо из запроса.
+    static bool history(const QSqlDatabase &db, const QString &cardNumber, int limit,
+                        qint64 beforeId, HistoryBuffer &out);
+
+    // Строки карты с from <= ts < to по возрастанию: архивные разделы
+    // периода от старых к новым, затем горячая таблица. Строки читаются
+    // курсором по индексу (card_number, ts) и отдаются visit порциями до
+    // batchRows строк в одном буфере — память не зависит от длины периода.
+    // visit вернул false — чтение прерывается, результат false.
+    static bool forEachBatchInRange(const QSqlDatabase &db,
+                                    const QString &cardNumber,
+                                    const QDateTime &from,
+                                    const QDateTime &to,
+                                    int batchRows,
+                                    const std::function<bool(const HistoryBuffer &)> &visit);
+
+    // Баланс карты на момент at: горячая таблица, затем разделы от новых
+    // к старым. Если строк не позже at нет — баланс до первой строки карты.
+    static std::optional<double>
+    balanceAt(const QSqlDatabase &db, const QString &cardNumber, const QDateTime &at);
+
+    static bool createPartitionSchema(const QSqlDatabase &db,
+                                      const QString &schemaName);
+};
+
+// Фоновый перенос закрытых месяцев в архив. Работает на собственном
+// соединении в отдельном потоке; каждая порция — копия в раздел и затем
+// удаление скопированного из основной БД, две короткие транзакции; между
+// порциями пауза, чтобы терминалы успевали получать блокировку.
+class TransactionArchiver : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit TransactionArchiver(const QString &databasePath,
+                                 int batchSize = 500,
+                                 int pauseMs = 20,
+                                 QObject *parent = nullptr);
+
+public slots:
+    void run();
+
+signals:
+    void progress(const QString &month, qint64 movedTotal);
+    void finished(bool ok, qint64 movedTotal);
+
+private:
+    bool archiveMonth(QSqlDatabase &db, const QString &month, qint64 coveredId, qint64 &moved);
+
+    QString m_databasePath;
+    int m_batchSize;
+    int m_pauseMs;
+};
+
+#endif // TRANSACTIONARCHIVE_H
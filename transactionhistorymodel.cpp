@@ -0,0 +1,104 @@
+#include "transactionhistorymodel.h"
+
+#include <QDateTime>
+
+TransactionHistoryModel::TransactionHistoryModel(int pageSize, QObject *parent)
+    : QAbstractListModel(parent)
+    , m_pageSize(pageSize)
+{
+}
+
+void TransactionHistoryModel::reset(PageLoader loader)
+{
+    beginResetModel();
+    m_loader = std::move(loader);
+    m_head.clear();
+    m_rows.clear();
+    m_exhausted = !m_loader;
+    endResetModel();
+}
+
+void TransactionHistoryModel::prepend(const TransactionRecord &record)
+{
+    // Строка уже могла прийти со страницей, загруженной после COMMIT.
+    qint64 newest = !m_head.isEmpty() ? m_head.id(m_head.size() - 1)
+                    : !m_rows.isEmpty() ? m_rows.id(0)
+                                        : 0;
+    if (record.id <= newest)
+        return;
+
+    beginInsertRows(QModelIndex(), 0, 0);
+    m_head.append(record);
+    endInsertRows();
+}
+
+const HistoryBuffer &TransactionHistoryModel::locate(int row, int &index) const
+{
+    if (row < m_head.size()) {
+        index = m_head.size() - 1 - row;
+        return m_head;
+    }
+    index = row - m_head.size();
+    return m_rows;
+}
+
+std::optional<TransactionRecord> TransactionHistoryModel::record(int row) const
+{
+    if (row < 0 || row >= rowCount())
+        return std::nullopt;
+
+    int index;
+    return locate(row, index).record(index);
+}
+
+int TransactionHistoryModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : m_head.size() + m_rows.size();
+}
+
+QVariant TransactionHistoryModel::data(const QModelIndex &index, int role) const
+{
+    if (role != Qt::DisplayRole || index.row() < 0 || index.row() >= rowCount())
+        return QVariant();
+
+    int i;
+    const HistoryBuffer &rows = locate(index.row(), i);
+
+    // В буфере — секунды UTC, в списке — местное время.
+    return QString("%1 | %2 | %3 | баланс после: %4")
+        .arg(QDateTime::fromSecsSinceEpoch(rows.timestamp(i)).toString("yyyy-MM-dd HH:mm:ss"))
+        .arg(QString::fromUtf8(transactionTypeInfo(rows.type(i)).displayName))
+        .arg(rows.amountCents(i) / 100.0, 0, 'f', 2)
+        .arg(rows.balanceCents(i) / 100.0, 0, 'f', 2);
+}
+
+bool TransactionHistoryModel::canFetchMore(const QModelIndex &parent) const
+{
+    return !parent.isValid() && !m_exhausted;
+}
+
+void TransactionHistoryModel::fetchMore(const QModelIndex &parent)
+{
+    if (!canFetchMore(parent))
+        return;
+
+    // Строки сверху новее любой страницы; курсор — последняя строка
+    // страниц, а если страниц ещё нет — самая старая из добавленных.
+    qint64 beforeId = !m_rows.isEmpty() ? m_rows.id(m_rows.size() - 1)
+                      : !m_head.isEmpty() ? m_head.id(0)
+                                          : 0;
+
+    HistoryBuffer page;
+    page.reserve(m_pageSize);
+    if (!m_loader(beforeId, m_pageSize, page) || page.size() < m_pageSize)
+        m_exhausted = true;
+
+    if (!page.isEmpty()) {
+        int first = rowCount();
+        beginInsertRows(QModelIndex(), first, first + page.size() - 1);
+        m_rows.append(page);
+        endInsertRows();
+    }
+
+    emit pageLoaded(page.size());
+}
@@ -0,0 +1,55 @@
+#ifndef TRANSACTIONHISTORYMODEL_H
+#define TRANSACTIONHISTORYMODEL_H
+
+#include <QAbstractListModel>
+
+#include <functional>
+#include <optional>
+
+#include "historybuffer.h"
+#include "storage.h"
+
+// История карты для QListView, новые сверху. Новые операции добавляются
+// сверху по сигналу (prepend), старые подгружаются страницами, когда
+// список прокручен до конца (canFetchMore / fetchMore).
+//
+// Строки хранятся по столбцам (HistoryBuffer): m_head — добавленные
+// сверху, в порядке прихода; m_rows — загруженные страницы, новые первыми.
+class TransactionHistoryModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+    // Загрузка страницы в page: строки с id < beforeId (0 — самые новые).
+    using PageLoader = std::function<bool(qint64 beforeId, int limit, HistoryBuffer &page)>;
+
+    explicit TransactionHistoryModel(int pageSize = 10, QObject *parent = nullptr);
+
+    // Новый сеанс; пустой loader — очистить список.
+    void reset(PageLoader loader);
+    void prepend(const TransactionRecord &record);
+
+    std::optional<TransactionRecord> record(int row) const;
+    bool isExhausted() const { return m_exhausted; }
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+    bool canFetchMore(const QModelIndex &parent) const override;
+    void fetchMore(const QModelIndex &parent) override;
+
+signals:
+    void pageLoaded(int rows);
+
+private:
+    // Буфер и строка в нём для строки модели.
+    const HistoryBuffer &locate(int row, int &index) const;
+
+    PageLoader m_loader;
+    HistoryBuffer m_head;
+    HistoryBuffer m_rows;
+    int m_pageSize;
+    bool m_exhausted = true;
+};
+
+#endif // TRANSACTIONHISTORYMODEL_H
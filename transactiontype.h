@@ -0,0 +1,90 @@
+#ifndef TRANSACTIONTYPE_H
+#define TRANSACTIONTYPE_H
+
+#include <QString>
+#include <QVariant>
+
+#include <cstddef>
+
+// Тип операции хранится в transactions.type одним целым числом. Значения
+// пишутся в БД и архивы, поэтому существующие коды не меняются — новые
+// типы добавляются в конец.
+enum class TransactionType : quint8 {
+    Unknown          = 0,
+    Withdraw         = 1,
+    Deposit          = 2,
+    TransferOut      = 3,
+    TransferIn       = 4,
+    PinChange        = 5,
+    AdminTransferOut = 6,
+    AdminTransferIn  = 7,
+    AdminAdjustment  = 8,   // amount со знаком: новый баланс - прежний
+    Interest         = 9,   // начисление процентов (EndOfDayBatch)
+    MonthlyFee       = 10,  // ежемесячная комиссия (EndOfDayBatch)
+};
+
+struct TransactionTypeInfo {
+    TransactionType type;
+    const char *code;           // прежнее строковое значение (миграция, журнал)
+    const char *displayName;    // строка истории
+    const char *receiptLabel;   // заголовок чека
+    int balanceSign;            // -1 списание, +1 зачисление, 0 без движения
+};
+
+constexpr TransactionTypeInfo TRANSACTION_TYPES[] = {
+    { TransactionType::Unknown,          "unknown",            "Операция",                    "Операция",                    0 },
+    { TransactionType::Withdraw,         "withdraw",           "Снятие",                      "Снятие",                     -1 },
+    { TransactionType::Deposit,          "deposit",            "Поступление",                 "Пополнение",                 +1 },
+    { TransactionType::TransferOut,      "transfer_out",       "Перевод (списание)",          "Перевод",                    -1 },
+    { TransactionType::TransferIn,       "transfer_in",        "Перевод (зачисление)",        "Перевод (зачисление)",       +1 },
+    { TransactionType::PinChange,        "pin_change",         "Смена PIN",                   "Смена PIN",                   0 },
+    { TransactionType::AdminTransferOut, "admin_transfer_out", "Админ. перевод (списание)",   "Админ. перевод (списание)",  -1 },
+    { TransactionType::AdminTransferIn,  "admin_transfer_in",  "Админ. перевод (зачисление)", "Админ. перевод (зачисление)", +1 },
+    { TransactionType::AdminAdjustment,  "admin_adjustment",   "Корректировка баланса",       "Корректировка баланса",      +1 },
+    { TransactionType::Interest,         "interest",           "Начисление процентов",        "Проценты",                   +1 },
+    { TransactionType::MonthlyFee,       "monthly_fee",        "Комиссия за обслуживание",    "Комиссия",                   -1 },
+};
+
+constexpr std::size_t TRANSACTION_TYPE_COUNT =
+    sizeof(TRANSACTION_TYPES) / sizeof(TRANSACTION_TYPES[0]);
+
+constexpr bool transactionTypesIndexed()
+{
+    for (std::size_t i = 0; i < TRANSACTION_TYPE_COUNT; ++i) {
+        if (std::size_t(TRANSACTION_TYPES[i].type) != i)
+            return false;
+    }
+    return true;
+}
+static_assert(transactionTypesIndexed(), "TRANSACTION_TYPES must be indexed by code");
+
+constexpr const TransactionTypeInfo &transactionTypeInfo(TransactionType type)
+{
+    return std::size_t(type) < TRANSACTION_TYPE_COUNT ? TRANSACTION_TYPES[std::size_t(type)]
+                                                      : TRANSACTION_TYPES[0];
+}
+
+constexpr int transactionTypeCode(TransactionType type)
+{
+    return int(type);
+}
+
+// Значение столбца type. Архивы, созданные до перехода на коды, хранят
+// строки — они распознаются по прежнему строковому значению.
+inline TransactionType transactionTypeFromStorage(const QVariant &value)
+{
+    bool ok = false;
+    int code = value.toInt(&ok);
+    if (ok)
+        return code > 0 && std::size_t(code) < TRANSACTION_TYPE_COUNT
+                   ? TransactionType(code) : TransactionType::Unknown;
+
+    QString text = value.toString();
+    for (const TransactionTypeInfo &info : TRANSACTION_TYPES) {
+        if (text == QLatin1String(info.code))
+            return info.type;
+    }
+    return TransactionType::Unknown;
+}
+
+#endif // TRANSACTIONTYPE_H
@@ -0,0 +1,336 @@
+#include "velocitylimiter.h"
+
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QVariant>
+#include <QDateTime>
+#include <QElapsedTimer>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "cardkey.h"
+#include "eventlog.h"
+#include "transactiontype.h"
+
+namespace {
+const qint64 SLOT_MS = 5 * 60 * 1000;
+const VelocityLimiter::Limits NO_LIMITS;
+
+qint64 toCents(double amount)
+{
+    return std::llround(amount * 100.0);
+}
+
+qint64 centsOrZero(const QVariant &value)
+{
+    return value.isNull() ? 0 : toCents(value.toDouble());
+}
+
+quint32 saturatingAdd(quint32 bucket, qint64 cents)
+{
+    qint64 sum = qint64(bucket) + cents;
+    return sum > 0xffffffffLL ? 0xffffffffu : quint32(sum);
+}
+
+quint32 saturatingSub(quint32 bucket, qint64 cents)
+{
+    return qint64(bucket) > cents ? quint32(bucket - cents) : 0u;
+}
+}
+
+VelocityLimiter::VelocityLimiter()
+{
+}
+
+void VelocityLimiter::setClasses(const QList<CardClass> &classes)
+{
+    m_classes = classes;
+    std::stable_sort(m_classes.begin(), m_classes.end(),
+                     [](const CardClass &a, const CardClass &b) {
+                         return a.prefix.size() > b.prefix.size();
+                     });
+}
+
+const VelocityLimiter::Limits &VelocityLimiter::limitsFor(const QString &cardNumber,
+                                                          Kind kind) const
+{
+    for (const CardClass &c : m_classes) {
+        if (cardNumber.startsWith(c.prefix))
+            return kind == Kind::Withdraw ? c.withdraw : c.transfer;
+    }
+    return NO_LIMITS;
+}
+
+bool VelocityLimiter::keyOf(const QString &cardNumber, Kind kind, quint64 &key)
+{
+    quint64 k;
+    if (!cardKeyStrict(cardNumber, k))
+        return false;
+    key = k * 2 + quint64(kind);
+    return true;
+}
+
+quint32 VelocityLimiter::slotOf(qint64 ms)
+{
+    return quint32(ms / SLOT_MS);
+}
+
+VelocityLimiter::Shard &VelocityLimiter::shardOf(quint64 key)
+{
+    // Обе операции одной карты попадают в один шард.
+    return m_shards[(key >> 1) % ShardCount];
+}
+
+void VelocityLimiter::advance(Window &w, quint32 slot)
+{
+    if (slot <= w.head)
+        return;
+
+    quint32 fineSteps = std::min<quint32>(slot - w.head, FineBuckets);
+    for (quint32 i = 1; i <= fineSteps; ++i)
+        w.fine[(w.head + i) % FineBuckets] = 0;
+
+    quint32 oldHour = w.head / FinePerCoarse;
+    quint32 newHour = slot / FinePerCoarse;
+    quint32 coarseSteps = std::min<quint32>(newHour - oldHour, CoarseBuckets);
+    for (quint32 i = 1; i <= coarseSteps; ++i)
+        w.coarse[(oldHour + i) % CoarseBuckets] = 0;
+
+    w.head = slot;
+}
+
+void VelocityLimiter::add(Window &w, quint32 slot, qint64 cents)
+{
+    advance(w, slot);
+
+    if (w.head - slot < quint32(FineBuckets)) {
+        quint32 &b = w.fine[slot % FineBuckets];
+        b = cents >= 0 ? saturatingAdd(b, cents) : saturatingSub(b, -cents);
+    }
+
+    quint32 hour = slot / FinePerCoarse;
+    if (w.head / FinePerCoarse - hour < quint32(CoarseBuckets)) {
+        quint32 &b = w.coarse[hour % CoarseBuckets];
+        b = cents >= 0 ? saturatingAdd(b, cents) : saturatingSub(b, -cents);
+    }
+}
+
+bool VelocityLimiter::reserve(const QString &cardNumber, Kind kind,
+                              double amount, qint64 nowMs)
+{
+    const Limits &limits = limitsFor(cardNumber, kind);
+    if (limits.hourlyCents == 0 && limits.dailyCents == 0)
+        return true;
+
+    quint64 key;
+    if (!keyOf(cardNumber, kind, key))
+        return true;
+
+    qint64 cents = toCents(amount);
+    quint32 slot = slotOf(nowMs);
+    Shard &shard = shardOf(key);
+
+    std::lock_guard<std::mutex> lock(shard.lock);
+
+    qint64 hourly = 0;
+    qint64 daily = 0;
+
+    auto it = shard.windows.find(key);
+    if (it != shard.windows.end()) {
+        advance(*it, slot);
+        for (quint32 b : it->fine)
+            hourly += b;
+        for (quint32 b : it->coarse)
+            daily += b;
+    }
+
+    if ((limits.hourlyCents != 0 && hourly + cents > limits.hourlyCents)
+        || (limits.dailyCents != 0 && daily + cents > limits.dailyCents))
+        return false;
+
+    if (it == shard.windows.end()) {
+        Window w;
+        w.head = slot;
+        it = shard.windows.insert(key, w);
+    }
+    add(*it, slot, cents);
+
+    if (shard.windows.size() >= shard.sweepAt)
+        sweep(shard, slot);
+    return true;
+}
+
+void VelocityLimiter::release(const QString &cardNumber, Kind kind,
+                              double amount, qint64 nowMs)
+{
+    quint64 key;
+    if (!keyOf(cardNumber, kind, key))
+        return;
+
+    Shard &shard = shardOf(key);
+    std::lock_guard<std::mutex> lock(shard.lock);
+
+    auto it = shard.windows.find(key);
+    if (it == shard.windows.end())
+        return;
+
+    add(*it, slotOf(nowMs), -toCents(amount));
+}
+
+void VelocityLimiter::sweep(Shard &shard, quint32 slot)
+{
+    for (auto it = shard.windows.begin(); it != shard.windows.end(); ) {
+        advance(*it, slot);
+        bool empty = std::all_of(std::begin(it->coarse), std::end(it->coarse),
+                                 [](quint32 b) { return b == 0; });
+        if (empty)
+            it = shard.windows.erase(it);
+        else
+            ++it;
+    }
+
+    // Следующая чистка — когда шард снова вырастет вдвое: в среднем O(1)
+    // на операцию.
+    shard.sweepAt = std::max(1024, int(shard.windows.size()) * 2);
+}
+
+int VelocityLimiter::trackedWindows() const
+{
+    int total = 0;
+    for (const Shard &shard : m_shards) {
+        std::lock_guard<std::mutex> lock(shard.lock);
+        total += shard.windows.size();
+    }
+    return total;
+}
+
+bool VelocityLimiter::load(const QList<QSqlDatabase> &databases)
+{
+    QSqlQuery query(databases.first());
+    query.setForwardOnly(true);
+
+    if (!query.exec("SELECT card_prefix, withdraw_hourly, withdraw_daily, "
+                    "transfer_hourly, transfer_daily FROM card_limits"))
+    {
+        EventLog::error("sql.failed", "SELECT card_limits", query.lastError().text());
+        return false;
+    }
+
+    QList<CardClass> classes;
+    while (query.next()) {
+        CardClass c;
+        c.prefix = query.value(0).toString();
+        c.withdraw.hourlyCents = centsOrZero(query.value(1));
+        c.withdraw.dailyCents = centsOrZero(query.value(2));
+        c.transfer.hourlyCents = centsOrZero(query.value(3));
+        c.transfer.dailyCents = centsOrZero(query.value(4));
+        classes.append(c);
+    }
+    setClasses(classes);
+
+    // Окна восстанавливаются из горячей таблицы: архиватор переносит только
+    // закрытые месяцы, поэтому последние сутки почти всегда в ней.
+    for (const QSqlDatabase &db : databases) {
+        QSqlQuery recent(db);
+        recent.setForwardOnly(true);
+        recent.prepare("SELECT card_number, type, amount, ts FROM transactions "
+                       "WHERE ts >= :since AND type IN (:withdraw, :transferOut) "
+                       "ORDER BY ts");
+        recent.bindValue(":since", QDateTime::currentDateTimeUtc().addDays(-1)
+                                       .toString("yyyy-MM-dd HH:mm:ss"));
+        recent.bindValue(":withdraw", transactionTypeCode(TransactionType::Withdraw));
+        recent.bindValue(":transferOut", transactionTypeCode(TransactionType::TransferOut));
+
+        if (!recent.exec()) {
+            EventLog::error("sql.failed", "SELECT transactions.recent",
+                            recent.lastError().text());
+            return false;
+        }
+
+        while (recent.next()) {
+            QString card = cardNumberFromKey(recent.value(0).toLongLong());
+            Kind kind = transactionTypeFromStorage(recent.value(1)) == TransactionType::Withdraw
+                            ? Kind::Withdraw : Kind::Transfer;
+            const Limits &limits = limitsFor(card, kind);
+            if (limits.hourlyCents == 0 && limits.dailyCents == 0)
+                continue;
+
+            quint64 key;
+            if (!keyOf(card, kind, key))
+                continue;
+
+            QDateTime ts = QDateTime::fromString(recent.value(3).toString(),
+                                                 "yyyy-MM-dd HH:mm:ss");
+            ts.setTimeSpec(Qt::UTC);
+            quint32 slot = slotOf(ts.toMSecsSinceEpoch());
+
+            Shard &shard = shardOf(key);
+            std::lock_guard<std::mutex> lock(shard.lock);
+
+            auto it = shard.windows.find(key);
+            if (it == shard.windows.end()) {
+                Window w;
+                w.head = slot;
+                it = shard.windows.insert(key, w);
+            }
+            add(*it, slot, toCents(recent.value(2).toDouble()));
+        }
+    }
+
+    EventLog::info("limits.loaded", nullptr,
+                   QString("classes=%1 windows=%2").arg(classes.size()).arg(trackedWindows()));
+    return true;
+}
+
+int VelocityLimiter::runBenchmark(QTextStream &out, int cards, qint64 checks)
+{
+    VelocityLimiter limiter;
+
+    CardClass defaults;
+    defaults.withdraw = { 30000 * 100LL, 100000 * 100LL };
+    defaults.transfer = { 50000 * 100LL, 200000 * 100LL };
+    limiter.setClasses({ defaults });
+
+    std::vector<QString> numbers;
+    numbers.reserve(cards);
+    for (int i = 0; i < cards; ++i)
+        numbers.push_back(QString("4000%1").arg(i, 12, 10, QChar('0')));
+
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    QElapsedTimer timer;
+    timer.start();
+    for (const QString &card : numbers)
+        limiter.reserve(card, Kind::Withdraw, 100.0, now);
+    double fillSeconds = timer.nsecsElapsed() / 1e9;
+
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int> cardDist(0, cards - 1);
+    std::uniform_int_distribution<int> centsDist(100, 500000);
+
+    // Каждая проверка на 1 мс позже предыдущей, поэтому корзины сдвигаются.
+    qint64 accepted = 0;
+    timer.restart();
+    for (qint64 i = 0; i < checks; ++i) {
+        const QString &card = numbers[cardDist(rng)];
+        Kind kind = (i & 1) ? Kind::Transfer : Kind::Withdraw;
+        if (limiter.reserve(card, kind, centsDist(rng) / 100.0, now + i))
+            ++accepted;
+    }
+    qint64 checkNs = timer.nsecsElapsed();
+
+    int windows = limiter.trackedWindows();
+
+    out << QString("cards         %1\n").arg(cards)
+        << QString("fill          %1 s\n").arg(fillSeconds, 0, 'f', 3)
+        << QString("checks        %1\n").arg(checks)
+        << QString("accepted      %1\n").arg(accepted)
+        << QString("ns/check      %1\n").arg(checks > 0 ? double(checkNs) / checks : 0.0, 0, 'f', 1)
+        << QString("windows       %1\n").arg(windows)
+        << QString("bytes/window  %1 (+ узел QHash)\n").arg(int(sizeof(Window) + sizeof(quint64)));
+    out.flush();
+    return 0;
+}
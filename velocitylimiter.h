@@ -0,0 +1,83 @@
+#ifndef VELOCITYLIMITER_H
+#define VELOCITYLIMITER_H
+
+#include <QString>
+#include <QList>
+#include <QHash>
+#include <QSqlDatabase>
+#include <QTextStream>
+
+#include <array>
+#include <mutex>
+
+// Скользящие лимиты на снятие и переводы по карте: за последний час и за
+// последние сутки. Проверка и учёт суммы — O(1), без SUM по transactions.
+//
+// Окно карты — 12 пятиминутных и 24 часовых корзин в копейках (148 байт).
+// В памяти держатся только карты, по которым были операции за сутки;
+// пустые окна вычищаются по мере роста шарда.
+class VelocityLimiter
+{
+public:
+    enum class Kind : quint8 { Withdraw = 0, Transfer = 1 };
+
+    struct Limits {
+        qint64 hourlyCents = 0;   // 0 — без лимита
+        qint64 dailyCents = 0;
+    };
+
+    struct CardClass {
+        QString prefix;           // пустой префикс — класс по умолчанию
+        Limits withdraw;
+        Limits transfer;
+    };
+
+    VelocityLimiter();
+
+    void setClasses(const QList<CardClass> &classes);
+
+    // Классы из card_limits основной БД и суммы снятий/переводов за
+    // последние сутки из всех шардов (см. ShardMap).
+    bool load(const QList<QSqlDatabase> &databases);
+
+    // Проверяет лимит и сразу учитывает сумму. Если списание потом не
+    // прошло, сумму нужно вернуть через release() с тем же nowMs.
+    bool reserve(const QString &cardNumber, Kind kind, double amount, qint64 nowMs);
+    void release(const QString &cardNumber, Kind kind, double amount, qint64 nowMs);
+
+    int trackedWindows() const;
+
+    static int runBenchmark(QTextStream &out, int cards, qint64 checks);
+
+private:
+    static constexpr int ShardCount = 64;
+    static constexpr int FineBuckets = 12;     // по 5 минут — последний час
+    static constexpr int CoarseBuckets = 24;   // по часу — последние сутки
+    static constexpr int FinePerCoarse = 12;
+
+    struct Window {
+        quint32 head = 0;                      // последний 5-минутный слот
+        quint32 fine[FineBuckets] = {};
+        quint32 coarse[CoarseBuckets] = {};
+    };
+
+    struct Shard {
+        mutable std::mutex lock;
+        QHash<quint64, Window> windows;
+        int sweepAt = 1024;
+    };
+
+    static bool keyOf(const QString &cardNumber, Kind kind, quint64 &key);
+    static quint32 slotOf(qint64 ms);
+    static void advance(Window &w, quint32 slot);
+    static void add(Window &w, quint32 slot, qint64 cents);
+
+    const Limits &limitsFor(const QString &cardNumber, Kind kind) const;
+    Shard &shardOf(quint64 key);
+    void sweep(Shard &shard, quint32 slot);
+
+    QList<CardClass> m_classes;   // по убыванию длины префикса
+    std::array<Shard, ShardCount> m_shards;
+};
+
+#endif // VELOCITYLIMITER_H